@@ -0,0 +1,458 @@
+// AccessionIndex.cpp - An on-disk index from NCBI taxonomy IDs to the GI
+// numbers and accessions of their sequence records, built from NCBI's
+// *.accession2taxid dumps. With it, taxonomy IDs are resolved into GI lists
+// locally instead of by querying NCBI (e.g. on machines without internet).
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/lexical_cast.hpp>
+#include "AccessionIndex.hpp"
+#include "Compression.hpp"
+#include "HelperFunctions.hpp"
+#include "SeqIdList.hpp"
+
+namespace {
+	// Index layout: an IndexHeader followed by the record offsets, GIs,
+	// accession offsets and accessions, each starting on an eight byte
+	// boundary so they can be used straight from the mapping
+	const char ACCESSION_INDEX_MAGIC[8] = {'C','B','D','B','A','C','C','\0'};
+	const uint32_t ACCESSION_INDEX_VERSION = 1;
+
+	struct IndexHeader {
+		SnapshotHeader snapshot;
+		uint64_t taxIDs;
+		uint64_t records;
+		uint64_t accessionBytes;
+		uint64_t recordOffsetsOffset;
+		uint64_t gisOffset;
+		uint64_t accessionOffsetsOffset;
+		uint64_t accessionsOffset;
+	};
+
+	// Most fields looked at on a line of a dump
+	const int MAX_DUMP_FIELDS = 8;
+	// Bytes of a gzipped dump held in memory at a time
+	const size_t DUMP_CHUNK_SIZE = 1 << 24;
+
+	// A record of an accession2taxid dump, pointing into the dump's contents
+	struct DumpRecord {
+		const char *accession;
+		size_t accessionLength;
+		int taxID;
+		uint64_t gi;
+	};
+
+	// Rounds up to the next multiple of eight
+	uint64_t Align(uint64_t offset) {
+		return (offset + 7) & ~(uint64_t)7;
+	}
+
+	// Converts the characters [first, last) to an unsigned number
+	// Returns false if they are not all digits (e.g. "na" for no GI)
+	bool ParseNumber(const char *first, const char *last, uint64_t &value) {
+		if (first == last) return false;
+		value = 0;
+		for (; first != last; first++) {
+			if (*first < '0' || *first > '9') return false;
+			value = value * 10 + (*first - '0');
+		}
+		return true;
+	}
+
+	// Splits a line into tab separated fields, returning how many there are
+	int SplitFields(const char *first, const char *last,
+					const char **fieldFirst, const char **fieldLast) {
+		if (last > first && last[-1] == '\r') last--;
+		int fields = 0;
+		while (fields < MAX_DUMP_FIELDS) {
+			const char *tab = static_cast<const char *>(
+				memchr(first, '\t', last - first));
+			fieldFirst[fields] = first;
+			fieldLast[fields] = (tab == NULL) ? last : tab;
+			fields++;
+			if (tab == NULL) break;
+			first = tab + 1;
+		}
+		return fields;
+	}
+
+	// Returns whether the characters [first, last) spell out text
+	bool FieldIs(const char *first, const char *last, const char *text) {
+		size_t length = strlen(text);
+		return (size_t)(last - first) == length &&
+			   memcmp(first, text, length) == 0;
+	}
+
+	// Parses the lines of an accession2taxid dump, passing each record to a
+	// handler. Columns are located by the dump's header ("accession",
+	// "accession.version", "taxid", "gi"); headerless dumps are assumed to be
+	// in that order, or to be "accession.version", "taxid" if only two wide
+	class DumpParser {
+	public:
+		DumpParser(const std::string &fileName)
+			: fileName(fileName), accessionField(-1), taxIDField(-1)
+			, giField(-1), line(0) {}
+
+		// Parses the whole lines in [cursor, end), the last of which need not
+		// end in a newline
+		// Throws std::runtime_error on a malformed line
+		template <typename Handler>
+		void Parse(const char *cursor, const char *end, Handler &handle) {
+			const char *fieldFirst[MAX_DUMP_FIELDS];
+			const char *fieldLast[MAX_DUMP_FIELDS];
+			while (cursor < end) {
+				const char *newline = static_cast<const char *>(
+					memchr(cursor, '\n', end - cursor));
+				const char *lineEnd = (newline == NULL) ? end : newline;
+				int fields = SplitFields(cursor, lineEnd, fieldFirst,
+										 fieldLast);
+				const char *lineStart = cursor;
+				cursor = lineEnd + 1;
+				line++;
+				if (lineEnd == lineStart) continue;
+
+				if (taxIDField == -1) {
+					for (int field = 0; field < fields; field++) {
+						if (FieldIs(fieldFirst[field], fieldLast[field],
+									"accession.version"))
+							accessionField = field;
+						else if (FieldIs(fieldFirst[field], fieldLast[field],
+										 "taxid"))
+							taxIDField = field;
+						else if (FieldIs(fieldFirst[field], fieldLast[field],
+										 "gi"))
+							giField = field;
+					}
+					if (taxIDField != -1 && accessionField != -1) continue;
+					accessionField = (fields == 2) ? 0 : 1;
+					taxIDField = (fields == 2) ? 1 : 2;
+					giField = (fields == 2) ? -1 : 3;
+				}
+
+				uint64_t taxID, gi;
+				if (fields <= std::max(accessionField, taxIDField) ||
+					!ParseNumber(fieldFirst[taxIDField], fieldLast[taxIDField],
+								 taxID) ||
+					taxID > 0x7fffffff) {
+					throw std::runtime_error(
+						"Malformed accession2taxid file: " + fileName +
+						" (line " + boost::lexical_cast<std::string>(line) +
+						")");
+				}
+				if (giField == -1 || fields <= giField ||
+					!ParseNumber(fieldFirst[giField], fieldLast[giField], gi)) {
+					gi = 0;
+				}
+				DumpRecord record;
+				record.accession = fieldFirst[accessionField];
+				record.accessionLength = fieldLast[accessionField] -
+										 fieldFirst[accessionField];
+				record.taxID = taxID;
+				record.gi = gi;
+				handle(record);
+			}
+		}
+	private:
+		std::string fileName;
+		int accessionField, taxIDField, giField;
+		size_t line;
+	};
+
+	// Reads every record of an accession2taxid dump, passing each to handle.
+	// A plain dump is parsed straight from its mapping; a gzipped one is
+	// inflated a chunk at a time, so that only a chunk of it is ever in memory
+	// Throws std::runtime_error if the dump cannot be read or is malformed
+	template <typename Handler>
+	void ScanDump(const std::string &fileName, Handler &handle) {
+		DumpParser parser(fileName);
+		if (!IsGzipFile(fileName)) {
+			MappedFile dump(fileName);
+			parser.Parse(dump.Data(), dump.Data() + dump.Size(), handle);
+			return;
+		}
+
+		// The partial line at the end of each chunk is carried over to the
+		// start of the next
+		InputStream dump(std::vector<std::string>(1, fileName));
+		std::vector<char> buffer(DUMP_CHUNK_SIZE);
+		size_t carried = 0;
+		while (true) {
+			// A line longer than the buffer
+			if (carried == buffer.size()) buffer.resize(2 * buffer.size());
+			size_t count = dump.Read(&buffer[carried], buffer.size() - carried);
+			if (count == 0) break;
+			const char *first = &buffer[0], *last = first + carried + count;
+			const char *linesEnd = last;
+			while (linesEnd > first && linesEnd[-1] != '\n') linesEnd--;
+			parser.Parse(first, linesEnd, handle);
+			carried = last - linesEnd;
+			memmove(&buffer[0], linesEnd, carried);
+		}
+		parser.Parse(&buffer[0], &buffer[0] + carried, handle);
+	}
+
+	// First pass: counts the records and accession bytes of each taxonomy ID
+	struct RecordCounter {
+		std::vector<uint64_t> &records;
+		std::vector<uint64_t> &bytes;
+
+		RecordCounter(std::vector<uint64_t> &records,
+					  std::vector<uint64_t> &bytes)
+			: records(records), bytes(bytes) {}
+		void operator()(const DumpRecord &record) {
+			if ((size_t)record.taxID >= records.size()) {
+				records.resize(record.taxID + 1, 0);
+				bytes.resize(record.taxID + 1, 0);
+			}
+			records[record.taxID]++;
+			bytes[record.taxID] += record.accessionLength + 1;
+		}
+	};
+
+	// Second pass: places each record in its taxonomy ID's range
+	struct RecordPlacer {
+		std::vector<uint64_t> &nextRecord;
+		std::vector<uint64_t> &nextByte;
+		uint64_t *gis;
+		uint64_t *accessionOffsets;
+		char *accessions;
+
+		RecordPlacer(std::vector<uint64_t> &nextRecord,
+					 std::vector<uint64_t> &nextByte, uint64_t *gis,
+					 uint64_t *accessionOffsets, char *accessions)
+			: nextRecord(nextRecord), nextByte(nextByte), gis(gis)
+			, accessionOffsets(accessionOffsets), accessions(accessions) {}
+		void operator()(const DumpRecord &record) {
+			uint64_t position = nextRecord[record.taxID]++;
+			uint64_t offset = nextByte[record.taxID];
+			gis[position] = record.gi;
+			accessionOffsets[position] = offset;
+			memcpy(accessions + offset, record.accession,
+				   record.accessionLength);
+			accessions[offset + record.accessionLength] = '\0';
+			nextByte[record.taxID] += record.accessionLength + 1;
+		}
+	};
+
+	// A writable, file backed mapping in which an index is laid out
+	class OutputMapping {
+	public:
+		OutputMapping(const std::string &fileName, size_t size)
+			: data(NULL), size(size)
+		{
+			int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (fd == -1)
+				throw std::runtime_error("Cannot write: " + fileName);
+			if (ftruncate(fd, size) != 0) {
+				close(fd);
+				throw std::runtime_error("Cannot write: " + fileName);
+			}
+			void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+								 MAP_SHARED, fd, 0);
+			close(fd);
+			if (mapping == MAP_FAILED)
+				throw std::runtime_error("Cannot map: " + fileName);
+			data = static_cast<char *>(mapping);
+		}
+		~OutputMapping() {
+			munmap(data, size);
+		}
+		char *Data() {
+			return data;
+		}
+	private:
+		OutputMapping(const OutputMapping &);
+		OutputMapping &operator=(const OutputMapping &);
+
+		char *data;
+		size_t size;
+	};
+
+	// Checks that the sections of a mapped index can be followed without
+	// leaving them: record ranges in order and within the records, and every
+	// accession starting within the arena, which ends in a null terminator
+	bool SectionsConsistent(const Column<uint64_t> &recordOffsets,
+							const Column<uint64_t> &accessionOffsets,
+							const Column<char> &accessions) {
+		for (size_t i = 1; i < recordOffsets.Size(); i++)
+			if (recordOffsets[i] < recordOffsets[i - 1]) return false;
+		for (size_t i = 0; i < accessionOffsets.Size(); i++)
+			if (accessionOffsets[i] >= accessions.Size()) return false;
+		return accessions.Size() == 0 ||
+			   accessions[accessions.Size() - 1] == '\0';
+	}
+}
+
+// Default constructor, needs later setup with an index file
+AccessionIndex::AccessionIndex() {}
+
+// Maps an index file written by Build
+// Throws std::runtime_error if the file is not a valid index
+AccessionIndex::AccessionIndex(const std::string &indexFile) {
+	Open(indexFile);
+}
+
+void AccessionIndex::Open(const std::string &indexFile) {
+	recordOffsets.Clear();
+	gis.Clear();
+	accessionOffsets.Clear();
+	accessions.Clear();
+	file.Open(indexFile);
+
+	IndexHeader header;
+	if (file.Size() < sizeof(header))
+		throw std::runtime_error("Not an accession index: " + indexFile);
+	memcpy(&header, file.Data(), sizeof(header));
+	bool valid =
+		SnapshotMatches(header.snapshot, ACCESSION_INDEX_MAGIC,
+						ACCESSION_INDEX_VERSION) &&
+		BorrowSection(file, header.recordOffsetsOffset, header.taxIDs + 1,
+					  recordOffsets) &&
+		BorrowSection(file, header.gisOffset, header.records, gis) &&
+		BorrowSection(file, header.accessionOffsetsOffset, header.records,
+					  accessionOffsets) &&
+		BorrowSection(file, header.accessionsOffset, header.accessionBytes,
+					  accessions) &&
+		recordOffsets[header.taxIDs] == header.records &&
+		SectionsConsistent(recordOffsets, accessionOffsets, accessions);
+	if (!valid) {
+		file.Close();
+		throw std::runtime_error("Not an accession index: " + indexFile);
+	}
+}
+
+// Builds an index file from accession2taxid dumps in two streaming passes
+// Throws std::runtime_error if a dump cannot be read or is malformed, or if
+// the index cannot be written
+void AccessionIndex::Build(const std::vector<std::string> &accession2taxidFiles,
+						   const std::string &indexFile) {
+	// First pass: size every taxonomy ID's range of records and accessions
+	std::vector<uint64_t> records, bytes;
+	RecordCounter counter(records, bytes);
+	for (std::vector<std::string>::const_iterator it =
+			accession2taxidFiles.begin();
+		 it != accession2taxidFiles.end();
+		 it++) {
+		ScanDump(*it, counter);
+	}
+
+	// Turn the counts into starting offsets (in place, they are reused as the
+	// next free slot of each range during the second pass)
+	uint64_t totalRecords = 0, totalBytes = 0;
+	for (size_t taxID = 0; taxID < records.size(); taxID++) {
+		uint64_t count = records[taxID], length = bytes[taxID];
+		records[taxID] = totalRecords;
+		bytes[taxID] = totalBytes;
+		totalRecords += count;
+		totalBytes += length;
+	}
+
+	IndexHeader header;
+	memset(&header, 0, sizeof(header));
+	StampSnapshot(header.snapshot, ACCESSION_INDEX_MAGIC,
+				  ACCESSION_INDEX_VERSION);
+	header.taxIDs = records.size();
+	header.records = totalRecords;
+	header.accessionBytes = totalBytes;
+	header.recordOffsetsOffset = Align(sizeof(header));
+	header.gisOffset = Align(header.recordOffsetsOffset +
+							 (header.taxIDs + 1) * sizeof(uint64_t));
+	header.accessionOffsetsOffset = Align(header.gisOffset +
+										  totalRecords * sizeof(uint64_t));
+	header.accessionsOffset = Align(header.accessionOffsetsOffset +
+									totalRecords * sizeof(uint64_t));
+	size_t indexSize = header.accessionsOffset + totalBytes;
+
+	// Lay the index out aside and rename it into place once complete
+	AtomicFile index(indexFile);
+	{
+		OutputMapping output(index.TempName(), indexSize);
+		char *base = output.Data();
+		memcpy(base, &header, sizeof(header));
+		uint64_t *offsets =
+			reinterpret_cast<uint64_t *>(base + header.recordOffsetsOffset);
+		std::copy(records.begin(), records.end(), offsets);
+		offsets[header.taxIDs] = totalRecords;
+		uint64_t *giColumn =
+			reinterpret_cast<uint64_t *>(base + header.gisOffset);
+		uint64_t *accessionOffsetColumn =
+			reinterpret_cast<uint64_t *>(base + header.accessionOffsetsOffset);
+
+		// Second pass: place every record
+		RecordPlacer placer(records, bytes, giColumn, accessionOffsetColumn,
+							base + header.accessionsOffset);
+		for (std::vector<std::string>::const_iterator it =
+				accession2taxidFiles.begin();
+			 it != accession2taxidFiles.end();
+			 it++) {
+			ScanDump(*it, placer);
+		}
+
+		// Sort each taxonomy ID's records by GI
+		std::vector< std::pair<uint64_t, uint64_t> > range;
+		for (size_t taxID = 0; taxID < header.taxIDs; taxID++) {
+			uint64_t first = offsets[taxID], last = offsets[taxID + 1];
+			if (last - first < 2) continue;
+			range.clear();
+			for (uint64_t i = first; i < last; i++) {
+				range.push_back(std::make_pair(giColumn[i],
+											   accessionOffsetColumn[i]));
+			}
+			std::sort(range.begin(), range.end());
+			for (uint64_t i = first; i < last; i++) {
+				giColumn[i] = range[i - first].first;
+				accessionOffsetColumn[i] = range[i - first].second;
+			}
+		}
+	}
+	index.Commit();
+}
+
+// Returns the number of records in the index
+size_t AccessionIndex::Size() const {
+	return gis.Size();
+}
+
+// Appends the GI numbers of a taxonomy ID's records (records without a GI are
+// skipped)
+void AccessionIndex::GetGIs(const int taxID,
+							std::vector<uint64_t> &output) const {
+	uint64_t first, last;
+	GetRange(taxID, first, last);
+	for (uint64_t i = first; i < last; i++)
+		if (gis[i] != 0) output.push_back(gis[i]);
+}
+
+// Adds the accession.versions of a taxonomy ID's records without a GI
+void AccessionIndex::GetAccessionsWithoutGIs(const int taxID,
+											 AccessionSet &output) const {
+	uint64_t first, last;
+	GetRange(taxID, first, last);
+	for (uint64_t i = first; i < last; i++) {
+		if (gis[i] != 0) continue;
+		const char *accession = accessions.Data() + accessionOffsets[i];
+		output.Add(accession, strlen(accession));
+	}
+}
+
+// Returns the range of records of a taxonomy ID
+void AccessionIndex::GetRange(const int taxID, uint64_t &first,
+							  uint64_t &last) const {
+	if (taxID < 0 || (size_t)taxID + 1 >= recordOffsets.Size()) {
+		first = last = 0;
+		return;
+	}
+	first = recordOffsets[taxID];
+	last = recordOffsets[taxID + 1];
+}
@@ -0,0 +1,58 @@
+// AccessionIndex.hpp - An on-disk index from NCBI taxonomy IDs to the GI
+// numbers and accessions of their sequence records, built from NCBI's
+// *.accession2taxid dumps. With it, taxonomy IDs are resolved into GI lists
+// locally instead of by querying NCBI (e.g. on machines without internet).
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef ACCESSIONINDEX_HPP
+#define ACCESSIONINDEX_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "HelperFunctions.hpp"
+
+class AccessionSet;
+
+// Records are grouped by taxonomy ID (sorted by GI within each group), so the
+// records of a taxonomy ID are one contiguous range of the index
+class AccessionIndex {
+public:
+	// Default constructor, needs later setup with an index file
+	AccessionIndex();
+	// Maps an index file written by Build
+	// Throws std::runtime_error if the file is not a valid index
+	AccessionIndex(const std::string &indexFile);
+	void Open(const std::string &indexFile);
+
+	// Builds an index file from accession2taxid dumps in two streaming passes
+	// (counting, then placing each record), so memory use is bounded by the
+	// number of taxonomy IDs rather than the size of the dumps
+	// Throws std::runtime_error if a dump cannot be read or is malformed, or
+	// if the index cannot be written
+	static void Build(const std::vector<std::string> &accession2taxidFiles,
+					  const std::string &indexFile);
+
+	// Returns the number of records in the index
+	size_t Size() const;
+	// Appends the GI numbers of a taxonomy ID's records (records without a GI
+	// are skipped)
+	void GetGIs(const int taxID, std::vector<uint64_t> &output) const;
+	// Adds the accession.versions of a taxonomy ID's records without a GI,
+	// which only a seqid list can select
+	void GetAccessionsWithoutGIs(const int taxID, AccessionSet &output) const;
+private:
+	// Returns the range of records of a taxonomy ID
+	void GetRange(const int taxID, uint64_t &first, uint64_t &last) const;
+
+	MappedFile file;
+	Column<uint64_t> recordOffsets;		// By taxonomy ID, plus one
+	Column<uint64_t> gis;				// By record, 0 if none
+	Column<uint64_t> accessionOffsets;	// By record, into accessions
+	Column<char> accessions;			// Null terminated accession.versions
+};
+
+#endif // ACCESSIONINDEX_HPP
@@ -0,0 +1,460 @@
+// Benchmark.cpp - Measures the hot paths of CreateBlastDB (taxonomy loading,
+// LCA queries, list parsing, FASTA scanning) on deterministic synthetic data,
+// printing one JSON object per benchmark so runs can be compared over time.
+// Also generates the synthetic nodes.dmp trees, ID lists and FASTA on its own.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include "Fasta.hpp"
+#include "HelperFunctions.hpp"
+#include "Taxonomy.hpp"
+
+#define DEFAULT_LINE_LENGTH 80
+#define MIN_DESCRIPTION_LENGTH (DEFAULT_LINE_LENGTH/2)
+
+namespace {
+	const int SUCCESS                   = 0;
+	const int ERROR_IN_COMMAND_LINE     = 1;
+	const int ERROR_UNHANDLED_EXCEPTION = 2;
+
+	// Ranks given to generated nodes by depth; deeper nodes get "no rank"
+	const char *RANKS[] = {
+		"no rank", "superkingdom", "phylum", "class", "order", "family",
+		"genus", "species", "subspecies"
+	};
+	const size_t RANK_COUNT = sizeof(RANKS) / sizeof(RANKS[0]);
+
+	// Generated files are written through a buffer of this many bytes
+	const size_t WRITE_BUFFER_SIZE = 4 << 20;
+
+	// Generated FASTA sequences are sliced out of a pool of random residues
+	const size_t RESIDUE_POOL_SIZE = 4 << 20;
+	const size_t FASTA_LINE_WIDTH = 80;
+	const size_t MIN_SEQUENCE_LENGTH = 100;
+	const size_t MAX_SEQUENCE_LENGTH = 10000;
+	// Every this many records repeats the sequence before it
+	const size_t DUPLICATE_EVERY = 50;
+
+	// Appends to a file through a large buffer
+	class BufferedWriter {
+	public:
+		BufferedWriter(const std::string &fileName) : fileName(fileName) {
+			file = fopen(fileName.c_str(), "wb");
+			if (file == NULL)
+				throw std::runtime_error("Cannot write: " + fileName);
+			buffer.reserve(WRITE_BUFFER_SIZE);
+		}
+		~BufferedWriter() {
+			if (file != NULL) fclose(file);
+		}
+		std::string &Buffer() {
+			return buffer;
+		}
+		// Writes the buffer out once it is full enough
+		void Flush(bool force = false) {
+			if (!force && buffer.size() < WRITE_BUFFER_SIZE) return;
+			if (fwrite(buffer.data(), 1, buffer.size(), file) !=
+				buffer.size()) {
+				throw std::runtime_error("Cannot write: " + fileName);
+			}
+			buffer.clear();
+		}
+		void Close() {
+			Flush(true);
+			if (fclose(file) != 0) {
+				file = NULL;
+				throw std::runtime_error("Cannot write: " + fileName);
+			}
+			file = NULL;
+		}
+	private:
+		FILE *file;
+		std::string fileName;
+		std::string buffer;
+	};
+
+	// Writes a random tree of nodeCount nodes in nodes.dmp format, no node
+	// deeper than maxDepth nor with more than fanOut children. Taxonomy IDs
+	// are shuffled so that related nodes are scattered as in NCBI's tree.
+	// Returns the taxonomy IDs used
+	// Throws std::runtime_error if the tree cannot hold that many nodes
+	std::vector<int> GenerateTree(const std::string &fileName,
+								  size_t nodeCount, size_t maxDepth,
+								  size_t fanOut, uint64_t seed) {
+		std::mt19937_64 random(seed);
+		std::vector<int> taxIDs(nodeCount);
+		for (size_t i = 0; i < nodeCount; i++) taxIDs[i] = i + 1;
+		std::shuffle(taxIDs.begin() + 1, taxIDs.end(), random);
+
+		// Nodes still able to take children, by index
+		std::vector<size_t> parents(nodeCount, 0), depths(nodeCount, 0),
+							childCounts(nodeCount, 0), open(1, 0);
+		for (size_t node = 1; node < nodeCount; node++) {
+			if (open.empty()) {
+				throw std::runtime_error("A tree of depth " +
+					boost::lexical_cast<std::string>(maxDepth) +
+					" and fan-out " + boost::lexical_cast<std::string>(fanOut) +
+					" cannot hold " +
+					boost::lexical_cast<std::string>(nodeCount) + " nodes");
+			}
+			size_t pick = random() % open.size(), parent = open[pick];
+			parents[node] = parent;
+			depths[node] = depths[parent] + 1;
+			if (++childCounts[parent] == fanOut) {
+				open[pick] = open.back();
+				open.pop_back();
+			}
+			if (depths[node] < maxDepth) open.push_back(node);
+		}
+
+		BufferedWriter writer(fileName);
+		std::string &line = writer.Buffer();
+		for (size_t node = 0; node < nodeCount; node++) {
+			bool hidden = random() % 10 == 0;
+			line += boost::lexical_cast<std::string>(taxIDs[node]);
+			line += "\t|\t";
+			line += boost::lexical_cast<std::string>(taxIDs[parents[node]]);
+			line += "\t|\t";
+			line += RANKS[(depths[node] < RANK_COUNT) ? depths[node] : 0];
+			line += "\t|\tBN\t|\t0\t|\t1\t|\t11\t|\t1\t|\t0\t|\t1\t|\t";
+			line += hidden ? "1" : "0";
+			line += "\t|\t0\t|\t\t|\n";
+			writer.Flush();
+		}
+		writer.Close();
+		return taxIDs;
+	}
+
+	// Writes count random numbers in [1, maxValue], one per line
+	void GenerateIDs(const std::string &fileName, size_t count,
+					 uint64_t maxValue, uint64_t seed) {
+		std::mt19937_64 random(seed);
+		BufferedWriter writer(fileName);
+		for (size_t i = 0; i < count; i++) {
+			writer.Buffer() += boost::lexical_cast<std::string>(
+				random() % maxValue + 1);
+			writer.Buffer() += '\n';
+			writer.Flush();
+		}
+		writer.Close();
+	}
+
+	// Writes about size bytes of random FASTA records, with every
+	// DUPLICATE_EVERY-th record repeating the one before it
+	void GenerateFasta(const std::string &fileName, uint64_t size,
+					   bool protein, uint64_t seed) {
+		std::mt19937_64 random(seed);
+		const char *alphabet = protein ? "ACDEFGHIKLMNPQRSTVWY" : "ACGT";
+		size_t alphabetSize = strlen(alphabet);
+		std::string pool(RESIDUE_POOL_SIZE, 'A');
+		for (size_t i = 0; i < pool.size(); i++)
+			pool[i] = alphabet[random() % alphabetSize];
+
+		BufferedWriter writer(fileName);
+		std::string &buffer = writer.Buffer();
+		uint64_t written = 0;
+		size_t offset = 0, length = 0;
+		for (size_t record = 0; written < size; record++) {
+			if (record % DUPLICATE_EVERY != DUPLICATE_EVERY - 1 ||
+				record == 0) {
+				length = MIN_SEQUENCE_LENGTH + random() %
+					(MAX_SEQUENCE_LENGTH - MIN_SEQUENCE_LENGTH + 1);
+				offset = random() % (pool.size() - length);
+			}
+			size_t start = buffer.size();
+			buffer += ">seq" + boost::lexical_cast<std::string>(record) +
+					  " synthetic record\n";
+			for (size_t i = 0; i < length; i += FASTA_LINE_WIDTH) {
+				buffer.append(pool, offset + i,
+							  std::min(FASTA_LINE_WIDTH, length - i));
+				buffer += '\n';
+			}
+			written += buffer.size() - start;
+			writer.Flush();
+		}
+		writer.Close();
+	}
+
+	// Returns the value at fraction of the way through sorted values
+	double Percentile(const std::vector<double> &sorted, double fraction) {
+		if (sorted.empty()) return 0;
+		return sorted[std::min(sorted.size() - 1,
+							   (size_t)(fraction * sorted.size()))];
+	}
+
+	// Results are folded into this so that nothing measured is optimized out
+	volatile uint64_t sink;
+
+	// Times calls calls of operation(i), each handling items items (of bytes
+	// bytes), and prints throughput, latency percentiles per call and the
+	// peak resident set size as one JSON object
+	template <typename Operation>
+	void Measure(const std::string &label, const std::string &benchmark,
+				 const std::string &unit, size_t calls, double items,
+				 double bytes, Operation operation) {
+		typedef std::chrono::steady_clock Clock;
+		std::vector<double> latencies(calls);
+		ResetPeakMemory();
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < calls; i++) {
+			Clock::time_point before = Clock::now();
+			operation(i);
+			latencies[i] = std::chrono::duration<double, std::nano>(
+				Clock::now() - before).count();
+		}
+		double seconds = std::chrono::duration<double>(
+			Clock::now() - start).count();
+		long peakRSS = GetPeakMemory();
+		std::sort(latencies.begin(), latencies.end());
+
+		std::cout << "{\"label\":\"" << label << "\""
+				  << ",\"benchmark\":\"" << benchmark << "\""
+				  << ",\"unit\":\"" << unit << "\""
+				  << ",\"calls\":" << calls
+				  << ",\"items\":" << (uint64_t)(items * calls)
+				  << ",\"seconds\":" << seconds
+				  << ",\"items_per_second\":" << items * calls / seconds;
+		if (bytes > 0)
+			std::cout << ",\"mb_per_second\":"
+					  << bytes * calls / seconds / (1 << 20);
+		std::cout << ",\"p50_ns\":" << Percentile(latencies, 0.50)
+				  << ",\"p90_ns\":" << Percentile(latencies, 0.90)
+				  << ",\"p99_ns\":" << Percentile(latencies, 0.99)
+				  << ",\"peak_rss_kb\":" << peakRSS << "}" << std::endl;
+	}
+}
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+	try {
+		std::string appName = boost::filesystem::basename(argv[0]);
+		std::string generate;
+		std::string output;
+		std::string workDir;
+		std::string label;
+		size_t nodeCount;
+		size_t maxDepth;
+		size_t fanOut;
+		size_t queries;
+		size_t listSize;
+		size_t idCount;
+		size_t fastaMB;
+		size_t repeat;
+		uint64_t seed;
+		unsigned int threads;
+		bool protein;
+
+		// Set up possible options
+		po::options_description desc("Options", DEFAULT_LINE_LENGTH,
+									 MIN_DESCRIPTION_LENGTH);
+		desc.add_options()
+			("help,h", "Display help")
+			("depth", po::value<size_t>(&maxDepth)
+				->value_name("INT")->default_value(40),
+				"Maximum depth of the generated tree")
+			("fanOut", po::value<size_t>(&fanOut)
+				->value_name("INT")->default_value(1000),
+				"Maximum children of a node in the generated tree")
+			("fastaMB", po::value<size_t>(&fastaMB)
+				->value_name("INT")->default_value(256),
+				"Size of the generated FASTA in MB (0 to skip the FASTA "
+				"benchmarks)")
+			("generate", po::value<std::string>(&generate)
+				->value_name("STR"),
+				"Only write a generated \"tree\", \"ids\" or \"fasta\" file "
+				"to --output, sized by the other options")
+			("ids", po::value<size_t>(&idCount)
+				->value_name("INT")->default_value(10000000),
+				"Number of IDs in the generated ID lists")
+			("label", po::value<std::string>(&label)
+				->value_name("STR")->default_value(""),
+				"Label added to every result (e.g. a commit)")
+			("listSize", po::value<size_t>(&listSize)
+				->value_name("INT")->default_value(1000),
+				"Taxonomy IDs per list when finding the LCA of a list")
+			("nodes", po::value<size_t>(&nodeCount)
+				->value_name("INT")->default_value(2500000),
+				"Number of nodes in the generated tree")
+			("output,o", po::value<std::string>(&output)
+				->value_name("FILE"), "File written by --generate")
+			("protein", po::value<bool>(&protein)
+				->zero_tokens()->default_value(false)->implicit_value(true),
+				"Generate protein rather than nucleotide FASTA")
+			("queries", po::value<size_t>(&queries)
+				->value_name("INT")->default_value(1000000),
+				"Number of timed queries per query benchmark")
+			("repeat", po::value<size_t>(&repeat)
+				->value_name("INT")->default_value(5),
+				"Number of timed calls per file benchmark")
+			("seed", po::value<uint64_t>(&seed)
+				->value_name("INT")->default_value(42),
+				"Seed of the generators")
+			("threads", po::value<unsigned int>(&threads)
+				->value_name("INT")->default_value(0),
+				"Number of threads used for parsing (0 for one per core)")
+			("workDir", po::value<std::string>(&workDir)
+				->value_name("PATH")->default_value("bench_data"),
+				"Directory for generated files, which are reused by later "
+				"runs with the same sizes")
+			;
+
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+		if (vm.count("help")) {
+			std::cout << "USAGE: " << appName << " [options]\n";
+			std::cout << "\n" << desc << std::endl;
+			return SUCCESS;
+		}
+
+		// Write a single generated file
+		if (!generate.empty()) {
+			if (output.empty()) {
+				std::cerr << "--generate needs --output" << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (generate == "tree") {
+				GenerateTree(output, nodeCount, maxDepth, fanOut, seed);
+			} else if (generate == "ids") {
+				GenerateIDs(output, idCount, 0xFFFFFFFF, seed);
+			} else if (generate == "fasta") {
+				GenerateFasta(output, (uint64_t)fastaMB << 20, protein, seed);
+			} else {
+				std::cerr << "Cannot generate: " << generate << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			return SUCCESS;
+		}
+
+		// Generate the data once per set of sizes
+		boost::filesystem::create_directories(workDir);
+		std::string suffix = "_" + boost::lexical_cast<std::string>(seed);
+		std::string treeFile = workDir + "/nodes_" +
+			boost::lexical_cast<std::string>(nodeCount) + "_" +
+			boost::lexical_cast<std::string>(maxDepth) + "_" +
+			boost::lexical_cast<std::string>(fanOut) + suffix + ".dmp";
+		std::string giFile = workDir + "/gis_" +
+			boost::lexical_cast<std::string>(idCount) + suffix + ".txt";
+		std::string taxaFile = workDir + "/taxa_" +
+			boost::lexical_cast<std::string>(idCount) + suffix + ".txt";
+		std::string fastaFile = workDir + "/seqs_" +
+			boost::lexical_cast<std::string>(fastaMB) +
+			(protein ? "_prot" : "_nucl") + suffix + ".fasta";
+		std::string cacheFile = treeFile + ".cache";
+		if (!FileExists(treeFile))
+			GenerateTree(treeFile, nodeCount, maxDepth, fanOut, seed);
+		if (!FileExists(giFile))
+			GenerateIDs(giFile, idCount, 0xFFFFFFFF, seed);
+		if (!FileExists(taxaFile))
+			GenerateIDs(taxaFile, idCount, 0x7FFFFFFF, seed + 1);
+		if (fastaMB > 0 && !FileExists(fastaFile))
+			GenerateFasta(fastaFile, (uint64_t)fastaMB << 20, protein, seed);
+
+		// Taxonomy loading
+		double treeBytes = GetFileSize(treeFile);
+		LCA_Finder finder;
+		Measure(label, "LCA_Finder::LoadData", "node", repeat, nodeCount,
+				treeBytes, [&](size_t) {
+			finder.LoadData(treeFile.c_str());
+		});
+		finder.SaveCache(cacheFile, treeFile);
+		Measure(label, "LCA_Finder::LoadCache", "node", repeat, nodeCount,
+				GetFileSize(cacheFile), [&](size_t) {
+			LCA_Finder cached;
+			sink = cached.LoadCache(cacheFile, treeFile);
+		});
+
+		// Taxonomy queries, on IDs drawn from the tree
+		std::mt19937_64 random(seed);
+		std::vector<int> taxIDs;
+		taxIDs.reserve(nodeCount);
+		for (int taxID = 1; taxIDs.size() < nodeCount; taxID++)
+			if (finder.Contains(taxID)) taxIDs.push_back(taxID);
+		std::vector<int> picks(2 * queries);
+		for (size_t i = 0; i < picks.size(); i++)
+			picks[i] = taxIDs[random() % taxIDs.size()];
+		Measure(label, "LCA_Finder::GetLCA_ID(pair)", "query", queries, 1, 0,
+				[&](size_t i) {
+			sink += finder.GetLCA_ID(picks[2 * i], picks[2 * i + 1]);
+		});
+		std::vector<int> list(listSize);
+		size_t listCalls = std::max(queries / listSize, (size_t)1);
+		Measure(label, "LCA_Finder::GetLCA_ID(list)", "taxID", listCalls,
+				listSize, 0, [&](size_t i) {
+			for (size_t j = 0; j < listSize; j++)
+				list[j] = picks[(i * listSize + j) % picks.size()];
+			sink += finder.GetLCA_ID<std::vector, int>(list);
+		});
+		Measure(label, "LCA_Finder::TraceToRoot", "query", queries, 1, 0,
+				[&](size_t i) {
+			sink += finder.TraceToRoot(picks[i]).size();
+		});
+
+		// List parsing
+		Measure(label, "ReadFile(uint64_t)", "id", repeat, idCount,
+				GetFileSize(giFile), [&](size_t) {
+			std::vector<uint64_t> ids;
+			ReadFile(giFile, ids, threads);
+			sink += ids.size();
+		});
+		Measure(label, "ReadFile(int)", "id", repeat, idCount,
+				GetFileSize(taxaFile), [&](size_t) {
+			std::vector<int> ids;
+			ReadFile(taxaFile, ids, threads);
+			sink += ids.size();
+		});
+
+		// Command line building
+		std::vector<std::string> fileNames;
+		for (size_t i = 0; i < listSize; i++)
+			fileNames.push_back("reference_" +
+				boost::lexical_cast<std::string>(i) + ".fasta");
+		Measure(label, "ToCmdLineStr", "name", listCalls, listSize, 0,
+				[&](size_t) {
+			sink += ToCmdLineStr(fileNames.begin(), fileNames.end(), "_",
+								 &RemoveExtension).size();
+		});
+
+		// FASTA scanning
+		if (fastaMB > 0) {
+			double fastaBytes = GetFileSize(fastaFile);
+			Measure(label, "ValidateFasta", "byte", repeat, fastaBytes,
+					fastaBytes, [&](size_t) {
+				sink += ValidateFasta(fastaFile, protein, threads).records;
+			});
+			std::vector<char> buffer(1 << 20);
+			Measure(label, "FastaShards(deduplicating)", "byte", repeat,
+					fastaBytes, fastaBytes, [&](size_t) {
+				FastaShards shards(std::vector<std::string>(1, fastaFile), 1,
+								   0, threads, true);
+				FastaShards::Cursor cursor;
+				while (size_t size = shards.Read(0, cursor, buffer.data(),
+												 buffer.size()))
+					sink += size;
+				sink += shards.Deduplication().duplicates;
+			});
+		}
+
+	} catch (const std::exception &e) {
+		std::cerr << "An exception occurred:\n" << e.what() << std::endl;
+		return ERROR_UNHANDLED_EXCEPTION;
+	}
+	return SUCCESS;
+}
@@ -0,0 +1,308 @@
+// BlastAlias.cpp - Writes BLAST alias files (.nal/.pal), which present several
+// databases (or a GI restricted view of one) as one, without running
+// blastdb_aliastool. The sizes of the databases are read from their index
+// files so that the alias carries the right sequence and letter counts.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstdlib>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include "BlastAlias.hpp"
+#include "HelperFunctions.hpp"
+
+namespace {
+	// Index file (.nin/.pin) versions understood
+	const uint32_t MIN_INDEX_VERSION = 4;
+	const uint32_t MAX_INDEX_VERSION = 5;
+	// Largest string (title, timestamp...) expected in an index header
+	const uint32_t MAX_HEADER_STRING = 1 << 20;
+	// Deepest chain of aliases followed, in case some list each other
+	const int MAX_ALIAS_DEPTH = 16;
+
+	// Returns the extension of a database file of the given kind
+	std::string Extension(bool protein, const char *kind) {
+		return std::string(protein ? ".p" : ".n") + kind;
+	}
+
+	// Reads the header of an index file, in which numbers are big endian
+	// except for the total length, which is little endian
+	class IndexReader {
+	public:
+		IndexReader(const std::string &fileName)
+			: fileName(fileName),
+			  ifs(fileName.c_str(), std::ios::in | std::ios::binary) {
+			if (ifs.fail())
+				throw std::runtime_error("Cannot read: " + fileName);
+		}
+		uint32_t ReadInt() {
+			unsigned char bytes[4];
+			Read(bytes, sizeof(bytes));
+			return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+				   ((uint32_t)bytes[2] << 8) | bytes[3];
+		}
+		uint64_t ReadLittleEndianLong() {
+			unsigned char bytes[8];
+			Read(bytes, sizeof(bytes));
+			uint64_t value = 0;
+			for (int i = 7; i >= 0; i--) value = (value << 8) | bytes[i];
+			return value;
+		}
+		void SkipString() {
+			uint32_t length = ReadInt();
+			if (length > MAX_HEADER_STRING) Malformed();
+			ifs.seekg(length, std::ios::cur);
+		}
+		void Malformed() const {
+			throw std::runtime_error("Malformed BLAST database: " + fileName);
+		}
+	private:
+		void Read(unsigned char *bytes, size_t size) {
+			ifs.read(reinterpret_cast<char *>(bytes), size);
+			if (ifs.gcount() != (std::streamsize)size) Malformed();
+		}
+
+		std::string fileName;
+		std::ifstream ifs;
+	};
+
+	// Returns the size of a database volume from its index file
+	// Throws std::runtime_error if it is malformed or of the wrong type
+	DatabaseSize ReadIndexSize(const std::string &indexFile, bool protein) {
+		IndexReader reader(indexFile);
+		uint32_t version = reader.ReadInt();
+		if (version < MIN_INDEX_VERSION || version > MAX_INDEX_VERSION)
+			reader.Malformed();
+		if (reader.ReadInt() != (protein ? 1u : 0u)) reader.Malformed();
+		if (version >= 5) reader.ReadInt();			// Volume number
+		reader.SkipString();						// Title
+		if (version >= 5) reader.SkipString();		// LMDB file
+		reader.SkipString();						// Timestamp
+		DatabaseSize size;
+		size.sequences = reader.ReadInt();
+		size.letters = reader.ReadLittleEndianLong();
+		size.known = true;
+		return size;
+	}
+
+	// Returns the values of an alias file's entries by key
+	// Throws std::runtime_error if it cannot be read
+	std::vector< std::pair<std::string, std::string> > ReadAliasEntries(
+		const std::string &aliasFile) {
+		std::ifstream ifs(aliasFile.c_str());
+		if (ifs.fail())
+			throw std::runtime_error("Cannot read: " + aliasFile);
+		std::vector< std::pair<std::string, std::string> > entries;
+		std::string line;
+		while (std::getline(ifs, line)) {
+			size_t start = line.find_first_not_of(" \t\r");
+			if (start == std::string::npos || line[start] == '#') continue;
+			size_t keyEnd = line.find_first_of(" \t\r", start);
+			std::string key = line.substr(start, keyEnd - start);
+			std::string value;
+			if (keyEnd != std::string::npos) {
+				size_t valueStart = line.find_first_not_of(" \t", keyEnd);
+				size_t valueEnd = line.find_last_not_of(" \t\r");
+				if (valueStart != std::string::npos)
+					value = line.substr(valueStart, valueEnd + 1 - valueStart);
+			}
+			entries.push_back(std::make_pair(key, value));
+		}
+		return entries;
+	}
+
+	// Splits a DBLIST into its names, which are separated by spaces unless
+	// double quoted
+	std::vector<std::string> SplitDatabaseList(const std::string &list) {
+		std::vector<std::string> names;
+		std::string name;
+		bool quoted = false, any = false;
+		for (size_t i = 0; i <= list.size(); i++) {
+			char c = (i < list.size()) ? list[i] : ' ';
+			if (c == '"') {
+				quoted = !quoted;
+				any = true;
+			} else if ((c == ' ' || c == '\t') && !quoted) {
+				if (any) names.push_back(name);
+				name.clear();
+				any = false;
+			} else {
+				name += c;
+				any = true;
+			}
+		}
+		return names;
+	}
+
+	// Returns where a database is found (its name with the directory it is
+	// in, if not the current one), or an empty string if it isn't
+	std::string FindDatabase(const std::string &name, bool protein) {
+		if (FileExists(name + Extension(protein, "al")) ||
+			FileExists(name + Extension(protein, "in")))
+			return name;
+		if (boost::filesystem::path(name).is_absolute()) return "";
+		const char *blastDB = getenv("BLASTDB");
+		std::stringstream directories((blastDB == NULL) ? "" : blastDB);
+		std::string directory;
+		while (std::getline(directories, directory, ':')) {
+			if (directory.empty()) continue;
+			std::string found = (boost::filesystem::path(directory) /
+								 name).string();
+			if (FileExists(found + Extension(protein, "al")) ||
+				FileExists(found + Extension(protein, "in")))
+				return found;
+		}
+		return "";
+	}
+
+	// Returns the size of a database at a given depth of aliases
+	DatabaseSize DatabaseSizeOf(const std::string &name, bool protein,
+								int depth) {
+		std::string found = FindDatabase(name, protein);
+		if (found.empty())
+			throw std::runtime_error("BLAST database not found: " + name);
+		if (!FileExists(found + Extension(protein, "al")))
+			return ReadIndexSize(found + Extension(protein, "in"), protein);
+
+		// An alias records its size, or is the sum of the databases it lists
+		// (which are relative to its own directory) if it restricts none of
+		// their sequences
+		std::string aliasFile = found + Extension(protein, "al");
+		if (depth >= MAX_ALIAS_DEPTH)
+			throw std::runtime_error("Aliases nested too deep: " + aliasFile);
+		std::vector< std::pair<std::string, std::string> > entries =
+			ReadAliasEntries(aliasFile);
+		DatabaseSize size, recorded;
+		size.sequences = size.letters = 0;
+		size.known = true;
+		recorded.known = false;
+		bool hasSequences = false, hasLetters = false, restricted = false;
+		std::vector<std::string> volumes;
+		for (size_t i = 0; i < entries.size(); i++) {
+			const std::string &key = entries[i].first, &value =
+				entries[i].second;
+			try {
+				if (key == "NSEQ") {
+					recorded.sequences =
+						boost::lexical_cast<uint64_t>(value);
+					hasSequences = true;
+				} else if (key == "LENGTH") {
+					recorded.letters = boost::lexical_cast<uint64_t>(value);
+					hasLetters = true;
+				}
+			} catch (const boost::bad_lexical_cast &) {
+				throw std::runtime_error("Malformed BLAST alias: " +
+										 aliasFile);
+			}
+			if (key == "DBLIST") {
+				volumes = SplitDatabaseList(value);
+			} else if (key == "GILIST" || key == "OIDLIST" ||
+					   key == "SEQIDLIST" || key == "TAXIDLIST" ||
+					   key == "MEMB_BIT" || key == "FIRST_OID" ||
+					   key == "LAST_OID") {
+				restricted = true;
+			}
+		}
+		if (hasSequences && hasLetters) {
+			recorded.known = true;
+			return recorded;
+		}
+		if (restricted || volumes.empty()) {
+			size.known = false;
+			return size;
+		}
+		boost::filesystem::path directory =
+			boost::filesystem::path(aliasFile).parent_path();
+		for (size_t i = 0; i < volumes.size(); i++) {
+			boost::filesystem::path volume(volumes[i]);
+			std::string volumeName = (volume.is_absolute() ||
+				directory.empty()) ? volume.string() :
+				(directory / volume).string();
+			DatabaseSize volumeSize = DatabaseSizeOf(volumeName, protein,
+													 depth + 1);
+			if (!volumeSize.known) size.known = false;
+			size.sequences += volumeSize.sequences;
+			size.letters += volumeSize.letters;
+		}
+		return size;
+	}
+
+	// Returns a database's name as listed in an alias in aliasDirectory:
+	// relative names are made absolute unless the alias is in the current
+	// directory, and names with spaces are quoted
+	std::string ListedName(const std::string &name,
+						   const boost::filesystem::path &aliasDirectory) {
+		std::string listed = name;
+		if (!aliasDirectory.empty() &&
+			!boost::filesystem::path(name).is_absolute())
+			listed = boost::filesystem::absolute(name).string();
+		if (listed.find(' ') != std::string::npos)
+			listed = "\"" + listed + "\"";
+		return listed;
+	}
+}
+
+// ==== FUNCTIONS ==============================================================
+
+// Returns the size of a BLAST database from its index or alias file
+// Throws std::runtime_error if the database cannot be found or its files are
+// malformed
+DatabaseSize ReadDatabaseSize(const std::string &name, bool protein) {
+	return DatabaseSizeOf(name, protein, 0);
+}
+
+// Writes an alias file listing the given databases, optionally restricted to
+// the GIs of a GI list
+// Throws std::runtime_error if a database cannot be found or is malformed, or
+// the alias cannot be written
+void WriteAlias(const std::string &output, const std::string &title,
+				const std::vector<std::string> &dbs, const std::string &giList,
+				bool protein) {
+	boost::filesystem::path aliasDirectory =
+		boost::filesystem::path(output).parent_path();
+
+	// Check every database is there, totting up their sizes (which aren't
+	// known for a GI restricted view without counting its GIs in each)
+	std::string list;
+	DatabaseSize size;
+	size.sequences = size.letters = 0;
+	size.known = giList.empty();
+	for (std::vector<std::string>::const_iterator it = dbs.begin();
+		 it != dbs.end();
+		 it++) {
+		DatabaseSize dbSize = ReadDatabaseSize(*it, protein);
+		if (!dbSize.known) size.known = false;
+		size.sequences += dbSize.sequences;
+		size.letters += dbSize.letters;
+		std::string found = FindDatabase(*it, protein);
+		list += ((it == dbs.begin()) ? "" : " ") +
+				ListedName(found, aliasDirectory);
+	}
+
+	// Written to the side and renamed, so a reader never sees half an alias
+	std::string aliasFile = output + Extension(protein, "al");
+	AtomicFile alias(aliasFile);
+	std::ofstream ofs(alias.TempName().c_str(),
+					  std::ios::out | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + alias.TempName());
+	ofs << "#\n# Alias file created by CreateBlastDB\n#\n"
+		<< "TITLE " << title << "\n"
+		<< "DBLIST " << list << "\n";
+	if (!giList.empty())
+		ofs << "GILIST " << ListedName(giList, aliasDirectory) << "\n";
+	if (size.known)
+		ofs << "NSEQ " << size.sequences << "\n"
+			<< "LENGTH " << size.letters << "\n";
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + aliasFile);
+	alias.Commit();
+}
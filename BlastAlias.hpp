@@ -0,0 +1,43 @@
+// BlastAlias.hpp - Writes BLAST alias files (.nal/.pal), which present several
+// databases (or a GI restricted view of one) as one, without running
+// blastdb_aliastool. The sizes of the databases are read from their index
+// files so that the alias carries the right sequence and letter counts.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef BLASTALIAS_HPP
+#define BLASTALIAS_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// The number of sequences and letters in a BLAST database
+struct DatabaseSize {
+	uint64_t sequences;
+	uint64_t letters;
+	bool known;				// False for aliases restricted to some sequences
+							// (e.g. by a GI list) that don't record theirs
+};
+
+// Returns the size of a BLAST database, read from the header of its index
+// file (.nin/.pin) or from the alias file (.nal/.pal) listing its volumes.
+// Names are resolved like BLAST does: as given, then in each of the
+// directories of $BLASTDB
+// Throws std::runtime_error if the database cannot be found or its files are
+// malformed
+DatabaseSize ReadDatabaseSize(const std::string &name, bool protein);
+
+// Writes an alias file for output (output.nal, or output.pal if protein) with
+// the given title listing the given databases and, if giList is not empty,
+// restricting them to the GIs of that GI list. The alias is written whole or
+// not at all
+// Throws std::runtime_error if a database cannot be found or is malformed, or
+// the alias cannot be written
+void WriteAlias(const std::string &output, const std::string &title,
+				const std::vector<std::string> &dbs, const std::string &giList,
+				bool protein);
+
+#endif // BLASTALIAS_HPP
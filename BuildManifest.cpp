@@ -0,0 +1,247 @@
+// BuildManifest.cpp - Remembers what went into the databases built by earlier
+// runs, so that stages whose inputs have not changed can be skipped.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "BuildManifest.hpp"
+#include "HelperFunctions.hpp"
+#include "Subprocess.hpp"
+
+namespace {
+	const char *MANIFEST_HEADER = "CreateBlastDB build manifest";
+	const int MANIFEST_VERSION = 1;
+
+	// Files are hashed in pieces of this many bytes, in parallel, and the
+	// hashes of the pieces are hashed in turn
+	const size_t FILE_HASH_CHUNK_SIZE = 16 << 20;
+
+	// Returns a 128 bit hash as 32 hexadecimal digits
+	std::string ToHex(uint64_t low, uint64_t high) {
+		char hex[33];
+		snprintf(hex, sizeof(hex), "%016llx%016llx",
+				 (unsigned long long)high, (unsigned long long)low);
+		return hex;
+	}
+
+	// A piece of a file to be hashed
+	struct HashChunk {
+		size_t file;
+		size_t offset;
+		size_t size;
+		uint64_t low, high;
+	};
+}
+
+// ==== CLASSES ================================================================
+
+// BuildManifest - A record of the stages built by earlier runs
+BuildManifest::BuildManifest(const std::string &manifestFile,
+							 unsigned int threads)
+	: manifestFile(manifestFile), threads(threads)
+{
+	std::ifstream ifs(manifestFile.c_str());
+	if (ifs.fail()) return;
+
+	// One tab separated record per line, the last field being free text
+	std::string line;
+	if (!std::getline(ifs, line) || line != MANIFEST_HEADER) return;
+	if (!std::getline(ifs, line) ||
+		line != "version\t" + boost::lexical_cast<std::string>(
+			MANIFEST_VERSION)) {
+		return;
+	}
+	try {
+		while (std::getline(ifs, line)) {
+			std::vector<std::string> fields;
+			size_t start = 0, tab;
+			while (fields.size() < 4 &&
+				   (tab = line.find('\t', start)) != std::string::npos) {
+				fields.push_back(line.substr(start, tab - start));
+				start = tab + 1;
+			}
+			fields.push_back(line.substr(start));
+			if (fields[0] == "file" && fields.size() == 5) {
+				FileRecord &record = files[fields[4]];
+				record.size = boost::lexical_cast<int64_t>(fields[1]);
+				record.modificationTime =
+					boost::lexical_cast<int64_t>(fields[2]);
+				record.hash = fields[3];
+			} else if (fields[0] == "stage" && fields.size() == 4) {
+				StageRecord &record = stages[fields[1]];
+				record.fingerprint = fields[2];
+				record.output = fields[3];
+			} else {
+				throw std::runtime_error("Malformed manifest: " + manifestFile);
+			}
+		}
+	} catch (const std::exception &) {
+		// Everything is rebuilt rather than trusting part of a manifest
+		files.clear();
+		stages.clear();
+	}
+}
+
+std::string BuildManifest::Fingerprint(const std::vector<std::string> &files,
+									   const std::vector<std::string> &settings) {
+	HashFiles(files);
+	Hasher128 hasher;
+	for (std::vector<std::string>::const_iterator it = settings.begin();
+		 it != settings.end();
+		 it++) {
+		hasher.Update(it->c_str(), it->size() + 1);
+	}
+	for (std::vector<std::string>::const_iterator it = files.begin();
+		 it != files.end();
+		 it++) {
+		const std::string &hash = this->files[*it].hash;
+		hasher.Update(it->c_str(), it->size() + 1);
+		hasher.Update(hash.c_str(), hash.size() + 1);
+	}
+	uint64_t low, high;
+	hasher.Final(low, high);
+	return ToHex(low, high);
+}
+
+std::string BuildManifest::ToolVersion(const std::string &tool) {
+	std::map<std::string, std::string>::iterator known =
+		toolVersions.find(tool);
+	if (known != toolVersions.end()) return known->second;
+
+	// Whatever the tool says (even that it cannot be started) identifies it
+	std::string version;
+	std::vector<Command> command(1);
+	command[0].push_back(tool);
+	command[0].push_back("-version");
+	std::vector<ProcessUsage> usage;
+	RunPipeline(command, [&version](const char *data, size_t size) {
+		version.append(data, size);
+	}, usage);
+	return toolVersions[tool] = version + usage[0].output;
+}
+
+bool BuildManifest::UpToDate(const std::string &stage,
+							 const std::string &fingerprint,
+							 std::string &output) const {
+	std::map<std::string, StageRecord>::const_iterator record =
+		stages.find(stage);
+	if (record == stages.end() || record->second.fingerprint != fingerprint)
+		return false;
+	output = record->second.output;
+	return true;
+}
+
+void BuildManifest::Record(const std::string &stage,
+						   const std::string &fingerprint,
+						   const std::string &output) {
+	StageRecord &record = stages[stage];
+	record.fingerprint = fingerprint;
+	record.output = output;
+}
+
+void BuildManifest::Save() const {
+	// Written to the side and renamed, so a reader never sees half a manifest
+	AtomicFile manifest(manifestFile);
+	std::ofstream ofs(manifest.TempName().c_str(),
+					  std::ios::out | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + manifest.TempName());
+	ofs << MANIFEST_HEADER << "\n" << "version\t" << MANIFEST_VERSION << "\n";
+	for (std::map<std::string, FileRecord>::const_iterator it = files.begin();
+		 it != files.end();
+		 it++) {
+		ofs << "file\t" << it->second.size << "\t"
+			<< it->second.modificationTime << "\t" << it->second.hash << "\t"
+			<< it->first << "\n";
+	}
+	for (std::map<std::string, StageRecord>::const_iterator it =
+			stages.begin();
+		 it != stages.end();
+		 it++) {
+		ofs << "stage\t" << it->first << "\t" << it->second.fingerprint
+			<< "\t" << it->second.output << "\n";
+	}
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + manifestFile);
+	manifest.Commit();
+}
+
+void BuildManifest::HashFiles(const std::vector<std::string> &fileNames) {
+	// Only files whose size or modification time changed need hashing
+	std::vector<std::string> stale;
+	std::vector<FileRecord> current;
+	for (std::vector<std::string>::const_iterator it = fileNames.begin();
+		 it != fileNames.end();
+		 it++) {
+		FileRecord record;
+		record.size = GetFileSize(*it);
+		record.modificationTime = GetFileModificationTime(*it);
+		if (record.size < 0)
+			throw std::runtime_error("Cannot read: " + *it);
+		std::map<std::string, FileRecord>::const_iterator known =
+			files.find(*it);
+		if (known != files.end() && known->second.size == record.size &&
+			known->second.modificationTime == record.modificationTime) {
+			continue;
+		}
+		if (std::find(stale.begin(), stale.end(), *it) != stale.end())
+			continue;
+		stale.push_back(*it);
+		current.push_back(record);
+	}
+	if (stale.empty()) return;
+
+	// Hash the pieces of every stale file at once, so that one large file or
+	// many small ones keep every thread busy
+	std::vector<MappedFile *> mappings;
+	std::vector<HashChunk> chunks;
+	try {
+		for (size_t file = 0; file < stale.size(); file++) {
+			mappings.push_back(new MappedFile(stale[file]));
+			size_t size = mappings.back()->Size(), offset = 0;
+			do {
+				HashChunk chunk;
+				chunk.file = file;
+				chunk.offset = offset;
+				chunk.size = std::min(size - offset, FILE_HASH_CHUNK_SIZE);
+				chunks.push_back(chunk);
+				offset += chunk.size;
+			} while (offset < size);
+		}
+		ParallelFor(chunks.size(), threads, [&](size_t i) {
+			HashChunk &chunk = chunks[i];
+			Hasher128 hasher;
+			hasher.Update(mappings[chunk.file]->Data() + chunk.offset,
+						  chunk.size);
+			hasher.Final(chunk.low, chunk.high);
+		});
+	} catch (...) {
+		for (size_t i = 0; i < mappings.size(); i++) delete mappings[i];
+		throw;
+	}
+	for (size_t i = 0; i < mappings.size(); i++) delete mappings[i];
+
+	// A file's hash is the hash of its pieces' hashes, in order
+	size_t chunk = 0;
+	for (size_t file = 0; file < stale.size(); file++) {
+		Hasher128 hasher;
+		for (; chunk < chunks.size() && chunks[chunk].file == file; chunk++) {
+			hasher.Update(&chunks[chunk].low, sizeof(uint64_t));
+			hasher.Update(&chunks[chunk].high, sizeof(uint64_t));
+		}
+		uint64_t low, high;
+		hasher.Final(low, high);
+		current[file].hash = ToHex(low, high);
+		files[stale[file]] = current[file];
+	}
+}
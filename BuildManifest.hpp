@@ -0,0 +1,66 @@
+// BuildManifest.hpp - Remembers what went into the databases built by earlier
+// runs, so that stages whose inputs have not changed can be skipped.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef BUILDMANIFEST_HPP
+#define BUILDMANIFEST_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A record of every stage built by earlier runs (keyed by name) along with a
+// fingerprint of its inputs: the content hashes of its files, its settings and
+// the versions of the tools it ran. Content hashes are kept with each file's
+// size and modification time, and are only recomputed when those change
+class BuildManifest {
+public:
+	// Loads the manifest if it exists; a missing, unreadable or outdated
+	// manifest is treated as empty, so everything is rebuilt. Files are hashed
+	// across up to threads threads (one per core if 0)
+	BuildManifest(const std::string &manifestFile, unsigned int threads = 0);
+	// Returns a fingerprint of the given files' contents (and names) and
+	// settings, hashing any file not seen unchanged before
+	// Throws std::runtime_error if a file cannot be read
+	std::string Fingerprint(const std::vector<std::string> &files,
+							const std::vector<std::string> &settings);
+	// Returns the version reported by an external tool (run once per tool)
+	std::string ToolVersion(const std::string &tool);
+	// Returns whether stage was last built with the given fingerprint, giving
+	// the output it recorded
+	bool UpToDate(const std::string &stage, const std::string &fingerprint,
+				  std::string &output) const;
+	// Records that stage was built into output with the given fingerprint
+	void Record(const std::string &stage, const std::string &fingerprint,
+				const std::string &output);
+	// Writes the manifest back to its file
+	// Throws std::runtime_error if it cannot be written
+	void Save() const;
+private:
+	// The last known size, modification time and content hash of a file
+	struct FileRecord {
+		int64_t size;
+		int64_t modificationTime;
+		std::string hash;
+	};
+	// The fingerprint of a built stage and what it produced
+	struct StageRecord {
+		std::string fingerprint;
+		std::string output;
+	};
+
+	// Brings the content hashes of the given files up to date
+	void HashFiles(const std::vector<std::string> &fileNames);
+
+	std::string manifestFile;
+	unsigned int threads;
+	std::map<std::string, FileRecord> files;
+	std::map<std::string, StageRecord> stages;
+	std::map<std::string, std::string> toolVersions;
+};
+
+#endif // BUILDMANIFEST_HPP
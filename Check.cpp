@@ -0,0 +1,294 @@
+// Check.cpp - Checks the accession index (building it from plain, gzipped and
+// headerless accession2taxid dumps, looking records up by taxonomy ID, and
+// refusing indexes with a damaged header, truncated or damaged record ranges,
+// accession offsets or arena) and the staleness checks shared by the snapshots,
+// on small synthetic files in a scratch directory. Prints each failed check
+// and exits with a failure status if there were any.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <zlib.h>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include "AccessionIndex.hpp"
+#include "HelperFunctions.hpp"
+#include "SeqIdList.hpp"
+
+namespace {
+	const int SUCCESS                   = 0;
+	const int CHECKS_FAILED             = 1;
+	const int ERROR_UNHANDLED_EXCEPTION = 2;
+
+	// Records of the synthetic dumps: taxonomy ID 9606 has GIs 50 and 100 and
+	// one accession without a GI, 562 has GI 300, and 7 has no records
+	const char *DUMP =
+		"accession\taccession.version\ttaxid\tgi\n"
+		"A1\tA1.1\t9606\t100\n"
+		"A2\tA2.1\t9606\tna\n"
+		"\n"
+		"B1\tB1.2\t562\t300\r\n"
+		"A3\tA3.1\t9606\t50";
+	const char *HEADERLESS_DUMP =
+		"C1.1\t562\n"
+		"C2.1\t8\n";
+	// Lines of the dump large enough to be read in several chunks once gzipped
+	const size_t LARGE_DUMP_LINES = 600000;
+
+	size_t checks = 0, failures = 0;
+
+	void Check(bool passed, const std::string &description) {
+		checks++;
+		if (passed) return;
+		failures++;
+		std::cout << "FAIL: " << description << std::endl;
+	}
+
+	// Runs task, checking that it throws std::runtime_error
+	template <typename Task>
+	void CheckThrows(Task task, const std::string &description) {
+		bool threw = false;
+		try {
+			task();
+		} catch (const std::runtime_error &) {
+			threw = true;
+		}
+		Check(threw, description);
+	}
+
+	void WriteFile(const std::string &fileName, const std::string &contents) {
+		std::ofstream ofs(fileName.c_str(), std::ios::out | std::ios::binary);
+		ofs.write(contents.data(), contents.size());
+		ofs.close();
+		if (ofs.fail())
+			throw std::runtime_error("Cannot write: " + fileName);
+	}
+
+	// Writes contents gzipped, split into members gzip style tools concatenate
+	void WriteGzipFile(const std::string &fileName,
+					   const std::string &contents, size_t members) {
+		remove(fileName.c_str());
+		size_t memberSize = contents.size() / members + 1;
+		for (size_t first = 0; first < contents.size(); first += memberSize) {
+			gzFile file = gzopen(fileName.c_str(), "ab");
+			size_t size = std::min(memberSize, contents.size() - first);
+			if (file == NULL ||
+				gzwrite(file, contents.data() + first, size) != (int)size ||
+				gzclose(file) != Z_OK) {
+				throw std::runtime_error("Cannot write: " + fileName);
+			}
+		}
+	}
+
+	std::vector<uint64_t> GIs(const AccessionIndex &index, int taxID) {
+		std::vector<uint64_t> gis;
+		index.GetGIs(taxID, gis);
+		return gis;
+	}
+
+	std::vector<std::string> AccessionsWithoutGIs(const AccessionIndex &index,
+												  int taxID) {
+		AccessionSet set(1);
+		index.GetAccessionsWithoutGIs(taxID, set);
+		std::vector<std::string> accessions;
+		set.Sort();
+		set.ToVector(accessions);
+		return accessions;
+	}
+
+	// Checks the records of the synthetic dump in an index
+	void CheckDumpRecords(const AccessionIndex &index,
+						  const std::string &name) {
+		std::vector<uint64_t> human = GIs(index, 9606);
+		Check(human.size() == 2 && human[0] == 50 && human[1] == 100,
+			  name + ": GIs of a taxon, in order");
+		std::vector<uint64_t> ecoli = GIs(index, 562);
+		Check(!ecoli.empty() && ecoli[0] == 300, name + ": GIs of a taxon");
+		std::vector<std::string> accessions = AccessionsWithoutGIs(index, 9606);
+		Check(accessions.size() == 1 && accessions[0] == "A2.1",
+			  name + ": accessions without GIs");
+		Check(GIs(index, 7).empty(), name + ": a taxon without records");
+		Check(GIs(index, 0).empty() && GIs(index, -1).empty() &&
+			  GIs(index, 1 << 30).empty(),
+			  name + ": taxa outside the index");
+	}
+
+	// Returns the contents of a file with a byte changed
+	std::string Damage(const std::string &contents, size_t offset) {
+		std::string damaged = contents;
+		damaged[offset] ^= 0x55;
+		return damaged;
+	}
+
+	// Returns a 64 bit field of an index header, at a byte offset
+	uint64_t HeaderField(const std::string &index, size_t offset) {
+		uint64_t field;
+		memcpy(&field, index.data() + offset, sizeof(field));
+		return field;
+	}
+
+	void CheckAccessionIndex(const std::string &directory) {
+		std::string dump = directory + "/plain.accession2taxid";
+		std::string gzippedDump = directory + "/gzipped.accession2taxid.gz";
+		std::string headerlessDump = directory + "/headerless.accession2taxid";
+		std::string indexFile = directory + "/accession2taxid.index";
+		WriteFile(dump, DUMP);
+		WriteGzipFile(gzippedDump, DUMP, 3);
+		WriteFile(headerlessDump, HEADERLESS_DUMP);
+
+		AccessionIndex::Build(std::vector<std::string>(1, dump), indexFile);
+		AccessionIndex plain(indexFile);
+		Check(plain.Size() == 4, "plain dump: every record indexed");
+		CheckDumpRecords(plain, "plain dump");
+		std::string plainIndex = ReadFile(indexFile);
+
+		AccessionIndex::Build(std::vector<std::string>(1, gzippedDump),
+							  indexFile);
+		Check(ReadFile(indexFile) == plainIndex,
+			  "gzipped dump: same index as the plain dump");
+
+		std::vector<std::string> dumps;
+		dumps.push_back(gzippedDump);
+		dumps.push_back(headerlessDump);
+		AccessionIndex::Build(dumps, indexFile);
+		AccessionIndex merged(indexFile);
+		Check(merged.Size() == 6, "several dumps: every record indexed");
+		CheckDumpRecords(merged, "several dumps");
+		std::vector<std::string> accessions = AccessionsWithoutGIs(merged, 562);
+		Check(accessions.size() == 1 && accessions[0] == "C1.1",
+			  "headerless dump: accession.version and taxid columns");
+
+		// A dump read in several chunks, with lines split between them
+		std::string large = "accession.version\ttaxid\tgi\n";
+		for (size_t line = 0; line < LARGE_DUMP_LINES; line++) {
+			large += "L" + boost::lexical_cast<std::string>(line) + ".1\t" +
+					 boost::lexical_cast<std::string>(line % 1000 + 1) + "\t" +
+					 boost::lexical_cast<std::string>(line + 1) + "\n";
+		}
+		WriteFile(dump, large);
+		AccessionIndex::Build(std::vector<std::string>(1, dump), indexFile);
+		std::string largeIndex = ReadFile(indexFile);
+		WriteGzipFile(gzippedDump, large, 1);
+		AccessionIndex::Build(std::vector<std::string>(1, gzippedDump),
+							  indexFile);
+		Check(ReadFile(indexFile) == largeIndex,
+			  "large gzipped dump: same index as the plain dump");
+		AccessionIndex largeIndexed(indexFile);
+		Check(largeIndexed.Size() == LARGE_DUMP_LINES &&
+			  GIs(largeIndexed, 1000).size() == LARGE_DUMP_LINES / 1000,
+			  "large gzipped dump: every record indexed");
+
+		// A malformed dump leaves the last index alone
+		WriteFile(dump, "A1.1\tnine\n");
+		CheckThrows([&]() {
+			AccessionIndex::Build(std::vector<std::string>(1, dump), indexFile);
+		}, "malformed dump: refused");
+		Check(ReadFile(indexFile) == largeIndex,
+			  "malformed dump: last index left in place");
+		bool tempFileLeft = false;
+		for (boost::filesystem::directory_iterator it(directory);
+			 it != boost::filesystem::directory_iterator();
+			 it++) {
+			if (it->path().extension() == ".temp") tempFileLeft = true;
+		}
+		Check(!tempFileLeft, "malformed dump: nothing left written aside");
+		CheckThrows([&]() {
+			AccessionIndex::Build(std::vector<std::string>(1, directory +
+										"/missing.accession2taxid"),
+								  indexFile);
+		}, "missing dump: refused");
+
+		// Corrupt indexes are refused rather than mapped
+		std::string corruptFile = directory + "/corrupt.index";
+		std::vector<std::string> corrupt;
+		corrupt.push_back("");
+		corrupt.push_back(plainIndex.substr(0, 16));
+		corrupt.push_back(plainIndex.substr(0, plainIndex.size() - 1));
+		corrupt.push_back(Damage(plainIndex, 0));	// Magic
+		corrupt.push_back(Damage(plainIndex, 8));	// Version
+		corrupt.push_back(Damage(plainIndex, 12));	// Byte order
+		corrupt.push_back(Damage(plainIndex, 16));	// Taxonomy ID count
+		corrupt.push_back(Damage(plainIndex, 24));	// Record count
+		corrupt.push_back(Damage(plainIndex, 48));	// A section's offset
+		// A record offset out of order, an accession's offset past the arena
+		// and the arena's last terminator
+		uint64_t recordOffsetsOffset = HeaderField(plainIndex, 40);
+		uint64_t accessionOffsetsOffset = HeaderField(plainIndex, 56);
+		uint64_t arenaEnd = HeaderField(plainIndex, 64) +
+							HeaderField(plainIndex, 32);
+		corrupt.push_back(Damage(plainIndex, recordOffsetsOffset + 8));
+		corrupt.push_back(Damage(plainIndex, accessionOffsetsOffset + 7));
+		corrupt.push_back(Damage(plainIndex, arenaEnd - 1));
+		for (size_t i = 0; i < corrupt.size(); i++) {
+			WriteFile(corruptFile, corrupt[i]);
+			CheckThrows([&]() {
+				AccessionIndex index(corruptFile);
+			}, "corrupt index " + boost::lexical_cast<std::string>(i) +
+			   ": refused");
+		}
+		CheckThrows([&]() {
+			AccessionIndex index(directory + "/missing.index");
+		}, "missing index: refused");
+	}
+
+	// Checks when snapshots (such as the taxonomy and name caches) are taken
+	// to be stale relative to the file they were built from
+	void CheckSourceStamps(const std::string &directory) {
+		std::string source = directory + "/source.dmp";
+		WriteFile(source, "1\t|\t1\t|\n");
+		SourceStamp stamp = StampSource(source);
+		Check(SourceUnchanged(source, stamp), "unchanged source: fresh");
+
+		std::time_t modified = boost::filesystem::last_write_time(source);
+		boost::filesystem::last_write_time(source, modified - 60);
+		Check(SourceUnchanged(source, stamp),
+			  "source with a new modification time alone: fresh");
+		WriteFile(source, "2\t|\t1\t|\n");
+		boost::filesystem::last_write_time(source, modified - 120);
+		Check(!SourceUnchanged(source, stamp),
+			  "source changed within the same size: stale");
+		WriteFile(source, "1\t|\t1\t|\n2\t|\t1\t|\n");
+		Check(!SourceUnchanged(source, stamp),
+			  "source changed in size: stale");
+		remove(source.c_str());
+		Check(!SourceUnchanged(source, stamp), "missing source: stale");
+
+		SnapshotHeader header;
+		StampSnapshot(header, "CBDBCHK", 2);
+		Check(SnapshotMatches(header, "CBDBCHK", 2), "snapshot header: match");
+		Check(!SnapshotMatches(header, "CBDBCHK", 1) &&
+			  !SnapshotMatches(header, "CBDBXXX", 2),
+			  "snapshot header: other kinds and versions refused");
+	}
+}
+
+int main() {
+	boost::filesystem::path directory;
+	try {
+		directory = boost::filesystem::temp_directory_path() /
+					boost::filesystem::unique_path("CreateBlastDB-%%%%-%%%%");
+		boost::filesystem::create_directories(directory);
+		CheckAccessionIndex(directory.string());
+		CheckSourceStamps(directory.string());
+	} catch (std::exception &e) {
+		std::cerr << "Unhandled Exception reached the top of main: "
+				  << e.what() << ", application will now exit" << std::endl;
+		boost::filesystem::remove_all(directory);
+		return ERROR_UNHANDLED_EXCEPTION;
+	}
+	boost::filesystem::remove_all(directory);
+	std::cout << checks << " checks, " << failures << " failed" << std::endl;
+	return (failures == 0) ? SUCCESS : CHECKS_FAILED;
+}
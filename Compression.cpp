@@ -0,0 +1,452 @@
+// Compression.cpp - Reads inputs that may be gzip compressed (NCBI's dumps,
+// references and GI lists usually are) or tar archives (taxdump.tar.gz),
+// either whole into memory or as a stream, without decompressing them to
+// disk first. The blocks of BGZF files (gzip files made of independent
+// members that record their own sizes) are inflated in parallel.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <zlib.h>
+#include "Compression.hpp"
+#include "HelperFunctions.hpp"
+
+namespace {
+	// Fixed parts of a gzip member
+	const size_t GZIP_HEADER_SIZE = 10;
+	const size_t GZIP_TRAILER_SIZE = 8;			// CRC32 and length
+	const unsigned char GZIP_FEXTRA = 4;
+	// Offset of the extra field in a BGZF block, which holds its size
+	const size_t BGZF_EXTRA_OFFSET = 12;
+	// Window bits for zlib: raw deflate data, or gzip members
+	const int RAW_DEFLATE_WINDOW = -15;
+	const int GZIP_WINDOW = 15 + 16;
+	// Most bytes handed to zlib at once (its counts are 32 bit)
+	const size_t MAX_INFLATE_BYTES = 1 << 30;
+	// BGZF blocks inflated at once by a stream (up to 16 MB of output)
+	const size_t STREAM_BGZF_BLOCKS = 256;
+	// Bytes given out at a time by a stream otherwise
+	const size_t STREAM_CHUNK_SIZE = 1 << 20;
+	const size_t TAR_BLOCK_SIZE = 512;
+
+	uint32_t ReadLittleEndian(const char *data, int bytes) {
+		uint32_t value = 0;
+		for (int i = bytes - 1; i >= 0; i--)
+			value = (value << 8) | (unsigned char)data[i];
+		return value;
+	}
+
+	void Malformed(const std::string &source) {
+		throw std::runtime_error("Malformed gzip file: " + source);
+	}
+
+	// A BGZF block: a gzip member with its size in its extra field
+	struct BgzfBlock {
+		size_t offset;
+		size_t size;
+		size_t dataOffset;			// Of its deflate data
+		size_t dataSize;
+		uint32_t crc;
+		uint32_t length;			// Once inflated
+	};
+
+	// Reads the header of a BGZF block starting at offset
+	// Returns false if there is no whole BGZF block there
+	bool ReadBgzfBlock(const char *data, size_t size, size_t offset,
+					   BgzfBlock &block) {
+		const unsigned char *header =
+			reinterpret_cast<const unsigned char *>(data + offset);
+		if (offset > size || size - offset < BGZF_EXTRA_OFFSET ||
+			header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 ||
+			header[3] != GZIP_FEXTRA) {
+			return false;
+		}
+		size_t extraSize = ReadLittleEndian(data + offset + 10, 2);
+		size_t extraEnd = BGZF_EXTRA_OFFSET + extraSize;
+		if (size - offset < extraEnd) return false;
+		size_t blockSize = 0;
+		for (size_t field = BGZF_EXTRA_OFFSET; field + 4 <= extraEnd; ) {
+			size_t fieldSize = ReadLittleEndian(data + offset + field + 2, 2);
+			if (header[field] == 'B' && header[field + 1] == 'C' &&
+				fieldSize == 2 && field + 6 <= extraEnd) {
+				blockSize = ReadLittleEndian(data + offset + field + 4, 2) + 1;
+			}
+			field += 4 + fieldSize;
+		}
+		if (blockSize < extraEnd + GZIP_TRAILER_SIZE ||
+			blockSize > size - offset) {
+			return false;
+		}
+		block.offset = offset;
+		block.size = blockSize;
+		block.dataOffset = offset + extraEnd;
+		block.dataSize = blockSize - extraEnd - GZIP_TRAILER_SIZE;
+		block.crc = ReadLittleEndian(data + offset + blockSize - 8, 4);
+		block.length = ReadLittleEndian(data + offset + blockSize - 4, 4);
+		return true;
+	}
+
+	// Finds the BGZF blocks from offset on, at most maxBlocks of them (all
+	// if 0)
+	// Returns false if something other than a BGZF block is found
+	bool FindBgzfBlocks(const char *data, size_t size, size_t offset,
+						size_t maxBlocks, std::vector<BgzfBlock> &blocks) {
+		blocks.clear();
+		while (offset < size && (maxBlocks == 0 || blocks.size() < maxBlocks)) {
+			BgzfBlock block;
+			if (!ReadBgzfBlock(data, size, offset, block)) return false;
+			blocks.push_back(block);
+			offset += block.size;
+		}
+		return true;
+	}
+
+	// Inflates a BGZF block into output, which has room for its length
+	// Throws std::runtime_error naming source if the block is corrupt
+	void InflateBlock(const char *data, const BgzfBlock &block, char *output,
+					  const std::string &source) {
+		char empty;
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		if (inflateInit2(&stream, RAW_DEFLATE_WINDOW) != Z_OK)
+			throw std::runtime_error("Cannot decompress: " + source);
+		stream.next_in = (Bytef *)(data + block.dataOffset);
+		stream.avail_in = block.dataSize;
+		stream.next_out = (Bytef *)((block.length > 0) ? output : &empty);
+		stream.avail_out = block.length;
+		int status = inflate(&stream, Z_FINISH);
+		size_t inflated = stream.total_out;
+		inflateEnd(&stream);
+		if (status != Z_STREAM_END || inflated != block.length ||
+			crc32(0, (const Bytef *)output, block.length) != block.crc) {
+			Malformed(source);
+		}
+	}
+
+	// Inflates BGZF blocks into output, one after another, across up to
+	// threads threads
+	void InflateBlocks(const char *data, const std::vector<BgzfBlock> &blocks,
+					   std::vector<char> &output, const std::string &source,
+					   unsigned int threads) {
+		std::vector<size_t> offsets(blocks.size() + 1, 0);
+		for (size_t i = 0; i < blocks.size(); i++)
+			offsets[i + 1] = offsets[i] + blocks[i].length;
+		output.resize(offsets.back());
+		ParallelFor(blocks.size(), threads, [&](size_t i) {
+			InflateBlock(data, blocks[i], &output[0] + offsets[i], source);
+		});
+	}
+
+	// Inflates the gzip members of data from position on into output, up to
+	// outputSize bytes, starting the inflater afresh for each member.
+	// memberEnded tracks whether the last member was whole
+	// Returns the number of bytes inflated, 0 once the data is done
+	// Throws std::runtime_error naming source if the data is corrupt or
+	// truncated
+	size_t InflateMembers(z_stream &stream, const char *data, size_t size,
+						  size_t &position, char *output, size_t outputSize,
+						  bool &memberEnded, const std::string &source) {
+		size_t inflated = 0;
+		while (inflated < outputSize && position < size) {
+			stream.next_in = (Bytef *)(data + position);
+			stream.avail_in = std::min(size - position, MAX_INFLATE_BYTES);
+			stream.next_out = (Bytef *)(output + inflated);
+			stream.avail_out = std::min(outputSize - inflated,
+										MAX_INFLATE_BYTES);
+			size_t availableIn = stream.avail_in;
+			size_t availableOut = stream.avail_out;
+			int status = inflate(&stream, Z_NO_FLUSH);
+			position += availableIn - stream.avail_in;
+			inflated += availableOut - stream.avail_out;
+			if (status == Z_STREAM_END) {
+				// Another member may follow. Anything else (e.g. padding) is
+				// ignored, as gzip does
+				memberEnded = true;
+				if (IsGzip(data + position, size - position)) {
+					inflateReset(&stream);
+					memberEnded = false;
+				} else {
+					position = size;
+				}
+			} else if (status == Z_OK) {
+				memberEnded = false;
+			} else if (status != Z_BUF_ERROR ||
+					   (stream.avail_in > 0 && stream.avail_out > 0)) {
+				Malformed(source);
+			}
+		}
+		if (position >= size && !memberEnded) Malformed(source);
+		return inflated;
+	}
+
+	// Returns the value of an octal field of a tar header
+	uint64_t ParseOctal(const char *field, size_t size) {
+		uint64_t value = 0;
+		for (size_t i = 0; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+			value = value * 8 + (field[i] - '0');
+		return value;
+	}
+
+	// Returns a null padded field of a tar header as a string
+	std::string TarField(const char *field, size_t size) {
+		return std::string(field, std::find(field, field + size, '\0'));
+	}
+}
+
+// ==== CLASSES ================================================================
+
+// InputFile - The contents of an input file, decompressed if gzipped
+InputFile::InputFile() : data(NULL), size(0) {}
+
+InputFile::InputFile(const std::string &fileName, const std::string &member,
+					 unsigned int threads)
+	: data(NULL), size(0)
+{
+	Open(fileName, member, threads);
+}
+
+// Maps the file, decompressing it into memory if it is gzipped, and narrows
+// it down to the member if it is a tar archive
+// Throws std::runtime_error if the file cannot be read or is corrupt, or if
+// it is an archive without the member
+void InputFile::Open(const std::string &fileName, const std::string &member,
+					 unsigned int threads) {
+	Close();
+	file.Open(fileName);
+	data = file.Data();
+	size = file.Size();
+	if (IsGzip(data, size)) {
+		Gunzip(data, size, fileName, buffer, threads);
+		file.Close();
+		data = buffer.empty() ? NULL : &buffer[0];
+		size = buffer.size();
+	}
+	if (!member.empty() && IsTar(data, size)) {
+		const char *memberData;
+		size_t memberSize;
+		if (!FindTarMember(data, size, member, memberData, memberSize)) {
+			Close();
+			throw std::runtime_error("No " + member + " in: " + fileName);
+		}
+		data = memberData;
+		size = memberSize;
+		// Only the member is kept of a decompressed archive
+		if (!buffer.empty()) {
+			std::vector<char>(data, data + size).swap(buffer);
+			data = buffer.empty() ? NULL : &buffer[0];
+		}
+	}
+}
+
+void InputFile::Close() {
+	file.Close();
+	std::vector<char>().swap(buffer);
+	data = NULL;
+	size = 0;
+}
+
+const char *InputFile::Data() const {
+	return data;
+}
+
+size_t InputFile::Size() const {
+	return size;
+}
+
+// InputStream - Reads files one after another, decompressing those gzipped
+InputStream::InputStream(const std::vector<std::string> &fileNames,
+						 unsigned int threads)
+	: fileNames(fileNames), nextFile(0), threads(threads), position(0)
+	, gzipped(false), bgzf(false), memberEnded(false), inflater(NULL)
+	, bufferPosition(0)
+{
+	NextFile();
+}
+
+InputStream::~InputStream() {
+	if (inflater != NULL) {
+		inflateEnd(inflater);
+		delete inflater;
+	}
+}
+
+// Reads up to size bytes into output
+// Returns the number of bytes read, 0 once every file has been read
+// Throws std::runtime_error if a file cannot be read or is corrupt
+size_t InputStream::Read(char *output, size_t size) {
+	while (bufferPosition == buffer.size()) {
+		if (!Refill() && !NextFile()) return 0;
+	}
+	size_t count = std::min(size, buffer.size() - bufferPosition);
+	memcpy(output, &buffer[bufferPosition], count);
+	bufferPosition += count;
+	return count;
+}
+
+// Opens the next file, returning false if there are none left
+bool InputStream::NextFile() {
+	if (inflater != NULL) {
+		inflateEnd(inflater);
+		delete inflater;
+		inflater = NULL;
+	}
+	file.Close();
+	buffer.clear();
+	bufferPosition = 0;
+	position = 0;
+	if (nextFile >= fileNames.size()) return false;
+	file.Open(fileNames[nextFile++]);
+	BgzfBlock block;
+	gzipped = IsGzip(file.Data(), file.Size());
+	bgzf = gzipped && ReadBgzfBlock(file.Data(), file.Size(), 0, block);
+	memberEnded = false;
+	if (gzipped && !bgzf) {
+		inflater = new z_stream;
+		memset(inflater, 0, sizeof(*inflater));
+		if (inflateInit2(inflater, GZIP_WINDOW) != Z_OK) {
+			delete inflater;
+			inflater = NULL;
+			throw std::runtime_error("Cannot decompress: " +
+									 fileNames[nextFile - 1]);
+		}
+	}
+	return true;
+}
+
+// Decompresses more of the current file into the buffer
+// Returns false once the file is done
+bool InputStream::Refill() {
+	buffer.clear();
+	bufferPosition = 0;
+	if (nextFile == 0 || position >= file.Size()) return false;
+	const std::string &source = fileNames[nextFile - 1];
+	const char *data = file.Data();
+	size_t size = file.Size();
+
+	if (!gzipped) {
+		size_t count = std::min(size - position, STREAM_CHUNK_SIZE);
+		buffer.assign(data + position, data + position + count);
+		position += count;
+	} else if (bgzf) {
+		std::vector<BgzfBlock> blocks;
+		if (!FindBgzfBlocks(data, size, position, STREAM_BGZF_BLOCKS, blocks))
+			Malformed(source);
+		InflateBlocks(data, blocks, buffer, source, threads);
+		position = blocks.back().offset + blocks.back().size;
+	} else {
+		buffer.resize(STREAM_CHUNK_SIZE);
+		buffer.resize(InflateMembers(*inflater, data, size, position,
+									 &buffer[0], buffer.size(), memberEnded,
+									 source));
+	}
+	return true;
+}
+
+// ==== FUNCTIONS ==============================================================
+
+// Returns whether data starts like a gzip file
+bool IsGzip(const char *data, size_t size) {
+	return size >= GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE &&
+		   (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+}
+
+// Returns whether data starts like a tar archive
+bool IsTar(const char *data, size_t size) {
+	return size >= TAR_BLOCK_SIZE && memcmp(data + 257, "ustar", 5) == 0;
+}
+
+// Returns whether a file is gzipped
+// Throws std::runtime_error if it cannot be read
+bool IsGzipFile(const std::string &fileName) {
+	std::ifstream ifs(fileName.c_str(), std::ios::in | std::ios::binary);
+	if (ifs.fail())
+		throw std::runtime_error("Cannot read: " + fileName);
+	char header[GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE];
+	ifs.read(header, sizeof(header));
+	return IsGzip(header, ifs.gcount());
+}
+
+// Decompresses a gzip file's data (every member of it) into output
+// Throws std::runtime_error naming source if the data is corrupt
+void Gunzip(const char *data, size_t size, const std::string &source,
+			std::vector<char> &output, unsigned int threads) {
+	output.clear();
+	std::vector<BgzfBlock> blocks;
+	BgzfBlock block;
+	if (ReadBgzfBlock(data, size, 0, block) &&
+		FindBgzfBlocks(data, size, 0, 0, blocks)) {
+		InflateBlocks(data, blocks, output, source, threads);
+		return;
+	}
+
+	// Otherwise members can only be found by inflating them in turn
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, GZIP_WINDOW) != Z_OK)
+		throw std::runtime_error("Cannot decompress: " + source);
+	size_t position = 0, inflated = 0;
+	bool memberEnded = false;
+	try {
+		// Grown as needed, rather than guessed at so much that most goes unused
+		output.resize(std::max(size, STREAM_CHUNK_SIZE));
+		while (position < size) {
+			if (inflated == output.size()) output.resize(2 * output.size());
+			inflated += InflateMembers(stream, data, size, position,
+									   &output[inflated],
+									   output.size() - inflated, memberEnded,
+									   source);
+		}
+	} catch (...) {
+		inflateEnd(&stream);
+		throw;
+	}
+	inflateEnd(&stream);
+	output.resize(inflated);
+}
+
+// Finds a member of a tar archive by its file name (in any directory)
+// Returns false if there is no such member
+bool FindTarMember(const char *data, size_t size, const std::string &member,
+				   const char *&memberData, size_t &memberSize) {
+	std::string longName;
+	size_t offset = 0;
+	while (offset + TAR_BLOCK_SIZE <= size && data[offset] != '\0') {
+		const char *header = data + offset;
+		uint64_t entrySize = ParseOctal(header + 124, 12);
+		size_t contents = offset + TAR_BLOCK_SIZE;
+		if (entrySize > size - contents) return false; // Truncated
+		char type = header[156];
+
+		// GNU tar gives long names as an entry of their own
+		std::string name = longName;
+		longName.clear();
+		if (name.empty()) {
+			name = TarField(header, 100);
+			std::string prefix = TarField(header + 345, 155);
+			if (!prefix.empty() && memcmp(header + 257, "ustar\0", 6) == 0)
+				name = prefix + "/" + name;
+		}
+		if (type == 'L') {
+			longName = TarField(data + contents, entrySize);
+		} else if (type == '0' || type == '\0') {
+			size_t slash = name.rfind('/');
+			if (name.substr((slash == std::string::npos) ? 0 : slash + 1) ==
+				member) {
+				memberData = data + contents;
+				memberSize = entrySize;
+				return true;
+			}
+		}
+		offset = contents + (entrySize + TAR_BLOCK_SIZE - 1) /
+				 TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+	}
+	return false;
+}
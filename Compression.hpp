@@ -0,0 +1,109 @@
+// Compression.hpp - Reads inputs that may be gzip compressed (NCBI's dumps,
+// references and GI lists usually are) or tar archives (taxdump.tar.gz),
+// either whole into memory or as a stream, without decompressing them to
+// disk first. The blocks of BGZF files (gzip files made of independent
+// members that record their own sizes) are inflated in parallel.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <string>
+#include <vector>
+#include "HelperFunctions.hpp"
+
+struct z_stream_s;
+
+// ==== CLASSES ================================================================
+
+// The contents of an input file: mapped as it is, or decompressed into memory
+// if it is gzipped. If it is a tar archive and a member is asked for, just
+// the contents of that member (found by its file name, in any directory)
+class InputFile {
+public:
+	// Default constructor, needs later setup with a file
+	InputFile();
+	// Throws std::runtime_error if the file cannot be read or is corrupt, or
+	// if it is an archive without the member
+	InputFile(const std::string &fileName, const std::string &member = "",
+			  unsigned int threads = 0);
+	void Open(const std::string &fileName, const std::string &member = "",
+			  unsigned int threads = 0);
+	void Close();
+	const char *Data() const;
+	size_t Size() const;
+private:
+	// Non-copyable, as the contents are owned
+	InputFile(const InputFile &);
+	InputFile &operator=(const InputFile &);
+
+	MappedFile file;
+	std::vector<char> buffer;		// The decompressed contents, if gzipped
+	const char *data;
+	size_t size;
+};
+
+// Reads files one after another as a single stream, decompressing those that
+// are gzipped as it goes (several BGZF blocks at once, across up to threads
+// threads), e.g. to feed them to a program's standard input
+class InputStream {
+public:
+	// Throws std::runtime_error if the first file cannot be read
+	InputStream(const std::vector<std::string> &fileNames,
+				unsigned int threads = 0);
+	~InputStream();
+	// Reads up to size bytes into output
+	// Returns the number of bytes read, 0 once every file has been read
+	// Throws std::runtime_error if a file cannot be read or is corrupt
+	size_t Read(char *output, size_t size);
+private:
+	// Non-copyable, as the inflater is owned
+	InputStream(const InputStream &);
+	InputStream &operator=(const InputStream &);
+
+	// Opens the next file, returning false if there are none left
+	bool NextFile();
+	// Decompresses more of the current file into the buffer
+	// Returns false once the file is done
+	bool Refill();
+
+	std::vector<std::string> fileNames;
+	size_t nextFile;
+	unsigned int threads;
+	MappedFile file;
+	size_t position;				// Of the next unread byte of file
+	bool gzipped;
+	bool bgzf;
+	bool memberEnded;				// Whether the last gzip member was whole
+	z_stream_s *inflater;			// Inflating a gzipped file that isn't BGZF
+	std::vector<char> buffer;		// Decompressed, not yet read
+	size_t bufferPosition;
+};
+
+// ==== FUNCTIONS ==============================================================
+
+// Returns whether data starts like a gzip file
+bool IsGzip(const char *data, size_t size);
+
+// Returns whether data starts like a tar archive
+bool IsTar(const char *data, size_t size);
+
+// Returns whether a file is gzipped
+// Throws std::runtime_error if it cannot be read
+bool IsGzipFile(const std::string &fileName);
+
+// Decompresses a gzip file's data (every member of it) into output, inflating
+// BGZF blocks across up to threads threads (one per core if 0)
+// Throws std::runtime_error naming source if the data is corrupt
+void Gunzip(const char *data, size_t size, const std::string &source,
+			std::vector<char> &output, unsigned int threads = 0);
+
+// Finds a member of a tar archive by its file name (in any directory)
+// Returns false if there is no such member
+bool FindTarMember(const char *data, size_t size, const std::string &member,
+				   const char *&memberData, size_t &memberSize);
+
+#endif // COMPRESSION_HPP
@@ -6,85 +6,1824 @@
 // Revised On: So many times for bug fixes
 //			   Aug 11, 2017		Fixed flow of calling NCBI programs
 
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <unistd.h>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/program_options.hpp>
+#include "AccessionIndex.hpp"
+#include "BlastAlias.hpp"
+#include "BuildManifest.hpp"
+#include "Compression.hpp"
+#include "Fasta.hpp"
+#include "GiList.hpp"
 #include "HelperFunctions.hpp"
+#include "RunStatistics.hpp"
+#include "SeqIdList.hpp"
+#include "Subprocess.hpp"
 #include "Taxonomy.hpp"
+#include "TaxonomyNames.hpp"
+#include "TaxonomyServer.hpp"
 
 #define BLAST_DB_PATH "/media/Storage2/BlastDB"
 #define DEFAULT_LINE_LENGTH 80
 #define MIN_DESCRIPTION_LENGTH (DEFAULT_LINE_LENGTH/2)
 
+namespace po = boost::program_options;
+
 namespace {
 	const int SUCCESS                   = 0;
 	const int ERROR_IN_COMMAND_LINE     = 1;
 	const int ERROR_UNHANDLED_EXCEPTION = 2;
-}
+	const int ERROR_INVALID_INPUT       = 3;
+	const int ERROR_TOOL_FAILED         = 4;
 
-namespace po = boost::program_options;
+	// A stage of the build, recorded in the build manifest once its command
+	// has succeeded
+	struct BuildStage {
+		std::string name;
+		std::string fingerprint;
+		std::string output;
+		std::string command;		// As given by CommandLine
+	};
 
-int main(int argc, char *argv[]) {
+	// Strips the double quotes put around a name by ToCmdLineStr
+	std::string Unquote(const std::string &name) {
+		if (name.size() >= 2 && name[0] == '"' && name[name.size() - 1] == '"')
+			return name.substr(1, name.size() - 2);
+		return name;
+	}
 
-	try {
-		std::string appName = boost::filesystem::basename(argv[0]);
+	// Returns whether a BLAST database (or an alias of some) exists
+	bool DatabaseExists(const std::string &name, const std::string &dbtype) {
+		std::string prefix = (dbtype == "nucl") ? ".n" : ".p";
+		return FileExists(name + prefix + "al") ||
+			   FileExists(name + prefix + "in");
+	}
+
+	// Returns the number of a shard (of count) as it ends shard names: two
+	// digits, or as many as the last shard needs
+	std::string ShardNumber(size_t shard, size_t count) {
+		std::string number = boost::lexical_cast<std::string>(shard);
+		size_t digits = std::max((size_t)2,
+			boost::lexical_cast<std::string>(count - 1).size());
+		return std::string(digits - std::min(digits, number.size()), '0') +
+			   number;
+	}
+
+	// Returns the names of the reference volumes of name's shards, given
+	// their number as recorded in a build manifest (none if it isn't one)
+	std::vector<std::string> ShardVolumes(const std::string &name,
+										  const std::string &recorded) {
+		std::vector<std::string> volumes;
+		size_t count = 0;
+		try {
+			count = boost::lexical_cast<size_t>(recorded);
+		} catch (const boost::bad_lexical_cast &) {
+			return volumes;
+		}
+		for (size_t shard = 0; shard < count; shard++)
+			volumes.push_back(name + "_shard" + ShardNumber(shard, count));
+		return volumes;
+	}
+
+	// Number of taxonomy IDs OR'ed into each esearch query
+	const size_t ESEARCH_BATCH_SIZE = 250;
+
+	// Appends the GIs of the records linked to any of the given taxonomy IDs
+	// to gis, streaming them from esearch | efetch. With expand, NCBI expands
+	// each taxonomy ID to its whole subtree; otherwise only records directly
+	// linked to them are found (as when subtrees were expanded locally)
+	// Returns whether every query succeeded (saying why not to err)
+	// Throws std::runtime_error if efetch returns something other than GIs
+	bool FetchGIs(const std::vector<int> &taxIDs, bool expand,
+				  std::vector<uint64_t> &gis, int verbosity,
+				  RunStatistics &runStatistics, std::ostream &out,
+				  std::ostream &err) {
+		bool succeeded = true;
+		for (size_t first = 0; first < taxIDs.size();
+			 first += ESEARCH_BATCH_SIZE) {
+			size_t last = std::min(first + ESEARCH_BATCH_SIZE, taxIDs.size());
+			std::string query;
+			for (size_t i = first; i < last; i++) {
+				query += ((i == first) ? "txid" : " OR txid") +
+						 boost::lexical_cast<std::string>(taxIDs[i]) +
+						 (expand ? "[Organism:exp]" : "[Organism:noexp]");
+			}
+			std::vector<Command> pipeline(2);
+			pipeline[0].push_back("esearch");
+			pipeline[0].push_back("-db");
+			pipeline[0].push_back("nuccore");
+			pipeline[0].push_back("-query");
+			pipeline[0].push_back(query);
+			pipeline[1].push_back("efetch");
+			pipeline[1].push_back("-format");
+			pipeline[1].push_back("uid");
+			if (verbosity > 1)
+				out << "Executing: " << CommandLine(pipeline[0]) << " | "
+					<< CommandLine(pipeline[1]) << std::endl;
+
+			// Parse whole lines as they arrive, keeping any partial line
+			// until the rest of it does
+			std::string pending;
+			uint64_t line = 1;
+			std::vector<ProcessUsage> usage;
+			bool fetched = RunPipeline(pipeline,
+				[&](const char *data, size_t size) {
+					pending.append(data, size);
+					size_t end = pending.rfind('\n');
+					if (end == std::string::npos) return;
+					line += ParseIntegers(pending.data(), end + 1,
+										  "efetch output", gis, 1, line);
+					pending.erase(0, end + 1);
+				}, usage);
+			ParseIntegers(pending.data(), pending.size(), "efetch output",
+						  gis, 1, line);
+			runStatistics.AddProcesses(usage);
+			for (size_t i = 0; i < usage.size(); i++) {
+				if (!fetched && usage[i].status != 0)
+					err << "Failed: " << usage[i].command << " ("
+						<< DescribeStatus(usage[i].status) << ")" << std::endl
+						<< usage[i].output << std::flush;
+				else if (fetched && verbosity > 0)
+					out << usage[i].output << std::flush;
+			}
+			if (!fetched) succeeded = false;
+		}
+		return succeeded;
+	}
+
+	// Says which tools failed, with what they said unless it was logged
+	void ReportFailures(const std::vector<ProcessUsage> &failed,
+						int verbosity, std::ostream &err) {
+		for (size_t i = 0; i < failed.size(); i++) {
+			err << "Failed: " << failed[i].command << " ("
+				<< DescribeStatus(failed[i].status) << ")" << std::endl;
+			if (verbosity == 0) err << failed[i].output << std::flush;
+		}
+	}
+
+	// Writes the run report if one was asked for, warning if it cannot be
+	void SaveStatistics(RunStatistics &runStatistics,
+						const std::string &statsFile, std::ostream &err) {
+		runStatistics.EndStage();
+		if (statsFile.empty()) return;
+		try {
+			runStatistics.Save(statsFile);
+		} catch (const std::exception &e) {
+			err << "Warning: " << e.what() << std::endl;
+		}
+	}
+
+	// Writes an alias for each shard (output.NN) over its reference volume
+	// and its share of the other databases, then one over every shard
+	// (output). The other databases are dealt out largest first, each to the
+	// shard with the fewest letters so far; those of unknown size (GI
+	// restricted views) count for nothing and so go round the shards. Without
+	// reference volumes, the databases are dealt into the shards asked for
+	// Throws std::runtime_error if a database cannot be found or an alias
+	// cannot be written
+	void WriteShardAliases(const std::string &output,
+						   const std::vector<std::string> &volumes,
+						   const std::vector<std::string> &dbs, size_t shards,
+						   bool protein, int verbosity, std::ostream &out) {
+		size_t count = volumes.size();
+		if (count == 0)
+			count = std::max(std::min(shards, dbs.size()), (size_t)1);
+		std::vector< std::vector<std::string> > lists(count);
+		std::vector<uint64_t> letters(count, 0);
+		for (size_t shard = 0; shard < volumes.size(); shard++) {
+			lists[shard].push_back(volumes[shard]);
+			letters[shard] = ReadDatabaseSize(volumes[shard], protein).letters;
+		}
+		std::vector< std::pair<uint64_t, size_t> > sizes;
+		for (size_t i = 0; i < dbs.size(); i++) {
+			DatabaseSize size = ReadDatabaseSize(dbs[i], protein);
+			sizes.push_back(std::make_pair(size.known ? size.letters : 0, i));
+		}
+		std::sort(sizes.begin(), sizes.end(),
+			[](const std::pair<uint64_t, size_t> &a,
+			   const std::pair<uint64_t, size_t> &b) {
+				return (a.first != b.first) ? a.first > b.first :
+											  a.second < b.second;
+			});
+		for (size_t i = 0; i < sizes.size(); i++) {
+			size_t lightest = 0;
+			for (size_t shard = 1; shard < count; shard++) {
+				if (letters[shard] < letters[lightest] ||
+					(letters[shard] == letters[lightest] &&
+					 lists[shard].size() < lists[lightest].size()))
+					lightest = shard;
+			}
+			lists[lightest].push_back(dbs[sizes[i].second]);
+			letters[lightest] += sizes[i].first;
+		}
+
+		std::string extension = protein ? ".pal" : ".nal";
+		std::vector<std::string> aliases;
+		for (size_t shard = 0; shard < count; shard++) {
+			if (lists[shard].empty()) continue;
+			std::string alias = output + "." + ShardNumber(shard, count);
+			if (verbosity > 1)
+				out << "Writing alias: " << alias << extension << std::endl;
+			WriteAlias(alias, alias, lists[shard], "", protein);
+			aliases.push_back(alias);
+		}
+		if (verbosity > 1)
+			out << "Writing alias: " << output << extension << std::endl;
+		WriteAlias(output, output, aliases, "", protein);
+	}
+
+	// Settings shared by every database built in a run
+	struct RunOptions {
+		std::vector<std::string> accession2taxid;
+		std::string nodesFile;
+		std::string namesFile;
+		std::string namesCacheFile;
+		std::string taxCacheFile;
+		std::string accIndexFile;
+		std::string manifestFile;
+		std::string serveSocket;
+		std::string taxServerSocket;
+		std::string nameSearch;
+		unsigned int threads;
+		unsigned int jobs;
+		bool buildTaxCache;
+		bool verifyCaches;
+	};
+
+	// Everything describing one database to build
+	struct JobOptions {
 		int verbosity;
+		unsigned int jobs;			// Tools run at once
+		size_t giMemory;
+		size_t shards;				// Reference volumes, 0 if not sharded
+		uint64_t maxShardLetters;	// Most residues per shard, 0 if no limit
 		std::vector<std::string> dbs;
 		std::vector<std::string> refs;
 		std::vector<std::string> gis;
+		std::vector<std::string> intersectGis;	// GIs kept only if in each
+		std::vector<std::string> excludeGis;	// GIs left out
+		std::vector<std::string> accessions;
+		std::vector<std::string> excludeAccessions;
 		std::vector<std::string> taxa;
 		std::string blastPath;
 		std::string dbtype;
-		std::string nodesFile;
+		std::string buildManifestFile;
+		std::string childRank;
+		std::string lcaRank;
 		std::string output;
+		std::string statsFile;
+		std::string groups;			// "", "db" or "gilist"
+		std::string prefix;			// Prepended to intermediate databases
+		std::vector<uint64_t> taxaGIs;	// Already found for the taxa
 		bool getChildrenGIs;
+		bool skipHidden;
+		bool validate;
+		bool dedup;
+		bool rebuild;
+	};
 
-		// Set up possible options
-		po::options_description desc("Options", DEFAULT_LINE_LENGTH,
-									 MIN_DESCRIPTION_LENGTH);
+	// Returns an option value stored in store, defaulting to defaultValue
+	// only if defaults are wanted
+	template <typename T>
+	po::typed_value<T> *Value(T *store, const T &defaultValue, bool defaults) {
+		po::typed_value<T> *value = po::value<T>(store);
+		if (defaults) value->default_value(defaultValue);
+		return value;
+	}
+
+	// Adds the options describing a database to desc, stored in job. Without
+	// defaults, options that aren't given leave job as it was, so that the
+	// jobs of a batch manifest inherit those of the command line
+	void AddJobOptions(po::options_description &desc, JobOptions &job,
+					   bool defaults) {
 		desc.add_options()
-			("help,h", "Display help")
-			("blastPath,b", po::value<std::string>(&blastPath)
-				->value_name("PATH")->default_value(BLAST_DB_PATH),
+			("accession,a", po::value< std::vector<std::string> >(
+				&job.accessions)->value_name("FILE")->multitoken()
+				->composing(),
+				"Create database using seqid lists: text files of "
+				"whitespace delimited accession.versions, or binary lists "
+				"(.bsl), selecting records that have no GI (allows "
+				"multiple)")
+			("blastPath,b", Value<std::string>(&job.blastPath,
+				BLAST_DB_PATH, defaults)->value_name("PATH"),
 				"Path to BLAST databases")
-			("children,c", po::value<bool>(&getChildrenGIs)
-				->zero_tokens()->default_value(false)->implicit_value(true),
+			("buildManifest", po::value<std::string>(&job.buildManifestFile)
+				->value_name("FILE"),
+				"Record of what went into the databases built by earlier "
+				"runs; stages whose inputs are unchanged are skipped "
+				"(default: output prefix + \".build\")")
+			("children,c", Value<bool>(&job.getChildrenGIs, false, defaults)
+				->zero_tokens()->implicit_value(true),
 				"To be used when including taxonomy IDs, "
 				"When last common ancestor is found, retrieve all GIs from all"
 				"children when creating the database")
-			("db,d", po::value< std::vector<std::string> >(&dbs)
+			("childRank", po::value<std::string>(&job.childRank)
+				->value_name("STR"),
+				"To be used with --children, only retrieve GIs from children "
+				"of this rank (e.g. \"species\")")
+			("db,d", po::value< std::vector<std::string> >(&job.dbs)
 				->value_name("FILE")->multitoken()->composing(),
 				"Create database based off of pre-existing databases")
-			("dbtype,D", po::value<std::string>(&dbtype)
-				->value_name("STR")->default_value("nucl"), 
+			("dbtype,D", Value<std::string>(&job.dbtype, "nucl", defaults)
+				->value_name("STR"),
 				"Type of database: \"nucl\" or \"prot\"")
-			("gi,g", po::value< std::vector<std::string> >(&gis)
+			("dedup", Value<bool>(&job.dedup, false, defaults)
+				->zero_tokens()->implicit_value(true),
+				"Remove duplicate sequences across the reference FASTAs, "
+				"keeping one record with the deflines of all its copies "
+				"(the references must not be gzipped)")
+			("excludeAccession", po::value< std::vector<std::string> >(
+				&job.excludeAccessions)->value_name("FILE")->multitoken()
+				->composing(),
+				"Leave the accession.versions of these seqid lists out of "
+				"the seqid list; as with --excludeGi, their union is written "
+				"to output + \".negative.bsl\" for BLAST's "
+				"-negative_seqidlist if needed")
+			("excludeGi", po::value< std::vector<std::string> >(
+				&job.excludeGis)->value_name("FILE")->multitoken()
+				->composing(),
+				"Leave the GIs of these lists (text or binary) out of the GI "
+				"list; if the database also holds unrestricted databases "
+				"(--db, --reference), their union is written to output + "
+				"\".negative.gil\" for BLAST's -negative_gilist")
+			("gi,g", po::value< std::vector<std::string> >(&job.gis)
 				->value_name("FILE")->multitoken()->composing(),
 				"Create database using text file containing "
 				"newline delimited GI numbers (allows multiple GI.txt)")
-			("nodesFile,n", po::value<std::string>(&nodesFile)
-				->value_name("FILE")->default_value("nodes.dmp"),
+			("groups", po::value<std::string>(&job.groups)
+				->value_name("STR"),
 				"To be used when including taxonomy IDs, "
-				"NCBI Taxonomy nodes file for finding last common ancestor, "
-				"download: ftp://ftp.ncbi.nih.gov/pub/taxonomy/taxdump.tar.gz")
-			("output,o", po::value<std::string>(&output)
-				->value_name("STR")->default_value("out"), "Output prefix")
-			("reference,r", po::value< std::vector<std::string> >(&refs)
+				"resolve each taxa file, or each block of one headed by a "
+				"\">label\" line, to its own LCA (listed in output + "
+				"\".lca\"): \"db\" builds a database per group "
+				"(output.label), \"gilist\" only writes each group's GI "
+				"list (output.label.gil)")
+			("giMemory", Value<size_t>(&job.giMemory,
+				DEFAULT_GI_MEMORY_BUDGET >> 20, defaults)->value_name("MB"),
+				"Memory used when merging the GI lists; larger lists are "
+				"sorted in runs spilled to temporary files")
+			("intersectGi", po::value< std::vector<std::string> >(
+				&job.intersectGis)->value_name("FILE")->multitoken()
+				->composing(),
+				"Keep only the GIs (of --gi and --taxa) that are also in "
+				"every one of these lists (text or binary)")
+			("lcaRank", po::value<std::string>(&job.lcaRank)
+				->value_name("STR"),
+				"To be used when including taxonomy IDs, round the LCA up to "
+				"its nearest ancestor of this rank (e.g. \"genus\") to build "
+				"the database from the whole taxon")
+			("maxShardLetters", Value<uint64_t>(&job.maxShardLetters, 0,
+				defaults)->value_name("INT"),
+				"Split the references into as many shards as needed (see "
+				"--shards) for each to hold about this many residues at most")
+			("output,o", Value<std::string>(&job.output, "out", defaults)
+				->value_name("STR"), "Output prefix")
+			("reference,r", po::value< std::vector<std::string> >(&job.refs)
 				->value_name("FILE")->multitoken()->composing(),
 				"Create database using FASTA records (allows multiple FASTA)")
-			("taxa,t", po::value< std::vector<std::string> >(&taxa)
+			("rebuild", Value<bool>(&job.rebuild, false, defaults)
+				->zero_tokens()->implicit_value(true),
+				"Rebuild every database, even if its inputs are unchanged")
+			("shards", Value<size_t>(&job.shards, 0, defaults)
+				->value_name("INT"),
+				"Split the references into this many database volumes of "
+				"about equal residue counts, built in parallel (see --jobs), "
+				"with an alias for each shard (output.NN, also taking its "
+				"share of the other databases) and one over them all (the "
+				"references must not be gzipped)")
+			("skipHidden", Value<bool>(&job.skipHidden, false, defaults)
+				->zero_tokens()->implicit_value(true),
+				"To be used with --children, skip children hidden in GenBank "
+				"lineages")
+			("stats", po::value<std::string>(&job.statsFile)
+				->value_name("FILE"),
+				"Write a JSON report of the time, CPU and memory used by each "
+				"stage and each external tool, with input sizes and "
+				"throughput")
+			("taxa,t", po::value< std::vector<std::string> >(&job.taxa)
 				->value_name("FILE")->multitoken()->composing(),
 				"Create database using text file containing "
 				"newline delimited taxonomy ids (allows multiple Taxa.txt)")
-			("verbosity,v", po::value<int>(&verbosity)
-				->value_name("INT")->default_value(0)->implicit_value(1),
+			("validate", Value<bool>(&job.validate, false, defaults)
+				->zero_tokens()->implicit_value(true),
+				"Check the reference FASTAs (alphabet of --dbtype, empty "
+				"records, duplicated IDs) before creating any database")
+			("verbosity,v", Value<int>(&job.verbosity, 0, defaults)
+				->value_name("INT")->implicit_value(1),
 				"Verbosity level")
+			;
+	}
+
+	// Checks the options of a database, filling in those left to default
+	// Returns SUCCESS, or ERROR_IN_COMMAND_LINE (having said why)
+	int CheckJob(JobOptions &job, const RunOptions &run, std::ostream &out,
+				 std::ostream &err) {
+		if (job.verbosity > 1)
+			out << "BLAST Path: " << job.blastPath << std::endl;
+		if (job.dbtype != "nucl" && job.dbtype != "prot") {
+			err << "Database type must be either \"nucl\" or \"prot\""
+				<< ": " << job.dbtype << std::endl;
+			return ERROR_IN_COMMAND_LINE;
+		}
+		if (job.verbosity > 1)
+			out << "DBType: " << job.dbtype << std::endl;
+		if (!job.dbs.empty()) {
+			// The db given is an incomplete file name, just the prefix is to
+			// be given
+			if (job.verbosity > 1)
+				out << "DBs: " << job.dbs << std::endl;
+		}
+		if (!job.gis.empty()) {
+			try {
+				FilesExist(job.gis);
+			} catch (std::exception &e) {
+				err << e.what() << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (job.verbosity > 1)
+				out << "GIs: " << job.gis << std::endl;
+		}
+		if (!job.intersectGis.empty() || !job.excludeGis.empty()) {
+			try {
+				FilesExist(job.intersectGis);
+				FilesExist(job.excludeGis);
+			} catch (std::exception &e) {
+				err << e.what() << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (!job.intersectGis.empty() && job.gis.empty() &&
+				job.taxa.empty()) {
+				err << "GI intersections need GIs (see --gi and --taxa)"
+					<< std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (job.verbosity > 1)
+				out << "Intersected GIs: " << job.intersectGis << std::endl
+					<< "Excluded GIs: " << job.excludeGis << std::endl;
+		}
+		if (!job.accessions.empty() || !job.excludeAccessions.empty()) {
+			try {
+				FilesExist(job.accessions);
+				FilesExist(job.excludeAccessions);
+			} catch (std::exception &e) {
+				err << e.what() << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (job.verbosity > 1)
+				out << "Accessions: " << job.accessions << std::endl
+					<< "Excluded accessions: " << job.excludeAccessions
+					<< std::endl;
+		}
+		if (!job.taxa.empty()) {
+			try {
+				FilesExist(job.taxa);
+			} catch (std::exception &e) {
+				err << e.what() << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (job.verbosity > 1)
+				out << "Taxa: " << job.taxa << std::endl;
+			// Nodes file only used when taxa option specified, and not even
+			// then if a taxonomy server answers instead
+			if (run.taxServerSocket.empty() && !FileExists(run.nodesFile)) {
+				err << "Given nodes file does not exist: "
+					<< run.nodesFile << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+		}
+		if (!job.groups.empty()) {
+			if (job.groups != "db" && job.groups != "gilist") {
+				err << "Groups must be either \"db\" or \"gilist\": "
+					<< job.groups << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (job.taxa.empty()) {
+				err << "Groups need taxa (see --taxa)" << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			if (job.verbosity > 1)
+				out << "Groups: " << job.groups << std::endl;
+		}
+		if (job.verbosity > 1)
+			out << "Output: " << job.output << std::endl;
+		if (job.buildManifestFile.empty())
+			job.buildManifestFile = job.output + ".build";
+		if (!job.refs.empty()) {
+			try {
+				FilesExist(job.refs);
+			} catch (std::exception &e) {
+				err << e.what() << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			// Deduplicated and sharded references are read back in place
+			// rather than inflated whole into memory
+			bool sharded = job.shards > 0 || job.maxShardLetters > 0;
+			for (size_t i = 0; i < job.refs.size() && (job.dedup || sharded);
+				 i++) {
+				if (IsGzipFile(job.refs[i])) {
+					err << "References must be decompressed to be "
+						<< (job.dedup ? "deduplicated" : "sharded") << ": "
+						<< job.refs[i] << std::endl;
+					return ERROR_IN_COMMAND_LINE;
+				}
+			}
+			if (job.verbosity > 1)
+				out << "References: " << job.refs << std::endl;
+		}
+		return SUCCESS;
+	}
+
+	// Loads the taxonomy from the nodes file, or from its binary cache if
+	// one is used
+	void LoadTaxonomy(LCA_Finder &taxonomy, const RunOptions &run,
+					  RunStatistics &runStatistics) {
+		if (run.taxCacheFile.empty()) {
+			taxonomy.LoadData(run.nodesFile.c_str());
+			runStatistics.AddInput("bytes", GetFileSize(run.nodesFile));
+		} else {
+			taxonomy = LCA_Finder(run.nodesFile, run.taxCacheFile,
+								  run.verifyCaches);
+			runStatistics.AddInput("bytes", GetFileSize(run.taxCacheFile));
+		}
+		runStatistics.AddInput("nodes", taxonomy.Size());
+	}
+
+	// Returns the union of the GIs of text or binary GI lists
+	// Throws std::runtime_error if a list cannot be read or is malformed
+	GiSet ReadGIs(const std::vector<std::string> &files, unsigned int threads,
+				  RunStatistics &runStatistics) {
+		GiSet gis(threads);
+		for (std::vector<std::string>::const_iterator it = files.begin();
+			 it != files.end();
+			 it++) {
+			gis.AddFile(*it);
+			runStatistics.AddInput("bytes", GetFileSize(*it));
+		}
+		return gis;
+	}
+
+	// Keeps the GIs of gis that are in every one of intersections, less
+	// those in exclusions
+	void FilterGIs(GiSet &gis, const std::vector<GiSet> &intersections,
+				   const GiSet &exclusions) {
+		for (std::vector<GiSet>::const_iterator it = intersections.begin();
+			 it != intersections.end();
+			 it++) {
+			gis.Intersect(*it);
+		}
+		gis.Subtract(exclusions);
+	}
+
+	// Returns the union of the accession.versions of seqid lists
+	// Throws std::runtime_error if a list cannot be read or is malformed
+	AccessionSet ReadAccessions(const std::vector<std::string> &files,
+								unsigned int threads,
+								RunStatistics &runStatistics) {
+		AccessionSet accessions(threads);
+		for (std::vector<std::string>::const_iterator it = files.begin();
+			 it != files.end();
+			 it++) {
+			accessions.AddFile(*it);
+			runStatistics.AddInput("bytes", GetFileSize(*it));
+		}
+		return accessions;
+	}
+
+	// Adds what the taxa of a job resolve to (the taxa, the taxonomy, the
+	// accession index and how the LCA is expanded) to the inputs and settings
+	// of a stage fingerprint
+	void AddTaxaFingerprint(const JobOptions &job, const RunOptions &run,
+							std::vector<std::string> &inputs,
+							std::vector<std::string> &settings) {
+		inputs.insert(inputs.end(), job.taxa.begin(), job.taxa.end());
+		inputs.push_back(run.nodesFile);
+		inputs.push_back(run.accIndexFile);
+		if (FileExists(run.namesFile))
+			inputs.push_back(run.namesFile);
+		settings.push_back(job.getChildrenGIs ? "children" : "");
+		settings.push_back(job.childRank);
+		settings.push_back(job.skipHidden ? "skipHidden" : "");
+		settings.push_back(job.lcaRank);
+	}
+
+	// Returns whether [data, data + size) holds anything but numbers and
+	// whitespace, i.e. taxa given by name
+	bool HasNames(const char *data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			char c = data[i];
+			if ((c < '0' || c > '9') && c != ' ' && c != '\t' && c != '\r' &&
+				c != '\n') {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Parses the taxa in [data, data + size) of source, whose first line is
+	// numbered firstLine, into taxIDs: whitespace delimited taxonomy IDs and
+	// names (e.g. "Escherichia coli"), one per line, in any mix. Names are
+	// looked up in the names index, loaded into names when first needed
+	// Returns the number of newlines
+	// Throws std::runtime_error naming source and the line of anything that
+	// is neither a taxonomy ID nor a known name, or if the names index
+	// cannot be loaded
+	uint64_t ParseTaxa(const char *data, size_t size, const std::string &source,
+					   uint64_t firstLine, const RunOptions &run,
+					   boost::shared_ptr<NameIndex> &names,
+					   std::vector<int> &taxIDs) {
+		std::vector<uint64_t> numbers;
+		uint64_t lines = 0;
+		if (!HasNames(data, size)) {
+			lines = ParseIntegers(data, size, source, numbers, run.threads,
+								  firstLine);
+		} else {
+			const char *cursor = data, *end = data + size;
+			while (cursor < end) {
+				const char *newline = static_cast<const char *>(
+					memchr(cursor, '\n', end - cursor));
+				const char *lineEnd = (newline == NULL) ? end : newline;
+				if (!HasNames(cursor, lineEnd - cursor)) {
+					ParseIntegers(cursor, lineEnd - cursor, source, numbers, 1,
+								  firstLine + lines);
+				} else {
+					if (!names) {
+						names.reset(new NameIndex(run.namesFile,
+												  run.namesCacheFile,
+												  run.verifyCaches));
+					}
+					std::string name(cursor, lineEnd);
+					int taxID = names->Find(name);
+					if (taxID < 0) {
+						boost::algorithm::trim(name);
+						throw std::runtime_error(std::string(
+							(taxID == NameIndex::AMBIGUOUS_NAME) ?
+							"Ambiguous taxon name (give its unique name, "
+							"e.g. \"Bacillus <bacteria>\") \"" :
+							"Unknown taxon name \"") + name + "\" in: " +
+							source + " (line " + boost::lexical_cast<
+							std::string>(firstLine + lines) + ")");
+					}
+					numbers.push_back(taxID);
+				}
+				if (newline != NULL) lines++;
+				cursor = lineEnd + 1;
+			}
+		}
+		for (size_t i = 0; i < numbers.size(); i++) {
+			if (numbers[i] > (uint64_t)std::numeric_limits<int>::max())
+				throw std::runtime_error("Number too large in: " + source);
+			taxIDs.push_back((int)numbers[i]);
+		}
+		return lines;
+	}
+
+	// Answers the taxonomy queries of a job from a running taxonomy server
+	// (if one is used), or else from the given taxonomy or one loaded for
+	// the job
+	class TaxonomySource {
+	public:
+		TaxonomySource(const LCA_Finder *taxonomy, const RunOptions &run,
+					   int verbosity, RunStatistics &runStatistics,
+					   std::ostream &out)
+			: taxonomy(taxonomy) {
+			if (taxonomy == NULL && !run.taxServerSocket.empty()) {
+				if (taxServer.Connect(run.taxServerSocket)) {
+					if (verbosity > 1)
+						out << "Taxonomy server: " << run.taxServerSocket
+							<< std::endl;
+				} else if (verbosity > 0) {
+					out << "No taxonomy server on: " << run.taxServerSocket
+						<< ", loading the taxonomy" << std::endl;
+				}
+			}
+			if (taxonomy == NULL && !taxServer.Connected()) {
+				runStatistics.BeginStage("load taxonomy");
+				LoadTaxonomy(ownTaxonomy, run, runStatistics);
+				this->taxonomy = &ownTaxonomy;
+			}
+		}
+		int GetLCA_ID(std::vector<int> &taxIDs) {
+			return taxServer.Connected() ? taxServer.GetLCA_ID(taxIDs) :
+				taxonomy->GetLCA_ID<std::vector, int>(taxIDs);
+		}
+		std::vector<int> GetDescendants(int taxID, const std::string &rank,
+										bool skipHidden) {
+			return taxServer.Connected() ?
+				taxServer.GetDescendants(taxID, rank, skipHidden) :
+				taxonomy->GetDescendants(taxID, rank, skipHidden);
+		}
+		int RollUpToRank(int taxID, const std::string &rank) {
+			return taxServer.Connected() ?
+				taxServer.RollUpToRank(taxID, rank) :
+				taxonomy->RollUpToRank(taxID, rank);
+		}
+		// Returns whether queries can be made from several threads at once
+		// (the taxonomy is only read, but a server connection is one stream)
+		bool Shared() const {
+			return !taxServer.Connected();
+		}
+	private:
+		const LCA_Finder *taxonomy;
+		LCA_Finder ownTaxonomy;
+		TaxonomyClient taxServer;
+	};
+
+	int RunGroups(const JobOptions &job, const RunOptions &run,
+				  const LCA_Finder *taxonomy, RunStatistics &runStatistics,
+				  std::ostream &out, std::ostream &err);
+
+	// Builds the database described by job (and the intermediate databases
+	// it aggregates), logging to out and err. Taxonomy IDs are resolved with
+	// the given taxonomy, which is only read so that jobs can share it, or
+	// with one loaded for the job if none is given. Jobs with groups build
+	// a database per group (see RunGroups)
+	// Returns the exit status of the job
+	int RunJob(const JobOptions &job, const RunOptions &run,
+			   const LCA_Finder *taxonomy, RunStatistics &runStatistics,
+			   std::ostream &out, std::ostream &err) {
+		if (!job.groups.empty())
+			return RunGroups(job, run, taxonomy, runStatistics, out, err);
+
+		// The job's options under their usual names. The database and GI
+		// lists grow as databases are built along the way
+		std::vector<std::string> dbs(job.dbs), gis(job.gis);
+		const std::vector<std::string> &refs = job.refs, &taxa = job.taxa;
+		const std::string &blastPath = job.blastPath, &dbtype = job.dbtype,
+			&buildManifestFile = job.buildManifestFile,
+			&childRank = job.childRank, &lcaRank = job.lcaRank,
+			&output = job.output;
+		const int verbosity = job.verbosity;
+		const unsigned int jobs = job.jobs;
+		const size_t giMemory = job.giMemory;
+		const bool getChildrenGIs = job.getChildrenGIs,
+			skipHidden = job.skipHidden, validate = job.validate,
+			dedup = job.dedup, rebuild = job.rebuild,
+			sharded = job.shards > 0 || job.maxShardLetters > 0;
+
+		// Check the references before anything expensive is started
+		if (validate && !refs.empty()) {
+			runStatistics.BeginStage("validate");
+			bool valid = true;
+			for (std::vector<std::string>::const_iterator it = refs.begin();
+				 it != refs.end();
+				 it++) {
+				FastaStatistics statistics = ValidateFasta(*it,
+					dbtype == "prot", run.threads);
+				runStatistics.AddInput("bytes", GetFileSize(*it));
+				runStatistics.AddInput("records", statistics.records);
+				if (verbosity > 0)
+					out << *it << ": " << statistics.records
+						<< " records, " << statistics.residues
+						<< " residues" << std::endl;
+				for (size_t i = 0; i < statistics.problems.size(); i++)
+					err << *it << ": " << statistics.problems[i]
+						<< std::endl;
+				if (!statistics.Valid()) {
+					err << *it << ": " << statistics.emptyRecords
+						<< " empty records, "
+						<< statistics.invalidResidues
+						<< " invalid residues, "
+						<< statistics.duplicateIDs
+						<< " duplicated IDs, " << statistics.strayLines
+						<< " stray lines" << std::endl;
+					valid = false;
+				}
+			}
+			if (!valid) return ERROR_INVALID_INPUT;
+		}
+
+		// Create database from refs. Databases are built in the background
+		// (up to --jobs at once) alongside the taxonomy stage and GI aliasing.
+		// Stages whose inputs are unchanged since the last build are skipped.
+		// Intermediate databases are named after the inputs (and, in batch mode,
+		// the output so that jobs don't collide)
+		JobScheduler scheduler(jobs, (verbosity > 0) ? &out : NULL);
+		BuildManifest manifest(buildManifestFile, run.threads);
+		std::vector<BuildStage> building;
+		BuildStage shardStage;					// Recorded if nothing fails
+		std::vector<std::string> shardVolumes;
+		if (!refs.empty()) {
+			runStatistics.BeginStage("references");
+			std::string refDBName = job.prefix + Unquote(ToCmdLineStr(
+				refs.begin(), refs.end(), "_", &RemoveExtension));
+
+			// With several jobs, each reference becomes its own database so
+			// they can be built concurrently (sharded references are built
+			// concurrently anyway)
+			std::vector< std::vector<std::string> > refGroups;
+			std::vector<std::string> refDBNames;
+			if (jobs > 1 && !dedup && !sharded) {
+				for (std::vector<std::string>::const_iterator it = refs.begin();
+					 it != refs.end();
+					 it++) {
+					refGroups.push_back(std::vector<std::string>(1, *it));
+					refDBNames.push_back(job.prefix + RemoveExtension(*it));
+				}
+			} else {
+				refGroups.push_back(refs);
+				refDBNames.push_back(refDBName);
+			}
+
+			for (size_t i = 0; i < refGroups.size(); i++) {
+				// Sharded references are recorded as one stage, built into
+				// as many volumes as it records
+				BuildStage stage;
+				stage.name = (sharded ? "shard " : "makeblastdb ") +
+							 refDBNames[i];
+				stage.output = refDBNames[i];
+				std::vector<std::string> settings;
+				settings.push_back(manifest.ToolVersion("makeblastdb"));
+				settings.push_back(dbtype);
+				settings.push_back(dedup ? "dedup" : "");
+				if (sharded) {
+					settings.push_back(
+						boost::lexical_cast<std::string>(job.shards));
+					settings.push_back(
+						boost::lexical_cast<std::string>(job.maxShardLetters));
+				}
+				stage.fingerprint = manifest.Fingerprint(refGroups[i],
+														 settings);
+				std::string built;
+				if (!rebuild && manifest.UpToDate(stage.name,
+						stage.fingerprint, built)) {
+					std::vector<std::string> volumes;
+					if (sharded) volumes = ShardVolumes(refDBNames[i], built);
+					else if (built == stage.output) volumes.push_back(built);
+					bool exist = !volumes.empty();
+					for (size_t j = 0; j < volumes.size() && exist; j++)
+						exist = DatabaseExists(volumes[j], dbtype);
+					if (exist) {
+						for (size_t j = 0; j < volumes.size(); j++) {
+							if (verbosity > 0)
+								out << "Up to date: " << volumes[j]
+									<< std::endl;
+						}
+						if (sharded) shardVolumes = volumes;
+						else dbs.push_back(refDBNames[i]);
+						continue;
+					}
+				}
+
+				// Fold duplicate sequences into one record and deal the
+				// records out into shards (just the one if not sharded), each
+				// streamed into its own makeblastdb
+				if (dedup || sharded) {
+					if (dedup && verbosity > 1)
+						out << "Removing duplicate sequences"
+							<< std::endl;
+					boost::shared_ptr<FastaShards> shards(new FastaShards(
+						refGroups[i], sharded ? job.shards : 1,
+						sharded ? job.maxShardLetters : 0, run.threads,
+						dedup));
+					if (dedup) {
+						const DeduplicationStatistics &statistics =
+							shards->Deduplication();
+						for (size_t j = 0; j < refs.size(); j++) {
+							runStatistics.AddInput("bytes",
+												   GetFileSize(refs[j]));
+						}
+						runStatistics.AddInput("records", statistics.records);
+						if (verbosity > 0)
+							out << "Removed " << statistics.duplicates
+								<< " duplicate sequences ("
+								<< statistics.uniqueRecords << " of "
+								<< statistics.records << " records kept)"
+								<< std::endl;
+					}
+					size_t count = shards->Count();
+					std::vector<std::string> volumes = sharded ?
+						ShardVolumes(refDBNames[i],
+									 boost::lexical_cast<std::string>(count)) :
+						std::vector<std::string>(1, refDBNames[i]);
+					for (size_t shard = 0; shard < count; shard++) {
+						const std::string &volume = volumes[shard];
+						if (sharded && verbosity > 0)
+							out << "Shard " << volume << ": "
+								<< shards->Records(shard) << " records, "
+								<< shards->Residues(shard) << " residues"
+								<< std::endl;
+						Command command;
+						command.push_back("makeblastdb");
+						command.push_back("-dbtype");
+						command.push_back(dbtype);
+						command.push_back("-in");
+						command.push_back("-");
+						command.push_back("-out");
+						command.push_back(volume);
+						command.push_back("-title");
+						command.push_back(volume);
+						if (!sharded) stage.command = CommandLine(command);
+						if (verbosity > 1)
+							out << "Executing: " << CommandLine(command)
+								<< std::endl;
+						FastaShards::Cursor cursor;
+						scheduler.Add(command, [shards, shard, cursor](
+							char *output, size_t size) mutable {
+							return shards->Read(shard, cursor, output, size);
+						});
+					}
+					if (sharded) {
+						shardVolumes.insert(shardVolumes.end(),
+											volumes.begin(), volumes.end());
+						stage.output = boost::lexical_cast<std::string>(count);
+						shardStage = stage;
+					} else {
+						building.push_back(stage);
+						dbs.push_back(refDBNames[i]);
+					}
+					continue;
+				}
+
+				// Build command for creating a BLAST database from reference
+				// FASTAs
+				Command command;
+				command.push_back("makeblastdb");
+				command.push_back("-dbtype");
+				command.push_back(dbtype);
+				// Gzipped references are decompressed into its standard input
+				// rather than to disk
+				std::vector<std::string> inputs;
+				for (size_t j = 0; j < refGroups[i].size(); j++) {
+					if (IsGzipFile(refGroups[i][j])) inputs = refGroups[i];
+				}
+				command.push_back("-in");
+				command.push_back(inputs.empty() ? Unquote(ToCmdLineStr(
+					refGroups[i].begin(), refGroups[i].end())) : "-");
+				command.push_back("-out");
+				command.push_back(refDBNames[i]);
+				if (!inputs.empty()) {
+					command.push_back("-title");
+					command.push_back(refDBNames[i]);
+				}
+				stage.command = CommandLine(command);
+				if (verbosity > 1)
+					out << "Executing: " << stage.command << std::endl;
+				scheduler.Add(command, inputs);
+				building.push_back(stage);
+				dbs.push_back(refDBNames[i]);
+			}
+		}
+
+		// The GI database is up to date if neither the GI lists nor what the
+		// taxonomy IDs resolve to have changed. GIs looked up online can
+		// change at any time, as can the tree of a taxonomy server, so they
+		// are always looked up again
+		BuildStage giStage;
+		bool giStageUpToDate = false;
+		if ((!gis.empty() || !taxa.empty() || !job.taxaGIs.empty()) &&
+			(taxa.empty() || (!run.accIndexFile.empty() &&
+							  run.taxServerSocket.empty()))) {
+			runStatistics.BeginStage("build manifest");
+			giStage.name = "blastdb_aliastool -gilist";
+			std::vector<std::string> inputs(gis), settings;
+			settings.push_back(manifest.ToolVersion("blastdb_aliastool"));
+			settings.push_back(dbtype);
+			settings.push_back(blastPath);
+			if (!taxa.empty()) AddTaxaFingerprint(job, run, inputs, settings);
+			if (!job.taxaGIs.empty()) {
+				settings.push_back(boost::lexical_cast<std::string>(
+					HashBytes(&job.taxaGIs[0],
+							  job.taxaGIs.size() * sizeof(uint64_t))));
+			}
+			if (!job.intersectGis.empty() || !job.excludeGis.empty()) {
+				inputs.insert(inputs.end(), job.intersectGis.begin(),
+							  job.intersectGis.end());
+				inputs.insert(inputs.end(), job.excludeGis.begin(),
+							  job.excludeGis.end());
+				settings.push_back("intersect " + boost::lexical_cast<
+					std::string>(job.intersectGis.size()) + ", exclude " +
+					boost::lexical_cast<std::string>(job.excludeGis.size()));
+			}
+			giStage.fingerprint = manifest.Fingerprint(inputs, settings);
+			std::string built;
+			if (!rebuild && manifest.UpToDate(giStage.name,
+					giStage.fingerprint, built) &&
+				DatabaseExists(built, dbtype) && FileExists(built + ".gil")) {
+				if (verbosity > 0)
+					out << "Up to date: " << built << std::endl;
+				giStageUpToDate = true;
+				dbs.push_back(built);
+			}
+		}
+
+		// Likewise the seqid list database, of the accession lists and, with
+		// an accession index, of the taxa's records without GIs. A stage that
+		// selected nothing is recorded without a database, so that the taxa
+		// aren't resolved again just to find that out
+		const bool taxaAccessions = !taxa.empty() && !run.accIndexFile.empty();
+		BuildStage accessionStage;
+		bool accessionStageUpToDate = false;
+		if ((!job.accessions.empty() || taxaAccessions) &&
+			(!taxaAccessions || run.taxServerSocket.empty())) {
+			runStatistics.BeginStage("build manifest");
+			accessionStage.name = "blastdb_aliastool -seqidlist";
+			std::vector<std::string> inputs(job.accessions), settings;
+			inputs.insert(inputs.end(), job.excludeAccessions.begin(),
+						  job.excludeAccessions.end());
+			settings.push_back(manifest.ToolVersion("blastdb_aliastool"));
+			settings.push_back(dbtype);
+			settings.push_back(blastPath);
+			settings.push_back("exclude " + boost::lexical_cast<std::string>(
+				job.excludeAccessions.size()));
+			if (taxaAccessions) AddTaxaFingerprint(job, run, inputs, settings);
+			accessionStage.fingerprint = manifest.Fingerprint(inputs,
+															  settings);
+			std::string built;
+			if (!rebuild && manifest.UpToDate(accessionStage.name,
+					accessionStage.fingerprint, built) &&
+				(built.empty() || (DatabaseExists(built, dbtype) &&
+								   FileExists(built + ".bsl")))) {
+				if (verbosity > 0 && !built.empty())
+					out << "Up to date: " << built << std::endl;
+				accessionStageUpToDate = true;
+				if (!built.empty()) dbs.push_back(built);
+			}
+		}
+
+		// Find GI numbers given taxonomy IDs, kept in memory to be merged
+		// straight into the GI list, along with the accessions of records
+		// without GIs
+		std::vector<uint64_t> taxaGIs(job.taxaGIs);
+		AccessionSet taxaAccessionSet(run.threads);
+		bool toolFailed = false;
+		if (!taxa.empty() && (!giStageUpToDate ||
+			(taxaAccessions && !accessionStageUpToDate))) {
+			std::vector<int> taxIDs;
+
+			// Consolidate taxIDs into one vector
+			runStatistics.BeginStage("read taxa");
+			boost::shared_ptr<NameIndex> names;
+			for (std::vector<std::string>::const_iterator it = taxa.begin();
+				 it != taxa.end();
+				 it++) {
+				InputFile mapping(*it);
+				ParseTaxa(mapping.Data(), mapping.Size(), *it, 1, run, names,
+						  taxIDs);
+				runStatistics.AddInput("bytes", mapping.Size());
+			}
+			if (names && verbosity > 1)
+				out << "Names index: " << names->Size() << " names"
+					<< std::endl;
+			runStatistics.AddInput("taxIDs", taxIDs.size());
+
+			// Find taxID of last common ancestor
+			if (verbosity > 1)
+				out << "Finding LCA's taxonomy ID" << std::endl; 
+			TaxonomySource source(taxonomy, run, verbosity, runStatistics,
+								  out);
+			runStatistics.BeginStage("find LCA");
+			int LCA_ID = source.GetLCA_ID(taxIDs);
+			runStatistics.AddInput("taxIDs", taxIDs.size());
+			if (verbosity > 0)
+				out << "LCA ID: " << LCA_ID << std::endl;
+			if (!lcaRank.empty() && LCA_ID != -1) {
+				int rankID = source.RollUpToRank(LCA_ID, lcaRank);
+				if (rankID == -1) {
+					err << "Warning: LCA (ID: " << LCA_ID << ") has no "
+						<< lcaRank << " above it, using the LCA" << std::endl;
+				} else {
+					LCA_ID = rankID;
+					if (verbosity > 0)
+						out << "LCA " << lcaRank << " ID: " << LCA_ID
+							<< std::endl;
+				}
+			}
+
+			// Expand the LCA's subtree from the tree when its taxonomy IDs
+			// are looked up offline or filtered; otherwise a single query
+			// has NCBI expand it
+			std::vector<int> queryTaxIDs(1, LCA_ID);
+			bool expandLocally = getChildrenGIs &&
+				(!run.accIndexFile.empty() || !childRank.empty() ||
+				 skipHidden);
+			if (expandLocally) {
+				queryTaxIDs = source.GetDescendants(LCA_ID, childRank,
+													skipHidden);
+				if (verbosity > 0)
+					out << "Children: " << queryTaxIDs.size()
+						<< " taxonomy IDs" << std::endl;
+			}
+
+			// Get the gis associated with LCA (and children)
+			if (verbosity > 1)
+				out << "Finding the GI's associated with LCA"
+					<< std::endl;
+			runStatistics.BeginStage("find GIs");
+			runStatistics.AddInput("taxIDs", queryTaxIDs.size());
+			if (!run.accIndexFile.empty()) {
+				// Visit the taxonomy IDs in order so the index is read
+				// sequentially
+				AccessionIndex accessionIndex(run.accIndexFile);
+				std::sort(queryTaxIDs.begin(), queryTaxIDs.end());
+				queryTaxIDs.erase(std::unique(queryTaxIDs.begin(),
+											  queryTaxIDs.end()),
+								  queryTaxIDs.end());
+				for (size_t i = 0; i < queryTaxIDs.size(); i++) {
+					accessionIndex.GetGIs(queryTaxIDs[i], taxaGIs);
+					accessionIndex.GetAccessionsWithoutGIs(queryTaxIDs[i],
+														   taxaAccessionSet);
+				}
+				runStatistics.AddInput("GIs", taxaGIs.size());
+				runStatistics.AddInput("accessions", taxaAccessionSet.Size());
+				if (verbosity > 0)
+					out << "Accession index: " << taxaGIs.size() << " GIs, "
+						<< taxaAccessionSet.Size() << " accessions without "
+						<< "GIs" << std::endl;
+			} else {
+				toolFailed = !FetchGIs(queryTaxIDs,
+									   getChildrenGIs && !expandLocally,
+									   taxaGIs, verbosity, runStatistics,
+									   out, err);
+				runStatistics.AddInput("GIs", taxaGIs.size());
+			}
+
+			// Check if anything was returned
+			if (!taxaGIs.empty() || !taxaAccessionSet.Empty()) {
+				if (verbosity > 1)
+					out << "Found GI's; adding to GI list" << std::endl;
+			} else if (!toolFailed) {
+				err << "Warning: no direct links found for last common "
+					<< "ancestor (ID: " << LCA_ID << "). Try using "
+					<< "--children flag" << std::endl;
+			}
+		}
+
+		// Create database from given GI numbers (unless those of the taxa
+		// could not all be found)
+		if ((!gis.empty() || !taxaGIs.empty()) && !giStageUpToDate &&
+			!toolFailed) {
+
+			// Prepare command line arguments
+			std::vector<std::string> giNames(gis);
+			if (!taxaGIs.empty()) giNames.push_back("LCA_GIs");
+			std::string giDBName = job.prefix + Unquote(ToCmdLineStr(
+				giNames.begin(), giNames.end(), "_", &RemoveExtension));
+
+			// Merge every GI list into one sorted binary list, which BLAST
+			// reads without parsing or sorting it again
+			std::string giListFile = giDBName + ".gil";
+			runStatistics.BeginStage("compile GI list");
+			if (verbosity > 1)
+				out << "Compiling GI lists into: " << giListFile
+					<< std::endl;
+			uint64_t giCount;
+			if (job.intersectGis.empty() && job.excludeGis.empty()) {
+				for (size_t i = 0; i < gis.size(); i++)
+					runStatistics.AddInput("bytes", GetFileSize(gis[i]));
+				giCount = CompileGIList(gis, taxaGIs, giListFile,
+										giMemory << 20, run.threads);
+			} else {
+				// Combined as compressed bitmaps, which hold even whole
+				// databases' worth of GIs in little memory
+				GiSet giSet = ReadGIs(gis, run.threads, runStatistics);
+				giSet.Add(taxaGIs);
+				std::vector<GiSet> intersections;
+				for (size_t i = 0; i < job.intersectGis.size(); i++) {
+					intersections.push_back(ReadGIs(std::vector<std::string>(
+						1, job.intersectGis[i]), run.threads, runStatistics));
+				}
+				FilterGIs(giSet, intersections, ReadGIs(job.excludeGis,
+					run.threads, runStatistics));
+				if (verbosity > 1)
+					out << "GI set: " << (giSet.MemoryUsage() >> 10)
+						<< " kB" << std::endl;
+				giCount = giSet.WriteBinaryGIList(giListFile);
+				if (giCount == 0)
+					err << "Warning: no GIs left in: " << giListFile
+						<< std::endl;
+			}
+			runStatistics.AddInput("GIs", giCount);
+			if (verbosity > 0)
+				out << "GI list: " << giCount << " unique GIs"
+					<< std::endl;
+
+			// Set this silly parameter in order to create the database type?!?
+			std::string blastDBName;
+			if (dbtype == "nucl") 
+				blastDBName = blastPath + "/nt";
+			else 
+				blastDBName = blastPath + "/nr";
+		
+			// Build command for aliasing multiple BLAST databases / GI files
+			Command command;
+			command.push_back("blastdb_aliastool");
+			command.push_back("-db");
+			command.push_back(blastDBName);
+			command.push_back("-dbtype");
+			command.push_back(dbtype);
+			command.push_back("-gilist");
+			command.push_back(giListFile);
+			command.push_back("-out");
+			command.push_back(giDBName);
+			command.push_back("-title");
+			command.push_back(giDBName);
+			giStage.command = CommandLine(command);
+			giStage.output = giDBName;
+			if (verbosity > 1)
+				out << "Executing: " << giStage.command << std::endl;
+			scheduler.Add(command);
+			if (!giStage.fingerprint.empty()) building.push_back(giStage);
+			dbs.push_back(giDBName);
+		}
+
+		// Create database from given accession.versions (and those of the
+		// taxa's records without GIs), which BLAST selects with a binary
+		// seqid list from version 5 databases
+		if ((!job.accessions.empty() || taxaAccessions) &&
+			!accessionStageUpToDate && !toolFailed) {
+			std::vector<std::string> accessionNames(job.accessions);
+			if (taxaAccessions) accessionNames.push_back("LCA_accessions");
+			std::string accessionDBName = job.prefix + Unquote(ToCmdLineStr(
+				accessionNames.begin(), accessionNames.end(), "_",
+				&RemoveExtension));
+
+			// Interned, merged and sorted once into the binary list
+			std::string seqIdListFile = accessionDBName + ".bsl";
+			runStatistics.BeginStage("compile seqid list");
+			if (verbosity > 1)
+				out << "Compiling seqid lists into: " << seqIdListFile
+					<< std::endl;
+			AccessionSet accessionSet = ReadAccessions(job.accessions,
+				run.threads, runStatistics);
+			accessionSet.Union(taxaAccessionSet);
+			accessionSet.Subtract(ReadAccessions(job.excludeAccessions,
+				run.threads, runStatistics));
+			runStatistics.AddInput("accessions", accessionSet.Size());
+			if (verbosity > 0)
+				out << "Seqid list: " << accessionSet.Size()
+					<< " unique accessions" << std::endl;
+
+			if (accessionSet.Empty()) {
+				if (!accessionStage.fingerprint.empty())
+					building.push_back(accessionStage);
+			} else {
+				if (verbosity > 1)
+					out << "Seqid list index: "
+						<< (accessionSet.MemoryUsage() >> 10) << " kB"
+						<< std::endl;
+				accessionSet.WriteBinarySeqIdList(seqIdListFile,
+												  accessionDBName);
+
+				Command command;
+				command.push_back("blastdb_aliastool");
+				command.push_back("-db");
+				command.push_back(blastPath +
+								  ((dbtype == "nucl") ? "/nt" : "/nr"));
+				command.push_back("-dbtype");
+				command.push_back(dbtype);
+				command.push_back("-seqidlist");
+				command.push_back(seqIdListFile);
+				command.push_back("-out");
+				command.push_back(accessionDBName);
+				command.push_back("-title");
+				command.push_back(accessionDBName);
+				accessionStage.command = CommandLine(command);
+				accessionStage.output = accessionDBName;
+				if (verbosity > 1)
+					out << "Executing: " << accessionStage.command
+						<< std::endl;
+				scheduler.Add(command);
+				if (!accessionStage.fingerprint.empty())
+					building.push_back(accessionStage);
+				dbs.push_back(accessionDBName);
+			}
+		}
+
+		// The aggregate needs every database to be finished
+		runStatistics.BeginStage("wait for tools");
+		std::vector<ProcessUsage> failed = scheduler.Wait();
+		ReportFailures(failed, verbosity, err);
+	
+		// Create an aggregated database based off of previous databases, the
+		// newly created reference database, and the newly created GI number
+		// db. The alias is written directly (it is quicker to write it again
+		// than to check whether it needs writing), with the sizes of the
+		// databases as they are now
+		bool aliasFailed = false;
+		if ((dbs.size() || shardVolumes.size()) && failed.empty() &&
+			!toolFailed) {
+			runStatistics.BeginStage("aggregate");
+			try {
+				if (sharded) {
+					WriteShardAliases(output, shardVolumes, dbs, job.shards,
+									  dbtype == "prot", verbosity, out);
+				} else {
+					if (verbosity > 1)
+						out << "Writing alias: " << output
+							<< ((dbtype == "prot") ? ".pal" : ".nal")
+							<< std::endl;
+					WriteAlias(output, output, dbs, "", dbtype == "prot");
+				}
+
+				// Aliases cannot leave GIs out of the databases they list
+				// whole, so those GIs are left to BLAST to skip
+				if (!job.excludeGis.empty() &&
+					(!job.dbs.empty() || !refs.empty())) {
+					std::string negativeFile = output + ".negative.gil";
+					uint64_t excluded = ReadGIs(job.excludeGis, run.threads,
+						runStatistics).WriteBinaryGIList(negativeFile);
+					if (verbosity > 0)
+						out << "Negative GI list: " << excluded << " GIs in "
+							<< negativeFile << " (search with "
+							<< "-negative_gilist)" << std::endl;
+				}
+				if (!job.excludeAccessions.empty() &&
+					(!job.dbs.empty() || !refs.empty())) {
+					std::string negativeFile = output + ".negative.bsl";
+					AccessionSet excluded = ReadAccessions(
+						job.excludeAccessions, run.threads, runStatistics);
+					excluded.WriteBinarySeqIdList(negativeFile);
+					if (verbosity > 0)
+						out << "Negative seqid list: " << excluded.Size()
+							<< " accessions in " << negativeFile
+							<< " (search with -negative_seqidlist)"
+							<< std::endl;
+				}
+			} catch (const std::exception &e) {
+				err << "Failed: " << e.what() << std::endl;
+				aliasFailed = true;
+			}
+		}
+
+		// Remember the stages that were built for the next run (the shards
+		// only if every one of them was)
+		if (!shardStage.fingerprint.empty() && failed.empty())
+			building.push_back(shardStage);
+		if (!building.empty()) {
+			std::set<std::string> failedCommands;
+			for (size_t i = 0; i < failed.size(); i++)
+				failedCommands.insert(failed[i].command);
+			for (std::vector<BuildStage>::iterator it = building.begin();
+				 it != building.end();
+				 it++) {
+				if (failedCommands.count(it->command) == 0)
+					manifest.Record(it->name, it->fingerprint, it->output);
+			}
+			try {
+				manifest.Save();
+			} catch (const std::exception &e) {
+				err << "Warning: " << e.what() << std::endl;
+			}
+		}
+
+		// Cleanup
+		runStatistics.AddProcesses(scheduler.Usage());
+		return (failed.empty() && !toolFailed && !aliasFailed) ?
+			SUCCESS : ERROR_TOOL_FAILED;
+	}
+
+	// Runs jobs (up to run.jobs at once), each failing on its own, sharing
+	// the given taxonomy. The log of each is printed to out and err whole
+	// once it is done, headed by the kind of job it is
+	// Returns SUCCESS, or the status of the first job that failed
+	int RunJobs(const std::vector<JobOptions> &jobs, const RunOptions &run,
+				const LCA_Finder *taxonomy, const std::string &kind,
+				std::ostream &out, std::ostream &err) {
+		std::vector<int> statuses(jobs.size(), SUCCESS);
+		std::mutex logMutex;
+		ParallelFor(jobs.size(), run.jobs, [&](size_t i) {
+			std::ostringstream jobOut, jobErr;
+			RunStatistics jobStatistics;
+			try {
+				statuses[i] = RunJob(jobs[i], run, taxonomy, jobStatistics,
+									 jobOut, jobErr);
+			} catch (const std::exception &e) {
+				jobErr << "An exception occurred:\n" << e.what() << std::endl;
+				statuses[i] = ERROR_UNHANDLED_EXCEPTION;
+			}
+			SaveStatistics(jobStatistics, jobs[i].statsFile, jobErr);
+
+			std::lock_guard<std::mutex> lock(logMutex);
+			out << kind << " " << i + 1 << " (" << jobs[i].output << "): "
+				<< ((statuses[i] == SUCCESS) ? "done" : "failed")
+				<< std::endl << jobOut.str() << std::flush;
+			err << jobErr.str() << std::flush;
+		});
+
+		int status = SUCCESS;
+		size_t failedJobs = 0;
+		for (size_t i = 0; i < statuses.size(); i++) {
+			if (statuses[i] == SUCCESS) continue;
+			if (failedJobs++ == 0) status = statuses[i];
+		}
+		if (failedJobs > 0)
+			err << failedJobs << " of " << jobs.size() << " "
+				<< boost::algorithm::to_lower_copy(kind) << "s failed"
+				<< std::endl;
+		return status;
+	}
+
+	// A group of taxonomy IDs resolved to its own LCA (see --groups)
+	struct TaxaGroup {
+		std::string label;
+		std::vector<int> taxIDs;
+		int LCA_ID;
+		std::vector<uint64_t> gis;
+	};
+
+	// Returns a group label with anything unfit for a file name replaced
+	std::string GroupLabel(const std::string &label) {
+		std::string result;
+		for (size_t i = 0; i < label.size(); i++) {
+			char c = label[i];
+			result += (isalnum((unsigned char)c) || c == '-' || c == '_' ||
+					   c == '.') ? c : '_';
+		}
+		return result.empty() ? "_" : result;
+	}
+
+	// Reads groups of taxa (see ParseTaxa) from taxa files: each file is a
+	// group named after it, unless split into blocks headed by ">label" lines
+	// (the taxa before the first of which are still the file's own group)
+	// Throws std::runtime_error if a file cannot be read or holds something
+	// other than taxa, or if two groups share a label
+	std::vector<TaxaGroup> ReadTaxaGroups(const std::vector<std::string> &files,
+										  const RunOptions &run) {
+		std::vector<TaxaGroup> groups;
+		std::set<std::string> labels;
+		std::vector<int> taxIDs;
+		boost::shared_ptr<NameIndex> names;
+		for (std::vector<std::string>::const_iterator file = files.begin();
+			 file != files.end();
+			 file++) {
+			InputFile mapping(*file);
+			const char *data = mapping.Data();
+			size_t size = mapping.Size(), position = 0;
+			uint64_t line = 1;
+			std::string label = RemoveExtension(
+				boost::filesystem::path(*file).filename().string());
+			bool labelled = false;
+			while (position <= size) {
+				// The block runs up to the next header line
+				size_t end = position;
+				while (end < size && data[end] != '>') {
+					const char *newline = static_cast<const char *>(
+						memchr(data + end, '\n', size - end));
+					end = (newline == NULL) ? size : newline + 1 - data;
+				}
+				taxIDs.clear();
+				uint64_t blockLines = ParseTaxa(data + position,
+					end - position, *file, line, run, names, taxIDs);
+				if (!taxIDs.empty() || labelled) {
+					TaxaGroup group;
+					group.label = GroupLabel(label);
+					group.LCA_ID = -1;
+					group.taxIDs = taxIDs;
+					if (!labels.insert(group.label).second)
+						throw std::runtime_error("Groups share the label \"" +
+							group.label + "\" in: " + *file);
+					groups.push_back(group);
+				}
+				line += blockLines;
+				if (end >= size) break;
+
+				// Read the header line
+				const char *newline = static_cast<const char *>(
+					memchr(data + end, '\n', size - end));
+				size_t headerEnd = (newline == NULL) ? size :
+					newline - data;
+				label = std::string(data + end + 1, headerEnd - end - 1);
+				size_t labelEnd = label.find_last_not_of(" \t\r");
+				size_t labelStart = label.find_first_not_of(" \t");
+				label = (labelEnd == std::string::npos) ? "" :
+					label.substr(labelStart, labelEnd + 1 - labelStart);
+				labelled = true;
+				position = (newline == NULL) ? size : headerEnd + 1;
+				line++;
+			}
+		}
+		return groups;
+	}
+
+	// Resolves each group of the job's taxa to its own LCA, across all cores,
+	// and finds the GIs of each (with the GIs of the job's GI lists). Each
+	// group then gets its own GI list (output.label.gil) or, with the
+	// databases and references of the job (built once, as output), its own
+	// database (output.label). The LCA of each group is listed in output +
+	// ".lca"
+	// Returns the exit status of the job
+	int RunGroups(const JobOptions &job, const RunOptions &run,
+				  const LCA_Finder *taxonomy, RunStatistics &runStatistics,
+				  std::ostream &out, std::ostream &err) {
+		const int verbosity = job.verbosity;
+		runStatistics.BeginStage("read taxa");
+		std::vector<TaxaGroup> groups = ReadTaxaGroups(job.taxa, run);
+		for (size_t i = 0; i < job.taxa.size(); i++)
+			runStatistics.AddInput("bytes", GetFileSize(job.taxa[i]));
+		runStatistics.AddInput("groups", groups.size());
+		if (verbosity > 0)
+			out << "Groups: " << groups.size() << std::endl;
+
+		// Find each group's LCA and the taxonomy IDs to look GIs up for
+		TaxonomySource source(taxonomy, run, verbosity, runStatistics, out);
+		runStatistics.BeginStage("find LCA");
+		runStatistics.AddInput("groups", groups.size());
+		std::vector< std::vector<int> > queryTaxIDs(groups.size());
+		std::vector<char> unranked(groups.size(), false);
+		bool expandLocally = job.getChildrenGIs &&
+			(!run.accIndexFile.empty() || !job.childRank.empty() ||
+			 job.skipHidden);
+		ParallelFor(groups.size(), source.Shared() ? run.threads : 1,
+					[&](size_t i) {
+			groups[i].LCA_ID = source.GetLCA_ID(groups[i].taxIDs);
+			if (groups[i].LCA_ID == -1) return;
+			if (!job.lcaRank.empty()) {
+				int rankID = source.RollUpToRank(groups[i].LCA_ID,
+												 job.lcaRank);
+				if (rankID == -1) unranked[i] = true;
+				else groups[i].LCA_ID = rankID;
+			}
+			if (expandLocally) {
+				queryTaxIDs[i] = source.GetDescendants(groups[i].LCA_ID,
+					job.childRank, job.skipHidden);
+			} else {
+				queryTaxIDs[i].push_back(groups[i].LCA_ID);
+			}
+		});
+
+		// Find the GIs of each group: all at once from an accession index,
+		// or one group at a time from NCBI so as not to flood it
+		runStatistics.BeginStage("find GIs");
+		bool toolFailed = false;
+		if (!run.accIndexFile.empty()) {
+			AccessionIndex accessionIndex(run.accIndexFile);
+			ParallelFor(groups.size(), run.threads, [&](size_t i) {
+				std::vector<int> &taxIDs = queryTaxIDs[i];
+				std::sort(taxIDs.begin(), taxIDs.end());
+				taxIDs.erase(std::unique(taxIDs.begin(), taxIDs.end()),
+							 taxIDs.end());
+				for (size_t j = 0; j < taxIDs.size(); j++)
+					accessionIndex.GetGIs(taxIDs[j], groups[i].gis);
+			});
+		} else {
+			for (size_t i = 0; i < groups.size(); i++) {
+				if (!FetchGIs(queryTaxIDs[i],
+							  job.getChildrenGIs && !expandLocally,
+							  groups[i].gis, verbosity, runStatistics, out,
+							  err))
+					toolFailed = true;
+			}
+		}
+
+		// List the LCA of each group
+		std::string lcaFile = job.output + ".lca";
+		std::ofstream ofs(lcaFile.c_str());
+		if (ofs.fail())
+			throw std::runtime_error("Cannot write: " + lcaFile);
+		ofs << "#group\tLCA\ttaxIDs\tGIs\n";
+		for (size_t i = 0; i < groups.size(); i++) {
+			runStatistics.AddInput("GIs", groups[i].gis.size());
+			ofs << groups[i].label << "\t" << groups[i].LCA_ID << "\t"
+				<< groups[i].taxIDs.size() << "\t" << groups[i].gis.size()
+				<< "\n";
+			if (verbosity > 0)
+				out << "Group " << groups[i].label << ": LCA ID "
+					<< groups[i].LCA_ID << ", " << groups[i].gis.size()
+					<< " GIs" << std::endl;
+			if (unranked[i])
+				err << "Warning: LCA of group " << groups[i].label << " (ID: "
+					<< groups[i].LCA_ID << ") has no " << job.lcaRank
+					<< " above it, using the LCA" << std::endl;
+			if (groups[i].gis.empty())
+				err << "Warning: no GIs found for group " << groups[i].label
+					<< " (LCA ID: " << groups[i].LCA_ID << ")" << std::endl;
+		}
+		ofs.close();
+		if (ofs.fail())
+			throw std::runtime_error("Cannot write: " + lcaFile);
+		if (toolFailed) return ERROR_TOOL_FAILED;
+
+		if (job.groups == "gilist") {
+			// The GIs of the job's GI lists are read once for every group
+			runStatistics.BeginStage("compile GI lists");
+			if (!job.intersectGis.empty() || !job.excludeGis.empty()) {
+				GiSet sharedGIs = ReadGIs(job.gis, run.threads,
+										  runStatistics);
+				std::vector<GiSet> intersections;
+				for (size_t i = 0; i < job.intersectGis.size(); i++) {
+					intersections.push_back(ReadGIs(std::vector<std::string>(
+						1, job.intersectGis[i]), run.threads, runStatistics));
+				}
+				GiSet exclusions = ReadGIs(job.excludeGis, run.threads,
+										   runStatistics);
+				ParallelFor(groups.size(), run.threads, [&](size_t i) {
+					if (groups[i].gis.empty() && sharedGIs.Empty()) return;
+					GiSet groupGIs(1);
+					groupGIs.Add(groups[i].gis);
+					groupGIs.Union(sharedGIs);
+					FilterGIs(groupGIs, intersections, exclusions);
+					groupGIs.WriteBinaryGIList(job.output + "." +
+											   groups[i].label + ".gil");
+				});
+				return SUCCESS;
+			}
+			std::vector<uint64_t> sharedGIs, temp;
+			for (size_t i = 0; i < job.gis.size(); i++) {
+				ReadFile(job.gis[i], temp, run.threads);
+				sharedGIs.insert(sharedGIs.end(), temp.begin(), temp.end());
+				runStatistics.AddInput("bytes", GetFileSize(job.gis[i]));
+			}
+			ParallelFor(groups.size(), run.threads, [&](size_t i) {
+				if (groups[i].gis.empty() && sharedGIs.empty()) return;
+				groups[i].gis.insert(groups[i].gis.end(), sharedGIs.begin(),
+									 sharedGIs.end());
+				CompileGIList(std::vector<std::string>(), groups[i].gis,
+							  job.output + "." + groups[i].label + ".gil",
+							  job.giMemory << 20, 1);
+			});
+			return SUCCESS;
+		}
+
+		// Build the job's databases and references once, to be shared
+		JobOptions shared(job);
+		shared.groups.clear();
+		shared.taxa.clear();
+		shared.gis.clear();
+		shared.intersectGis.clear();
+		shared.excludeGis.clear();
+		shared.accessions.clear();
+		shared.excludeAccessions.clear();
+		if (!job.dbs.empty() || !job.refs.empty()) {
+			if (verbosity > 0)
+				out << "Building shared databases: " << job.output
+					<< std::endl;
+			int status = RunJob(shared, run, taxonomy, runStatistics, out,
+								err);
+			if (status != SUCCESS) return status;
+		}
+
+		// Then a database for each group, each keeping its own manifest as
+		// they are built concurrently
+		runStatistics.BeginStage("groups");
+		runStatistics.AddInput("groups", groups.size());
+		std::vector<JobOptions> groupJobs;
+		for (size_t i = 0; i < groups.size(); i++) {
+			if (groups[i].gis.empty() && job.gis.empty() &&
+				job.accessions.empty())
+				continue;
+			JobOptions groupJob(shared);
+			groupJob.dbs.clear();
+			groupJob.refs.clear();
+			if (!job.dbs.empty() || !job.refs.empty())
+				groupJob.dbs.push_back(job.output);
+			groupJob.gis = job.gis;
+			groupJob.intersectGis = job.intersectGis;
+			groupJob.excludeGis = job.excludeGis;
+			groupJob.accessions = job.accessions;
+			groupJob.excludeAccessions = job.excludeAccessions;
+			groupJob.taxaGIs.swap(groups[i].gis);
+			groupJob.output = job.output + "." + groups[i].label;
+			groupJob.prefix = groupJob.output + ".";
+			groupJob.buildManifestFile = groupJob.output + ".build";
+			groupJob.statsFile.clear();
+			groupJob.jobs = 1;
+			// Each group is a view over the (possibly sharded) shared output
+			groupJob.shards = 0;
+			groupJob.maxShardLetters = 0;
+			groupJobs.push_back(groupJob);
+		}
+		return RunJobs(groupJobs, run, taxonomy, "Group", out, err);
+	}
+
+	// Reads a batch manifest: one job per line, given as the options that
+	// describe a database (e.g. "-o clade -t clade.txt -c"), with blank
+	// lines and lines starting with '#' ignored. Options a job doesn't give
+	// are those of base
+	// Throws std::runtime_error if the manifest cannot be read or parsed
+	std::vector<JobOptions> ReadJobs(const std::string &manifestFile,
+									 const JobOptions &base) {
+		std::ifstream ifs(manifestFile.c_str());
+		if (ifs.fail())
+			throw std::runtime_error("Cannot read: " + manifestFile);
+		std::vector<JobOptions> jobs;
+		std::string line;
+		for (size_t lineNumber = 1; std::getline(ifs, line); lineNumber++) {
+			size_t start = line.find_first_not_of(" \t\r");
+			if (start == std::string::npos || line[start] == '#') continue;
+			JobOptions job(base);
+			po::options_description desc;
+			AddJobOptions(desc, job, false);
+			try {
+				po::variables_map vm;
+				po::store(po::command_line_parser(po::split_unix(line))
+					.options(desc).run(), vm);
+				po::notify(vm);
+			} catch (const std::exception &e) {
+				throw std::runtime_error(manifestFile + " (line " +
+					boost::lexical_cast<std::string>(lineNumber) + "): " +
+					e.what());
+			}
+			jobs.push_back(job);
+		}
+		return jobs;
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	try {
+		RunStatistics runStatistics;
+		std::string appName = boost::filesystem::basename(argv[0]);
+		RunOptions run;
+		JobOptions base;
+
+		// Set up possible options
+		po::options_description desc("Options", DEFAULT_LINE_LENGTH,
+									 MIN_DESCRIPTION_LENGTH);
+		po::options_description jobDesc("Database options (per job in a "
+			"--manifest)", DEFAULT_LINE_LENGTH, MIN_DESCRIPTION_LENGTH);
+		AddJobOptions(jobDesc, base, true);
+		desc.add_options()
+			("help,h", "Display help")
+			("acc2taxid", po::value< std::vector<std::string> >(
+				&run.accession2taxid)->value_name("FILE")->multitoken()
+				->composing(),
+				"Build the accession index (see --accIndex) from NCBI "
+				"*.accession2taxid files, download: "
+				"ftp://ftp.ncbi.nih.gov/pub/taxonomy/accession2taxid/")
+			("accIndex", po::value<std::string>(&run.accIndexFile)
+				->value_name("FILE"),
+				"To be used when including taxonomy IDs, "
+				"find GIs in this accession index instead of querying NCBI "
+				"(default when building: \"accession2taxid.index\")")
+			("buildTaxCache", po::value<bool>(&run.buildTaxCache)
+				->zero_tokens()->default_value(false)->implicit_value(true),
+				"Load the nodes file and save it as a binary taxonomy cache "
+				"(see --taxCache) for near instant loading by later runs")
+			("jobs,j", po::value<unsigned int>(&run.jobs)
+				->value_name("INT")->default_value(1),
+				"Number of databases built at once; with more than one, each "
+				"reference FASTA gets its own database (with --manifest, the "
+				"number of jobs run at once)")
+			("manifest", po::value<std::string>(&run.manifestFile)
+				->value_name("FILE"),
+				"Build many databases in one run, sharing one loaded "
+				"taxonomy: one job per line, given as database options "
+				"(those not given are taken from the command line). "
+				"Intermediate databases are prefixed with the job's output")
+			("namesFile", po::value<std::string>(&run.namesFile)
+				->value_name("FILE")->default_value("names.dmp"),
+				"To be used when including taxonomy IDs, "
+				"NCBI Taxonomy names file for taxa given by name (e.g. "
+				"\"Escherichia coli\") instead of taxonomy ID, indexed into "
+				"names file name + \".cache\" on first use; may be gzipped "
+				"(default: the nodes file if it is taxdump.tar.gz), "
+				"download: ftp://ftp.ncbi.nih.gov/pub/taxonomy/taxdump.tar.gz")
+			("nodesFile,n", po::value<std::string>(&run.nodesFile)
+				->value_name("FILE")->default_value("nodes.dmp"),
+				"To be used when including taxonomy IDs, "
+				"NCBI Taxonomy nodes file for finding last common ancestor; "
+				"may be gzipped, or taxdump.tar.gz itself, "
+				"download: ftp://ftp.ncbi.nih.gov/pub/taxonomy/taxdump.tar.gz")
+			("taxCache", po::value<std::string>(&run.taxCacheFile)
+				->value_name("FILE"),
+				"To be used when including taxonomy IDs, "
+				"binary taxonomy cache used in place of the nodes file, "
+				"rebuilt automatically when stale (default: nodes file "
+				"name + \".cache\", if it exists or is being built)")
+			("searchNames", po::value<std::string>(&run.nameSearch)
+				->value_name("STR"),
+				"List the taxonomy IDs and names of the names file (see "
+				"--namesFile) starting with this, ignoring case")
+			("serve", po::value<std::string>(&run.serveSocket)
+				->value_name("SOCKET"),
+				"Load the taxonomy (see --nodesFile and --taxCache) and keep "
+				"it resident, answering LCA, parent, root path and "
+				"descendant queries on this UNIX socket until interrupted")
+			("taxServer", po::value<std::string>(&run.taxServerSocket)
+				->value_name("SOCKET"),
+				"To be used when including taxonomy IDs, "
+				"ask the taxonomy server (see --serve) listening on this "
+				"socket instead of loading the taxonomy, if one is running")
+			("threads", po::value<unsigned int>(&run.threads)
+				->value_name("INT")->default_value(0),
+				"Number of threads used for parsing (0 for one per core)")
+			("verifyCaches", po::value<bool>(&run.verifyCaches)
+				->zero_tokens()->default_value(false)->implicit_value(true),
+				"Checksum the taxonomy and name caches (see --taxCache and "
+				"--namesFile) when loading them, rebuilding those damaged, "
+				"instead of trusting them once their version and source "
+				"file stamp match")
 			//("unreg", "Unrecognized options")
 			;
+		desc.add(jobDesc);
 
 		// Ensure arguments were inputted
 		if (argc == 1) {
@@ -107,77 +1846,54 @@ int main(int argc, char *argv[]) {
 		po::notify(vm);
 
 		// Visually see what was inputted
+		int verbosity = base.verbosity;
 		if (vm.count("help")) {
 			std::cout << "USAGE: " << appName << " [options]\n";
 			std::cout << "\n" << desc << std::endl;
 			return 0;
 		}
-		if (vm.count("blastPath")) {
-			if (verbosity > 1)
-				std::cout << "BLAST Path: " << blastPath << std::endl;
-		}
-		if (vm.count("dbtype")) {
-			if (dbtype != "nucl" && dbtype != "prot") {
-				std::cerr << "Database type must be either \"nucl\" or \"prot\""
-						  << ": " << dbtype << std::endl;
-				return ERROR_IN_COMMAND_LINE;
-			}
+		// Names come from the same taxdump archive as the nodes, if given one
+		if (vm["namesFile"].defaulted() &&
+			(boost::algorithm::ends_with(run.nodesFile, ".tar") ||
+			 boost::algorithm::ends_with(run.nodesFile, ".tar.gz") ||
+			 boost::algorithm::ends_with(run.nodesFile, ".tgz")))
+			run.namesFile = run.nodesFile;
+		run.namesCacheFile = run.namesFile +
+			((run.namesFile == run.nodesFile) ? ".names.cache" : ".cache");
+		if (run.buildTaxCache || vm.count("taxCache") ||
+			FileExists(run.nodesFile + ".cache")) {
+			if (run.taxCacheFile.empty())
+				run.taxCacheFile = run.nodesFile + ".cache";
 			if (verbosity > 1)
-				std::cout << "DBType: " << dbtype << std::endl;
-		}
-		if (vm.count("db")) {
-			// The db given is an incomplete file name, just the prefix is to
-			// be given
-			/*
-			try {
-				FilesExist(dbs);
-			} catch (std::exception &e) {
-				std::cerr << e.what() << std::endl;
-				return ERROR_IN_COMMAND_LINE;
-			}*/
-			if (verbosity > 1)
-				std::cout << "DBs: " << dbs << std::endl;
-		}
-		if (vm.count("gi")) {
-			try {
-				FilesExist(gis);
-			} catch (std::exception &e) {
-				std::cerr << e.what() << std::endl;
+				std::cout << "Taxonomy cache: " << run.taxCacheFile
+						  << std::endl;
+			if (!FileExists(run.nodesFile)) {
+				std::cerr << "Given nodes file does not exist: "
+						  << run.nodesFile << std::endl;
 				return ERROR_IN_COMMAND_LINE;
 			}
-			if (verbosity > 1)
-				std::cout << "GIs: " << gis << std::endl;
 		}
-		if (vm.count("taxa")) {
+		if (vm.count("acc2taxid")) {
 			try {
-				FilesExist(taxa);
+				FilesExist(run.accession2taxid);
 			} catch (std::exception &e) {
 				std::cerr << e.what() << std::endl;
 				return ERROR_IN_COMMAND_LINE;
 			}
+			if (run.accIndexFile.empty())
+				run.accIndexFile = "accession2taxid.index";
 			if (verbosity > 1)
-				std::cout << "Taxa: " << taxa << std::endl;
-			// Nodes file only used when taxa option specified
-			if (!FileExists(nodesFile)) {
-				std::cerr << "Given nodes file does not exist: "
-						  << nodesFile << std::endl;
-				return ERROR_IN_COMMAND_LINE;
-			}
-		}
-		if (vm.count("output")) {
-			if (verbosity > 1)
-				std::cout << "Output: " << output << std::endl;
-		}
-		if (vm.count("reference")) {
-			try {
-				FilesExist(refs);
-			} catch (std::exception &e) {
-				std::cerr << e.what() << std::endl;
+				std::cout << "Accession2taxid: " << run.accession2taxid
+						  << std::endl;
+		} else if (vm.count("accIndex")) {
+			if (!FileExists(run.accIndexFile)) {
+				std::cerr << "Given accession index does not exist: "
+						  << run.accIndexFile << std::endl;
 				return ERROR_IN_COMMAND_LINE;
 			}
-			if (verbosity > 1)
-				std::cout << "References: " << refs << std::endl;
 		}
+		if (vm.count("accIndex") && verbosity > 1)
+			std::cout << "Accession index: " << run.accIndexFile << std::endl;
 		/*
 		if (vm.count("unreg")) {
 			if (verbosity > 1)
@@ -188,134 +1904,126 @@ int main(int argc, char *argv[]) {
 		}
 		*/
 
-		// Find GI numbers given taxonomy IDs
-		std::string tempGIsFile;
-		if (!taxa.empty()) {
-			std::vector<int> taxIDs, temp;
-
-			// Consolidate taxIDs into one vector
-			for (std::vector<std::string>::iterator it = taxa.begin();
-				 it != taxa.end();
+		// Look names up rather than build anything
+		if (vm.count("searchNames")) {
+			runStatistics.BeginStage("search names");
+			NameIndex names(run.namesFile, run.namesCacheFile,
+							run.verifyCaches);
+			std::vector< std::pair<std::string, int> > found =
+				names.FindPrefix(run.nameSearch);
+			for (std::vector< std::pair<std::string, int> >::iterator it =
+				 found.begin();
+				 it != found.end();
 				 it++) {
-				ReadFile(*it, temp);
-				taxIDs.insert(taxIDs.end(), temp.begin(), temp.end());
+				if (it->second == NameIndex::AMBIGUOUS_NAME)
+					std::cout << "ambiguous";
+				else
+					std::cout << it->second;
+				std::cout << "\t" << it->first << "\n";
 			}
-
-			// Find taxID of last common ancestor
-			if (verbosity > 1)
-				std::cout << "Finding LCA's taxonomy ID" << std::endl; 
-			LCA_Finder lca_finder(nodesFile);
-			int LCA_ID = lca_finder.GetLCA_ID<std::vector, int>(taxIDs);
 			if (verbosity > 0)
-				std::cout << "LCA ID: " << LCA_ID << std::endl;
+				std::cout << found.size() << " of " << names.Size()
+						  << " names" << std::endl;
+			SaveStatistics(runStatistics, base.statsFile, std::cerr);
+			return SUCCESS;
+		}
 
-			// Get the gis associated with LCA (and children)
-			if (verbosity > 1)
-				std::cout << "Finding the GI's associated with LCA"
+		// Answer taxonomy queries rather than build anything
+		if (!run.serveSocket.empty()) {
+			if (run.taxCacheFile.empty() && !FileExists(run.nodesFile)) {
+				std::cerr << "Given nodes file does not exist: "
+						  << run.nodesFile << std::endl;
+				return ERROR_IN_COMMAND_LINE;
+			}
+			LCA_Finder lca_finder;
+			LoadTaxonomy(lca_finder, run, runStatistics);
+			if (verbosity > 0)
+				std::cout << "Serving " << lca_finder.Size()
+						  << " taxonomy nodes on: " << run.serveSocket
 						  << std::endl;
-			tempGIsFile = GetTempFileName("LCA_GIs");
-			system(("esearch"
-					" -db nuccore"
-					" -query \"txid" + 
-							   boost::lexical_cast<std::string>(LCA_ID) + 
-							   "[Organism:" +
-							   ((getChildrenGIs) ? "exp" : "noexp") + "]\""
-					" | "
-					"efetch"
-					" -format uid"
-					" > " + tempGIsFile
-					).c_str());
+			TaxonomyServer(lca_finder).Serve(run.serveSocket);
+			SaveStatistics(runStatistics, base.statsFile, std::cerr);
+			return SUCCESS;
+		}
 
-			// Check if anything was returned
-			if (GetFileSize(tempGIsFile) > 0) {
-				if (verbosity > 1)
-					std::cout << "Found GI's; adding to GI list" << std::endl;
-				gis.push_back(tempGIsFile);
-			} else {
-				std::cerr << "Warning: no direct links found for last common "
-						  << "ancestor (ID: " << LCA_ID << "). Try using "
-						  << "--children flag" << std::endl;
+		// Read the batch of jobs, each building its own database; the report
+		// asked for on the command line covers the batch as a whole
+		std::vector<JobOptions> batch;
+		std::string statsFile = base.statsFile;
+		if (!run.manifestFile.empty()) {
+			base.statsFile.clear();
+			batch = ReadJobs(run.manifestFile, base);
+			std::set<std::string> outputs;
+			for (size_t i = 0; i < batch.size(); i++) {
+				batch[i].prefix = batch[i].output + ".";
+				batch[i].jobs = 1;
+				if (CheckJob(batch[i], run, std::cout, std::cerr) != SUCCESS)
+					return ERROR_IN_COMMAND_LINE;
+				if (!outputs.insert(batch[i].output).second) {
+					std::cerr << "Jobs share the same output: "
+							  << batch[i].output << std::endl;
+					return ERROR_IN_COMMAND_LINE;
+				}
 			}
+		} else {
+			base.jobs = run.jobs;
+			if (CheckJob(base, run, std::cout, std::cerr) != SUCCESS)
+				return ERROR_IN_COMMAND_LINE;
 		}
 
-		// Create database from refs
-		if (!refs.empty()) {
-			std::string refList = ToCmdLineStr(refs.begin(), refs.end());
-			std::string refDBName = ToCmdLineStr(refs.begin(), refs.end(), "_", 
-												 &RemoveExtension);
-												 
-			// Build command for creating a BLAST database from reference FASTAs
-			const std::string cmd = ("makeblastdb"
-				" -dbtype " + dbtype +
-				" -in " 	+ refList +
-				" -out " 	+ refDBName +
-				((verbosity > 0) ? "" : " >/dev/null 2>&1")
-			);
+		// Build the binary taxonomy cache
+		LCA_Finder lca_finder;
+		if (run.buildTaxCache) {
+			runStatistics.BeginStage("taxonomy cache");
 			if (verbosity > 1)
-				std::cout << "Executing: " << cmd << std::endl;
-			system(cmd.c_str());
-			dbs.push_back(refDBName);
+				std::cout << "Building taxonomy cache" << std::endl;
+			lca_finder.LoadData(run.nodesFile.c_str());
+			runStatistics.AddInput("bytes", GetFileSize(run.nodesFile));
+			runStatistics.AddInput("nodes", lca_finder.Size());
+			lca_finder.SaveCache(run.taxCacheFile, run.nodesFile);
 		}
 
-		// Create database from given GI numbers
-		if (!gis.empty()) {
-
-			// Prepare command line arguments
-			std::string giList = ToCmdLineStr(gis.begin(), gis.end());
-			std::string giDBName = ToCmdLineStr(gis.begin(), gis.end(), "_", 
-												&RemoveExtension);
-
-			// Set this silly parameter in order to create the database type?!?
-			std::string blastDBName;
-			if (dbtype == "nucl") 
-				blastDBName = blastPath + "/nt";
-			else 
-				blastDBName = blastPath + "/nr";
-			
-			// Build command for aliasing multiple BLAST databases / GI files
-			const std::string cmd = ("blastdb_aliastool"
-				" -db " + blastDBName +
-				" -dbtype " + dbtype +
-				((gis.empty()) ? "" : (" -gilist " + giList)) +
-				" -out " + giDBName +
-				" -title " + giDBName +
-				((verbosity > 0) ? "" : " >/dev/null 2>&1")
-			);
+		// Build the accession index
+		if (!run.accession2taxid.empty()) {
+			runStatistics.BeginStage("accession index");
 			if (verbosity > 1)
-				std::cout << "Executing: " << cmd << std::endl;
-			system(cmd.c_str());
-			dbs.push_back(giDBName);
+				std::cout << "Building accession index" << std::endl;
+			AccessionIndex::Build(run.accession2taxid, run.accIndexFile);
+			for (size_t i = 0; i < run.accession2taxid.size(); i++)
+				runStatistics.AddInput("bytes",
+									   GetFileSize(run.accession2taxid[i]));
 		}
-		
-		// Create an aggregated database based off of previous databases, the
-		// newly created reference database, and the newly created GI number db
-		if (dbs.size()) {
-			
-			// Prepare command line arguments
-			std::string dbList = ToCmdLineStr(dbs.begin(), dbs.end());
-			
-			// Set this silly parameter in order to create the database type?!?
-			std::string blastDBName;
-			if (dbtype == "nucl") 
-				blastDBName = blastPath + "/nt";
-			else 
-				blastDBName = blastPath + "/nr";
-			
-			// Build command for aliasing multiple BLAST databases / GI files
-			const std::string cmd = ("blastdb_aliastool"
-				" -dbtype " + dbtype +
-				((dbs.empty()) ? "" : (" -dblist " + dbList)) +
-				" -out " + output +
-				" -title " + output +
-				((verbosity > 0) ? "" : " >/dev/null 2>&1")
-			);
-			if (verbosity > 1)
-				std::cout << "Executing: " << cmd << std::endl;
-			system(cmd.c_str());
+
+		// Build the one database described on the command line
+		if (run.manifestFile.empty()) {
+			int status = RunJob(base, run,
+				(lca_finder.Size() > 0) ? &lca_finder : NULL, runStatistics,
+				std::cout, std::cerr);
+			SaveStatistics(runStatistics, statsFile, std::cerr);
+			return status;
 		}
 
-		// Cleanup
-		if (!tempGIsFile.empty()) system(("rm " + tempGIsFile).c_str());
+		// Otherwise load the taxonomy once for every job to share, unless a
+		// taxonomy server is there to answer them
+		TaxonomyClient taxServer;
+		bool useTaxServer = !run.taxServerSocket.empty() &&
+			taxServer.Connect(run.taxServerSocket);
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (!batch[i].taxa.empty() && lca_finder.Size() == 0 &&
+				!useTaxServer) {
+				runStatistics.BeginStage("load taxonomy");
+				LoadTaxonomy(lca_finder, run, runStatistics);
+			}
+		}
+
+		// Run the jobs (up to --jobs at once), each failing on its own
+		runStatistics.BeginStage("jobs");
+		runStatistics.AddInput("jobs", batch.size());
+		int status = RunJobs(batch, run,
+			(lca_finder.Size() > 0) ? &lca_finder : NULL, "Job", std::cout,
+			std::cerr);
+		SaveStatistics(runStatistics, statsFile, std::cerr);
+		return status;
 
 	} catch (const std::exception &e) {
 		std::cerr << "An exception occurred:\n" << e.what() << std::endl;
@@ -0,0 +1,738 @@
+// Fasta.cpp - Reads FASTA files natively so that references can be checked
+// (and later processed) before they are handed to makeblastdb. Files are
+// mapped into memory (or inflated a window at a time if gzipped), split at
+// record boundaries into chunks and the chunks are parsed in parallel.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Compression.hpp"
+#include "Fasta.hpp"
+#include "HelperFunctions.hpp"
+
+namespace {
+	// Files are split into chunks of about this many bytes
+	const size_t FASTA_CHUNK_SIZE = 64 << 20;
+	// Gzipped files are inflated and scanned about this many bytes at a time
+	const size_t FASTA_WINDOW_SIZE = 4 * FASTA_CHUNK_SIZE;
+	// Most problems described per file
+	const size_t MAX_PROBLEMS = 10;
+
+	// How each byte of a sequence line is treated
+	enum ResidueClass {
+		INVALID_RESIDUE,
+		VALID_RESIDUE,
+		IGNORED_CHARACTER	// Whitespace
+	};
+
+	// A table classifying every byte for a sequence type
+	struct Alphabet {
+		unsigned char classes[256];
+
+		Alphabet(bool protein) {
+			// IUPAC codes, NCBIstdaa includes every letter for proteins
+			const char *residues = protein ?
+				"ABCDEFGHIJKLMNOPQRSTUVWXYZ*-" : "ACGTURYSWKMBDHVN-";
+			memset(classes, INVALID_RESIDUE, sizeof(classes));
+			for (const char *c = residues; *c != '\0'; c++) {
+				classes[(unsigned char)*c] = VALID_RESIDUE;
+				classes[(unsigned char)tolower(*c)] = VALID_RESIDUE;
+			}
+			classes[(unsigned char)' '] = IGNORED_CHARACTER;
+			classes[(unsigned char)'\t'] = IGNORED_CHARACTER;
+			classes[(unsigned char)'\r'] = IGNORED_CHARACTER;
+		}
+	};
+
+	const Alphabet &GetAlphabet(bool protein) {
+		static const Alphabet nucleotides(false), proteins(true);
+		return protein ? proteins : nucleotides;
+	}
+
+	// Returns the number of leading bytes of the 16 at data that are residues
+	// of the common case: unambiguous bases for nucleotides and letters for
+	// proteins, in either case. Vectorized where SSE2 is available
+	inline size_t CommonResidues(const unsigned char *data, bool protein) {
+#ifdef __SSE2__
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+		// Setting 0x20 lowercases letters and maps nothing else onto them
+		__m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+		__m128i valid;
+		if (protein) {
+			__m128i offset = _mm_sub_epi8(lower, _mm_set1_epi8('a'));
+			valid = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(25)),
+								   offset);
+		} else {
+			valid = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('a')),
+							 _mm_cmpeq_epi8(lower, _mm_set1_epi8('c'))),
+				_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('g')),
+							 _mm_cmpeq_epi8(lower, _mm_set1_epi8('t'))));
+		}
+		unsigned int mask = _mm_movemask_epi8(valid);
+		return (mask == 0xFFFF) ? 16 : __builtin_ctz(~mask);
+#else
+		return 0;
+#endif
+	}
+
+	// What was found in one chunk of a file
+	struct ChunkResult {
+		uint64_t records;
+		uint64_t residues;
+		uint64_t emptyRecords;
+		uint64_t invalidResidues;
+		uint64_t strayLines;
+		uint64_t lines;
+		std::vector< std::pair<uint64_t, size_t> > ids;	// Hash, file offset
+		std::vector< std::pair<uint64_t, std::string> > problems; // By line
+
+		ChunkResult()
+			: records(0), residues(0), emptyRecords(0), invalidResidues(0)
+			, strayLines(0), lines(0) {}
+	};
+
+	// Returns the length of the ID starting at data (up to whitespace)
+	size_t IDLength(const char *data, const char *end) {
+		const char *c = data;
+		while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+			c++;
+		return c - data;
+	}
+
+	// Returns the chunk boundaries of a file: its start, the start of the first
+	// record after every FASTA_CHUNK_SIZE bytes, and its end
+	std::vector<size_t> FindChunks(const char *data, size_t size) {
+		std::vector<size_t> boundaries(1, 0);
+		size_t position = FASTA_CHUNK_SIZE;
+		while (position < size) {
+			// Only a '>' at the start of a line begins a record
+			const char *header = data + position;
+			for (;;) {
+				header = static_cast<const char *>(
+					memchr(header, '>', data + size - header));
+				if (header == NULL || header[-1] == '\n') break;
+				header++;
+			}
+			if (header == NULL) break;
+			boundaries.push_back(header - data);
+			position = boundaries.back() + FASTA_CHUNK_SIZE;
+		}
+		boundaries.push_back(size);
+		return boundaries;
+	}
+
+	// Hands a FASTA file to handle as runs of whole records, each with its
+	// offset in the file: all at once if the file is plain (it is mapped), or
+	// a window at a time if it is gzipped, so that only one window of it is
+	// ever inflated in memory. A record longer than a window grows the window
+	template <typename Handler>
+	void ScanFasta(const std::string &fileName, unsigned int threads,
+				   Handler handle) {
+		if (!IsGzipFile(fileName)) {
+			MappedFile fasta(fileName);
+			handle(fasta.Data(), fasta.Size(), 0);
+			return;
+		}
+
+		// The partial record at the end of each window is carried over to
+		// the start of the next
+		InputStream fasta(std::vector<std::string>(1, fileName), threads);
+		std::vector<char> buffer(FASTA_WINDOW_SIZE);
+		size_t filled = 0;
+		uint64_t offset = 0;
+		while (true) {
+			if (filled == buffer.size()) buffer.resize(2 * buffer.size());
+			size_t count = fasta.Read(&buffer[filled], buffer.size() - filled);
+			if (count == 0) break;
+			filled += count;
+			if (filled < buffer.size()) continue;
+
+			// Only a '>' at the start of a line begins a record
+			size_t recordsEnd = filled - 1;
+			while (recordsEnd > 0 && (buffer[recordsEnd] != '>' ||
+									  buffer[recordsEnd - 1] != '\n')) {
+				recordsEnd--;
+			}
+			if (recordsEnd == 0) continue;
+			handle(&buffer[0], recordsEnd, offset);
+			offset += recordsEnd;
+			filled -= recordsEnd;
+			memmove(&buffer[0], &buffer[recordsEnd], filled);
+		}
+		handle(&buffer[0], filled, offset);
+	}
+
+	// Notes a problem found on a line of a chunk
+	void AddProblem(ChunkResult &result, uint64_t line,
+					const std::string &description) {
+		if (result.problems.size() < MAX_PROBLEMS)
+			result.problems.push_back(std::make_pair(line, description));
+	}
+
+	// Returns the number of residues on a sequence line, counting those not in
+	// the alphabet into invalid and pointing firstInvalid at the first of them
+	uint64_t CountResidues(const unsigned char *c, const unsigned char *end,
+						   const Alphabet &alphabet, bool protein,
+						   uint64_t &invalid,
+						   const unsigned char *&firstInvalid) {
+		uint64_t residues = 0;
+		while (c < end) {
+			// Bulk of the line, sixteen bytes at a time
+			if (end - c >= 16) {
+				size_t common = CommonResidues(c, protein);
+				residues += common;
+				c += common;
+				if (common == 16) continue;
+			}
+			// Anything else, byte by byte through the table
+			unsigned char type = alphabet.classes[*c];
+			residues += (type == VALID_RESIDUE);
+			if (type == INVALID_RESIDUE) {
+				if (firstInvalid == NULL) firstInvalid = c;
+				invalid++;
+			}
+			c++;
+		}
+		return residues;
+	}
+
+	// Parses the records within [first, last) of a file at data
+	void ParseChunk(const char *data, size_t first, size_t last,
+					const Alphabet &alphabet, bool protein,
+					ChunkResult &result) {
+		const char *cursor = data + first, *end = data + last;
+		const char *id = NULL;
+		size_t idLength = 0;
+		uint64_t recordResidues = 0, recordLine = 0;
+
+		while (cursor < end) {
+			const char *newline = static_cast<const char *>(
+				memchr(cursor, '\n', end - cursor));
+			const char *lineEnd = (newline == NULL) ? end : newline;
+			result.lines++;
+
+			if (*cursor == '>') {
+				if (id != NULL && recordResidues == 0) {
+					result.emptyRecords++;
+					AddProblem(result, recordLine,
+							   "empty record " + std::string(id, idLength));
+				}
+				id = cursor + 1;
+				idLength = IDLength(id, lineEnd);
+				recordResidues = 0;
+				recordLine = result.lines;
+				result.records++;
+				result.ids.push_back(std::make_pair(HashBytes(id, idLength),
+													(size_t)(id - data)));
+				if (idLength == 0)
+					AddProblem(result, result.lines, "record without an ID");
+			} else {
+				uint64_t invalid = 0;
+				const unsigned char *firstInvalid = NULL;
+				uint64_t residues = CountResidues(
+					reinterpret_cast<const unsigned char *>(cursor),
+					reinterpret_cast<const unsigned char *>(lineEnd),
+					alphabet, protein, invalid, firstInvalid);
+				if (id == NULL) {
+					// Anything but blank lines before the first header
+					if (residues > 0 || invalid > 0) {
+						result.strayLines++;
+						AddProblem(result, result.lines,
+								   "sequence before the first header");
+					}
+				} else {
+					recordResidues += residues;
+					result.residues += residues;
+					if (invalid > 0) {
+						result.invalidResidues += invalid;
+						AddProblem(result, result.lines,
+								   "invalid residue '" +
+								   std::string(1, *firstInvalid) +
+								   "' in record " + std::string(id, idLength));
+					}
+				}
+			}
+			cursor = lineEnd + 1;
+		}
+		if (id != NULL && recordResidues == 0) {
+			result.emptyRecords++;
+			AddProblem(result, recordLine,
+					   "empty record " + std::string(id, idLength));
+		}
+	}
+
+	// Marks a record without duplicates, or the last of a sequence's records
+	const uint64_t NO_DUPLICATE = (uint64_t)-1;
+	// Marks a record not dealt to any shard
+	const uint16_t NOT_DEALT = std::numeric_limits<uint16_t>::max();
+
+	// A record found while deduplicating, with the hash of its sequence
+	struct HashedRecord {
+		uint64_t hashLow;
+		uint64_t hashHigh;
+		size_t begin;		// Offset of its '>'
+		uint64_t residues;
+	};
+
+	// Hashes the sequence of every record within [first, last) of a file,
+	// counting its residues as MeasureChunk does. Residues are uppercased and
+	// whitespace dropped before hashing, so line lengths and case don't matter
+	void HashChunk(const char *data, size_t first, size_t last,
+				   std::vector<HashedRecord> &records) {
+		const char *cursor = data + first, *end = data + last;
+		Hasher128 hasher;
+		char normalized[4096];
+		size_t normalizedLength = 0;
+
+		while (cursor < end) {
+			const char *newline = static_cast<const char *>(
+				memchr(cursor, '\n', end - cursor));
+			const char *lineEnd = (newline == NULL) ? end : newline + 1;
+			if (*cursor == '>') {
+				if (!records.empty()) {
+					hasher.Update(normalized, normalizedLength);
+					hasher.Final(records.back().hashLow,
+								 records.back().hashHigh);
+				}
+				HashedRecord record;
+				record.begin = cursor - data;
+				record.residues = 0;
+				records.push_back(record);
+				hasher = Hasher128();
+				normalizedLength = 0;
+			} else if (!records.empty()) {
+				for (const char *c = cursor; c < lineEnd; c++) {
+					if (*c == '\n' || *c == '\r' || *c == ' ' || *c == '\t')
+						continue;
+					normalized[normalizedLength++] = toupper(*c);
+					records.back().residues++;
+					if (normalizedLength == sizeof(normalized)) {
+						hasher.Update(normalized, normalizedLength);
+						normalizedLength = 0;
+					}
+				}
+			}
+			cursor = lineEnd;
+		}
+		if (!records.empty()) {
+			hasher.Update(normalized, normalizedLength);
+			hasher.Final(records.back().hashLow, records.back().hashHigh);
+		}
+	}
+
+	// Finds the records within [first, last) of a file, noting where each
+	// begins and how many residues it has (bytes of its sequence lines bar
+	// whitespace)
+	void MeasureChunk(const char *data, size_t first, size_t last,
+					  std::vector<size_t> &begins,
+					  std::vector<uint64_t> &residues) {
+		const char *cursor = data + first, *end = data + last;
+		while (cursor < end) {
+			const char *newline = static_cast<const char *>(
+				memchr(cursor, '\n', end - cursor));
+			const char *lineEnd = (newline == NULL) ? end : newline + 1;
+			if (*cursor == '>') {
+				begins.push_back(cursor - data);
+				residues.push_back(0);
+			} else if (!residues.empty()) {
+				uint64_t count = 0;
+				for (const char *c = cursor; c < lineEnd; c++)
+					count += (*c != '\n' && *c != '\r' && *c != ' ' &&
+							  *c != '\t');
+				residues.back() += count;
+			}
+			cursor = lineEnd;
+		}
+	}
+
+	// Chains each record repeating the sequence of an earlier one onto the
+	// first record of that sequence, through an open addressing (linear
+	// probing) hash set of record numbers, flagging it as a duplicate
+	void ChainDuplicates(const std::vector< std::pair<uint64_t, uint64_t> >
+							&hashes,
+						 std::vector<uint64_t> &nextDuplicates,
+						 std::vector<bool> &duplicates) {
+		size_t capacity = 16;
+		while (capacity < 2 * hashes.size()) capacity <<= 1;
+		std::vector<uint64_t> slots(capacity, NO_DUPLICATE);
+		std::vector<uint64_t> lastDuplicates(hashes.size(), NO_DUPLICATE);
+		nextDuplicates.assign(hashes.size(), NO_DUPLICATE);
+		duplicates.assign(hashes.size(), false);
+		for (size_t record = 0; record < hashes.size(); record++) {
+			size_t slot = hashes[record].first & (capacity - 1);
+			while (slots[slot] != NO_DUPLICATE &&
+				   hashes[slots[slot]] != hashes[record]) {
+				slot = (slot + 1) & (capacity - 1);
+			}
+			if (slots[slot] == NO_DUPLICATE) {
+				slots[slot] = record;
+				lastDuplicates[record] = record;
+				continue;
+			}
+			uint64_t first = slots[slot];
+			nextDuplicates[lastDuplicates[first]] = record;
+			lastDuplicates[first] = record;
+			duplicates[record] = true;
+		}
+	}
+
+	// Returns the length of the header line of a record, without its line
+	// break
+	size_t DeflineLength(const char *record, size_t length) {
+		const char *newline = static_cast<const char *>(
+			memchr(record, '\n', length));
+		size_t defline = (newline == NULL) ? length : newline - record;
+		if (defline > 0 && record[defline - 1] == '\r') defline--;
+		return defline;
+	}
+}
+
+DeduplicationStatistics::DeduplicationStatistics()
+	: records(0), uniqueRecords(0), duplicates(0) {}
+
+FastaStatistics::FastaStatistics()
+	: records(0), residues(0), emptyRecords(0), invalidResidues(0)
+	, duplicateIDs(0), strayLines(0) {}
+
+// Returns whether nothing was wrong with the file
+bool FastaStatistics::Valid() const {
+	return emptyRecords == 0 && invalidResidues == 0 && duplicateIDs == 0 &&
+		   strayLines == 0 && problems.empty();
+}
+
+// Validates a FASTA file against the IUPAC nucleotide or protein alphabet,
+// counting records and residues and looking for empty records, stray sequence
+// and duplicated IDs. Uses up to threads threads (one per core if 0)
+// Throws std::runtime_error if the file cannot be read
+FastaStatistics ValidateFasta(const std::string &fileName, bool protein,
+							  unsigned int threads) {
+	// Parse each window of the file in chunks, combining the chunks in order
+	// and numbering their lines from the start of the file
+	const Alphabet &alphabet = GetAlphabet(protein);
+	FastaStatistics statistics;
+	statistics.fileName = fileName;
+	std::vector< std::pair<uint64_t, uint64_t> > ids;	// Hash, file offset
+	uint64_t linesBefore = 0;
+	ScanFasta(fileName, threads,
+			  [&](const char *data, size_t size, uint64_t offset) {
+		std::vector<size_t> boundaries = FindChunks(data, size);
+		std::vector<ChunkResult> chunks(boundaries.size() - 1);
+		ParallelFor(chunks.size(), threads, [&](size_t chunk) {
+			ParseChunk(data, boundaries[chunk], boundaries[chunk + 1],
+					   alphabet, protein, chunks[chunk]);
+		});
+		for (size_t chunk = 0; chunk < chunks.size(); chunk++) {
+			ChunkResult &result = chunks[chunk];
+			statistics.records += result.records;
+			statistics.residues += result.residues;
+			statistics.emptyRecords += result.emptyRecords;
+			statistics.invalidResidues += result.invalidResidues;
+			statistics.strayLines += result.strayLines;
+			for (size_t i = 0; i < result.problems.size() &&
+							   statistics.problems.size() < MAX_PROBLEMS;
+				 i++) {
+				statistics.problems.push_back("line " +
+					boost::lexical_cast<std::string>(
+						linesBefore + result.problems[i].first) +
+					": " + result.problems[i].second);
+			}
+			linesBefore += result.lines;
+			for (size_t i = 0; i < result.ids.size(); i++) {
+				ids.push_back(std::make_pair(result.ids[i].first,
+											 offset + result.ids[i].second));
+			}
+		}
+	});
+
+	// Duplicated IDs sort next to each other by hash, then by position so the
+	// first occurrence is the one kept. Equal hashes are confirmed against the
+	// IDs themselves, read back from the file
+	std::sort(ids.begin(), ids.end());
+	std::vector<uint64_t> offsets;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if ((i > 0 && ids[i].first == ids[i - 1].first) ||
+			(i + 1 < ids.size() && ids[i].first == ids[i + 1].first))
+			offsets.push_back(ids[i].second);
+	}
+	if (offsets.empty()) return statistics;
+	std::sort(offsets.begin(), offsets.end());
+	std::vector<std::string> offsetIDs(offsets.size());
+	size_t next = 0;
+	ScanFasta(fileName, threads,
+			  [&](const char *data, size_t size, uint64_t offset) {
+		for (; next < offsets.size() && offsets[next] < offset + size; next++) {
+			const char *id = data + (offsets[next] - offset);
+			offsetIDs[next].assign(id, IDLength(id, data + size));
+		}
+	});
+	for (size_t i = 1, first = 0; i < ids.size(); i++) {
+		if (ids[i].first != ids[first].first) {
+			first = i;
+			continue;
+		}
+		const std::string &id = offsetIDs[std::lower_bound(offsets.begin(),
+			offsets.end(), ids[i].second) - offsets.begin()];
+		const std::string &original = offsetIDs[std::lower_bound(
+			offsets.begin(), offsets.end(), ids[first].second) -
+			offsets.begin()];
+		if (id.empty() || id != original) continue;
+		statistics.duplicateIDs++;
+		if (statistics.problems.size() < MAX_PROBLEMS)
+			statistics.problems.push_back("duplicated ID " + id);
+	}
+	return statistics;
+}
+
+// FastaShards - The records of FASTA files dealt out into shards
+FastaShards::Cursor::Cursor() : file(0), record(0), offset(0) {}
+
+// Deals the records of files out into shards, first folding together those
+// with the same sequence if deduplicating
+// Throws std::runtime_error if a file cannot be read or is gzipped, or if too
+// many shards are needed
+FastaShards::FastaShards(const std::vector<std::string> &fileNames,
+						 size_t shards, uint64_t maxResidues,
+						 unsigned int threads, bool deduplicate) {
+	// Find every record and its residues (and hash its sequence if
+	// deduplicating), a chunk of a file at a time
+	std::vector< std::pair<size_t, std::pair<size_t, size_t> > > chunks;
+	for (size_t file = 0; file < fileNames.size(); file++) {
+		// Records are read back in any order, so the files are mapped rather
+		// than inflated whole into memory
+		if (IsGzipFile(fileNames[file]))
+			throw std::runtime_error("Cannot shard a gzipped file: " +
+									 fileNames[file]);
+		files.push_back(boost::shared_ptr<MappedFile>(
+			new MappedFile(fileNames[file])));
+		std::vector<size_t> boundaries = FindChunks(files.back()->Data(),
+													files.back()->Size());
+		for (size_t i = 0; i + 1 < boundaries.size(); i++) {
+			chunks.push_back(std::make_pair(file,
+				std::make_pair(boundaries[i], boundaries[i + 1])));
+		}
+	}
+	std::vector< std::vector<size_t> > chunkBegins(chunks.size());
+	std::vector< std::vector<uint64_t> > chunkResidues(chunks.size());
+	std::vector< std::vector< std::pair<uint64_t, uint64_t> > >
+		chunkHashes(chunks.size());
+	ParallelFor(chunks.size(), threads, [&](size_t chunk) {
+		const char *data = files[chunks[chunk].first]->Data();
+		size_t first = chunks[chunk].second.first;
+		size_t last = chunks[chunk].second.second;
+		if (!deduplicate) {
+			MeasureChunk(data, first, last, chunkBegins[chunk],
+						 chunkResidues[chunk]);
+			return;
+		}
+		std::vector<HashedRecord> records;
+		HashChunk(data, first, last, records);
+		for (size_t i = 0; i < records.size(); i++) {
+			chunkBegins[chunk].push_back(records[i].begin);
+			chunkResidues[chunk].push_back(records[i].residues);
+			chunkHashes[chunk].push_back(std::make_pair(records[i].hashLow,
+														records[i].hashHigh));
+		}
+	});
+	recordBegins.resize(files.size());
+	std::vector<uint64_t> residues;
+	std::vector< std::pair<uint64_t, uint64_t> > hashes;
+	for (size_t chunk = 0; chunk < chunks.size(); chunk++) {
+		std::vector<size_t> &begins = recordBegins[chunks[chunk].first];
+		begins.insert(begins.end(), chunkBegins[chunk].begin(),
+					  chunkBegins[chunk].end());
+		residues.insert(residues.end(), chunkResidues[chunk].begin(),
+						chunkResidues[chunk].end());
+		hashes.insert(hashes.end(), chunkHashes[chunk].begin(),
+					  chunkHashes[chunk].end());
+		std::vector<size_t>().swap(chunkBegins[chunk]);
+		std::vector<uint64_t>().swap(chunkResidues[chunk]);
+		std::vector< std::pair<uint64_t, uint64_t> >().swap(
+			chunkHashes[chunk]);
+	}
+	for (size_t file = 0; file < files.size(); file++)
+		recordBegins[file].push_back(files[file]->Size());
+	fileFirstRecords.assign(1, 0);
+	for (size_t file = 0; file < files.size(); file++) {
+		fileFirstRecords.push_back(fileFirstRecords.back() +
+								   recordBegins[file].size() - 1);
+	}
+
+	// Only the first record of each sequence is dealt out
+	std::vector<bool> duplicates;
+	if (deduplicate) {
+		ChainDuplicates(hashes, nextDuplicates, duplicates);
+		std::vector< std::pair<uint64_t, uint64_t> >().swap(hashes);
+		deduplication.records = residues.size();
+		deduplication.duplicates = std::count(duplicates.begin(),
+											  duplicates.end(), true);
+		deduplication.uniqueRecords = deduplication.records -
+									  deduplication.duplicates;
+	}
+	std::vector<uint64_t> order;
+	uint64_t totalResidues = 0;
+	for (size_t record = 0; record < residues.size(); record++) {
+		if (deduplicate && duplicates[record]) continue;
+		order.push_back(record);
+		totalResidues += residues[record];
+	}
+
+	// As many shards as asked for, and enough to respect the limit
+	size_t count = std::max(shards, (size_t)1);
+	if (maxResidues > 0)
+		count = std::max(count,
+			(size_t)((totalResidues + maxResidues - 1) / maxResidues));
+	count = std::max(std::min(count, order.size()), (size_t)1);
+	if (count >= NOT_DEALT)
+		throw std::runtime_error("Too many shards: " +
+								 boost::lexical_cast<std::string>(count));
+	std::vector<uint64_t> dealtRecords(count, 0);
+	shardResidues.assign(count, 0);
+
+	// Deal the records out longest first, each to the lightest shard (the
+	// one with fewer records, then the first, on a tie)
+	std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+		return (residues[a] != residues[b]) ? residues[a] > residues[b] :
+											  a < b;
+	});
+	typedef std::pair< std::pair<uint64_t, uint64_t>, size_t > Load;
+	std::priority_queue< Load, std::vector<Load>, std::greater<Load> > loads;
+	for (size_t shard = 0; shard < count; shard++)
+		loads.push(Load(std::make_pair(0, 0), shard));
+	std::vector<uint16_t> dealt(residues.size(), NOT_DEALT);
+	for (size_t i = 0; i < order.size(); i++) {
+		size_t shard = loads.top().second;
+		loads.pop();
+		dealt[order[i]] = shard;
+		dealtRecords[shard]++;
+		shardResidues[shard] += residues[order[i]];
+		loads.push(Load(std::make_pair(shardResidues[shard],
+									   dealtRecords[shard]), shard));
+	}
+
+	// List the records of each shard in input order
+	shardRecords.resize(count);
+	for (size_t shard = 0; shard < count; shard++)
+		shardRecords[shard].reserve(dealtRecords[shard]);
+	for (size_t record = 0; record < dealt.size(); record++)
+		if (dealt[record] != NOT_DEALT)
+			shardRecords[dealt[record]].push_back(record);
+}
+
+size_t FastaShards::Count() const {
+	return shardRecords.size();
+}
+
+uint64_t FastaShards::Records(size_t shard) const {
+	return shardRecords[shard].size();
+}
+
+uint64_t FastaShards::Residues(size_t shard) const {
+	return shardResidues[shard];
+}
+
+const DeduplicationStatistics &FastaShards::Deduplication() const {
+	return deduplication;
+}
+
+// Copies up to size bytes of the records of a shard into output, from cursor
+// on, moving cursor along. A record with duplicates has its header line
+// replaced by the merged deflines, and a record missing its final newline is
+// given one
+// Returns the number of bytes copied, 0 at the end of the shard
+size_t FastaShards::Read(size_t shard, Cursor &cursor, char *output,
+						 size_t size) const {
+	const std::vector<uint64_t> &records = shardRecords[shard];
+	size_t copied = 0;
+	while (copied < size && cursor.record < records.size()) {
+		// The shard's records are in input order, so its files are visited in
+		// turn
+		uint64_t number = records[cursor.record];
+		while (number >= fileFirstRecords[cursor.file + 1]) cursor.file++;
+		const std::vector<size_t> &begins = recordBegins[cursor.file];
+		size_t index = number - fileFirstRecords[cursor.file];
+		const char *record = files[cursor.file]->Data() + begins[index];
+		size_t length = begins[index + 1] - begins[index];
+		if (cursor.offset == 0 && cursor.defline.empty() &&
+			!nextDuplicates.empty() && nextDuplicates[number] != NO_DUPLICATE)
+			cursor.defline = MergedDefline(number);
+
+		// The record as read: the merged defline (if any) in place of its
+		// header line, the rest of it, then a newline if it lacked one
+		const char *body = record;
+		if (!cursor.defline.empty()) {
+			const char *newline = static_cast<const char *>(
+				memchr(record, '\n', length));
+			body = (newline == NULL) ? record + length : newline + 1;
+		}
+		size_t header = cursor.defline.size();
+		size_t bodyLength = length - (body - record);
+		char last = (bodyLength > 0) ? body[bodyLength - 1] : '\n';
+		size_t total = header + bodyLength + ((last != '\n') ? 1 : 0);
+		if (cursor.offset < header) {
+			size_t count = std::min(size - copied, header - cursor.offset);
+			memcpy(output + copied, cursor.defline.data() + cursor.offset,
+				   count);
+			copied += count;
+			cursor.offset += count;
+		} else if (cursor.offset < header + bodyLength) {
+			size_t count = std::min(size - copied,
+									header + bodyLength - cursor.offset);
+			memcpy(output + copied, body + (cursor.offset - header), count);
+			copied += count;
+			cursor.offset += count;
+		} else {
+			output[copied++] = '\n';
+			cursor.offset++;
+		}
+		if (cursor.offset == total) {
+			cursor.record++;
+			cursor.offset = 0;
+			cursor.defline.clear();
+		}
+	}
+	return copied;
+}
+
+// Returns the text of a record, counting across the files
+const char *FastaShards::Record(uint64_t number, size_t &length) const {
+	size_t file = std::upper_bound(fileFirstRecords.begin(),
+								   fileFirstRecords.end(), number) -
+				  fileFirstRecords.begin() - 1;
+	const std::vector<size_t> &begins = recordBegins[file];
+	size_t index = number - fileFirstRecords[file];
+	length = begins[index + 1] - begins[index];
+	return files[file]->Data() + begins[index];
+}
+
+// Returns the defline of a record followed by those of its duplicates (less
+// their '>'), separated by ^A characters, as a header line
+std::string FastaShards::MergedDefline(uint64_t number) const {
+	size_t length;
+	const char *record = Record(number, length);
+	std::string defline(record, DeflineLength(record, length));
+	for (uint64_t other = nextDuplicates[number];
+		 other != NO_DUPLICATE;
+		 other = nextDuplicates[other]) {
+		record = Record(other, length);
+		defline += '\x01';
+		defline.append(record + 1, DeflineLength(record, length) - 1);
+	}
+	defline += '\n';
+	return defline;
+}
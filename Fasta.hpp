@@ -0,0 +1,120 @@
+// Fasta.hpp - Reads FASTA files natively so that references can be checked
+// (and later processed) before they are handed to makeblastdb. Files are
+// mapped into memory (or inflated a window at a time if gzipped), split at
+// record boundaries into chunks and the chunks are parsed in parallel. Records
+// can be deduplicated and dealt out into shards of about equal size, each to
+// be streamed into its own database volume.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef FASTA_HPP
+#define FASTA_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+
+class MappedFile;
+
+// What was found while validating a FASTA file
+struct FastaStatistics {
+	std::string fileName;
+	uint64_t records;
+	uint64_t residues;
+	uint64_t emptyRecords;			// Headers without any sequence
+	uint64_t invalidResidues;		// Not in the alphabet of the sequence type
+	uint64_t duplicateIDs;			// Records reusing an earlier record's ID
+	uint64_t strayLines;			// Sequence before the first header
+	std::vector<std::string> problems;	// Descriptions of the first few
+
+	FastaStatistics();
+	// Returns whether nothing was wrong with the file
+	bool Valid() const;
+};
+
+// What was found while deduplicating FASTA files
+struct DeduplicationStatistics {
+	uint64_t records;
+	uint64_t uniqueRecords;
+	uint64_t duplicates;			// Records folded into an earlier record
+
+	DeduplicationStatistics();
+};
+
+// The records of FASTA files dealt out into shards with about the same number
+// of residues, so that searches split across the shards take about as long
+// on each. Records are dealt longest first, each to the shard with the fewest
+// residues so far (longest processing time first bin packing, within 4/3 of
+// the best possible balance), and each shard keeps its records in input order.
+// When deduplicating, only the first record of each distinct sequence
+// (ignoring case and line breaks) is dealt, and it takes on the deflines of
+// its duplicates separated by ^A characters as in NCBI's nr. Sequences are
+// compared by 128 bit hashes computed in parallel
+class FastaShards {
+public:
+	// Where a reader of a shard is up to
+	struct Cursor {
+		size_t file;			// Holding the record
+		size_t record;			// Within the shard
+		size_t offset;			// Within the record as read
+		std::string defline;	// Merged with its duplicates', if it has any
+		Cursor();
+	};
+
+	// Deals the records of files out into shards shards, or into more if
+	// needed for none to hold much more than maxResidues residues (no limit
+	// if 0), but never more than there are records. Uses up to threads
+	// threads (one per core if 0). The files are mapped, not decompressed
+	// Throws std::runtime_error if a file cannot be read or is gzipped, or if
+	// too many shards are needed
+	FastaShards(const std::vector<std::string> &files, size_t shards,
+				uint64_t maxResidues = 0, unsigned int threads = 0,
+				bool deduplicate = false);
+	size_t Count() const;
+	uint64_t Records(size_t shard) const;
+	uint64_t Residues(size_t shard) const;
+	// Returns what deduplicating found (all zero if not deduplicating)
+	const DeduplicationStatistics &Deduplication() const;
+	// Copies up to size bytes of the records of a shard (each ending with a
+	// newline) into output, from cursor on, moving cursor along
+	// Returns the number of bytes copied, 0 at the end of the shard
+	size_t Read(size_t shard, Cursor &cursor, char *output, size_t size) const;
+private:
+	// Non-copyable, as the files are shared with readers
+	FastaShards(const FastaShards &);
+	FastaShards &operator=(const FastaShards &);
+
+	// Returns the text of a record, counting across the files
+	const char *Record(uint64_t number, size_t &length) const;
+	// Returns the defline of a record merged with those of its duplicates
+	std::string MergedDefline(uint64_t number) const;
+
+	std::vector< boost::shared_ptr<MappedFile> > files;
+	// By file: where each record begins (then the end of the file), and the
+	// number of its first record counting across the files (then the number
+	// of records)
+	std::vector< std::vector<size_t> > recordBegins;
+	std::vector<uint64_t> fileFirstRecords;
+	// By shard: the numbers of its records, in input order, so that a reader
+	// of a shard only visits its own records
+	std::vector< std::vector<uint64_t> > shardRecords;
+	std::vector<uint64_t> shardResidues;
+	// By record, when deduplicating: the next record repeating its sequence
+	// (NO_DUPLICATE if none)
+	std::vector<uint64_t> nextDuplicates;
+	DeduplicationStatistics deduplication;
+};
+
+// Validates a FASTA file against the IUPAC nucleotide or protein alphabet
+// (either case, plus gaps), counting records and residues and looking for
+// empty records, stray sequence and duplicated IDs. Uses up to threads
+// threads (one per core if 0). A gzipped file is inflated a window at a time
+// rather than whole, and only the hashes and positions of its IDs are kept
+// Throws std::runtime_error if the file cannot be read
+FastaStatistics ValidateFasta(const std::string &fileName, bool protein,
+							  unsigned int threads = 0);
+
+#endif // FASTA_HPP
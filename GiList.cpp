@@ -0,0 +1,714 @@
+// GiList.cpp - Compiles GI number lists into the binary GI list format read by
+// BLAST (-gilist), so overlapping lists are merged once rather than re-parsed
+// by blastdb_aliastool and BLAST on every use, and combines them as sets held
+// as compressed bitmaps.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "GiList.hpp"
+#include "Compression.hpp"
+#include "HelperFunctions.hpp"
+
+namespace {
+	// Binary GI lists start with a marker of -1 and the number of GIs, then
+	// hold the GIs themselves, all as big endian 32 bit integers
+	const uint32_t BINARY_GI_LIST_MARKER = 0xFFFFFFFF;
+	const uint64_t MAX_BINARY_GI = 0xFFFFFFFF;
+
+	// Numbers buffered when reading back a spilled run
+	const size_t MIN_RUN_BUFFER = 4096;
+
+	// Writes a 32 bit integer in big endian order
+	void WriteBigEndian(std::ofstream &ofs, uint32_t value) {
+		char bytes[4] = {
+			(char)(value >> 24), (char)(value >> 16),
+			(char)(value >> 8), (char)value
+		};
+		ofs.write(bytes, sizeof(bytes));
+	}
+
+	// Writes GIs in order to a binary GI list, dropping repeats, with the
+	// count patched into the header at the end
+	class BinaryGIListWriter {
+	public:
+		BinaryGIListWriter(const std::string &fileName)
+			: fileName(fileName), count(0), last(0)
+		{
+			ofs.open(fileName.c_str(),
+					 std::ios::out | std::ios::binary | std::ios::trunc);
+			if (ofs.fail())
+				throw std::runtime_error("Cannot write: " + fileName);
+			WriteBigEndian(ofs, BINARY_GI_LIST_MARKER);
+			WriteBigEndian(ofs, 0);
+		}
+		void Add(uint64_t gi) {
+			if (count > 0 && gi == last) return;
+			if (gi > MAX_BINARY_GI) {
+				throw std::runtime_error("GI too large for a binary GI list: " +
+										 boost::lexical_cast<std::string>(gi));
+			}
+			WriteBigEndian(ofs, gi);
+			last = gi;
+			count++;
+		}
+		uint64_t Finish() {
+			if (count > MAX_BINARY_GI)
+				throw std::runtime_error("Too many GIs for: " + fileName);
+			ofs.seekp(4);
+			WriteBigEndian(ofs, count);
+			ofs.close();
+			if (ofs.fail())
+				throw std::runtime_error("Cannot write: " + fileName);
+			return count;
+		}
+	private:
+		std::ofstream ofs;
+		std::string fileName;
+		uint64_t count;
+		uint64_t last;
+	};
+
+	// Reads back a spilled run a buffer at a time
+	class RunReader {
+	public:
+		RunReader(const std::string &fileName, size_t bufferSize)
+			: buffer(bufferSize), position(0), size(0)
+		{
+			ifs.open(fileName.c_str(), std::ios::in | std::ios::binary);
+			if (ifs.fail())
+				throw std::runtime_error("Cannot read: " + fileName);
+		}
+		// Returns false once the run is exhausted
+		bool Next(uint64_t &value) {
+			if (position == size) {
+				ifs.read(reinterpret_cast<char *>(&buffer[0]),
+						 buffer.size() * sizeof(uint64_t));
+				size = ifs.gcount() / sizeof(uint64_t);
+				position = 0;
+				if (size == 0) return false;
+			}
+			value = buffer[position++];
+			return true;
+		}
+	private:
+		std::ifstream ifs;
+		std::vector<uint64_t> buffer;
+		size_t position;
+		size_t size;
+	};
+
+	// Sorts a run, drops its repeats and writes it to a new temporary file
+	std::string SpillRun(std::vector<uint64_t> &run) {
+		std::sort(run.begin(), run.end());
+		run.erase(std::unique(run.begin(), run.end()), run.end());
+		std::string fileName = GetTempFileName("GI_run");
+		std::ofstream ofs(fileName.c_str(), std::ios::out | std::ios::binary);
+		if (ofs.fail())
+			throw std::runtime_error("Cannot write: " + fileName);
+		if (!run.empty())
+			ofs.write(reinterpret_cast<const char *>(&run[0]),
+					  run.size() * sizeof(uint64_t));
+		ofs.close();
+		if (ofs.fail())
+			throw std::runtime_error("Cannot write: " + fileName);
+		run.clear();
+		return fileName;
+	}
+
+	// GiSet containers each cover 65536 GIs: up to 4096 of them are smallest
+	// as an array, more as a bitmap of 1024 words
+	const uint32_t CONTAINER_BITS = 16;
+	const uint64_t CONTAINER_MASK = 0xFFFF;
+	const size_t BITMAP_WORDS = 1024;
+	const uint32_t MAX_ARRAY_VALUES = 4096;
+	// GIs added by each thread at the least, when spreading additions
+	const size_t MIN_PARALLEL_ADD = (size_t)1 << 20;
+	// Bytes of a GI list read into a set at a time
+	const size_t GI_SEGMENT_SIZE = (size_t)64 << 20;
+
+	// Fills bits with the set bit of every value of a container
+	void ToBitmap(const GiContainer &container, std::vector<uint64_t> &bits) {
+		if (container.kind == GiContainer::BITMAP) {
+			bits = container.bits;
+			return;
+		}
+		bits.assign(BITMAP_WORDS, 0);
+		if (container.kind == GiContainer::ARRAY) {
+			for (std::vector<uint16_t>::const_iterator it =
+				 container.values.begin();
+				 it != container.values.end();
+				 it++) {
+				bits[*it >> 6] |= (uint64_t)1 << (*it & 63);
+			}
+			return;
+		}
+		for (size_t i = 0; i + 1 < container.values.size(); i += 2) {
+			uint32_t first = container.values[i], last = container.values[i + 1];
+			for (uint32_t word = first >> 6; word <= (last >> 6); word++) {
+				uint64_t mask = ~(uint64_t)0;
+				if (word == (first >> 6)) mask &= ~(uint64_t)0 << (first & 63);
+				if (word == (last >> 6))
+					mask &= ~(uint64_t)0 >> (63 - (last & 63));
+				bits[word] |= mask;
+			}
+		}
+	}
+
+	// Sets a container (whose key is already set) to the values of a bitmap,
+	// as whichever kind of container is smallest. Takes the bitmap's words
+	void FromBitmap(GiContainer &container, std::vector<uint64_t> &bits) {
+		// A run starts at each set bit whose lower neighbour is clear
+		uint32_t cardinality = 0, runs = 0;
+		for (size_t i = 0; i < BITMAP_WORDS; i++) {
+			uint64_t carry = (i > 0) ? bits[i - 1] >> 63 : 0;
+			cardinality += __builtin_popcountll(bits[i]);
+			runs += __builtin_popcountll(bits[i] & ~((bits[i] << 1) | carry));
+		}
+		container.cardinality = cardinality;
+		container.values.clear();
+		size_t arrayBytes = 2 * (size_t)cardinality, runBytes = 4 * (size_t)runs,
+			   bitmapBytes = BITMAP_WORDS * sizeof(uint64_t);
+		if (runBytes < std::min(arrayBytes, bitmapBytes)) {
+			container.kind = GiContainer::RUNS;
+			std::vector<uint16_t> lasts;
+			for (size_t i = 0; i < BITMAP_WORDS; i++) {
+				uint64_t below = (i > 0) ? bits[i - 1] >> 63 : 0;
+				uint64_t above = (i + 1 < BITMAP_WORDS) ? bits[i + 1] << 63 : 0;
+				uint64_t firsts = bits[i] & ~((bits[i] << 1) | below);
+				uint64_t ends = bits[i] & ~((bits[i] >> 1) | above);
+				for (; firsts != 0; firsts &= firsts - 1)
+					container.values.push_back(i * 64 + __builtin_ctzll(firsts));
+				for (; ends != 0; ends &= ends - 1)
+					lasts.push_back(i * 64 + __builtin_ctzll(ends));
+			}
+			container.values.resize(2 * runs);
+			for (size_t run = runs; run-- > 0; ) {
+				container.values[2 * run] = container.values[run];
+				container.values[2 * run + 1] = lasts[run];
+			}
+			std::vector<uint64_t>().swap(container.bits);
+		} else if (arrayBytes < bitmapBytes) {
+			container.kind = GiContainer::ARRAY;
+			container.values.reserve(cardinality);
+			for (size_t i = 0; i < BITMAP_WORDS; i++) {
+				for (uint64_t word = bits[i]; word != 0; word &= word - 1)
+					container.values.push_back(i * 64 + __builtin_ctzll(word));
+			}
+			std::vector<uint64_t>().swap(container.bits);
+		} else {
+			container.kind = GiContainer::BITMAP;
+			container.bits.swap(bits);
+		}
+	}
+
+	// Sets a container (whose key is already set) to sorted, duplicate free
+	// values, as whichever kind of container is smallest. Takes the values
+	void FromArray(GiContainer &container, std::vector<uint16_t> &values) {
+		if (values.size() > MAX_ARRAY_VALUES) {
+			std::vector<uint64_t> bits(BITMAP_WORDS, 0);
+			for (std::vector<uint16_t>::const_iterator it = values.begin();
+				 it != values.end();
+				 it++) {
+				bits[*it >> 6] |= (uint64_t)1 << (*it & 63);
+			}
+			FromBitmap(container, bits);
+			return;
+		}
+		size_t runs = values.empty() ? 0 : 1;
+		for (size_t i = 1; i < values.size(); i++)
+			if (values[i] != values[i - 1] + 1) runs++;
+		container.cardinality = values.size();
+		std::vector<uint64_t>().swap(container.bits);
+		if (4 * runs < 2 * values.size()) {
+			container.kind = GiContainer::RUNS;
+			container.values.clear();
+			for (size_t i = 0; i < values.size(); i++) {
+				if (i == 0 || values[i] != values[i - 1] + 1) {
+					if (i > 0) container.values.push_back(values[i - 1]);
+					container.values.push_back(values[i]);
+				}
+			}
+			if (!values.empty()) container.values.push_back(values.back());
+		} else {
+			container.kind = GiContainer::ARRAY;
+			container.values.swap(values);
+		}
+	}
+
+	// Returns whether a container holds a value
+	bool ContainerHolds(const GiContainer &container, uint16_t value) {
+		const std::vector<uint16_t> &values = container.values;
+		switch (container.kind) {
+		case GiContainer::ARRAY:
+			return std::binary_search(values.begin(), values.end(), value);
+		case GiContainer::BITMAP:
+			return (container.bits[value >> 6] >> (value & 63)) & 1;
+		default:
+			// The runs' firsts and lasts alternate in ascending order, so the
+			// value is in a run if the first bound above it is a last
+			std::vector<uint16_t>::const_iterator bound =
+				std::lower_bound(values.begin(), values.end(), value);
+			if (bound == values.end()) return false;
+			return *bound == value || (bound - values.begin()) % 2 == 1;
+		}
+	}
+
+	// Calls visit(value) for every value of a container, in ascending order
+	template <typename Visit>
+	void ForEachValue(const GiContainer &container, Visit visit) {
+		const std::vector<uint16_t> &values = container.values;
+		switch (container.kind) {
+		case GiContainer::ARRAY:
+			for (size_t i = 0; i < values.size(); i++) visit(values[i]);
+			break;
+		case GiContainer::BITMAP:
+			for (size_t i = 0; i < BITMAP_WORDS; i++) {
+				for (uint64_t word = container.bits[i]; word != 0;
+					 word &= word - 1)
+					visit(i * 64 + __builtin_ctzll(word));
+			}
+			break;
+		default:
+			for (size_t i = 0; i + 1 < values.size(); i += 2)
+				for (uint32_t value = values[i]; value <= values[i + 1]; value++)
+					visit(value);
+		}
+	}
+
+	// Combines two containers of the same key into result. Arrays are merged
+	// (or filtered) as they are; anything else goes through bitmaps
+	void CombineContainers(const GiContainer &left, const GiContainer &right,
+						   GiSet::Operation op, GiContainer &result) {
+		result.key = left.key;
+		if (left.kind == GiContainer::ARRAY &&
+			(right.kind == GiContainer::ARRAY || op != GiSet::UNION)) {
+			std::vector<uint16_t> values;
+			if (right.kind == GiContainer::ARRAY) {
+				const std::vector<uint16_t> &a = left.values, &b = right.values;
+				if (op == GiSet::UNION) {
+					std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+								   std::back_inserter(values));
+				} else if (op == GiSet::INTERSECTION) {
+					std::set_intersection(a.begin(), a.end(), b.begin(),
+										  b.end(), std::back_inserter(values));
+				} else {
+					std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+										std::back_inserter(values));
+				}
+			} else {
+				for (size_t i = 0; i < left.values.size(); i++) {
+					if (ContainerHolds(right, left.values[i]) ==
+						(op == GiSet::INTERSECTION))
+						values.push_back(left.values[i]);
+				}
+			}
+			FromArray(result, values);
+			return;
+		}
+		std::vector<uint64_t> bits, rightBits;
+		ToBitmap(left, bits);
+		ToBitmap(right, rightBits);
+		for (size_t i = 0; i < BITMAP_WORDS; i++) {
+			if (op == GiSet::UNION) bits[i] |= rightBits[i];
+			else if (op == GiSet::INTERSECTION) bits[i] &= rightBits[i];
+			else bits[i] &= ~rightBits[i];
+		}
+		FromBitmap(result, bits);
+	}
+
+	// Builds the containers, ordered by key, of GIs in any order. Each key's
+	// values are gathered in an array until there are too many, then in a
+	// bitmap
+	void BuildContainers(const uint64_t *first, const uint64_t *last,
+						 std::vector<GiContainer> &containers) {
+		struct Builder {
+			uint64_t key;
+			std::vector<uint16_t> values;
+			std::vector<uint64_t> bits;
+		};
+		std::vector<Builder> builders;
+		std::unordered_map<uint64_t, size_t> slots;		// Key to builder
+		size_t slot = 0;
+		for (const uint64_t *gi = first; gi != last; gi++) {
+			uint64_t key = *gi >> CONTAINER_BITS;
+			uint16_t value = *gi & CONTAINER_MASK;
+			// GIs usually come sorted or in clumps, so the last key is reused
+			if (builders.empty() || builders[slot].key != key) {
+				std::pair<std::unordered_map<uint64_t, size_t>::iterator, bool>
+					found = slots.insert(std::make_pair(key, builders.size()));
+				if (found.second) {
+					builders.push_back(Builder());
+					builders.back().key = key;
+				}
+				slot = found.first->second;
+			}
+			Builder &builder = builders[slot];
+			if (builder.bits.empty()) {
+				builder.values.push_back(value);
+				if (builder.values.size() > MAX_ARRAY_VALUES) {
+					builder.bits.assign(BITMAP_WORDS, 0);
+					for (size_t i = 0; i < builder.values.size(); i++) {
+						builder.bits[builder.values[i] >> 6] |=
+							(uint64_t)1 << (builder.values[i] & 63);
+					}
+					std::vector<uint16_t>().swap(builder.values);
+				}
+			} else {
+				builder.bits[value >> 6] |= (uint64_t)1 << (value & 63);
+			}
+		}
+
+		std::vector< std::pair<uint64_t, size_t> > order;	// Key, builder
+		for (size_t i = 0; i < builders.size(); i++)
+			order.push_back(std::make_pair(builders[i].key, i));
+		std::sort(order.begin(), order.end());
+		containers.resize(order.size());
+		for (size_t i = 0; i < order.size(); i++) {
+			Builder &builder = builders[order[i].second];
+			containers[i].key = builder.key;
+			if (!builder.bits.empty()) {
+				FromBitmap(containers[i], builder.bits);
+			} else {
+				std::sort(builder.values.begin(), builder.values.end());
+				builder.values.erase(std::unique(builder.values.begin(),
+												 builder.values.end()),
+									 builder.values.end());
+				FromArray(containers[i], builder.values);
+			}
+		}
+	}
+
+	// Reads a big endian 32 bit integer
+	uint32_t ReadBigEndian(const char *data) {
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+		return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+			   ((uint32_t)bytes[2] << 8) | bytes[3];
+	}
+}
+
+// An empty container
+GiContainer::GiContainer() : key(0), kind(ARRAY), cardinality(0) {}
+
+// An empty set, whose operations use up to threads threads
+GiSet::GiSet(unsigned int threads) : threads(threads) {}
+
+// Adds GIs in any order, larger batches split across threads that each build
+// a set of their share, which are then unioned
+void GiSet::Add(const uint64_t *gis, size_t count) {
+	if (count == 0) return;
+	size_t pieces = std::min<size_t>(
+		(threads == 0) ? DefaultThreadCount() : threads,
+		count / MIN_PARALLEL_ADD);
+	if (pieces <= 1) {
+		GiSet added(threads);
+		BuildContainers(gis, gis + count, added.containers);
+		Union(added);
+		return;
+	}
+	std::vector<GiSet> added(pieces, GiSet(threads));
+	ParallelFor(pieces, threads, [&](size_t piece) {
+		BuildContainers(gis + count * piece / pieces,
+						gis + count * (piece + 1) / pieces,
+						added[piece].containers);
+	});
+	for (size_t piece = 0; piece < pieces; piece++) Union(added[piece]);
+}
+
+void GiSet::Add(const std::vector<uint64_t> &gis) {
+	if (!gis.empty()) Add(&gis[0], gis.size());
+}
+
+// Adds the GIs of a text or binary GI list (told apart by the binary list's
+// marker, which no text list starts with), a segment at a time
+void GiSet::AddFile(const std::string &fileName) {
+	InputFile list(fileName, "", threads);
+	const char *data = list.Data();
+	size_t size = list.Size();
+	std::vector<uint64_t> gis;
+
+	if (size >= 8 && ReadBigEndian(data) == BINARY_GI_LIST_MARKER) {
+		if ((size - 8) / 4 != ReadBigEndian(data + 4) || (size - 8) % 4 != 0)
+			throw std::runtime_error("Malformed binary GI list: " + fileName);
+		size_t segment = GI_SEGMENT_SIZE / sizeof(uint64_t);
+		for (size_t position = 8; position < size; ) {
+			size_t end = std::min(size, position + 4 * segment);
+			gis.clear();
+			for (; position < end; position += 4)
+				gis.push_back(ReadBigEndian(data + position));
+			Add(gis);
+		}
+		return;
+	}
+
+	uint64_t line = 1;
+	for (size_t position = 0; position < size; ) {
+		size_t end = size;
+		if (size - position > GI_SEGMENT_SIZE) {
+			const char *newline = static_cast<const char *>(memchr(
+				data + position + GI_SEGMENT_SIZE, '\n',
+				size - position - GI_SEGMENT_SIZE));
+			if (newline != NULL) end = newline + 1 - data;
+		}
+		gis.clear();
+		line += ParseIntegers(data + position, end - position, fileName, gis,
+							  threads, line);
+		Add(gis);
+		position = end;
+	}
+}
+
+// Returns the number of GIs
+uint64_t GiSet::Size() const {
+	uint64_t size = 0;
+	for (std::vector<GiContainer>::const_iterator it = containers.begin();
+		 it != containers.end();
+		 it++) {
+		size += it->cardinality;
+	}
+	return size;
+}
+
+bool GiSet::Empty() const {
+	return containers.empty();
+}
+
+bool GiSet::Contains(uint64_t gi) const {
+	GiContainer key;
+	key.key = gi >> CONTAINER_BITS;
+	std::vector<GiContainer>::const_iterator found = std::lower_bound(
+		containers.begin(), containers.end(), key,
+		[](const GiContainer &a, const GiContainer &b) {
+			return a.key < b.key;
+		});
+	return found != containers.end() && found->key == key.key &&
+		   ContainerHolds(*found, gi & CONTAINER_MASK);
+}
+
+// Returns the bytes taken by the containers
+size_t GiSet::MemoryUsage() const {
+	size_t bytes = containers.capacity() * sizeof(GiContainer);
+	for (std::vector<GiContainer>::const_iterator it = containers.begin();
+		 it != containers.end();
+		 it++) {
+		bytes += it->values.capacity() * sizeof(uint16_t) +
+				 it->bits.capacity() * sizeof(uint64_t);
+	}
+	return bytes;
+}
+
+// Pairs up the containers of both sets by key, combining the pairs across
+// threads. A container without a partner is kept as it is or dropped, as op
+// wants, and containers left empty are dropped
+void GiSet::Combine(const GiSet &other, Operation op) {
+	const size_t NONE = (size_t)-1;
+	std::vector< std::pair<size_t, size_t> > pairs;	// This set's, other's
+	size_t i = 0, j = 0;
+	while (i < containers.size() || j < other.containers.size()) {
+		if (j == other.containers.size() || (i < containers.size() &&
+			containers[i].key < other.containers[j].key)) {
+			if (op != INTERSECTION) pairs.push_back(std::make_pair(i, NONE));
+			i++;
+		} else if (i == containers.size() ||
+				   other.containers[j].key < containers[i].key) {
+			if (op == UNION) pairs.push_back(std::make_pair(NONE, j));
+			j++;
+		} else {
+			pairs.push_back(std::make_pair(i++, j++));
+		}
+	}
+
+	std::vector<GiContainer> combined(pairs.size());
+	ParallelFor(pairs.size(), threads, [&](size_t k) {
+		if (pairs[k].first == NONE) {
+			combined[k] = other.containers[pairs[k].second];
+		} else if (pairs[k].second == NONE) {
+			std::swap(combined[k], containers[pairs[k].first]);
+		} else {
+			CombineContainers(containers[pairs[k].first],
+							  other.containers[pairs[k].second], op,
+							  combined[k]);
+		}
+	});
+	containers.clear();
+	for (size_t k = 0; k < combined.size(); k++) {
+		if (combined[k].cardinality == 0) continue;
+		containers.push_back(GiContainer());
+		std::swap(containers.back(), combined[k]);
+	}
+}
+
+// Keeps the GIs in either set
+void GiSet::Union(const GiSet &other) {
+	Combine(other, UNION);
+}
+
+// Keeps the GIs in both sets
+void GiSet::Intersect(const GiSet &other) {
+	Combine(other, INTERSECTION);
+}
+
+// Keeps the GIs not in other
+void GiSet::Subtract(const GiSet &other) {
+	Combine(other, DIFFERENCE);
+}
+
+// Appends the GIs to gis in ascending order
+void GiSet::ToVector(std::vector<uint64_t> &gis) const {
+	gis.reserve(gis.size() + Size());
+	for (std::vector<GiContainer>::const_iterator it = containers.begin();
+		 it != containers.end();
+		 it++) {
+		uint64_t high = it->key << CONTAINER_BITS;
+		ForEachValue(*it, [&](uint32_t value) {
+			gis.push_back(high | value);
+		});
+	}
+}
+
+// Writes the GIs in ascending order as a binary GI list
+// Returns the number of GIs written
+// Throws std::runtime_error if a GI does not fit in 32 bits or the file
+// cannot be written
+uint64_t GiSet::WriteBinaryGIList(const std::string &outputFile) const {
+	BinaryGIListWriter writer(outputFile);
+	for (std::vector<GiContainer>::const_iterator it = containers.begin();
+		 it != containers.end();
+		 it++) {
+		uint64_t high = it->key << CONTAINER_BITS;
+		ForEachValue(*it, [&](uint32_t value) {
+			writer.Add(high | value);
+		});
+	}
+	return writer.Finish();
+}
+
+// Merges text GI lists and the given GIs into one sorted, duplicate free
+// binary GI list, in runs of at most memoryBudget bytes, the lists parsed
+// across up to threads threads. Returns the number of GIs written
+// Throws std::runtime_error if a list cannot be read or holds something other
+// than GIs that fit in 32 bits, or if the output cannot be written
+uint64_t CompileGIList(const std::vector<std::string> &files,
+					   const std::vector<uint64_t> &gis,
+					   const std::string &outputFile, size_t memoryBudget,
+					   unsigned int threads) {
+	size_t runCapacity = std::max(memoryBudget / sizeof(uint64_t),
+								  MIN_RUN_BUFFER);
+	std::vector<uint64_t> run;
+	std::vector<std::string> runFiles;
+	uint64_t written = 0;
+
+	try {
+		// Gather the numbers of every list into runs, parsing each list in
+		// newline aligned segments small enough that a run never outgrows its
+		// budget (every number takes at least two bytes of text)
+		size_t segmentSize = std::max(runCapacity / 2, MIN_RUN_BUFFER);
+		run.reserve(std::min(runCapacity, (size_t)1 << 20));
+		for (std::vector<std::string>::const_iterator file = files.begin();
+			 file != files.end();
+			 file++) {
+			InputFile list(*file);
+			const char *data = list.Data();
+			size_t size = list.Size(), position = 0;
+			uint64_t line = 1;
+			while (position < size) {
+				size_t end = size;
+				if (size - position > segmentSize) {
+					const char *newline = static_cast<const char *>(memchr(
+						data + position + segmentSize, '\n',
+						size - position - segmentSize));
+					if (newline != NULL) end = newline + 1 - data;
+				}
+				if (run.size() + (end - position) / 2 + 1 > runCapacity &&
+					!run.empty()) {
+					runFiles.push_back(SpillRun(run));
+				}
+				line += ParseIntegers(data + position, end - position, *file,
+									  run, threads, line);
+				position = end;
+			}
+		}
+
+		// Then the GIs given in memory
+		for (size_t first = 0; first < gis.size(); ) {
+			if (run.size() >= runCapacity) runFiles.push_back(SpillRun(run));
+			size_t count = std::min(gis.size() - first,
+									runCapacity - run.size());
+			run.insert(run.end(), gis.begin() + first,
+					   gis.begin() + first + count);
+			first += count;
+		}
+
+		if (runFiles.empty()) {
+			// Everything fit in memory
+			std::sort(run.begin(), run.end());
+			run.erase(std::unique(run.begin(), run.end()), run.end());
+			WriteBinaryGIList(run, outputFile);
+			written = run.size();
+		} else {
+			// K-way merge of the spilled runs, smallest GI first
+			runFiles.push_back(SpillRun(run));
+			std::vector<uint64_t>().swap(run);
+			size_t bufferSize = std::max(runCapacity / (runFiles.size() + 1),
+										 MIN_RUN_BUFFER);
+			std::vector<RunReader *> readers;
+			typedef std::pair<uint64_t, size_t> Head; // GI, run
+			std::priority_queue<Head, std::vector<Head>,
+								std::greater<Head> > heads;
+			try {
+				uint64_t gi;
+				for (size_t i = 0; i < runFiles.size(); i++) {
+					readers.push_back(new RunReader(runFiles[i], bufferSize));
+					if (readers[i]->Next(gi)) heads.push(Head(gi, i));
+				}
+				BinaryGIListWriter writer(outputFile);
+				while (!heads.empty()) {
+					Head head = heads.top();
+					heads.pop();
+					writer.Add(head.first);
+					if (readers[head.second]->Next(gi))
+						heads.push(Head(gi, head.second));
+				}
+				written = writer.Finish();
+			} catch (...) {
+				for (size_t i = 0; i < readers.size(); i++) delete readers[i];
+				throw;
+			}
+			for (size_t i = 0; i < readers.size(); i++) delete readers[i];
+		}
+	} catch (...) {
+		for (size_t i = 0; i < runFiles.size(); i++)
+			remove(runFiles[i].c_str());
+		throw;
+	}
+	for (size_t i = 0; i < runFiles.size(); i++) remove(runFiles[i].c_str());
+	return written;
+}
+
+// Writes sorted, duplicate free GIs as a binary GI list
+// Throws std::runtime_error if a GI does not fit in 32 bits or the file cannot
+// be written
+void WriteBinaryGIList(const std::vector<uint64_t> &gis,
+					   const std::string &outputFile) {
+	BinaryGIListWriter writer(outputFile);
+	for (std::vector<uint64_t>::const_iterator it = gis.begin();
+		 it != gis.end();
+		 it++) {
+		writer.Add(*it);
+	}
+	writer.Finish();
+}
@@ -0,0 +1,120 @@
+// GiList.hpp - Compiles GI number lists into the binary GI list format read by
+// BLAST (-gilist), so overlapping lists are merged once rather than re-parsed
+// by blastdb_aliastool and BLAST on every use. Lists can also be combined as
+// sets (union, intersection, difference) held as compressed bitmaps.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef GILIST_HPP
+#define GILIST_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Default memory budget for compiling GI lists
+const size_t DEFAULT_GI_MEMORY_BUDGET = (size_t)1 << 30;
+
+// ==== CLASSES ================================================================
+
+// The GIs of a GiSet sharing their upper 48 bits, held over their lower 16
+// bits in whichever kind of container is smallest: a sorted array of them
+// (up to 4096), a bitmap of all 65536, or the first and last of each run
+struct GiContainer {
+	enum Kind {
+		ARRAY,
+		BITMAP,
+		RUNS
+	};
+
+	uint64_t key;					// The upper 48 bits
+	Kind kind;
+	uint32_t cardinality;
+	std::vector<uint16_t> values;	// Sorted values, or run firsts and lasts
+	std::vector<uint64_t> bits;		// Of a bitmap
+
+	// An empty container
+	GiContainer();
+};
+
+// A set of GIs as a compressed bitmap (after Roaring bitmaps): containers of
+// GIs sharing their upper bits, ordered by those bits. Dense stretches of GIs
+// take a bit each and sparse ones two bytes each, so memory follows the
+// compressed size rather than the count, and sets are combined a container
+// at a time, the containers spread across threads
+class GiSet {
+public:
+	// How Combine treats the GIs of the two sets
+	enum Operation {
+		UNION,				// Kept if in either
+		INTERSECTION,		// Kept if in both
+		DIFFERENCE			// Kept if not in the other
+	};
+
+	// An empty set, whose operations use up to threads threads (one per core
+	// if 0)
+	GiSet(unsigned int threads = 0);
+	// Adds GIs, in any order and with any repeats
+	void Add(const uint64_t *gis, size_t count);
+	void Add(const std::vector<uint64_t> &gis);
+	// Adds the GIs of a text list (whitespace delimited numbers) or of a
+	// binary GI list, either of which may be gzipped
+	// Throws std::runtime_error if the list cannot be read or is malformed
+	void AddFile(const std::string &fileName);
+
+	// Returns the number of GIs
+	uint64_t Size() const;
+	bool Empty() const;
+	bool Contains(uint64_t gi) const;
+	// Returns the bytes taken by the containers
+	size_t MemoryUsage() const;
+
+	// Combines the set with other, a pair of containers at a time
+	void Combine(const GiSet &other, Operation op);
+	// Keeps the GIs in either set
+	void Union(const GiSet &other);
+	// Keeps the GIs in both sets
+	void Intersect(const GiSet &other);
+	// Keeps the GIs not in other
+	void Subtract(const GiSet &other);
+
+	// Appends the GIs to gis in ascending order
+	void ToVector(std::vector<uint64_t> &gis) const;
+	// Writes the GIs as a binary GI list, which BLAST reads as a positive
+	// (-gilist, GILIST) or a negative (-negative_gilist) list alike
+	// Returns the number of GIs written
+	// Throws std::runtime_error if a GI does not fit in 32 bits or the file
+	// cannot be written
+	uint64_t WriteBinaryGIList(const std::string &outputFile) const;
+private:
+	std::vector<GiContainer> containers;	// By key
+	unsigned int threads;
+};
+
+// ==== FUNCTIONS ==============================================================
+
+// Merges text GI lists (whitespace or newline delimited numbers), along with
+// GIs already in memory (e.g. those streamed from a tool), into one sorted,
+// duplicate free binary GI list. Numbers are gathered into runs of at
+// most memoryBudget bytes, each sorted as it fills; when there is more than one
+// run they are spilled to temporary files and k-way merged. Returns the number
+// of GIs written. Lists are parsed across up to threads threads (one per core
+// if 0)
+// Throws std::runtime_error if a list cannot be read or holds something other
+// than GIs that fit in 32 bits (the binary format's limit), or if the output
+// cannot be written
+uint64_t CompileGIList(const std::vector<std::string> &files,
+					   const std::vector<uint64_t> &gis,
+					   const std::string &outputFile,
+					   size_t memoryBudget = DEFAULT_GI_MEMORY_BUDGET,
+					   unsigned int threads = 0);
+
+// Writes sorted, duplicate free GIs as a binary GI list
+// Throws std::runtime_error if a GI does not fit in 32 bits or the file cannot
+// be written
+void WriteBinaryGIList(const std::vector<uint64_t> &gis,
+					   const std::string &outputFile);
+
+#endif // GILIST_HPP
@@ -4,14 +4,25 @@
 // Created On: Oct 12, 2016
 // Revised On: Never
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <boost/lexical_cast.hpp>
+#include "Compression.hpp"
 #include "HelperFunctions.hpp"
 #include <iostream>
 
@@ -28,9 +39,189 @@ const char *FileDoesNotExist::what() const throw() {
 	return message.c_str();
 }
 
+// MappedFile - A read-only memory mapping of an entire file
+MappedFile::MappedFile() : data(NULL), size(0) {}
+
+MappedFile::MappedFile(const std::string &fileName) : data(NULL), size(0) {
+	Open(fileName);
+}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+// Maps the file into memory, replacing any previous mapping
+// Throws std::runtime_error if the file cannot be opened or mapped
+void MappedFile::Open(const std::string &fileName) {
+	Close();
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error(std::string("Cannot read: ") + fileName);
+	struct stat stat_buf;
+	if (fstat(fd, &stat_buf) == -1) {
+		close(fd);
+		throw std::runtime_error(std::string("Cannot stat: ") + fileName);
+	}
+	// mmap refuses zero length mappings; an empty file is simply empty
+	if (stat_buf.st_size > 0) {
+		void *mapping = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_PRIVATE,
+							 fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error(std::string("Cannot map: ") + fileName);
+		}
+		madvise(mapping, stat_buf.st_size, MADV_SEQUENTIAL);
+		data = static_cast<const char *>(mapping);
+		size = stat_buf.st_size;
+	}
+	close(fd); // The mapping stays valid after closing the descriptor
+}
+
+void MappedFile::Close() {
+	if (data != NULL) munmap(const_cast<char *>(data), size);
+	data = NULL;
+	size = 0;
+}
+
+const char *MappedFile::Data() const {
+	return data;
+}
+
+size_t MappedFile::Size() const {
+	return size;
+}
+
+// Hasher128 - Computes a 128 bit hash (MurmurHash3_x64_128 by Austin Appleby)
+// of data given to it in pieces
+namespace {
+	const uint64_t MURMUR3_C1 = 0x87c37b91114253d5ULL;
+	const uint64_t MURMUR3_C2 = 0x4cf5ad432745937fULL;
+
+	inline uint64_t RotateLeft(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t FinalMix(uint64_t k) {
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+}
+
+Hasher128::Hasher128(uint64_t seed)
+	: h1(seed), h2(seed), tailLength(0), length(0) {}
+
+void Hasher128::Update(const void *data, size_t size) {
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	length += size;
+	// Top up a partial block left by the previous piece first
+	if (tailLength > 0) {
+		size_t take = std::min(size, sizeof(tail) - tailLength);
+		memcpy(tail + tailLength, bytes, take);
+		tailLength += take;
+		bytes += take;
+		size -= take;
+		if (tailLength < sizeof(tail)) return;
+		Block(tail);
+		tailLength = 0;
+	}
+	for (; size >= 16; bytes += 16, size -= 16) Block(bytes);
+	memcpy(tail, bytes, size);
+	tailLength = size;
+}
+
+// Returns the hash of everything given so far
+void Hasher128::Final(uint64_t &low, uint64_t &high) const {
+	uint64_t a = h1, b = h2, k1 = 0, k2 = 0;
+	switch (tailLength) {
+		case 15: k2 ^= (uint64_t)tail[14] << 48; // Fall through
+		case 14: k2 ^= (uint64_t)tail[13] << 40; // Fall through
+		case 13: k2 ^= (uint64_t)tail[12] << 32; // Fall through
+		case 12: k2 ^= (uint64_t)tail[11] << 24; // Fall through
+		case 11: k2 ^= (uint64_t)tail[10] << 16; // Fall through
+		case 10: k2 ^= (uint64_t)tail[9] << 8;   // Fall through
+		case 9:  k2 ^= (uint64_t)tail[8];
+				 k2 *= MURMUR3_C2;
+				 k2 = RotateLeft(k2, 33);
+				 k2 *= MURMUR3_C1;
+				 b ^= k2;						 // Fall through
+		case 8:  k1 ^= (uint64_t)tail[7] << 56;  // Fall through
+		case 7:  k1 ^= (uint64_t)tail[6] << 48;  // Fall through
+		case 6:  k1 ^= (uint64_t)tail[5] << 40;  // Fall through
+		case 5:  k1 ^= (uint64_t)tail[4] << 32;  // Fall through
+		case 4:  k1 ^= (uint64_t)tail[3] << 24;  // Fall through
+		case 3:  k1 ^= (uint64_t)tail[2] << 16;  // Fall through
+		case 2:  k1 ^= (uint64_t)tail[1] << 8;   // Fall through
+		case 1:  k1 ^= (uint64_t)tail[0];
+				 k1 *= MURMUR3_C1;
+				 k1 = RotateLeft(k1, 31);
+				 k1 *= MURMUR3_C2;
+				 a ^= k1;
+	}
+	a ^= length;
+	b ^= length;
+	a += b;
+	b += a;
+	a = FinalMix(a);
+	b = FinalMix(b);
+	a += b;
+	b += a;
+	low = a;
+	high = b;
+}
+
+void Hasher128::Block(const unsigned char *block) {
+	uint64_t k1, k2;
+	memcpy(&k1, block, sizeof(k1));
+	memcpy(&k2, block + 8, sizeof(k2));
+
+	k1 *= MURMUR3_C1;
+	k1 = RotateLeft(k1, 31);
+	k1 *= MURMUR3_C2;
+	h1 ^= k1;
+	h1 = RotateLeft(h1, 27);
+	h1 += h2;
+	h1 = h1 * 5 + 0x52dce729;
+
+	k2 *= MURMUR3_C2;
+	k2 = RotateLeft(k2, 33);
+	k2 *= MURMUR3_C1;
+	h2 ^= k2;
+	h2 = RotateLeft(h2, 31);
+	h2 += h1;
+	h2 = h2 * 5 + 0x38495ab5;
+}
+
+// AtomicFile - Writes a file aside and renames it into place once whole
+AtomicFile::AtomicFile(const std::string &fileName)
+	: fileName(fileName)
+	, tempName(fileName + "." + boost::lexical_cast<std::string>(getpid()) +
+			   ".temp")
+	, committed(false)
+{}
+
+AtomicFile::~AtomicFile() {
+	if (!committed) remove(tempName.c_str());
+}
+
+const std::string &AtomicFile::TempName() const {
+	return tempName;
+}
+
+// Renames the file into place
+// Throws std::runtime_error if it cannot be
+void AtomicFile::Commit() {
+	if (rename(tempName.c_str(), fileName.c_str()) != 0)
+		throw std::runtime_error("Cannot write: " + fileName);
+	committed = true;
+}
+
 // ==== FUNCTIONS ==============================================================
 
-inline bool FileExists(const std::string &name) {
+bool FileExists(const std::string &name) {
 	struct stat buffer;
 	return (stat(name.c_str(), &buffer) == 0);
 }
@@ -73,28 +264,210 @@ std::string ReadFile(const std::string &fileName) {
 }
 
 // Reads file into a vector of ints
-void ReadFile(const std::string &fileName, std::vector<int> &output) {
-	std::ifstream ifs(fileName.c_str(), std::ios::in | std::ios::binary);
+namespace {
+	// Integer lists are parsed in parallel in chunks of about this many bytes
+	const size_t INTEGER_CHUNK_SIZE = 8 << 20;
 
-	if (ifs.fail()) 
-		throw std::runtime_error(std::string("Cannot read: ") + fileName);
-	std::istream_iterator<int> start(ifs), end;
-	output.assign(start, end);
+	// Malformed lines listed in an error before the rest are only counted
+	const size_t MAX_MALFORMED_LINES = 10;
+
+	// The numbers, lines and malformed lines found in one chunk of a list
+	struct IntegerChunk {
+		std::vector<uint64_t> values;
+		uint64_t lines;
+		uint64_t malformed;
+		std::vector<uint64_t> malformedLines; // Counted from the chunk start
+		IntegerChunk() : lines(0), malformed(0) {}
+	};
+
+	inline bool IsSeparator(char c) {
+		return c == '\n' || c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Returns whether all eight bytes of a little endian word are digits
+	inline bool EightDigits(uint64_t word) {
+		return ((word & 0xF0F0F0F0F0F0F0F0ULL) |
+				(((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >>
+				 4)) == 0x3333333333333333ULL;
+	}
+
+	// Returns the value of eight digits in a little endian word
+	inline uint64_t ParseEightDigits(uint64_t word) {
+		word -= 0x3030303030303030ULL;
+		word = word * 10 + (word >> 8);
+		return (((word & 0x000000FF000000FFULL) *
+				 (100 + (1000000ULL << 32))) +
+				(((word >> 16) & 0x000000FF000000FFULL) *
+				 (1 + (10000ULL << 32)))) >> 32;
+	}
+
+	// Parses the digits in [first, last), returning false if they overflow
+	bool ParseDigitsChecked(const char *first, const char *last,
+							uint64_t &value) {
+		value = 0;
+		for (; first < last; first++) {
+			if (__builtin_mul_overflow(value, 10, &value) ||
+				__builtin_add_overflow(value, (uint64_t)(*first - '0'),
+									   &value)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Parses the numbers in [first, last), which ends after a newline or at
+	// the end of the list
+	void ParseIntegerChunk(const char *first, const char *last,
+						   IntegerChunk &chunk) {
+		const char *c = first;
+		while (c < last) {
+			if (IsSeparator(*c)) {
+				if (*c == '\n') chunk.lines++;
+				c++;
+				continue;
+			}
+
+			// Bulk of the number, eight digits at a time
+			const char *start = c;
+			uint64_t value = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			while (last - c >= 8) {
+				uint64_t word;
+				memcpy(&word, c, sizeof(word));
+				if (!EightDigits(word)) break;
+				value = value * 100000000ULL + ParseEightDigits(word);
+				c += 8;
+			}
+#endif
+			for (unsigned int digit;
+				 c < last && (digit = (unsigned char)*c - '0') <= 9;
+				 c++) {
+				value = value * 10 + digit;
+			}
+
+			// Anything but a separator after the digits spoils the line, as
+			// does a number too long to have been parsed without overflow
+			bool valid = c > start && (c == last || IsSeparator(*c));
+			if (valid && c - start > 19)
+				valid = ParseDigitsChecked(start, c, value);
+			if (valid) {
+				chunk.values.push_back(value);
+				continue;
+			}
+			chunk.malformed++;
+			if (chunk.malformedLines.size() < MAX_MALFORMED_LINES)
+				chunk.malformedLines.push_back(chunk.lines);
+			c = static_cast<const char *>(memchr(c, '\n', last - c));
+			if (c == NULL) c = last;
+		}
+	}
 }
 
-// Finds a file name to be used as a temporary dump of data
+// Parses the whitespace delimited unsigned integers in [data, data + size)
+// into output, splitting the data into newline aligned chunks parsed across
+// up to threads threads (one per core if 0). Returns the number of newlines
+// Throws std::runtime_error naming source and the malformed lines (numbered
+// from firstLine) if anything but numbers that fit in 64 bits is found
+uint64_t ParseIntegers(const char *data, size_t size,
+					   const std::string &source,
+					   std::vector<uint64_t> &output, unsigned int threads,
+					   uint64_t firstLine) {
+	// Cut the data after the first newline following every chunk's worth
+	std::vector<size_t> boundaries(1, 0);
+	while (size - boundaries.back() > INTEGER_CHUNK_SIZE) {
+		const char *newline = static_cast<const char *>(memchr(
+			data + boundaries.back() + INTEGER_CHUNK_SIZE, '\n',
+			size - boundaries.back() - INTEGER_CHUNK_SIZE));
+		if (newline == NULL) break;
+		boundaries.push_back(newline + 1 - data);
+	}
+	boundaries.push_back(size);
+
+	std::vector<IntegerChunk> chunks(boundaries.size() - 1);
+	ParallelFor(chunks.size(), threads, [&](size_t chunk) {
+		ParseIntegerChunk(data + boundaries[chunk],
+						  data + boundaries[chunk + 1], chunks[chunk]);
+	});
+
+	// Combine the chunks, numbering their lines from the start of the data
+	size_t count = output.size();
+	for (size_t chunk = 0; chunk < chunks.size(); chunk++)
+		count += chunks[chunk].values.size();
+	output.reserve(count);
+	uint64_t lines = 0, malformed = 0;
+	std::string malformedLines;
+	for (size_t chunk = 0; chunk < chunks.size(); chunk++) {
+		IntegerChunk &result = chunks[chunk];
+		output.insert(output.end(), result.values.begin(),
+					  result.values.end());
+		std::vector<uint64_t>().swap(result.values);
+		for (size_t i = 0; i < result.malformedLines.size() &&
+			 malformed + i < MAX_MALFORMED_LINES; i++) {
+			malformedLines += (malformedLines.empty() ? "" : ", ") +
+				boost::lexical_cast<std::string>(
+					firstLine + lines + result.malformedLines[i]);
+		}
+		malformed += result.malformed;
+		lines += result.lines;
+	}
+	if (malformed > 0) {
+		if (malformed > MAX_MALFORMED_LINES) {
+			malformedLines += " and " + boost::lexical_cast<std::string>(
+				malformed - MAX_MALFORMED_LINES) + " more";
+		}
+		throw std::runtime_error("Malformed numbers in: " + source +
+								 (malformed > 1 ? " (lines " : " (line ") +
+								 malformedLines + ")");
+	}
+	return lines;
+}
+
+// Reads a file of whitespace delimited unsigned integers into output
+// Throws std::runtime_error if the file cannot be read or is malformed
+void ReadFile(const std::string &fileName, std::vector<uint64_t> &output,
+			  unsigned int threads) {
+	InputFile file(fileName);
+	ParseIntegers(file.Data(), file.Size(), fileName, output, threads);
+}
+
+// Reads a file of whitespace delimited integers into output
+// Throws std::runtime_error if the file cannot be read, is malformed or holds
+// numbers too large for an int
+void ReadFile(const std::string &fileName, std::vector<int> &output,
+			  unsigned int threads) {
+	std::vector<uint64_t> values;
+	ReadFile(fileName, values, threads);
+	output.clear();
+	output.reserve(values.size());
+	for (std::vector<uint64_t>::const_iterator it = values.begin();
+		 it != values.end();
+		 it++) {
+		if (*it > (uint64_t)std::numeric_limits<int>::max()) {
+			throw std::runtime_error("Number too large in: " + fileName +
+				" (" + boost::lexical_cast<std::string>(*it) + ")");
+		}
+		output.push_back(*it);
+	}
+}
+
+// Finds a file name to be used as a temporary dump of data, creating it empty
+// so that no other thread or process can claim the same name
 // Returns the file name so it can be deleted later
+// Throws std::runtime_error if no file can be created
 std::string GetTempFileName(const char *fileName, const char *ext) {
 	std::string prefix=fileName, extension=ext;
 	std::string tempFileName = prefix + "." + extension;
 
-	if (!FileExists(tempFileName)) return tempFileName;
-	int count = 0;
-	do {
+	int count = 0, fd;
+	while ((fd = open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_EXCL,
+					  0644)) == -1) {
+		if (errno != EEXIST)
+			throw std::runtime_error("Cannot write: " + tempFileName);
 		count++;
 		tempFileName = prefix + "_" + boost::lexical_cast<std::string>(count) +
 					   "." + extension;
-	} while (FileExists(tempFileName));
+	}
+	close(fd);
 	return tempFileName;
 }
 
@@ -103,4 +476,120 @@ long GetFileSize(std::string filename) {
     struct stat stat_buf;
     int rc = stat(filename.c_str(), &stat_buf);
     return rc == 0 ? stat_buf.st_size : -1;
+}
+
+// Returns the last modification time of a file in nanoseconds (-1 if the file
+// doesn't exist)
+int64_t GetFileModificationTime(const std::string &fileName) {
+	struct stat stat_buf;
+	if (stat(fileName.c_str(), &stat_buf) != 0) return -1;
+	return (int64_t)stat_buf.st_mtim.tv_sec * 1000000000 +
+		   stat_buf.st_mtim.tv_nsec;
+}
+
+// Forgets the peak resident set size so far, so that the next call to
+// GetPeakMemory covers only what follows
+void ResetPeakMemory() {
+	std::ofstream ofs("/proc/self/clear_refs");
+	ofs << "5";
+}
+
+// Returns the peak resident set size in kB (-1 if unknown)
+long GetPeakMemory() {
+	std::ifstream ifs("/proc/self/status");
+	std::string line;
+	while (std::getline(ifs, line)) {
+		long kB;
+		if (line.compare(0, 6, "VmHWM:") == 0 &&
+			std::istringstream(line.substr(6)) >> kB) {
+			return kB;
+		}
+	}
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+	return -1;
+}
+
+// Returns the number of threads to use when none is given (one per core)
+unsigned int DefaultThreadCount() {
+	unsigned int cores = std::thread::hardware_concurrency();
+	return (cores == 0) ? 1 : cores;
+}
+
+// Returns a 64 bit hash of length bytes at data (MurmurHash64A by Austin
+// Appleby), which chews through eight bytes at a time
+uint64_t HashBytes(const void *data, size_t length, uint64_t seed) {
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	const unsigned char *end = bytes + (length / 8) * 8;
+	uint64_t h = seed ^ (length * m);
+
+	for (; bytes != end; bytes += 8) {
+		uint64_t k;
+		memcpy(&k, bytes, sizeof(k)); // Safe for unaligned data
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	switch (length & 7) {
+		case 7: h ^= (uint64_t)bytes[6] << 48; // Fall through
+		case 6: h ^= (uint64_t)bytes[5] << 40; // Fall through
+		case 5: h ^= (uint64_t)bytes[4] << 32; // Fall through
+		case 4: h ^= (uint64_t)bytes[3] << 24; // Fall through
+		case 3: h ^= (uint64_t)bytes[2] << 16; // Fall through
+		case 2: h ^= (uint64_t)bytes[1] << 8;  // Fall through
+		case 1: h ^= (uint64_t)bytes[0];
+				h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+namespace {
+	// Written as is, so only reads back the same in the same byte order
+	const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+}
+
+// Fills in a snapshot header for the current layout version
+void StampSnapshot(SnapshotHeader &header, const char *magic,
+				   uint32_t version) {
+	memcpy(header.magic, magic, sizeof(header.magic));
+	header.version = version;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+}
+
+// Returns whether a snapshot header is of the given kind and layout version,
+// and in this machine's byte order
+bool SnapshotMatches(const SnapshotHeader &header, const char *magic,
+					 uint32_t version) {
+	return memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+		   header.version == version &&
+		   header.byteOrder == SNAPSHOT_BYTE_ORDER;
+}
+
+// Stamps a source file with its size, modification time and hash
+// Throws std::runtime_error if it cannot be read
+SourceStamp StampSource(const std::string &fileName) {
+	SourceStamp stamp;
+	MappedFile source(fileName);
+	stamp.size = source.Size();
+	stamp.modificationTime = GetFileModificationTime(fileName);
+	stamp.hash = HashBytes(source.Data(), source.Size());
+	return stamp;
+}
+
+// Returns whether a source file is unchanged since it was stamped, only
+// rehashing it if its modification time changed
+bool SourceUnchanged(const std::string &fileName, const SourceStamp &stamp) {
+	long size = GetFileSize(fileName);
+	if (size < 0 || (uint64_t)size != stamp.size) return false;
+	if (GetFileModificationTime(fileName) == stamp.modificationTime)
+		return true;
+	MappedFile source(fileName);
+	return HashBytes(source.Data(), source.Size()) == stamp.hash;
 }
\ No newline at end of file
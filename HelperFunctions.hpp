@@ -7,7 +7,10 @@
 #ifndef HELPERFUNCTIONS_HPP
 #define HELPERFUNCTIONS_HPP
 
+#include <cstddef>
 #include <exception>
+#include <iosfwd>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -22,6 +25,116 @@ public:
 	virtual const char *what() const throw();
 };
 
+// A read-only memory mapping of an entire file, unmapped upon destruction.
+// Lets parsers scan large files in place without copying them onto the heap
+// Throws std::runtime_error if the file cannot be opened or mapped
+class MappedFile {
+public:
+	MappedFile();
+	MappedFile(const std::string &fileName);
+	~MappedFile();
+	void Open(const std::string &fileName);
+	void Close();
+	const char *Data() const;
+	size_t Size() const;
+private:
+	// Non-copyable, as the mapping is owned
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const char *data;
+	size_t size;
+};
+
+// An array that either owns its elements or borrows them from memory owned by
+// something else (such as a MappedFile), so that loaded data and data mapped
+// straight from disk are used the same way. Borrowed elements are read-only
+template <typename T>
+class Column {
+public:
+	Column();
+	Column(const Column &other);
+	Column &operator=(const Column &other);
+	// Borrows count elements starting at data, which must outlive the column
+	void Borrow(const T *data, size_t count);
+	// Returns the owned elements for modification, first copying them if they
+	// are borrowed
+	std::vector<T> &Mutable();
+	void Clear();
+	const T &operator[](size_t i) const;
+	const T *Data() const;
+	size_t Size() const;
+private:
+	std::vector<T> owned;
+	const T *borrowed;
+	size_t borrowedSize;
+};
+
+// Computes a 128 bit hash (MurmurHash3_x64_128) of data given to it in pieces,
+// so that something can be hashed while it is being streamed
+class Hasher128 {
+public:
+	Hasher128(uint64_t seed = 0);
+	void Update(const void *data, size_t length);
+	// Returns the hash of everything given so far
+	void Final(uint64_t &low, uint64_t &high) const;
+private:
+	void Block(const unsigned char *block);
+
+	uint64_t h1, h2;
+	unsigned char tail[16];
+	size_t tailLength;
+	uint64_t length;
+};
+
+// Writes a file aside (as "<file>.<pid>.temp") and renames it into place once
+// it is whole, so that a concurrent reader never sees half of it. The file
+// aside is removed if it is never committed
+class AtomicFile {
+public:
+	AtomicFile(const std::string &fileName);
+	~AtomicFile();
+	// Returns the name to write the file under until it is committed
+	const std::string &TempName() const;
+	// Renames the file into place
+	// Throws std::runtime_error if it cannot be
+	void Commit();
+private:
+	// Non-copyable, as the file aside is owned
+	AtomicFile(const AtomicFile &);
+	AtomicFile &operator=(const AtomicFile &);
+
+	std::string fileName;
+	std::string tempName;
+	bool committed;
+};
+
+// The start of a binary snapshot (a cache or index mapped straight from
+// disk): what it holds, the version of its layout and the byte order it was
+// written in
+struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+};
+
+// The source file a snapshot was built from, to tell when it goes stale
+struct SourceStamp {
+	uint64_t size;
+	int64_t modificationTime;
+	uint64_t hash;
+};
+
+// Where the sections (columns) of a snapshot lie, each starting on an eight
+// byte boundary so that it can be used straight from the mapping, and a
+// chained hash of their contents
+template <int SECTIONS>
+struct SnapshotSections {
+	uint64_t checksum;
+	uint64_t offsets[SECTIONS];
+	uint64_t counts[SECTIONS];
+};
+
 // ==== FUNCTIONS ==============================================================
 
 bool FileExists(const std::string &name);
@@ -59,16 +172,102 @@ std::ostream& operator<<(std::ostream& os, const std::vector<T>& v);
 // Reads file into a string
 std::string ReadFile(const std::string &fileName);
 
-// Reads file into a vector of strings
-void ReadFile(const std::string &fileName, std::vector<int> &output);
+// Parses the whitespace delimited unsigned integers in [data, data + size)
+// into output, splitting the data into newline aligned chunks parsed across
+// up to threads threads (one per core if 0). Returns the number of newlines
+// Throws std::runtime_error naming source and the malformed lines (numbered
+// from firstLine) if anything but numbers that fit in 64 bits is found
+uint64_t ParseIntegers(const char *data, size_t size,
+					   const std::string &source,
+					   std::vector<uint64_t> &output, unsigned int threads = 0,
+					   uint64_t firstLine = 1);
+
+// Reads a file of whitespace delimited unsigned integers into output
+// Throws std::runtime_error if the file cannot be read or is malformed
+void ReadFile(const std::string &fileName, std::vector<uint64_t> &output,
+			  unsigned int threads = 0);
+
+// Reads a file of whitespace delimited integers into output
+// Throws std::runtime_error if the file cannot be read, is malformed or holds
+// numbers too large for an int
+void ReadFile(const std::string &fileName, std::vector<int> &output,
+			  unsigned int threads = 0);
 
-// Finds a file name to be used as a temporary dump of data
+// Finds a file name to be used as a temporary dump of data, creating it empty
+// so that no other thread or process can claim the same name
 // Returns the file name so it can be deleted later
+// Throws std::runtime_error if no file can be created
 std::string GetTempFileName(const char *fileName, const char *ext = "temp");
 
 // Returns the file size in bytes
 long GetFileSize(std::string fileName);
 
+// Returns the last modification time of a file in nanoseconds (-1 if the file
+// doesn't exist)
+int64_t GetFileModificationTime(const std::string &fileName);
+
+// Forgets the peak resident set size so far, so that the next call to
+// GetPeakMemory covers only what follows (Linux only; elsewhere the peak is
+// that of the whole process)
+void ResetPeakMemory();
+
+// Returns the peak resident set size in kB (-1 if unknown)
+long GetPeakMemory();
+
+// Returns the number of threads to use when none is given (one per core)
+unsigned int DefaultThreadCount();
+
+// Calls task(i) for every i in [0, count) across up to threads threads (one
+// per core if 0), each thread claiming the next unclaimed index as it goes.
+// If any task throws, the first exception is rethrown once all threads stop
+template <typename Task>
+void ParallelFor(size_t count, unsigned int threads, Task task);
+
+// Returns a 64 bit hash of length bytes at data (MurmurHash64A), fast enough to
+// checksum large files and caches
+uint64_t HashBytes(const void *data, size_t length, uint64_t seed = 0);
+
+// Fills in a snapshot header for the current layout version
+void StampSnapshot(SnapshotHeader &header, const char *magic,
+				   uint32_t version);
+
+// Returns whether a snapshot header is of the given kind and layout version,
+// and in this machine's byte order
+bool SnapshotMatches(const SnapshotHeader &header, const char *magic,
+					 uint32_t version);
+
+// Stamps a source file with its size, modification time and hash
+// Throws std::runtime_error if it cannot be read
+SourceStamp StampSource(const std::string &fileName);
+
+// Returns whether a source file is unchanged since it was stamped. A new
+// modification time alone (e.g. a fresh download of the same dump) only costs
+// a rehash
+bool SourceUnchanged(const std::string &fileName, const SourceStamp &stamp);
+
+// Points a column at count elements from offset on of a mapped snapshot
+// Returns false if they do not lie within the snapshot
+template <typename T>
+bool BorrowSection(const MappedFile &file, uint64_t offset, uint64_t count,
+				   Column<T> &column);
+template <typename T, int SECTIONS>
+bool BorrowSection(const MappedFile &file,
+				   const SnapshotSections<SECTIONS> &sections, int section,
+				   Column<T> &column);
+
+// Appends a column to a snapshot being written, recording where it went and
+// folding its contents into the checksum
+template <typename T, int SECTIONS>
+void WriteSection(std::ostream &os, SnapshotSections<SECTIONS> &sections,
+				  int section, const Column<T> &column);
+
+// Returns the checksum of the sections of a mapped snapshot, given the size
+// of each section's elements. The sections must lie within the snapshot
+template <int SECTIONS>
+uint64_t ChecksumSections(const MappedFile &file,
+						  const SnapshotSections<SECTIONS> &sections,
+						  const size_t *elementSizes);
+
 // For templated functions and classes
 #include "HelperFunctions.tpp"
 
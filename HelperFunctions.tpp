@@ -14,7 +14,75 @@
 
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iterator>
+#include <mutex>
+#include <thread>
+
+// ==== CLASSES ================================================================
+
+// Column - An array that either owns its elements or borrows them
+template <typename T>
+Column<T>::Column() : borrowed(NULL), borrowedSize(0) {}
+
+template <typename T>
+Column<T>::Column(const Column &other)
+	: owned(other.owned)
+	, borrowed(other.borrowed)
+	, borrowedSize(other.borrowedSize)
+{}
+
+template <typename T>
+Column<T> &Column<T>::operator=(const Column &other) {
+	owned = other.owned;
+	borrowed = other.borrowed;
+	borrowedSize = other.borrowedSize;
+	return *this;
+}
+
+// Borrows count elements starting at data, which must outlive the column
+template <typename T>
+void Column<T>::Borrow(const T *data, size_t count) {
+	std::vector<T>().swap(owned);
+	borrowed = data;
+	borrowedSize = count;
+}
+
+// Returns the owned elements for modification, first copying them if they are
+// borrowed
+template <typename T>
+std::vector<T> &Column<T>::Mutable() {
+	if (borrowed != NULL) {
+		owned.assign(borrowed, borrowed + borrowedSize);
+		borrowed = NULL;
+		borrowedSize = 0;
+	}
+	return owned;
+}
+
+template <typename T>
+void Column<T>::Clear() {
+	std::vector<T>().swap(owned);
+	borrowed = NULL;
+	borrowedSize = 0;
+}
+
+template <typename T>
+const T &Column<T>::operator[](size_t i) const {
+	return (borrowed != NULL) ? borrowed[i] : owned[i];
+}
+
+template <typename T>
+const T *Column<T>::Data() const {
+	if (borrowed != NULL) return borrowed;
+	return owned.empty() ? NULL : &owned[0];
+}
+
+template <typename T>
+size_t Column<T>::Size() const {
+	return (borrowed != NULL) ? borrowedSize : owned.size();
+}
 
 // ==== FUNCTIONS ==============================================================
 
@@ -56,4 +124,91 @@ template<class T>
 std::ostream& operator<<(std::ostream& os, const std::vector<T>& v) {
     std::copy(v.begin(), v.end(), std::ostream_iterator<T>(os, " ")); 
     return os;
+}
+
+// Calls task(i) for every i in [0, count) across up to threads threads (one per
+// core if 0), each thread claiming the next unclaimed index as it goes.
+// If any task throws, the first exception is rethrown once all threads stop
+template <typename Task>
+void ParallelFor(size_t count, unsigned int threads, Task task) {
+	if (threads == 0) threads = DefaultThreadCount();
+	if (threads > count) threads = count;
+	if (threads <= 1) {
+		for (size_t i = 0; i < count; i++) task(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				try {
+					task(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error) error = std::current_exception();
+					next = count; // Stop handing out work
+				}
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+	if (error) std::rethrow_exception(error);
+}
+
+// Points a column at count elements from offset on of a mapped snapshot
+// Returns false if they do not lie within the snapshot
+template <typename T>
+bool BorrowSection(const MappedFile &file, uint64_t offset, uint64_t count,
+				   Column<T> &column) {
+	if (offset % 8 != 0 || offset > file.Size() ||
+		count > (file.Size() - offset) / sizeof(T)) {
+		return false;
+	}
+	column.Borrow(reinterpret_cast<const T *>(file.Data() + offset), count);
+	return true;
+}
+
+template <typename T, int SECTIONS>
+bool BorrowSection(const MappedFile &file,
+				   const SnapshotSections<SECTIONS> &sections, int section,
+				   Column<T> &column) {
+	return BorrowSection(file, sections.offsets[section],
+						 sections.counts[section], column);
+}
+
+// Appends a column to a snapshot being written, recording where it went and
+// folding its contents into the checksum
+template <typename T, int SECTIONS>
+void WriteSection(std::ostream &os, SnapshotSections<SECTIONS> &sections,
+				  int section, const Column<T> &column) {
+	static const char padding[8] = {0};
+	std::streamoff offset = os.tellp();
+	if (offset % 8 != 0) {
+		os.write(padding, 8 - offset % 8);
+		offset += 8 - offset % 8;
+	}
+	size_t bytes = column.Size() * sizeof(T);
+	sections.offsets[section] = offset;
+	sections.counts[section] = column.Size();
+	sections.checksum = HashBytes(column.Data(), bytes, sections.checksum);
+	if (bytes > 0)
+		os.write(reinterpret_cast<const char *>(column.Data()), bytes);
+}
+
+// Returns the checksum of the sections of a mapped snapshot
+template <int SECTIONS>
+uint64_t ChecksumSections(const MappedFile &file,
+						  const SnapshotSections<SECTIONS> &sections,
+						  const size_t *elementSizes) {
+	uint64_t checksum = 0;
+	for (int section = 0; section < SECTIONS; section++) {
+		checksum = HashBytes(file.Data() + sections.offsets[section],
+							 sections.counts[section] * elementSizes[section],
+							 checksum);
+	}
+	return checksum;
 }
\ No newline at end of file
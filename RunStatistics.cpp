@@ -0,0 +1,180 @@
+// RunStatistics.cpp - Times the stages of a run and the tools it launches, and
+// reports them (along with input sizes and throughput) as JSON.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "HelperFunctions.hpp"
+#include "RunStatistics.hpp"
+
+namespace {
+	// Returns a string as a JSON string literal
+	std::string Quote(const std::string &text) {
+		std::string quoted = "\"";
+		for (std::string::const_iterator c = text.begin(); c != text.end();
+			 c++) {
+			switch (*c) {
+				case '"': quoted += "\\\""; break;
+				case '\\': quoted += "\\\\"; break;
+				case '\n': quoted += "\\n"; break;
+				case '\t': quoted += "\\t"; break;
+				default:
+					if ((unsigned char)*c < 0x20) {
+						char escaped[7];
+						snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+						quoted += escaped;
+					} else {
+						quoted += *c;
+					}
+			}
+		}
+		return quoted + "\"";
+	}
+
+	// Returns the name given to the throughput of an input unit
+	std::string ThroughputName(const std::string &unit) {
+		return (unit == "bytes") ? "MB_per_second" : unit + "_per_second";
+	}
+
+	// Returns the throughput of an amount of input over some time
+	double Throughput(const std::string &unit, double amount, double seconds) {
+		if (seconds <= 0) return 0;
+		return ((unit == "bytes") ? amount / (1 << 20) : amount) / seconds;
+	}
+}
+
+// ==== CLASSES ================================================================
+
+// RunStatistics - The time and memory used by each stage of a run
+RunStatistics::RunStatistics() : inStage(false) {
+	Now(runWall, runUser, runSystem);
+	ResetPeakMemory();
+}
+
+// Ends the current stage (if any) and starts timing the next
+void RunStatistics::BeginStage(const std::string &name) {
+	EndStage();
+	Stage stage;
+	stage.name = name;
+	stages.push_back(stage);
+	inStage = true;
+	ResetPeakMemory();
+	Now(startWall, startUser, startSystem);
+}
+
+// Ends the current stage
+void RunStatistics::EndStage() {
+	if (!inStage) return;
+	Stage &stage = stages.back();
+	double wall, user, system;
+	Now(wall, user, system);
+	stage.wallSeconds = wall - startWall;
+	stage.userSeconds = user - startUser;
+	stage.systemSeconds = system - startSystem;
+	stage.peakMemory = GetPeakMemory();
+	inStage = false;
+}
+
+// Notes an amount of input handled by the current stage in some unit
+void RunStatistics::AddInput(const std::string &unit, double amount) {
+	if (!inStage) return;
+	std::vector< std::pair<std::string, double> > &inputs =
+		stages.back().inputs;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		if (inputs[i].first == unit) {
+			inputs[i].second += amount;
+			return;
+		}
+	}
+	inputs.push_back(std::make_pair(unit, amount));
+}
+
+// Notes the resources used by external tools
+void RunStatistics::AddProcesses(const std::vector<ProcessUsage> &processes) {
+	this->processes.insert(this->processes.end(), processes.begin(),
+						   processes.end());
+}
+
+void RunStatistics::AddProcess(const ProcessUsage &process) {
+	processes.push_back(process);
+}
+
+// Writes the report as JSON
+// Throws std::runtime_error if the file cannot be written
+void RunStatistics::Save(const std::string &fileName) const {
+	std::ofstream ofs(fileName.c_str(), std::ios::out | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + fileName);
+
+	// The run as a whole, its peak being the largest of any stage's
+	double wall, user, system;
+	Now(wall, user, system);
+	long peakMemory = GetPeakMemory();
+	for (size_t i = 0; i < stages.size(); i++)
+		peakMemory = std::max(peakMemory, stages[i].peakMemory);
+	ofs << "{\n  \"wall_seconds\": " << wall - runWall
+		<< ",\n  \"user_seconds\": " << user - runUser
+		<< ",\n  \"system_seconds\": " << system - runSystem
+		<< ",\n  \"peak_memory_kb\": " << peakMemory
+		<< ",\n  \"stages\": [";
+	for (size_t i = 0; i < stages.size(); i++) {
+		const Stage &stage = stages[i];
+		ofs << ((i == 0) ? "\n" : ",\n")
+			<< "    {\"name\": " << Quote(stage.name)
+			<< ", \"wall_seconds\": " << stage.wallSeconds
+			<< ", \"user_seconds\": " << stage.userSeconds
+			<< ", \"system_seconds\": " << stage.systemSeconds
+			<< ", \"peak_memory_kb\": " << stage.peakMemory
+			<< ", \"inputs\": {";
+		for (size_t j = 0; j < stage.inputs.size(); j++) {
+			ofs << ((j == 0) ? "" : ", ") << Quote(stage.inputs[j].first)
+				<< ": " << stage.inputs[j].second;
+		}
+		ofs << "}, \"throughput\": {";
+		for (size_t j = 0; j < stage.inputs.size(); j++) {
+			ofs << ((j == 0) ? "" : ", ")
+				<< Quote(ThroughputName(stage.inputs[j].first)) << ": "
+				<< Throughput(stage.inputs[j].first, stage.inputs[j].second,
+							  stage.wallSeconds);
+		}
+		ofs << "}}";
+	}
+	ofs << "\n  ],\n  \"processes\": [";
+	for (size_t i = 0; i < processes.size(); i++) {
+		const ProcessUsage &process = processes[i];
+		int exitCode = WIFEXITED(process.status) ?
+			WEXITSTATUS(process.status) : -1;
+		ofs << ((i == 0) ? "\n" : ",\n")
+			<< "    {\"command\": " << Quote(process.command)
+			<< ", \"exit_code\": " << exitCode
+			<< ", \"wall_seconds\": " << process.wallSeconds
+			<< ", \"user_seconds\": " << process.userSeconds
+			<< ", \"system_seconds\": " << process.systemSeconds
+			<< ", \"peak_memory_kb\": " << process.peakMemory << "}";
+	}
+	ofs << "\n  ]\n}\n";
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + fileName);
+}
+
+// Returns the wall, user and system seconds so far
+void RunStatistics::Now(double &wall, double &user, double &system) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	wall = now.tv_sec + now.tv_usec / 1e6;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+	system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
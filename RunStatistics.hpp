@@ -0,0 +1,55 @@
+// RunStatistics.hpp - Times the stages of a run and the tools it launches, and
+// reports them (along with input sizes and throughput) as JSON.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef RUNSTATISTICS_HPP
+#define RUNSTATISTICS_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "Subprocess.hpp"
+
+// Collects the wall time, CPU time and peak memory of each stage of a run,
+// the amounts of input each stage handled (bytes, nodes, GIs...) and the
+// resources used by every external tool
+class RunStatistics {
+public:
+	RunStatistics();
+	// Ends the current stage (if any) and starts timing the next
+	void BeginStage(const std::string &name);
+	// Ends the current stage
+	void EndStage();
+	// Notes an amount of input handled by the current stage in some unit
+	// (e.g. "bytes", "nodes", "GIs"), from which throughput is derived
+	void AddInput(const std::string &unit, double amount);
+	// Notes the resources used by external tools
+	void AddProcesses(const std::vector<ProcessUsage> &processes);
+	void AddProcess(const ProcessUsage &process);
+	// Writes the report as JSON
+	// Throws std::runtime_error if the file cannot be written
+	void Save(const std::string &fileName) const;
+private:
+	struct Stage {
+		std::string name;
+		double wallSeconds;
+		double userSeconds;
+		double systemSeconds;
+		long peakMemory;
+		std::vector< std::pair<std::string, double> > inputs;
+	};
+
+	// Returns the wall, user and system seconds so far
+	static void Now(double &wall, double &user, double &system);
+
+	std::vector<Stage> stages;
+	std::vector<ProcessUsage> processes;
+	bool inStage;
+	double startWall, startUser, startSystem;
+	double runWall, runUser, runSystem;
+};
+
+#endif // RUNSTATISTICS_HPP
@@ -0,0 +1,463 @@
+// SeqIdList.cpp - Sets of sequence identifiers (accession.versions) interned
+// into an arena, combined as sets and written as BLAST seqid lists.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "SeqIdList.hpp"
+#include "Compression.hpp"
+#include "HelperFunctions.hpp"
+
+namespace {
+	// Hash slots hold an identifier's offset (+ 1) into the arena in their
+	// low bits and the top bits of its hash above them
+	const uint64_t OFFSET_MASK = ((uint64_t)1 << 40) - 1;
+	const uint64_t MAX_ARENA_SIZE = OFFSET_MASK - 1;
+	const size_t MIN_SLOTS = 1024;
+	// Identifiers sorted, and arena bytes filtered, by each thread at the least
+	const size_t MIN_PARALLEL_SORT = (size_t)1 << 16;
+	const size_t MIN_PARALLEL_FILTER = (size_t)1 << 20;
+
+	// Binary seqid lists start with a null (which no text list does), then
+	// hold the file size, the number of identifiers, the title, the creation
+	// date and total length of the database the list was made against (left
+	// empty here) and the sorted identifiers, each after its length: a byte,
+	// or 0xFF and 4 bytes if longer. Numbers are little endian
+	const unsigned char LONG_ACCESSION = 0xFF;
+
+	bool IsSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+			   c == '\v' || c == '\f';
+	}
+
+	// Writes the lowest bytes bytes of value in little endian order
+	void WriteLittleEndian(std::ofstream &ofs, uint64_t value, int bytes) {
+		for (int i = 0; i < bytes; i++) ofs.put((char)(value >> (8 * i)));
+	}
+
+	// Reads bytes bytes in little endian order from a binary seqid list,
+	// throwing if the list is too short
+	uint64_t ReadLittleEndian(const char *data, size_t size, size_t &position,
+							  int bytes, const std::string &source) {
+		if (position > size || size - position < (size_t)bytes)
+			throw std::runtime_error("Malformed seqid list: " + source);
+		uint64_t value = 0;
+		for (int i = bytes - 1; i >= 0; i--)
+			value = (value << 8) | (unsigned char)data[position + i];
+		position += bytes;
+		return value;
+	}
+
+	// Calls visit(accession, length) for every identifier of an arena
+	// starting in [first, last), in order
+	template <typename Visit>
+	void ForEachAccession(const std::vector<char> &arena, size_t first,
+						  size_t last, Visit visit) {
+		for (size_t position = first; position < last; ) {
+			const char *accession = &arena[position];
+			size_t length = strlen(accession);
+			visit(accession, length);
+			position += length + 1;
+		}
+	}
+
+	// An identifier being sorted: its offset into the arena, and the 16
+	// bytes of it being compared (as big endian numbers, so they order alike)
+	struct SortKey {
+		uint64_t prefix;
+		uint64_t next;
+		uint64_t offset;
+	};
+
+	bool ByPrefix(const SortKey &a, const SortKey &b) {
+		return a.prefix < b.prefix || (a.prefix == b.prefix && a.next < b.next);
+	}
+
+	bool SamePrefix(const SortKey &a, const SortKey &b) {
+		return a.prefix == b.prefix && a.next == b.next;
+	}
+
+	// Returns the 8 bytes of an identifier from depth on, padded with nulls
+	// past its end
+	uint64_t Prefix(const char *accession, size_t depth) {
+		uint64_t prefix = 0;
+		bool ended = false;
+		for (int i = 0; i < 8; i++) {
+			unsigned char c = ended ? 0 : accession[depth + i];
+			ended = ended || c == '\0';
+			prefix = (prefix << 8) | c;
+		}
+		return prefix;
+	}
+
+	// Sets a key to the 16 bytes of its identifier from depth on
+	void SetPrefix(SortKey &key, const char *accession, size_t depth) {
+		key.prefix = Prefix(accession, depth);
+		key.next = (key.prefix & 0xFF) ? Prefix(accession, depth + 8) : 0;
+	}
+
+	// Sorts keys whose identifiers share their first depth bytes, 16 bytes
+	// at a time. Distinct identifiers sharing 16 more bytes can't have ended
+	// within them, so each tie is broken further on
+	void SortFrom(const char *arena, SortKey *first, SortKey *last,
+				  size_t depth) {
+		for (SortKey *key = first; key != last; key++)
+			SetPrefix(*key, arena + key->offset, depth);
+		std::sort(first, last, ByPrefix);
+		for (SortKey *tie = first; tie != last; ) {
+			SortKey *end = tie + 1;
+			while (end != last && SamePrefix(*end, *tie)) end++;
+			if (end - tie > 1) SortFrom(arena, tie, end, depth + 16);
+			tie = end;
+		}
+	}
+
+	// Sorts values by less, in chunks sorted across up to threads threads
+	// and then merged pairwise (each level of merges also across threads)
+	template <typename T, typename Less>
+	void ParallelSort(std::vector<T> &values, unsigned int threads, Less less) {
+		size_t chunks = std::min<size_t>(
+			(threads == 0) ? DefaultThreadCount() : threads,
+			values.size() / MIN_PARALLEL_SORT);
+		if (chunks <= 1) {
+			std::sort(values.begin(), values.end(), less);
+			return;
+		}
+		std::vector<size_t> bounds;
+		for (size_t i = 0; i <= chunks; i++)
+			bounds.push_back(values.size() * i / chunks);
+		ParallelFor(chunks, threads, [&](size_t i) {
+			std::sort(values.begin() + bounds[i], values.begin() + bounds[i + 1],
+					  less);
+		});
+		for (size_t width = 1; width < chunks; width *= 2) {
+			ParallelFor((chunks + 2 * width - 1) / (2 * width), threads,
+						[&](size_t pair) {
+				size_t first = 2 * width * pair,
+					   middle = std::min(first + width, chunks),
+					   last = std::min(first + 2 * width, chunks);
+				std::inplace_merge(values.begin() + bounds[first],
+								   values.begin() + bounds[middle],
+								   values.begin() + bounds[last], less);
+			});
+		}
+	}
+}
+
+// ==== CLASSES ================================================================
+
+// An empty set
+AccessionSet::AccessionSet(unsigned int threads)
+	: slots(MIN_SLOTS, 0), count(0), lastOffset(0), sorted(true),
+	  threads(threads) {}
+
+// Adds an identifier, unless already there, growing the slots to keep them
+// at most three quarters full
+void AccessionSet::Add(const char *accession, size_t length) {
+	if (length == 0)
+		throw std::runtime_error("Empty sequence identifier");
+	for (size_t i = 0; i < length; i++) {
+		if (IsSpace(accession[i]) || accession[i] == '\0') {
+			throw std::runtime_error("Malformed sequence identifier: " +
+									 std::string(accession, length));
+		}
+	}
+	uint64_t hash = HashBytes(accession, length);
+	size_t slot = FindSlot(accession, length, hash);
+	if (slots[slot] != 0) return;
+	if (arena.size() + length + 1 > MAX_ARENA_SIZE)
+		throw std::runtime_error("Too many sequence identifiers");
+
+	if (sorted && count > 0) {
+		size_t lastLength = arena.size() - lastOffset - 1;
+		int order = memcmp(&arena[lastOffset], accession,
+						   std::min(lastLength, length));
+		sorted = order < 0 || (order == 0 && lastLength < length);
+	}
+	lastOffset = arena.size();
+	arena.insert(arena.end(), accession, accession + length);
+	arena.push_back('\0');
+	slots[slot] = (hash & ~OFFSET_MASK) | (lastOffset + 1);
+	if (++count * 4 > slots.size() * 3) Rehash(count);
+}
+
+void AccessionSet::Add(const std::string &accession) {
+	Add(accession.data(), accession.size());
+}
+
+// Adds the identifiers of a text or binary seqid list
+void AccessionSet::AddFile(const std::string &fileName) {
+	InputFile list(fileName, "", threads);
+	const char *data = list.Data();
+	size_t size = list.Size();
+	arena.reserve(arena.size() + size);
+
+	if (size > 0 && data[0] == '\0') {
+		size_t position = 1;
+		ReadLittleEndian(data, size, position, 8, fileName);	// File size
+		uint64_t ids = ReadLittleEndian(data, size, position, 4, fileName);
+		Reserve(count + std::min<uint64_t>(ids, size));
+		position += ReadLittleEndian(data, size, position, 4, fileName);
+		size_t dateLength = ReadLittleEndian(data, size, position, 1,
+											 fileName);
+		position += dateLength;
+		ReadLittleEndian(data, size, position, 8, fileName);	// DB length
+		if (dateLength > 0)
+			position += ReadLittleEndian(data, size, position, 4, fileName);
+		for (uint64_t i = 0; i < ids; i++) {
+			uint64_t length = ReadLittleEndian(data, size, position, 1,
+											   fileName);
+			if (length == LONG_ACCESSION)
+				length = ReadLittleEndian(data, size, position, 4, fileName);
+			if (position > size || size - position < length)
+				throw std::runtime_error("Malformed seqid list: " + fileName);
+			Add(data + position, length);
+			position += length;
+		}
+		return;
+	}
+
+	// Usually one identifier a line
+	Reserve(count + std::count(data, data + size, '\n') + 1);
+	const char *cursor = data, *end = data + size;
+	while (cursor < end) {
+		if (IsSpace(*cursor)) {
+			cursor++;
+		} else if (*cursor == '#') {
+			const char *newline = static_cast<const char *>(
+				memchr(cursor, '\n', end - cursor));
+			cursor = (newline == NULL) ? end : newline + 1;
+		} else {
+			const char *first = cursor;
+			while (cursor < end && !IsSpace(*cursor)) cursor++;
+			Add(first, cursor - first);
+		}
+	}
+}
+
+size_t AccessionSet::Size() const {
+	return count;
+}
+
+bool AccessionSet::Empty() const {
+	return count == 0;
+}
+
+bool AccessionSet::Contains(const char *accession, size_t length) const {
+	return slots[FindSlot(accession, length,
+						  HashBytes(accession, length))] != 0;
+}
+
+bool AccessionSet::Contains(const std::string &accession) const {
+	return Contains(accession.data(), accession.size());
+}
+
+// Returns the bytes taken by the arena and index
+size_t AccessionSet::MemoryUsage() const {
+	return arena.capacity() + slots.capacity() * sizeof(uint64_t);
+}
+
+// Sorts the identifiers by their first 16 bytes (across threads), breaking
+// the ties of longer ones 16 bytes at a time, then lays the arena out again
+// in that order
+void AccessionSet::Sort() {
+	if (sorted) return;
+	std::vector<SortKey> keys;
+	keys.reserve(count);
+	ForEachAccession(arena, 0, arena.size(),
+					 [&](const char *accession, size_t) {
+		SortKey key;
+		SetPrefix(key, accession, 0);
+		key.offset = accession - &arena[0];
+		keys.push_back(key);
+	});
+	ParallelSort(keys, threads, ByPrefix);
+	std::vector< std::pair<size_t, size_t> > ties;
+	for (size_t first = 0; first < keys.size(); ) {
+		size_t end = first + 1;
+		while (end < keys.size() && SamePrefix(keys[end], keys[first]))
+			end++;
+		if (end - first > 1) ties.push_back(std::make_pair(first, end));
+		first = end;
+	}
+	ParallelFor(ties.size(), threads, [&](size_t i) {
+		SortFrom(&arena[0], &keys[ties[i].first], &keys[0] + ties[i].second,
+				 16);
+	});
+
+	std::vector<char> sortedArena;
+	sortedArena.reserve(arena.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		const char *accession = &arena[keys[i].offset];
+		lastOffset = sortedArena.size();
+		sortedArena.insert(sortedArena.end(), accession,
+						   accession + strlen(accession) + 1);
+	}
+	arena.swap(sortedArena);
+	sorted = true;
+	Rehash(count);
+}
+
+// Keeps the identifiers in either set
+void AccessionSet::Union(const AccessionSet &other) {
+	if (&other == this) return;
+	arena.reserve(arena.size() + other.arena.size());
+	Reserve(count + other.count);
+	ForEachAccession(other.arena, 0, other.arena.size(),
+					 [&](const char *accession, size_t length) {
+		Add(accession, length);
+	});
+}
+
+// Keeps the identifiers in both sets
+void AccessionSet::Intersect(const AccessionSet &other) {
+	Filter(other, true);
+}
+
+// Keeps the identifiers not in other
+void AccessionSet::Subtract(const AccessionSet &other) {
+	Filter(other, false);
+}
+
+// Appends the identifiers to accessions
+void AccessionSet::ToVector(std::vector<std::string> &accessions) const {
+	accessions.reserve(accessions.size() + count);
+	ForEachAccession(arena, 0, arena.size(),
+					 [&](const char *accession, size_t length) {
+		accessions.push_back(std::string(accession, length));
+	});
+}
+
+// Sorts the set, then writes it as a text seqid list
+void AccessionSet::WriteSeqIdList(const std::string &outputFile) {
+	Sort();
+	std::ofstream ofs(outputFile.c_str(), std::ios::out | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + outputFile);
+	ForEachAccession(arena, 0, arena.size(),
+					 [&](const char *accession, size_t length) {
+		ofs.write(accession, length).put('\n');
+	});
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + outputFile);
+}
+
+// Sorts the set, then writes it as a binary seqid list, with the file size
+// patched into the header at the end
+void AccessionSet::WriteBinarySeqIdList(const std::string &outputFile,
+										const std::string &title) {
+	Sort();
+	std::ofstream ofs(outputFile.c_str(),
+					  std::ios::out | std::ios::binary | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + outputFile);
+	ofs.put('\0');
+	WriteLittleEndian(ofs, 0, 8);					// File size
+	WriteLittleEndian(ofs, count, 4);
+	WriteLittleEndian(ofs, title.size(), 4);
+	ofs << title;
+	WriteLittleEndian(ofs, 0, 1);					// No creation date
+	WriteLittleEndian(ofs, 0, 8);					// No database length
+	ForEachAccession(arena, 0, arena.size(),
+					 [&](const char *accession, size_t length) {
+		if (length >= LONG_ACCESSION) {
+			WriteLittleEndian(ofs, LONG_ACCESSION, 1);
+			WriteLittleEndian(ofs, length, 4);
+		} else {
+			WriteLittleEndian(ofs, length, 1);
+		}
+		ofs.write(accession, length);
+	});
+	uint64_t fileSize = ofs.tellp();
+	ofs.seekp(1);
+	WriteLittleEndian(ofs, fileSize, 8);
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + outputFile);
+}
+
+// Linear probing from the identifier's hash, reading only the identifiers
+// whose hash tags match
+size_t AccessionSet::FindSlot(const char *accession, size_t length,
+							  uint64_t hash) const {
+	size_t mask = slots.size() - 1;
+	for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+		uint64_t entry = slots[slot];
+		if (entry == 0) return slot;
+		if ((entry & ~OFFSET_MASK) != (hash & ~OFFSET_MASK)) continue;
+		uint64_t offset = (entry & OFFSET_MASK) - 1;
+		if (offset + length < arena.size() &&
+			memcmp(&arena[offset], accession, length) == 0 &&
+			arena[offset + length] == '\0')
+			return slot;
+	}
+}
+
+// Grows the hash slots ahead of adding identifiers, so they are placed
+// again once rather than every time the slots fill
+void AccessionSet::Reserve(size_t capacity) {
+	if (capacity * 4 > slots.size() * 3) Rehash(capacity);
+}
+
+// Rebuilds the hash slots, placing every identifier again
+void AccessionSet::Rehash(size_t capacity) {
+	size_t slotCount = MIN_SLOTS;
+	while (capacity * 4 > slotCount * 3) slotCount *= 2;
+	slots.assign(slotCount, 0);
+	size_t mask = slotCount - 1;
+	ForEachAccession(arena, 0, arena.size(),
+					 [&](const char *accession, size_t length) {
+		uint64_t hash = HashBytes(accession, length);
+		size_t slot = hash & mask;
+		while (slots[slot] != 0) slot = (slot + 1) & mask;
+		slots[slot] = (hash & ~OFFSET_MASK) | (accession - &arena[0] + 1);
+	});
+}
+
+// Looks the identifiers up in other in chunks of the arena across threads,
+// keeping those wanted in their current order
+void AccessionSet::Filter(const AccessionSet &other, bool keep) {
+	// Chunks start at the start of an identifier
+	std::vector<size_t> bounds(1, 0);
+	for (size_t position = MIN_PARALLEL_FILTER; position < arena.size();
+		 position += MIN_PARALLEL_FILTER) {
+		const char *end = static_cast<const char *>(memchr(
+			&arena[position], '\0', arena.size() - position));
+		position = end + 1 - &arena[0];
+		if (position < arena.size()) bounds.push_back(position);
+	}
+	bounds.push_back(arena.size());
+
+	std::vector< std::vector<char> > kept(bounds.size() - 1);
+	ParallelFor(kept.size(), threads, [&](size_t chunk) {
+		ForEachAccession(arena, bounds[chunk], bounds[chunk + 1],
+						 [&](const char *accession, size_t length) {
+			if (other.Contains(accession, length) == keep)
+				kept[chunk].insert(kept[chunk].end(), accession,
+								   accession + length + 1);
+		});
+	});
+
+	std::vector<char> keptArena;
+	for (size_t chunk = 0; chunk < kept.size(); chunk++) {
+		keptArena.insert(keptArena.end(), kept[chunk].begin(),
+						 kept[chunk].end());
+		std::vector<char>().swap(kept[chunk]);
+	}
+	arena.swap(keptArena);
+	count = 0;
+	ForEachAccession(arena, 0, arena.size(),
+					 [&](const char *accession, size_t) {
+		lastOffset = accession - &arena[0];
+		count++;
+	});
+	Rehash(count);
+}
@@ -0,0 +1,89 @@
+// SeqIdList.hpp - Sets of sequence identifiers (accession.versions), for the
+// records NCBI no longer gives GIs, combined as sets and written as the seqid
+// lists (text or binary) that BLAST restricts databases to. Identifiers are
+// interned into one arena of characters with an open addressed index over
+// them, rather than held as a string each.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef SEQIDLIST_HPP
+#define SEQIDLIST_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// ==== CLASSES ================================================================
+
+// Identifiers are kept in the order they were added until the set is sorted.
+// Each takes its characters and a null in the arena, plus a share of the 8
+// byte hash slots (kept at most three quarters full), which hold its offset
+// into the arena and enough of its hash to skip most others without reading
+// them
+class AccessionSet {
+public:
+	// An empty set, whose sorting and set operations use up to threads
+	// threads (one per core if 0)
+	AccessionSet(unsigned int threads = 0);
+	// Adds an identifier, unless already there
+	// Throws std::runtime_error if it is empty, holds whitespace or nulls, or
+	// the set is full
+	void Add(const char *accession, size_t length);
+	void Add(const std::string &accession);
+	// Adds the identifiers of a text seqid list (whitespace delimited, '#'
+	// starting a comment up to the end of the line) or of a binary one, either
+	// of which may be gzipped
+	// Throws std::runtime_error if the list cannot be read or is malformed
+	void AddFile(const std::string &fileName);
+
+	size_t Size() const;
+	bool Empty() const;
+	bool Contains(const char *accession, size_t length) const;
+	bool Contains(const std::string &accession) const;
+	// Returns the bytes taken by the arena and index
+	size_t MemoryUsage() const;
+
+	// Puts the identifiers in ascending (byte) order, the order seqid lists
+	// are kept in
+	void Sort();
+	// Keeps the identifiers in either set
+	void Union(const AccessionSet &other);
+	// Keeps the identifiers in both sets
+	void Intersect(const AccessionSet &other);
+	// Keeps the identifiers not in other
+	void Subtract(const AccessionSet &other);
+
+	// Appends the identifiers to accessions, in ascending order once sorted
+	void ToVector(std::vector<std::string> &accessions) const;
+	// Sorts the set, then writes it as a text seqid list (one per line)
+	// Throws std::runtime_error if the file cannot be written
+	void WriteSeqIdList(const std::string &outputFile);
+	// Sorts the set, then writes it as a binary seqid list (.bsl), which
+	// BLAST reads as a positive (-seqidlist, SEQIDLIST) or a negative
+	// (-negative_seqidlist) list without parsing it
+	// Throws std::runtime_error if the file cannot be written
+	void WriteBinarySeqIdList(const std::string &outputFile,
+							  const std::string &title = "");
+private:
+	// Returns the slot holding an identifier of a given hash, or the empty
+	// slot it would take
+	size_t FindSlot(const char *accession, size_t length, uint64_t hash) const;
+	// Makes room in the hash slots for capacity identifiers
+	void Reserve(size_t capacity);
+	// Rebuilds the hash slots, the fewest that are at most three quarters
+	// full with room for capacity identifiers
+	void Rehash(size_t capacity);
+	// Keeps the identifiers that other holds if keep, or else doesn't hold
+	void Filter(const AccessionSet &other, bool keep);
+
+	std::vector<char> arena;		// Null terminated identifiers
+	std::vector<uint64_t> slots;	// Hash tag and offset + 1, 0 if empty
+	size_t count;
+	size_t lastOffset;				// Of the identifier added last
+	bool sorted;
+	unsigned int threads;
+};
+
+#endif // SEQIDLIST_HPP
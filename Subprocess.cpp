@@ -0,0 +1,471 @@
+// Subprocess.cpp - Runs the external programs (makeblastdb, blastdb_aliastool,
+// EDirect) that do the heavy lifting, several at a time if desired. Programs
+// are spawned directly (no shell) and their output is read through pipes.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <functional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include "Compression.hpp"
+#include "Subprocess.hpp"
+
+extern char **environ;
+
+namespace {
+	// Bytes read from a child's pipe at a time
+	const size_t READ_SIZE = 64 << 10;
+	// Bytes of input taken from a child's input source at a time
+	const size_t FEED_SIZE = 1 << 20;
+
+	// Returns the time since the epoch in seconds
+	double Now() {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		return now.tv_sec + now.tv_usec / 1e6;
+	}
+
+	double Seconds(const struct timeval &time) {
+		return time.tv_sec + time.tv_usec / 1e6;
+	}
+
+	// Makes a pipe whose ends are closed in any program spawned later (bar
+	// the copies given to it as its standard streams)
+	// Throws std::runtime_error if it cannot be made
+	void MakePipe(int fds[2], const Command &command) {
+		if (pipe2(fds, O_CLOEXEC) == -1)
+			throw std::runtime_error("Cannot start: " + CommandLine(command) +
+									 " (" + strerror(errno) + ")");
+	}
+
+	// Spawns a command as a child process reading inputFd (nothing if -1)
+	// and writing outputFd and errorFd, noting its start time
+	// Returns its pid, or -1 if it could not be started (in which case it is
+	// finished as if it had exited with status 127, saying why)
+	pid_t Spawn(const Command &command, int inputFd, int outputFd,
+				int errorFd, ProcessUsage &usage) {
+		usage.command = CommandLine(command);
+		usage.status = -1;
+		usage.wallSeconds = Now();
+		usage.userSeconds = usage.systemSeconds = 0;
+		usage.peakMemory = 0;
+		usage.output.clear();
+
+		std::vector<char *> arguments;
+		for (Command::const_iterator it = command.begin();
+			 it != command.end();
+			 it++)
+			arguments.push_back(const_cast<char *>(it->c_str()));
+		arguments.push_back(NULL);
+
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		if (inputFd == -1) {
+			posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+											 "/dev/null", O_RDONLY, 0);
+		} else {
+			posix_spawn_file_actions_adddup2(&actions, inputFd, STDIN_FILENO);
+		}
+		posix_spawn_file_actions_adddup2(&actions, outputFd, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, errorFd, STDERR_FILENO);
+		// SIGPIPE is ignored here while feeding input, but not in children
+		posix_spawnattr_t attributes;
+		posix_spawnattr_init(&attributes);
+		sigset_t defaults;
+		sigemptyset(&defaults);
+		sigaddset(&defaults, SIGPIPE);
+		posix_spawnattr_setsigdefault(&attributes, &defaults);
+		posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+		pid_t pid = -1;
+		int error = command.empty() ? EINVAL :
+			posix_spawnp(&pid, arguments[0], &actions, &attributes,
+						 &arguments[0], environ);
+		posix_spawnattr_destroy(&attributes);
+		posix_spawn_file_actions_destroy(&actions);
+		if (error != 0) {
+			usage.status = W_EXITCODE(127, 0);
+			usage.wallSeconds = 0;
+			usage.output = "Cannot start: " + usage.command + " (" +
+						   strerror(error) + ")\n";
+			return -1;
+		}
+		return pid;
+	}
+
+	// Waits for a child process and fills in the resources it used
+	void Finish(pid_t pid, ProcessUsage &usage) {
+		int status;
+		struct rusage resources;
+		while (wait4(pid, &status, 0, &resources) == -1) {
+			if (errno != EINTR) {
+				// It must have been reaped elsewhere
+				usage.wallSeconds = Now() - usage.wallSeconds;
+				return;
+			}
+		}
+		usage.status = status;
+		usage.wallSeconds = Now() - usage.wallSeconds;
+		usage.userSeconds = Seconds(resources.ru_utime);
+		usage.systemSeconds = Seconds(resources.ru_stime);
+		usage.peakMemory = resources.ru_maxrss;
+	}
+
+	bool Succeeded(int status) {
+		return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+	// Returns whether a character needs quoting for a shell
+	bool NeedsQuoting(char c) {
+		return !isalnum((unsigned char)c) && strchr("%+,-./:=@_", c) == NULL;
+	}
+}
+
+// ==== CLASSES ================================================================
+
+// JobScheduler - Runs queued commands, never more than maxJobs at once
+JobScheduler::JobScheduler(unsigned int maxJobs, std::ostream *log)
+	: maxJobs((maxJobs == 0) ? 1 : maxJobs), log(log)
+{}
+
+// Waits for any commands still queued or running
+JobScheduler::~JobScheduler() {
+	try {
+		Wait();
+	} catch (...) {} // Nothing more can be done for them
+}
+
+// Queues a command, starting it right away if a slot is free
+// Throws std::runtime_error if no pipe can be made for it
+void JobScheduler::Add(const Command &command,
+					   const std::vector<std::string> &inputs) {
+	if (inputs.empty()) {
+		Add(command, InputSource());
+		return;
+	}
+	// The files are only opened once the command starts reading them
+	boost::shared_ptr<InputStream> stream;
+	Add(command, [inputs, stream](char *output, size_t size) mutable {
+		if (!stream) stream.reset(new InputStream(inputs));
+		return stream->Read(output, size);
+	});
+}
+
+// Queues a command whose standard input is read from source
+// Throws std::runtime_error if no pipe can be made for it
+void JobScheduler::Add(const Command &command, const InputSource &source) {
+	Job job;
+	job.command = command;
+	job.input = source;
+	queued.push_back(job);
+	StartQueued();
+}
+
+// Waits for every queued command to finish
+// Returns the commands that failed (since the last Wait)
+std::vector<ProcessUsage> JobScheduler::Wait() {
+	while (!running.empty()) {
+		while (!Collect(-1)) {}
+		StartQueued();
+	}
+	std::vector<ProcessUsage> result;
+	result.swap(failed);
+	return result;
+}
+
+// Returns the resources used by every command finished so far
+const std::vector<ProcessUsage> &JobScheduler::Usage() const {
+	return usage;
+}
+
+// Starts queued commands while there are free slots
+void JobScheduler::StartQueued() {
+	// Collect any that already finished to free up their slots
+	while (!running.empty() && Collect(0)) {}
+
+	while (!queued.empty() && running.size() < maxJobs) {
+		Job job = queued.front();
+		queued.pop_front();
+		int fds[2], inputFds[2] = {-1, -1};
+		MakePipe(fds, job.command);
+		if (job.input) {
+			try {
+				MakePipe(inputFds, job.command);
+			} catch (...) {
+				close(fds[0]);
+				close(fds[1]);
+				throw;
+			}
+			// Written as the command reads it, so as not to hold up others
+			fcntl(inputFds[1], F_SETFL, O_NONBLOCK);
+			// A command that stops reading must not take this process down
+			signal(SIGPIPE, SIG_IGN);
+		}
+		Child child;
+		pid_t pid = Spawn(job.command, inputFds[0], fds[1], fds[1],
+						  child.usage);
+		close(fds[1]);
+		if (inputFds[0] != -1) close(inputFds[0]);
+		if (pid == -1) {
+			close(fds[0]);
+			if (inputFds[1] != -1) close(inputFds[1]);
+			Finished(child.usage);
+			continue;
+		}
+		child.outputFd = fds[0];
+		child.inputFd = inputFds[1];
+		child.input = job.input;
+		child.pendingPosition = 0;
+		running[pid] = child;
+	}
+}
+
+// Reads the output of running commands and collects those that finish. A
+// command has finished once its end of the pipe is closed
+bool JobScheduler::Collect(int timeout) {
+	// Outputs first, then the inputs still being written
+	std::vector<struct pollfd> fds;
+	std::vector<pid_t> pids, inputPids;
+	for (std::map<pid_t, Child>::iterator it = running.begin();
+		 it != running.end();
+		 it++) {
+		struct pollfd fd;
+		fd.fd = it->second.outputFd;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		fds.push_back(fd);
+		pids.push_back(it->first);
+	}
+	if (fds.empty()) return false;
+	for (std::map<pid_t, Child>::iterator it = running.begin();
+		 it != running.end();
+		 it++) {
+		if (it->second.inputFd == -1) continue;
+		struct pollfd fd;
+		fd.fd = it->second.inputFd;
+		fd.events = POLLOUT;
+		fd.revents = 0;
+		fds.push_back(fd);
+		inputPids.push_back(it->first);
+	}
+	if (poll(&fds[0], fds.size(), timeout) == -1) {
+		if (errno == EINTR) return false;
+		throw std::runtime_error(std::string("Cannot wait for commands (") +
+								 strerror(errno) + ")");
+	}
+
+	for (size_t i = 0; i < inputPids.size(); i++) {
+		if (fds[pids.size() + i].revents == 0) continue;
+		Child &child = running[inputPids[i]];
+		if (!Feed(inputPids[i], child)) {
+			close(child.inputFd);
+			child.inputFd = -1;
+			child.input = InputSource();
+			std::vector<char>().swap(child.pending);
+		}
+	}
+
+	bool finished = false;
+	std::vector<char> buffer(READ_SIZE);
+	for (size_t i = 0; i < pids.size(); i++) {
+		if (fds[i].revents == 0) continue;
+		Child &child = running[pids[i]];
+		ssize_t bytesRead = read(fds[i].fd, &buffer[0], buffer.size());
+		if (bytesRead > 0) {
+			child.usage.output.append(&buffer[0], bytesRead);
+			continue;
+		}
+		if (bytesRead == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+		close(fds[i].fd);
+		if (child.inputFd != -1) close(child.inputFd);
+		Finish(pids[i], child.usage);
+		Finished(child.usage);
+		running.erase(pids[i]);
+		finished = true;
+	}
+	return finished;
+}
+
+// Writes more of a command's input, returning false once there is none left
+// or the command stops reading it. A command whose input cannot be read is
+// stopped, with the reason added to its output
+bool JobScheduler::Feed(pid_t pid, Child &child) {
+	for (;;) {
+		if (child.pendingPosition == child.pending.size()) {
+			child.pending.resize(FEED_SIZE);
+			child.pendingPosition = 0;
+			try {
+				child.pending.resize(child.input(&child.pending[0],
+												 child.pending.size()));
+			} catch (const std::exception &e) {
+				child.usage.output += std::string(e.what()) + "\n";
+				kill(pid, SIGTERM);
+				return false;
+			}
+			if (child.pending.empty()) return false;
+		}
+		ssize_t written = write(child.inputFd,
+								&child.pending[child.pendingPosition],
+								child.pending.size() - child.pendingPosition);
+		if (written == -1) {
+			if (errno == EINTR) continue;
+			return errno == EAGAIN;		// Wait until there is room
+		}
+		child.pendingPosition += written;
+	}
+}
+
+// Records a finished command
+void JobScheduler::Finished(ProcessUsage &finished) {
+	if (log != NULL && !finished.output.empty())
+		*log << finished.output << std::flush;
+	if (!Succeeded(finished.status)) failed.push_back(finished);
+	usage.push_back(finished);
+}
+
+// ==== FUNCTIONS ==============================================================
+
+// Runs commands as a pipeline, passing the last one's output to consume
+bool RunPipeline(const std::vector<Command> &commands,
+				 const std::function<void(const char *, size_t)> &consume,
+				 std::vector<ProcessUsage> &usage) {
+	usage.assign(commands.size(), ProcessUsage());
+	std::vector<pid_t> pids(commands.size(), -1);
+	std::vector<struct pollfd> fds;		// Each one's errors, then the output
+	int inputFd = -1;
+
+	// Stops the pipeline, leaving its children to the consequences of their
+	// pipes being closed
+	struct Stop {
+		static void Pipeline(std::vector<pid_t> &pids,
+							 std::vector<struct pollfd> &fds, int inputFd,
+							 std::vector<ProcessUsage> &usage) {
+			for (size_t i = 0; i < fds.size(); i++)
+				if (fds[i].fd != -1) close(fds[i].fd);
+			if (inputFd != -1) close(inputFd);
+			for (size_t i = 0; i < pids.size(); i++) {
+				if (pids[i] == -1) continue;
+				kill(pids[i], SIGTERM);
+				Finish(pids[i], usage[i]);
+			}
+		}
+	};
+
+	try {
+		for (size_t i = 0; i < commands.size(); i++) {
+			int outputPipe[2], errorPipe[2];
+			MakePipe(outputPipe, commands[i]);
+			try {
+				MakePipe(errorPipe, commands[i]);
+			} catch (...) {
+				close(outputPipe[0]);
+				close(outputPipe[1]);
+				throw;
+			}
+			pids[i] = Spawn(commands[i], inputFd, outputPipe[1], errorPipe[1],
+							usage[i]);
+			close(outputPipe[1]);
+			close(errorPipe[1]);
+			if (inputFd != -1) close(inputFd);
+			inputFd = outputPipe[0];
+			struct pollfd fd;
+			fd.fd = errorPipe[0];
+			fd.events = POLLIN;
+			fd.revents = 0;
+			fds.push_back(fd);
+		}
+		if (inputFd != -1) {
+			struct pollfd fd;
+			fd.fd = inputFd;
+			fd.events = POLLIN;
+			fd.revents = 0;
+			fds.push_back(fd);
+			inputFd = -1;
+		}
+
+		// Read until every pipe is closed
+		std::vector<char> buffer(READ_SIZE);
+		size_t open = fds.size();
+		while (open > 0) {
+			if (poll(&fds[0], fds.size(), -1) == -1) {
+				if (errno == EINTR) continue;
+				throw std::runtime_error(std::string("Cannot wait for: ") +
+					usage.back().command + " (" + strerror(errno) + ")");
+			}
+			for (size_t i = 0; i < fds.size(); i++) {
+				if (fds[i].fd == -1 || fds[i].revents == 0) continue;
+				ssize_t bytesRead = read(fds[i].fd, &buffer[0], buffer.size());
+				if (bytesRead > 0) {
+					if (i < commands.size())
+						usage[i].output.append(&buffer[0], bytesRead);
+					else
+						consume(&buffer[0], bytesRead);
+					continue;
+				}
+				if (bytesRead == -1 && (errno == EINTR || errno == EAGAIN))
+					continue;
+				close(fds[i].fd);
+				fds[i].fd = -1;		// Ignored by poll from now on
+				open--;
+			}
+		}
+	} catch (...) {
+		Stop::Pipeline(pids, fds, inputFd, usage);
+		throw;
+	}
+
+	bool succeeded = true;
+	for (size_t i = 0; i < commands.size(); i++) {
+		if (pids[i] != -1) Finish(pids[i], usage[i]);
+		if (!Succeeded(usage[i].status)) succeeded = false;
+	}
+	return succeeded;
+}
+
+// Returns a command as it would be typed into a shell, for logs
+std::string CommandLine(const Command &command) {
+	std::string line;
+	for (Command::const_iterator it = command.begin();
+		 it != command.end();
+		 it++) {
+		if (it != command.begin()) line += ' ';
+		bool quote = it->empty();
+		for (size_t i = 0; i < it->size() && !quote; i++)
+			quote = NeedsQuoting((*it)[i]);
+		if (!quote) {
+			line += *it;
+			continue;
+		}
+		line += '\'';
+		for (size_t i = 0; i < it->size(); i++) {
+			if ((*it)[i] == '\'') line += "'\\''";
+			else line += (*it)[i];
+		}
+		line += '\'';
+	}
+	return line;
+}
+
+// Returns how a process ended, given its wait status
+std::string DescribeStatus(int status) {
+	if (status == -1) return "unknown status";
+	if (WIFSIGNALED(status))
+		return "killed by signal " +
+			boost::lexical_cast<std::string>(WTERMSIG(status));
+	return "exit status " +
+		boost::lexical_cast<std::string>(WEXITSTATUS(status));
+}
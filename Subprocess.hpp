@@ -0,0 +1,128 @@
+// Subprocess.hpp - Runs the external programs (makeblastdb, blastdb_aliastool,
+// EDirect) that do the heavy lifting, several at a time if desired. Programs
+// are spawned directly (no shell) and their output is read through pipes.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef SUBPROCESS_HPP
+#define SUBPROCESS_HPP
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// A program (found on the PATH) followed by its arguments, passed as they are
+// without going through a shell
+typedef std::vector<std::string> Command;
+
+// Fills a buffer with up to size bytes of a command's input, returning how
+// many (0 once there is no more)
+typedef std::function<size_t(char *, size_t)> InputSource;
+
+// The resources used by a finished child process (and its own children)
+struct ProcessUsage {
+	std::string command;	// As given by CommandLine
+	int status;				// As given by wait4
+	double wallSeconds;
+	double userSeconds;
+	double systemSeconds;
+	long peakMemory;		// Peak resident set size in kB
+	std::string output;		// What it wrote (see JobScheduler, RunPipeline)
+};
+
+// Runs queued commands as child processes, never more than maxJobs at once.
+// Commands start as soon as a slot is free, so the caller can carry on with
+// other work while they run. What each writes to standard output and standard
+// error is captured, and written to log (if given) once it finishes. A
+// command's standard input can be fed from files, decompressed on the way
+class JobScheduler {
+public:
+	JobScheduler(unsigned int maxJobs = 1, std::ostream *log = NULL);
+	// Waits for any commands still queued or running
+	~JobScheduler();
+	// Queues a command, starting it right away if a slot is free. A command
+	// that cannot be started fails as if it had exited with status 127. The
+	// inputs (if any) are read one after another, gunzipped if need be, and
+	// written to its standard input; a command whose inputs cannot be read
+	// is stopped
+	// Throws std::runtime_error if no pipe can be made for it
+	void Add(const Command &command,
+			 const std::vector<std::string> &inputs =
+				 std::vector<std::string>());
+	// Queues a command whose standard input is read from source as the
+	// command reads it. A command whose source throws is stopped
+	// Throws std::runtime_error if no pipe can be made for it
+	void Add(const Command &command, const InputSource &source);
+	// Waits for every queued command to finish
+	// Returns the commands that failed (since the last Wait)
+	std::vector<ProcessUsage> Wait();
+	// Returns the resources used by every command finished so far
+	const std::vector<ProcessUsage> &Usage() const;
+private:
+	// A command waiting for a slot, and what is fed to its input
+	struct Job {
+		Command command;
+		InputSource input;
+	};
+	// A command that is running, the pipe its output comes through and the
+	// pipe its input is written to (-1 once written), with what is still to
+	// be written
+	struct Child {
+		ProcessUsage usage;
+		int outputFd;
+		int inputFd;
+		InputSource input;
+		std::vector<char> pending;
+		size_t pendingPosition;
+	};
+
+	// Non-copyable, as the children are owned
+	JobScheduler(const JobScheduler &);
+	JobScheduler &operator=(const JobScheduler &);
+
+	// Starts queued commands while there are free slots
+	void StartQueued();
+	// Reads the output of running commands, waiting up to timeout
+	// milliseconds (or until one finishes if -1), and collects those that
+	// finish. Returns whether any finished
+	bool Collect(int timeout);
+	// Writes more of a command's input, returning false once there is none
+	// left or the command stops reading it
+	bool Feed(pid_t pid, Child &child);
+	// Records a finished command
+	void Finished(ProcessUsage &finished);
+
+	unsigned int maxJobs;
+	std::ostream *log;
+	std::deque<Job> queued;
+	std::map<pid_t, Child> running;
+	std::vector<ProcessUsage> failed;
+	std::vector<ProcessUsage> usage;
+};
+
+// ==== FUNCTIONS ==============================================================
+
+// Runs commands as a pipeline, each one's standard output feeding the next
+// one's standard input, and passes the last one's standard output to consume
+// as it arrives. What each writes to standard error is kept in its usage
+// Returns whether every command succeeded
+// Throws std::runtime_error if no pipes can be made, or whatever consume
+// throws (once the pipeline has been stopped)
+bool RunPipeline(const std::vector<Command> &commands,
+				 const std::function<void(const char *, size_t)> &consume,
+				 std::vector<ProcessUsage> &usage);
+
+// Returns a command as it would be typed into a shell, for logs
+std::string CommandLine(const Command &command);
+
+// Returns how a process ended (e.g. "exit status 1"), given its wait status
+std::string DescribeStatus(int status);
+
+#endif // SUBPROCESS_HPP
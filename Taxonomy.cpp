@@ -10,17 +10,122 @@
 // Revised On: Never
 
 #include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <map>
 #include <string>
 #include <vector>
+#include <boost/lexical_cast.hpp>
+#include "Compression.hpp"
 #include "HelperFunctions.hpp"
 #include "Taxonomy.hpp"
 
+namespace {
+	// Number of fields in each row of nodes.dmp
+	const int NODES_DUMP_FIELDS = 13;
+
+	// Converts the characters [first, last) to an int, akin to atoi but
+	// without needing a null terminated string
+	int ParseInt(const char *first, const char *last) {
+		bool negative = (first != last && *first == '-');
+		if (negative) first++;
+		int value = 0;
+		for (; first != last && *first >= '0' && *first <= '9'; first++)
+			value = value * 10 + (*first - '0');
+		return negative ? -value : value;
+	}
+
+	// Division and genetic code IDs are stored in a byte each; NCBI's are all
+	// well below this, so anything larger is a malformed row, not data
+	const int MAX_CODE_ID = 255;
+
+	bool CodeIDsFit(int divisionID, int geneticID,
+					int mitochondrialGeneticCodeID) {
+		return divisionID >= 0 && divisionID <= MAX_CODE_ID &&
+			   geneticID >= 0 && geneticID <= MAX_CODE_ID &&
+			   mitochondrialGeneticCodeID >= 0 &&
+			   mitochondrialGeneticCodeID <= MAX_CODE_ID;
+	}
+
+	// Binary snapshot layout: a CacheHeader followed by each column's elements,
+	// every column starting on an eight byte boundary so it can be used
+	// straight from the mapping
+	const char TAXONOMY_CACHE_MAGIC[8] = {'C','B','D','B','T','A','X','\0'};
+	const uint32_t TAXONOMY_CACHE_VERSION = 4;
+
+	// Columns of the snapshot, in the order they are written
+	enum CacheSection {
+		PARENTS_SECTION,
+		RANK_SECTION,
+		EMBL_CODE_SECTION,
+		COMMENTS_SECTION,
+		DIVISION_SECTION,
+		GENETIC_CODE_SECTION,
+		MITOCHONDRIAL_GENETIC_CODE_SECTION,
+		FLAGS_SECTION,
+		STRING_ARENA_SECTION,
+		RANK_NAMES_SECTION,
+		PREORDER_SECTION,
+		PREORDER_INDEX_SECTION,
+		PREORDER_DEPTHS_SECTION,
+		BLOCK_MINIMA_SECTION,
+		CHILD_OFFSETS_SECTION,
+		CHILDREN_SECTION,
+		SUBTREE_ENDS_SECTION,
+		DEPTH_OFFSETS_SECTION,
+		DEPTH_POSITIONS_SECTION,
+		RANK_POSITION_OFFSETS_SECTION,
+		RANK_POSITIONS_SECTION,
+		CACHE_SECTIONS
+	};
+
+	struct CacheHeader {
+		SnapshotHeader snapshot;
+		SourceStamp source;					// Of nodes.dmp
+		uint64_t nodeCount;
+		SnapshotSections<CACHE_SECTIONS> sections;
+	};
+
+	// Preorder positions are grouped into blocks of this many for range
+	// minimum queries. Minima over whole blocks come from a sparse table and
+	// the partial blocks at either end are scanned, which costs less than the
+	// extra lookups of an exact constant time scheme
+	const size_t RMQ_BLOCK_SIZE = 32;
+
+	// Returns the number of sparse table levels for the given number of blocks
+	int SparseTableLevels(size_t blocks) {
+		int levels = 0;
+		while (blocks > 0) {
+			levels++;
+			blocks >>= 1;
+		}
+		return levels;
+	}
+
+	// Groups the positions [0, count) by their keys (each below groups), so
+	// that the positions with key k are positions[offsets[k]..offsets[k + 1])
+	// in ascending order
+	template <typename Iterator>
+	void GroupPositions(Iterator keys, size_t groups, size_t count,
+						std::vector<int> &offsets,
+						std::vector<int> &positions) {
+		offsets.assign(groups + 1, 0);
+		for (size_t position = 0; position < count; position++)
+			offsets[keys[position] + 1]++;
+		for (size_t group = 0; group < groups; group++)
+			offsets[group + 1] += offsets[group];
+		positions.resize(count);
+		std::vector<int> next(offsets.begin(), offsets.end() - 1);
+		for (size_t position = 0; position < count; position++)
+			positions[next[keys[position]]++] = position;
+	}
+}
+
 TaxonNode::TaxonNode(std::vector<std::string> fields) 
 	: taxonID(						atoi(fields[0].c_str()))
 	, parentID(						atoi(fields[1].c_str()))
@@ -37,24 +142,65 @@ TaxonNode::TaxonNode(std::vector<std::string> fields)
 	, comments(							 fields[12].c_str())
 {}
 
+TaxonNode::TaxonNode(int taxonID, int parentID, const char *rank,
+					 const char *emblCode, int divisionID,
+					 bool inheritedDivFlag, int geneticID,
+					 bool inheritedGCFlag, int mitochondrialGeneticCodeID,
+					 bool inheritedMGCFlag, bool genbankHiddenFlag,
+					 bool hiddenSubtreeRootFlag, const char *comments)
+	: taxonID(taxonID)
+	, parentID(parentID)
+	, rank(rank)
+	, emblCode(emblCode)
+	, divisionID(divisionID)
+	, inheritedDivFlag(inheritedDivFlag)
+	, geneticID(geneticID)
+	, inheritedGCFlag(inheritedGCFlag)
+	, mitochondrialGeneticCodeID(mitochondrialGeneticCodeID)
+	, inheritedMGCFlag(inheritedMGCFlag)
+	, genbankHiddenFlag(genbankHiddenFlag)
+	, hiddenSubtreeRootFlag(hiddenSubtreeRootFlag)
+	, comments(comments)
+{}
+
 // Default constructor, needs later setup with nodes.dmp or tree hash table
-LCA_Finder::LCA_Finder() {}
+LCA_Finder::LCA_Finder() : nodeCount(0) {}
 
 // Give nodes.dmp for setup to initialize hash table
 // Throws std::runtime_error if file does not exist
-LCA_Finder::LCA_Finder(const char *nodesDumpFile) {
+LCA_Finder::LCA_Finder(const char *nodesDumpFile) : nodeCount(0) {
 	std::string file = nodesDumpFile;
 	LoadData(file);
 }
 
-LCA_Finder::LCA_Finder(std::string &nodesDumpFile) {
+LCA_Finder::LCA_Finder(std::string &nodesDumpFile) : nodeCount(0) {
 	LoadData(nodesDumpFile);
 }
 
 // Give a hash table of a tree
 LCA_Finder::LCA_Finder(std::map<int, TaxonNode> &TreeHashTable)
-	: treeHashTable(TreeHashTable)
-{}
+	: nodeCount(0)
+{
+	LoadData(TreeHashTable);
+}
+
+// Maps the binary snapshot cacheFile if it is up to date with nodes.dmp,
+// otherwise loads nodes.dmp and (re)writes the snapshot. A snapshot that cannot
+// be written is skipped. See LoadCache for verify
+// Throws std::runtime_error if nodes.dmp is needed but does not exist
+LCA_Finder::LCA_Finder(const std::string &nodesDumpFile,
+					   const std::string &cacheFile, bool verify)
+	: nodeCount(0)
+{
+	if (LoadCache(cacheFile, nodesDumpFile, verify)) return;
+	std::string file = nodesDumpFile;
+	LoadData(file);
+	try {
+		SaveCache(cacheFile, nodesDumpFile);
+	} catch (const std::runtime_error &e) {
+		// The tree is loaded regardless, the next run will simply try again
+	}
+}
 
 // Loads nodes.dmp for tree hash table
 // Throws std::runtime_error if file does not exist
@@ -66,76 +212,736 @@ void LCA_Finder::LoadData(const char *nodesDumpFile) {
 // Loads nodes.dmp for tree hash table
 // Throws std::runtime_error if file does not exist
 void LCA_Finder::LoadData(std::string &nodesDumpFile) {
-	std::string fileContents = ReadFile(nodesDumpFile);
-
-	// Delimit by rows, then by fields, load fields into a list, then into the
-	// hash table
-	size_t rowLast, rowNext, fieldLast, fieldNext;
-	std::string row, field;
-	std::string fieldDelim = "\t|\t";
-	std::string rowDelim = "\t|\n";
-	std::vector<std::string> fields;
-	
-	rowLast = 0;
-	while ((rowNext=fileContents.find(rowDelim,rowLast)) != std::string::npos){
-		row = fileContents.substr(rowLast, rowNext - rowLast);
-		fieldLast = 0;
-		fields.clear();
-		while ((fieldNext=row.find(fieldDelim,fieldLast)) != std::string::npos){
-			fields.push_back(row.substr(fieldLast, fieldNext - fieldLast));
-			fieldLast = fieldNext + fieldDelim.length();
+	InputFile file(nodesDumpFile, "nodes.dmp");
+	const char *cursor = file.Data();
+	const char *end = cursor + file.Size();
+
+	// Fields are separated by "\t|\t" and rows end with "\t|\n", so every
+	// field ends at a '|' that is preceded by a tab. Scanning for pipes with
+	// memchr (vectorized by the C library) splits the mapped file in a single
+	// pass, handing each field to the node as a pointer range, not a copy
+	const char *first[NODES_DUMP_FIELDS], *last[NODES_DUMP_FIELDS];
+	size_t line = 0;
+	while (cursor < end) {
+		// Skip blank lines between rows
+		if (*cursor == '\n' || *cursor == '\r') {
+			cursor++;
+			continue;
+		}
+		line++;
+		const char *fieldStart = cursor;
+		int field = 0;
+		bool rowComplete = false;
+		while (!rowComplete) {
+			const char *pipe = static_cast<const char *>(
+				memchr(cursor, '|', end - cursor));
+			if (pipe == NULL) break; // Trailing partial row, ignore it
+			cursor = pipe + 1;
+			// A '|' within a field is not a delimiter
+			if (pipe == fieldStart || pipe[-1] != '\t') continue;
+			char next = (cursor < end) ? *cursor : '\n';
+			if (next != '\t' && next != '\n') continue;
+
+			if (field < NODES_DUMP_FIELDS) {
+				first[field] = fieldStart;
+				last[field] = pipe - 1;
+			}
+			field++;
+			if (cursor < end) cursor++;
+			fieldStart = cursor;
+			rowComplete = (next == '\n');
 		}
-		fields.push_back(row.substr(fieldLast, fieldNext));
-		rowLast = rowNext + rowDelim.length();
-
-		// Load hash table
-		int taxonID = atoi(fields[0].c_str());
-		TaxonNode node(fields);
-		treeHashTable.insert(std::pair<int, TaxonNode>(taxonID, node));
-	}
-/*
-	int count = 1;
-	for (std::map<int, TaxonNode>::iterator it=treeHashTable.begin();
-		it != treeHashTable.end();
-		it++) {
-		std::cout << "Row: " << count << "\n"
-				  << "\tTaxon ID: " << it->first << "\n"
-				  << "\tParent ID: " << it->second.parentID << "\n"
-				  << "\tRank: " << it->second.rank << "\n"
-				  << "\tEmblCode: " << it->second.emblCode << "\n"
-				  << "\tDivision ID: " << it->second.divisionID << "\n"
-				  << "\tInherited Div Flag: " << it->second.inheritedDivFlag << "\n"
-				  << "\tGenetic ID: " << it->second.geneticID << "\n"
-				  << "\tInherited GC Flag: " << it->second.inheritedGCFlag << "\n"
-				  << "\tMito Genetic Code ID: " << it->second.mitochondrialGeneticCodeID << "\n"
-				  << "\tInherited MGC Flag: " << it->second.inheritedMGCFlag << "\n"
-				  << "\tGenbank Hidden Flag: " << it->second.genbankHiddenFlag << "\n"
-				  << "\tComments: " << it->second.comments << "\n";
-		count++;
-	}
-*/
+		if (!rowComplete) break;
+		int divisionID = 0, geneticID = 0, mitochondrialGeneticCodeID = 0;
+		if (field >= NODES_DUMP_FIELDS) {
+			divisionID = ParseInt(first[4], last[4]);
+			geneticID = ParseInt(first[6], last[6]);
+			mitochondrialGeneticCodeID = ParseInt(first[8], last[8]);
+		}
+		if (field < NODES_DUMP_FIELDS ||
+			!CodeIDsFit(divisionID, geneticID, mitochondrialGeneticCodeID)) {
+			throw std::runtime_error("Malformed nodes file: " + nodesDumpFile +
+				" (line " + boost::lexical_cast<std::string>(line) + ")");
+		}
+
+		// Load tree
+		StoreNode(ParseInt(first[0], last[0]),
+				  ParseInt(first[1], last[1]),
+				  InternRank(first[2], last[2] - first[2]),
+				  Intern(first[3], last[3] - first[3]),
+				  Intern(first[12], last[12] - first[12]),
+				  divisionID, geneticID, mitochondrialGeneticCodeID,
+				  (ParseInt(first[5], last[5]) ? INHERITED_DIV_FLAG : 0) |
+				  (ParseInt(first[7], last[7]) ? INHERITED_GC_FLAG : 0) |
+				  (ParseInt(first[9], last[9]) ? INHERITED_MGC_FLAG : 0) |
+				  (ParseInt(first[10], last[10]) ? GENBANK_HIDDEN_FLAG : 0) |
+				  (ParseInt(first[11], last[11]) ? HIDDEN_SUBTREE_ROOT_FLAG:0));
+	}
+	BuildIndex();
 }
 
 // Loads an existing tree hash table
 void LCA_Finder::LoadData(std::map<int, TaxonNode> &TreeHashTable) {
-	treeHashTable = TreeHashTable;
+	for (std::map<int, TaxonNode>::iterator it = TreeHashTable.begin();
+		 it != TreeHashTable.end();
+		 it++) {
+		AddNode(it->second);
+	}
+	BuildIndex();
+}
+
+// Adds a single node to the tree (ignored if its taxID is already present)
+// Throws std::runtime_error if its division or genetic code IDs are too large
+void LCA_Finder::AddNode(const TaxonNode &node) {
+	if (!CodeIDsFit(node.divisionID, node.geneticID,
+					node.mitochondrialGeneticCodeID)) {
+		throw std::runtime_error("Malformed taxon node: " +
+			boost::lexical_cast<std::string>(node.taxonID) +
+			" (division or genetic code ID out of range)");
+	}
+	const char *noText = "";
+	const char *rank = node.rank ? node.rank : noText;
+	const char *emblCode = node.emblCode ? node.emblCode : noText;
+	const char *comments = node.comments ? node.comments : noText;
+	StoreNode(node.taxonID, node.parentID,
+			  InternRank(rank, strlen(rank)),
+			  Intern(emblCode, strlen(emblCode)),
+			  Intern(comments, strlen(comments)),
+			  node.divisionID, node.geneticID, node.mitochondrialGeneticCodeID,
+			  (node.inheritedDivFlag ? INHERITED_DIV_FLAG : 0) |
+			  (node.inheritedGCFlag ? INHERITED_GC_FLAG : 0) |
+			  (node.inheritedMGCFlag ? INHERITED_MGC_FLAG : 0) |
+			  (node.genbankHiddenFlag ? GENBANK_HIDDEN_FLAG : 0) |
+			  (node.hiddenSubtreeRootFlag ? HIDDEN_SUBTREE_ROOT_FLAG : 0));
+}
+
+// Maps a binary snapshot written by SaveCache in place of the current tree
+// Returns false (leaving the tree empty) if the snapshot is missing, corrupt,
+// from another version or stale relative to nodes.dmp. The checksum is only
+// verified if asked, as it reads every page of what is otherwise mapped lazily
+bool LCA_Finder::LoadCache(const std::string &cacheFile,
+						   const std::string &nodesDumpFile, bool verify) {
+	Clear();
+	if (!FileExists(cacheFile) || !FileExists(nodesDumpFile)) return false;
+
+	boost::shared_ptr<MappedFile> file(new MappedFile(cacheFile));
+	if (file->Size() < sizeof(CacheHeader)) return false;
+	CacheHeader header;
+	memcpy(&header, file->Data(), sizeof(header));
+	if (!SnapshotMatches(header.snapshot, TAXONOMY_CACHE_MAGIC,
+						 TAXONOMY_CACHE_VERSION)) {
+		return false;
+	}
+
+	// Stale if nodes.dmp changed since the snapshot was taken
+	if (!SourceUnchanged(nodesDumpFile, header.source)) return false;
+
+	const SnapshotSections<CACHE_SECTIONS> &layout = header.sections;
+	bool valid =
+		BorrowSection(*file, layout, PARENTS_SECTION, parents) &&
+		BorrowSection(*file, layout, RANK_SECTION, rankIDs) &&
+		BorrowSection(*file, layout, EMBL_CODE_SECTION, emblCodeOffsets) &&
+		BorrowSection(*file, layout, COMMENTS_SECTION, commentsOffsets) &&
+		BorrowSection(*file, layout, DIVISION_SECTION, divisionIDs) &&
+		BorrowSection(*file, layout, GENETIC_CODE_SECTION, geneticIDs) &&
+		BorrowSection(*file, layout, MITOCHONDRIAL_GENETIC_CODE_SECTION,
+					  mitochondrialGeneticIDs) &&
+		BorrowSection(*file, layout, FLAGS_SECTION, flags) &&
+		BorrowSection(*file, layout, STRING_ARENA_SECTION, stringArena) &&
+		BorrowSection(*file, layout, RANK_NAMES_SECTION, rankNameOffsets) &&
+		BorrowSection(*file, layout, PREORDER_SECTION, preorder) &&
+		BorrowSection(*file, layout, PREORDER_INDEX_SECTION, preorderIndex) &&
+		BorrowSection(*file, layout, PREORDER_DEPTHS_SECTION, preorderDepths) &&
+		BorrowSection(*file, layout, BLOCK_MINIMA_SECTION, blockMinima) &&
+		BorrowSection(*file, layout, CHILD_OFFSETS_SECTION, childOffsets) &&
+		BorrowSection(*file, layout, CHILDREN_SECTION, children) &&
+		BorrowSection(*file, layout, SUBTREE_ENDS_SECTION, subtreeEnds) &&
+		BorrowSection(*file, layout, DEPTH_OFFSETS_SECTION, depthOffsets) &&
+		BorrowSection(*file, layout, DEPTH_POSITIONS_SECTION,
+					  depthPositions) &&
+		BorrowSection(*file, layout, RANK_POSITION_OFFSETS_SECTION,
+					  rankPositionOffsets) &&
+		BorrowSection(*file, layout, RANK_POSITIONS_SECTION, rankPositions);
+	if (valid) {
+		const size_t elementSizes[CACHE_SECTIONS] = {
+			sizeof(int), 1, sizeof(unsigned int), sizeof(unsigned int),
+			1, 1, 1, 1, 1, sizeof(unsigned int),
+			sizeof(int), sizeof(int), sizeof(int), sizeof(int),
+			sizeof(int), sizeof(int), sizeof(int),
+			sizeof(int), sizeof(int), sizeof(int), sizeof(int)
+		};
+		size_t taxIDs = parents.Size();
+		size_t blocks = (preorder.Size() + RMQ_BLOCK_SIZE - 1) / RMQ_BLOCK_SIZE;
+		valid = (!verify ||
+				 ChecksumSections(*file, layout, elementSizes) ==
+					layout.checksum) &&
+				rankIDs.Size() == taxIDs &&
+				emblCodeOffsets.Size() == taxIDs &&
+				commentsOffsets.Size() == taxIDs &&
+				divisionIDs.Size() == taxIDs &&
+				geneticIDs.Size() == taxIDs &&
+				mitochondrialGeneticIDs.Size() == taxIDs &&
+				flags.Size() == taxIDs &&
+				preorderIndex.Size() == taxIDs &&
+				preorderDepths.Size() == preorder.Size() &&
+				blockMinima.Size() == blocks * SparseTableLevels(blocks) &&
+				childOffsets.Size() == taxIDs + 1 &&
+				subtreeEnds.Size() == preorder.Size() &&
+				depthOffsets.Size() > 0 &&
+				depthPositions.Size() == preorder.Size() &&
+				rankPositionOffsets.Size() == rankNameOffsets.Size() + 1 &&
+				rankPositions.Size() == preorder.Size();
+	}
+	if (!valid) {
+		Clear();
+		return false;
+	}
+	nodeCount = header.nodeCount;
+	cacheMapping = file;
+	return true;
+}
+
+// Writes the tree as a versioned, checksummed binary snapshot, stamped with the
+// nodes.dmp it was loaded from. The snapshot is written aside and renamed into
+// place so concurrent runs never map a half written file
+// Throws std::runtime_error if the snapshot cannot be written
+void LCA_Finder::SaveCache(const std::string &cacheFile,
+						   const std::string &nodesDumpFile) const {
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	StampSnapshot(header.snapshot, TAXONOMY_CACHE_MAGIC,
+				  TAXONOMY_CACHE_VERSION);
+	header.source = StampSource(nodesDumpFile);
+	header.nodeCount = nodeCount;
+
+	AtomicFile cache(cacheFile);
+	std::ofstream ofs(cache.TempName().c_str(),
+					  std::ios::out | std::ios::binary | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + cache.TempName());
+	SnapshotSections<CACHE_SECTIONS> &layout = header.sections;
+	ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	WriteSection(ofs, layout, PARENTS_SECTION, parents);
+	WriteSection(ofs, layout, RANK_SECTION, rankIDs);
+	WriteSection(ofs, layout, EMBL_CODE_SECTION, emblCodeOffsets);
+	WriteSection(ofs, layout, COMMENTS_SECTION, commentsOffsets);
+	WriteSection(ofs, layout, DIVISION_SECTION, divisionIDs);
+	WriteSection(ofs, layout, GENETIC_CODE_SECTION, geneticIDs);
+	WriteSection(ofs, layout, MITOCHONDRIAL_GENETIC_CODE_SECTION,
+				 mitochondrialGeneticIDs);
+	WriteSection(ofs, layout, FLAGS_SECTION, flags);
+	WriteSection(ofs, layout, STRING_ARENA_SECTION, stringArena);
+	WriteSection(ofs, layout, RANK_NAMES_SECTION, rankNameOffsets);
+	WriteSection(ofs, layout, PREORDER_SECTION, preorder);
+	WriteSection(ofs, layout, PREORDER_INDEX_SECTION, preorderIndex);
+	WriteSection(ofs, layout, PREORDER_DEPTHS_SECTION, preorderDepths);
+	WriteSection(ofs, layout, BLOCK_MINIMA_SECTION, blockMinima);
+	WriteSection(ofs, layout, CHILD_OFFSETS_SECTION, childOffsets);
+	WriteSection(ofs, layout, CHILDREN_SECTION, children);
+	WriteSection(ofs, layout, SUBTREE_ENDS_SECTION, subtreeEnds);
+	WriteSection(ofs, layout, DEPTH_OFFSETS_SECTION, depthOffsets);
+	WriteSection(ofs, layout, DEPTH_POSITIONS_SECTION, depthPositions);
+	WriteSection(ofs, layout, RANK_POSITION_OFFSETS_SECTION,
+				 rankPositionOffsets);
+	WriteSection(ofs, layout, RANK_POSITIONS_SECTION, rankPositions);
+	ofs.seekp(0);
+	ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + cacheFile);
+	cache.Commit();
+}
+
+// Preprocesses the tree for constant time LCA queries: indexes the children of
+// every node, lays the tree out in preorder (children in ascending taxID order)
+// along with each node's depth and subtree extent, then builds a sparse table
+// of the shallowest node over runs of blocks. Lastly groups the preorder by
+// depth and by rank for ancestor queries
+void LCA_Finder::BuildIndex() {
+	ClearIndex();
+	size_t taxIDs = parents.Size();
+
+	// Children of every node in compressed sparse row form. Nodes that are
+	// their own parent, or whose parent is missing, are roots
+	std::vector<int> &offsets = childOffsets.Mutable();
+	std::vector<int> &childIDs = children.Mutable();
+	std::vector<int> roots;
+	offsets.assign(taxIDs + 1, 0);
+	for (size_t taxID = 0; taxID < taxIDs; taxID++) {
+		int parent = parents[taxID];
+		if (parent == -1) continue;
+		if (parent == (int)taxID || !Contains(parent))
+			roots.push_back(taxID);
+		else
+			offsets[parent + 1]++;
+	}
+	for (size_t taxID = 0; taxID < taxIDs; taxID++)
+		offsets[taxID + 1] += offsets[taxID];
+	childIDs.resize(offsets.back());
+	std::vector<int> nextChild(offsets.begin(), offsets.end() - 1);
+	for (size_t taxID = 0; taxID < taxIDs; taxID++) {
+		int parent = parents[taxID];
+		if (parent != -1 && parent != (int)taxID && Contains(parent))
+			childIDs[nextChild[parent]++] = taxID;
+	}
+	std::vector<int>().swap(nextChild);
+
+	// Preorder walk from each root
+	std::vector<int> &order = preorder.Mutable();
+	std::vector<int> &index = preorderIndex.Mutable();
+	std::vector<int> &depths = preorderDepths.Mutable();
+	order.reserve(nodeCount);
+	depths.reserve(nodeCount);
+	index.assign(taxIDs, -1);
+	std::vector< std::pair<int, int> > stack; // taxID, depth
+	for (std::vector<int>::iterator root = roots.begin();
+		 root != roots.end();
+		 root++) {
+		stack.push_back(std::make_pair(*root, 0));
+		while (!stack.empty()) {
+			int taxID = stack.back().first, depth = stack.back().second;
+			stack.pop_back();
+			index[taxID] = order.size();
+			order.push_back(taxID);
+			depths.push_back(depth);
+			// Pushed in reverse so they are visited in ascending order
+			for (int child = offsets[taxID + 1] - 1;
+				 child >= offsets[taxID];
+				 child--) {
+				stack.push_back(std::make_pair(childIDs[child], depth + 1));
+			}
+		}
+	}
+
+	// Subtree extents, accumulating sizes from the bottom of the preorder up
+	std::vector<int> &ends = subtreeEnds.Mutable();
+	ends.assign(order.size(), 1);
+	for (size_t position = order.size(); position-- > 0; ) {
+		if (depths[position] > 0)
+			ends[index[parents[order[position]]]] += ends[position];
+	}
+	for (size_t position = 0; position < order.size(); position++)
+		ends[position] += position;
+
+	// Sparse table: level l holds the position of the shallowest node across
+	// the 2^l blocks starting at each block
+	size_t blocks = (order.size() + RMQ_BLOCK_SIZE - 1) / RMQ_BLOCK_SIZE;
+	int levels = SparseTableLevels(blocks);
+	std::vector<int> &table = blockMinima.Mutable();
+	table.assign(blocks * levels, 0);
+	for (size_t block = 0; block < blocks; block++) {
+		size_t first = block * RMQ_BLOCK_SIZE;
+		size_t last = std::min(first + RMQ_BLOCK_SIZE, order.size());
+		size_t best = first;
+		for (size_t i = first + 1; i < last; i++)
+			if (depths[i] < depths[best]) best = i;
+		table[block] = best;
+	}
+	for (int level = 1; level < levels; level++) {
+		size_t span = (size_t)1 << (level - 1);
+		int *previous = &table[(level - 1) * blocks];
+		int *current = &table[level * blocks];
+		for (size_t block = 0; block + 2 * span <= blocks; block++) {
+			int left = previous[block], right = previous[block + span];
+			current[block] = (depths[right] < depths[left]) ? right : left;
+		}
+	}
+
+	// Preorder positions grouped by depth and by rank, each group in
+	// ascending order (a counting sort of the preorder)
+	int maxDepth = 0;
+	for (size_t position = 0; position < order.size(); position++)
+		maxDepth = std::max(maxDepth, depths[position]);
+	GroupPositions(depths.begin(), order.empty() ? 0 : maxDepth + 1,
+				   order.size(), depthOffsets.Mutable(),
+				   depthPositions.Mutable());
+	std::vector<unsigned char> positionRanks(order.size());
+	for (size_t position = 0; position < order.size(); position++)
+		positionRanks[position] = rankIDs[order[position]];
+	GroupPositions(positionRanks.begin(), rankNameOffsets.Size(),
+				   order.size(), rankPositionOffsets.Mutable(),
+				   rankPositions.Mutable());
+}
+
+// Returns the number of nodes in the tree
+size_t LCA_Finder::Size() const {
+	return nodeCount;
+}
+
+// Returns whether the given taxID is in the tree
+bool LCA_Finder::Contains(const int taxID) const {
+	return TraceParent(taxID) != -1;
+}
+
+// Returns the full nodes.dmp record of a taxID
+// Throws std::out_of_range if the taxID is not in the tree
+TaxonNode LCA_Finder::GetNode(const int taxID) const {
+	if (!Contains(taxID)) {
+		throw std::out_of_range("Taxonomy ID not in tree: " +
+								boost::lexical_cast<std::string>(taxID));
+	}
+	const char *arena = stringArena.Data();
+	unsigned char bits = flags[taxID];
+	return TaxonNode(taxID, parents[taxID],
+					 arena + rankNameOffsets[rankIDs[taxID]],
+					 arena + emblCodeOffsets[taxID],
+					 divisionIDs[taxID],
+					 bits & INHERITED_DIV_FLAG,
+					 geneticIDs[taxID],
+					 bits & INHERITED_GC_FLAG,
+					 mitochondrialGeneticIDs[taxID],
+					 bits & INHERITED_MGC_FLAG,
+					 bits & GENBANK_HIDDEN_FLAG,
+					 bits & HIDDEN_SUBTREE_ROOT_FLAG,
+					 arena + commentsOffsets[taxID]);
+}
+
+// Stores the given characters once in the string arena and returns their
+// offset. Only the handful of distinct ranks, EMBL codes and comments end up
+// being stored
+unsigned int LCA_Finder::Intern(const char *text, size_t length) {
+	internKey.assign(text, length);
+	std::map<std::string, unsigned int>::iterator it =
+		stringOffsets.find(internKey);
+	if (it != stringOffsets.end()) return it->second;
+
+	std::vector<char> &arena = stringArena.Mutable();
+	unsigned int offset = arena.size();
+	arena.insert(arena.end(), text, text + length);
+	arena.push_back('\0');
+	stringOffsets.insert(std::make_pair(internKey, offset));
+	return offset;
+}
+
+// Interns a rank and returns its number in the rank table
+// Throws std::runtime_error if there are too many distinct ranks
+unsigned char LCA_Finder::InternRank(const char *text, size_t length) {
+	unsigned int offset = Intern(text, length);
+	std::map<unsigned int, unsigned char>::iterator it =
+		rankNumbers.find(offset);
+	if (it != rankNumbers.end()) return it->second;
+
+	// The table may have come from a snapshot, without its numbers known
+	int rankID = FindRank(internKey);
+	if (rankID == -1) {
+		std::vector<unsigned int> &names = rankNameOffsets.Mutable();
+		if (names.size() > std::numeric_limits<unsigned char>::max())
+			throw std::runtime_error("Too many taxonomic ranks: " +
+									 internKey);
+		rankID = names.size();
+		names.push_back(offset);
+		if (preorder.Size() > 0) ClearIndex(); // Rank index is stale
+	}
+	rankNumbers.insert(std::make_pair(offset, (unsigned char)rankID));
+	return rankID;
+}
+
+// Returns the number of a rank in the rank table (-1 if no node has it)
+int LCA_Finder::FindRank(const std::string &rank) const {
+	const char *arena = stringArena.Data();
+	for (size_t rankID = 0; rankID < rankNameOffsets.Size(); rankID++)
+		if (rank == arena + rankNameOffsets[rankID]) return rankID;
+	return -1;
+}
+
+// Drops the LCA index
+void LCA_Finder::ClearIndex() {
+	preorder.Clear();
+	preorderIndex.Clear();
+	preorderDepths.Clear();
+	blockMinima.Clear();
+	childOffsets.Clear();
+	children.Clear();
+	subtreeEnds.Clear();
+	depthOffsets.Clear();
+	depthPositions.Clear();
+	rankPositionOffsets.Clear();
+	rankPositions.Clear();
+}
+
+// Empties the tree
+void LCA_Finder::Clear() {
+	ClearIndex();
+	parents.Clear();
+	rankIDs.Clear();
+	emblCodeOffsets.Clear();
+	commentsOffsets.Clear();
+	divisionIDs.Clear();
+	geneticIDs.Clear();
+	mitochondrialGeneticIDs.Clear();
+	flags.Clear();
+	stringArena.Clear();
+	rankNameOffsets.Clear();
+	stringOffsets.clear();
+	rankNumbers.clear();
+	nodeCount = 0;
+	cacheMapping.reset();
+}
+
+// Writes a node into the columns, growing them to fit its taxID
+void LCA_Finder::StoreNode(int taxonID, int parentID, unsigned char rankID,
+						   unsigned int emblCodeOffset,
+						   unsigned int commentsOffset, int divisionID,
+						   int geneticID, int mitochondrialGeneticCodeID,
+						   unsigned char flagBits) {
+	if (taxonID < 0 || parentID < 0) return; // Not a valid NCBI node
+	if (preorder.Size() > 0) ClearIndex(); // Stale once the tree changes
+	std::vector<int> &parentIDs = parents.Mutable();
+	std::vector<unsigned char> &ranks = rankIDs.Mutable();
+	std::vector<unsigned int> &emblCodes = emblCodeOffsets.Mutable();
+	std::vector<unsigned int> &comments = commentsOffsets.Mutable();
+	std::vector<unsigned char> &divisions = divisionIDs.Mutable();
+	std::vector<unsigned char> &geneticCodes = geneticIDs.Mutable();
+	std::vector<unsigned char> &mitoCodes = mitochondrialGeneticIDs.Mutable();
+	std::vector<unsigned char> &flagBitsColumn = flags.Mutable();
+	if ((size_t)taxonID >= parentIDs.size()) {
+		size_t size = taxonID + 1;
+		parentIDs.resize(size, -1);
+		ranks.resize(size);
+		emblCodes.resize(size);
+		comments.resize(size);
+		divisions.resize(size);
+		geneticCodes.resize(size);
+		mitoCodes.resize(size);
+		flagBitsColumn.resize(size);
+	} else if (parentIDs[taxonID] != -1) {
+		return; // Already present
+	}
+	parentIDs[taxonID] = parentID;
+	ranks[taxonID] = rankID;
+	emblCodes[taxonID] = emblCodeOffset;
+	comments[taxonID] = commentsOffset;
+	// Callers have checked these fit a byte (see CodeIDsFit)
+	divisions[taxonID] = divisionID;
+	geneticCodes[taxonID] = geneticID;
+	mitoCodes[taxonID] = mitochondrialGeneticCodeID;
+	flagBitsColumn[taxonID] = flagBits;
+	nodeCount++;
 }
 
 // Returns the parent taxID of a given taxID (-1 if doesn't exist)
-const int LCA_Finder::TraceParent(const int taxID) {
-	std::map<int, TaxonNode>::iterator it = treeHashTable.find(taxID);
-	return (it == treeHashTable.end()) ? -1 : it->second.parentID;
+const int LCA_Finder::TraceParent(const int taxID) const {
+	return (taxID >= 0 && (size_t)taxID < parents.Size()) ? parents[taxID] : -1;
 }
 
 // Returns a list of taxID's starting from a given taxID to the root
 // If it doesn't exist in the tree, returns only the given taxID in the list
-std::list<int> LCA_Finder::TraceToRoot(const int taxID) {
+std::list<int> LCA_Finder::TraceToRoot(const int taxID) const {
 	std::list<int> pathToRoot;
-	int node = taxID;
+	int node = taxID, parent;
 
 	do {
 		pathToRoot.push_back(node);
-		node = TraceParent(node);
+		parent = TraceParent(node);
+		if (parent == node) break; // Roots are their own parent
+		node = parent;
 	} while (node != -1 && node != 1); // -1 is invalid, 1 indicates root
 	return pathToRoot;
-}
\ No newline at end of file
+}
+
+// Returns the taxIDs of the immediate children of a given taxID, in ascending
+// order (empty if it doesn't exist or the tree isn't indexed)
+std::vector<int> LCA_Finder::GetChildren(const int taxID) const {
+	if (!Contains(taxID) || childOffsets.Size() == 0)
+		return std::vector<int>();
+	const int *first = children.Data() + childOffsets[taxID];
+	const int *last = children.Data() + childOffsets[taxID + 1];
+	return std::vector<int>(first, last);
+}
+
+// Returns the taxIDs of a given taxID and all of its descendants, optionally
+// only those of a given rank and/or those not hidden in GenBank lineages
+// If it doesn't exist in the tree, returns only the given taxID
+std::vector<int> LCA_Finder::GetDescendants(const int taxID,
+											const std::string &rank,
+											const bool skipHidden) const {
+	std::vector<int> descendants;
+	if (!Contains(taxID)) {
+		descendants.push_back(taxID);
+		return descendants;
+	}
+
+	// Not indexed (nodes were added since), find the nodes descending from the
+	// taxID by walking up from every node instead
+	std::vector<int> subtree;
+	const int *first, *last;
+	if (preorder.Size() == 0) {
+		for (size_t node = 0; node < parents.Size(); node++) {
+			int ancestor = node, parent = parents[node];
+			while (ancestor != taxID && parent != -1 && parent != ancestor) {
+				ancestor = parent;
+				parent = TraceParent(ancestor);
+			}
+			if (ancestor == taxID) subtree.push_back(node);
+		}
+		first = &subtree[0];
+		last = first + subtree.size();
+	} else {
+		int position = preorderIndex[taxID];
+		if (position == -1) { // Unreachable from any root
+			descendants.push_back(taxID);
+			return descendants;
+		}
+		first = preorder.Data() + position;
+		last = preorder.Data() + subtreeEnds[position];
+	}
+
+	if (rank.empty() && !skipHidden) {
+		descendants.assign(first, last);
+		return descendants;
+	}
+	int rankID = rank.empty() ? -1 : FindRank(rank);
+	if (!rank.empty() && rankID == -1) return descendants; // No such rank
+	for (; first != last; first++) {
+		if (skipHidden && (flags[*first] & GENBANK_HIDDEN_FLAG)) continue;
+		if (rankID != -1 && rankIDs[*first] != rankID) continue;
+		descendants.push_back(*first);
+	}
+	return descendants;
+}
+
+// Returns the preorder position of the shallowest node within the positions
+// [first, last]
+size_t LCA_Finder::RangeMinimum(size_t first, size_t last) const {
+	const int *depths = preorderDepths.Data();
+	size_t firstBlock = first / RMQ_BLOCK_SIZE;
+	size_t lastBlock = last / RMQ_BLOCK_SIZE;
+	size_t best = first;
+
+	if (firstBlock == lastBlock) {
+		for (size_t i = first + 1; i <= last; i++)
+			if (depths[i] < depths[best]) best = i;
+		return best;
+	}
+	// Scan the partial blocks at either end
+	for (size_t i = first + 1; i < (firstBlock + 1) * RMQ_BLOCK_SIZE; i++)
+		if (depths[i] < depths[best]) best = i;
+	for (size_t i = lastBlock * RMQ_BLOCK_SIZE; i <= last; i++)
+		if (depths[i] < depths[best]) best = i;
+	// Whole blocks in between come from two overlapping sparse table entries
+	if (firstBlock + 1 < lastBlock) {
+		size_t from = firstBlock + 1, to = lastBlock - 1;
+		size_t blocks = (preorder.Size() + RMQ_BLOCK_SIZE - 1) / RMQ_BLOCK_SIZE;
+		int level = SparseTableLevels(to - from + 1) - 1;
+		const int *row = blockMinima.Data() + level * blocks;
+		size_t left = row[from], right = row[to + 1 - ((size_t)1 << level)];
+		if (depths[left] < depths[best]) best = left;
+		if (depths[right] < depths[best]) best = right;
+	}
+	return best;
+}
+
+// Returns the taxID of the LCA of two taxIDs, in constant time once the tree is
+// indexed
+// If either is not in the tree or they are in disjoint trees, return -1
+const int LCA_Finder::GetLCA_ID(const int taxID1, const int taxID2) const {
+	if (taxID1 == taxID2) return taxID1;
+	if (!Contains(taxID1) || !Contains(taxID2)) return -1;
+
+	// Not indexed (nodes were added since), walk up the tree instead
+	if (preorder.Size() == 0) {
+		std::vector<int> ancestors;
+		for (int node = taxID1; node != -1; node = TraceParent(node)) {
+			ancestors.push_back(node);
+			if (TraceParent(node) == node) break;
+		}
+		for (int node = taxID2; node != -1; node = TraceParent(node)) {
+			if (std::find(ancestors.begin(), ancestors.end(), node) !=
+				ancestors.end()) {
+				return node;
+			}
+			if (TraceParent(node) == node) break;
+		}
+		return -1;
+	}
+
+	int first = preorderIndex[taxID1], last = preorderIndex[taxID2];
+	if (first == -1 || last == -1) return -1; // Unreachable from any root
+	if (first > last) std::swap(first, last);
+	// The shallowest node after the first up to the last is a child of the
+	// LCA, unless it is the root of another tree
+	size_t shallowest = RangeMinimum(first + 1, last);
+	if (preorderDepths[shallowest] == 0) return -1;
+	return parents[preorder[shallowest]];
+}
+
+// Returns the taxID of the LCA of each of the given sets of taxIDs
+std::vector<int> LCA_Finder::GetLCA_IDs(
+	const std::vector< std::vector<int> > &taxIDSets) const {
+	std::vector<int> LCA_IDs;
+	LCA_IDs.reserve(taxIDSets.size());
+	for (std::vector< std::vector<int> >::const_iterator it = taxIDSets.begin();
+		 it != taxIDSets.end();
+		 it++) {
+		int LCA_ID = it->empty() ? -1 : it->front();
+		for (size_t i = 1; i < it->size() && LCA_ID != -1; i++)
+			LCA_ID = GetLCA_ID(LCA_ID, (*it)[i]);
+		LCA_IDs.push_back(LCA_ID);
+	}
+	return LCA_IDs;
+}
+
+// Returns the depth of a taxID below its root (-1 if it doesn't exist)
+int LCA_Finder::GetDepth(const int taxID) const {
+	if (!Contains(taxID)) return -1;
+
+	// Not indexed (nodes were added since), count the hops to the root
+	if (preorder.Size() == 0) {
+		int depth = 0;
+		for (int node = taxID, parent = TraceParent(node);
+			 parent != -1 && parent != node && Contains(parent);
+			 node = parent, parent = TraceParent(node)) {
+			depth++;
+		}
+		return depth;
+	}
+	int position = preorderIndex[taxID];
+	return (position == -1) ? -1 : preorderDepths[position];
+}
+
+// Returns the ancestor of a taxID at the given depth (-1 if it doesn't exist
+// or isn't that deep)
+int LCA_Finder::GetLevelAncestor(const int taxID, const int depth) const {
+	int nodeDepth = GetDepth(taxID);
+	if (nodeDepth == -1 || depth < 0 || depth > nodeDepth) return -1;
+
+	// Not indexed (nodes were added since), walk up the tree instead
+	if (preorder.Size() == 0) {
+		int node = taxID;
+		for (int hops = nodeDepth - depth; hops > 0; hops--)
+			node = TraceParent(node);
+		return node;
+	}
+	// Nodes of the same depth have disjoint subtrees, so the last one at or
+	// before the taxID in preorder is its ancestor
+	int position = preorderIndex[taxID];
+	const int *first = depthPositions.Data() + depthOffsets[depth];
+	const int *last = depthPositions.Data() + depthOffsets[depth + 1];
+	return preorder[*(std::upper_bound(first, last, position) - 1)];
+}
+
+// Returns the nearest ancestor of a taxID (or the taxID itself) of the given
+// rank (-1 if it doesn't exist or has no such ancestor)
+int LCA_Finder::RollUpToRank(const int taxID, const std::string &rank) const {
+	int rankID = FindRank(rank);
+	if (rankID == -1 || !Contains(taxID)) return -1;
+
+	if (preorder.Size() > 0) {
+		int position = preorderIndex[taxID];
+		if (position == -1) return -1; // Unreachable from any root
+		const int *first = rankPositions.Data() + rankPositionOffsets[rankID];
+		const int *last = rankPositions.Data() +
+						  rankPositionOffsets[rankID + 1];
+		const int *candidate = std::upper_bound(first, last, position);
+		if (candidate == first) return -1; // None precede it at all
+		candidate--;
+		if (subtreeEnds[*candidate] > position) return preorder[*candidate];
+		// The last one of the rank is not an ancestor, which only happens
+		// where the rank nests (e.g. "clade"). Walk up the tree instead
+	}
+	for (int node = taxID; Contains(node); node = TraceParent(node)) {
+		if (rankIDs[node] == rankID) return node;
+		if (TraceParent(node) == node) break;
+	}
+	return -1;
+}
@@ -16,6 +16,8 @@
 #include <map>
 #include <string>
 #include <vector>
+#include <boost/shared_ptr.hpp>
+#include "HelperFunctions.hpp"
 
 // The data structure of nodes.dmp
 struct TaxonNode {
@@ -34,6 +36,12 @@ struct TaxonNode {
 	const char *comments;
 
 	TaxonNode(std::vector<std::string> info);
+	TaxonNode(int taxonID, int parentID, const char *rank,
+			  const char *emblCode, int divisionID, bool inheritedDivFlag,
+			  int geneticID, bool inheritedGCFlag,
+			  int mitochondrialGeneticCodeID, bool inheritedMGCFlag,
+			  bool genbankHiddenFlag, bool hiddenSubtreeRootFlag,
+			  const char *comments);
 };
 
 // Last common ancestor finder
@@ -47,26 +55,162 @@ public:
 	LCA_Finder(std::string &nodesDumpFile);
 	// Give a hash table of a tree
 	LCA_Finder(std::map<int, TaxonNode> &TreeHashTable);
+	// Maps the binary snapshot cacheFile if it is up to date with nodes.dmp,
+	// otherwise loads nodes.dmp and (re)writes the snapshot. A snapshot that
+	// cannot be written is skipped. See LoadCache for verify
+	// Throws std::runtime_error if nodes.dmp is needed but does not exist
+	LCA_Finder(const std::string &nodesDumpFile, const std::string &cacheFile,
+			   bool verify = false);
 	// Loads nodes.dmp for tree hash table
-	// Throws std::runtime_error if file does not exist
+	// Throws std::runtime_error if file does not exist or a row is malformed
 	void LoadData(const char *nodesDumpFile);
 	void LoadData(std::string &nodesDumpFile);
 	// Loads an existing tree hash table
 	void LoadData(std::map<int, TaxonNode> &TreeHashTable);
+	// Adds a single node to the tree (ignored if its taxID is already present)
+	// Invalidates the LCA index until BuildIndex is called again
+	// Throws std::runtime_error if its division or genetic code IDs exceed 255
+	void AddNode(const TaxonNode &node);
+	// Preprocesses the tree for constant time LCA queries. Done automatically
+	// by LoadData, and kept in the binary cache
+	void BuildIndex();
+
+	// Maps a binary snapshot written by SaveCache in place of the current tree
+	// Returns false (leaving the tree empty) if the snapshot is missing,
+	// corrupt, from another version or stale relative to nodes.dmp (its size,
+	// modification time and, if only the latter differs, content hash). Only
+	// the layout is checked unless verify is set, which also checksums every
+	// section (reading the whole snapshot rather than mapping it lazily)
+	bool LoadCache(const std::string &cacheFile,
+				   const std::string &nodesDumpFile, bool verify = false);
+	// Writes the tree as a versioned, checksummed binary snapshot, stamped
+	// with the nodes.dmp it was loaded from
+	// Throws std::runtime_error if the snapshot cannot be written
+	void SaveCache(const std::string &cacheFile,
+				   const std::string &nodesDumpFile) const;
+
+	// Returns the number of nodes in the tree
+	size_t Size() const;
+	// Returns whether the given taxID is in the tree
+	bool Contains(const int taxID) const;
+	// Returns the full nodes.dmp record of a taxID. Its text fields point into
+	// the finder and remain valid until more data is loaded
+	// Throws std::out_of_range if the taxID is not in the tree
+	TaxonNode GetNode(const int taxID) const;
 
 	// Returns the parent taxID of a given taxID (-1 if doesn't exist)
-	const int TraceParent(const int taxID);
+	const int TraceParent(const int taxID) const;
 	// Returns a list of taxID's starting from a given taxID to the root
 	// If it doesn't exist in the tree, returns only the given taxID in the list
-	std::list<int> TraceToRoot(const int taxID);
+	std::list<int> TraceToRoot(const int taxID) const;
+	// Returns the taxIDs of the immediate children of a given taxID, in
+	// ascending order (empty if it doesn't exist or the tree isn't indexed)
+	std::vector<int> GetChildren(const int taxID) const;
+	// Returns the taxIDs of a given taxID and all of its descendants, which are
+	// a contiguous run of the preorder. Optionally only those of a given rank
+	// and/or those not hidden in GenBank lineages
+	// If it doesn't exist in the tree, returns only the given taxID
+	std::vector<int> GetDescendants(const int taxID,
+									const std::string &rank = "",
+									const bool skipHidden = false) const;
+	// Returns the taxID of the LCA of two taxIDs, in constant time once the
+	// tree is indexed
+	// If either is not in the tree or they are in disjoint trees, return -1
+	const int GetLCA_ID(const int taxID1, const int taxID2) const;
 	// Returns the taxID of the LCA given a list of taxIDs
 	// If an empty list, return -1
 	// If somehow the tree hash table is actually disjoint (i.e. actually is
 	// two trees and thus has multiple roots), then return -1
 	template <template <typename, typename> class Container, typename Type>
-	const int GetLCA_ID(Container<Type, std::allocator<Type> > &taxIDs);
+	const int GetLCA_ID(Container<Type, std::allocator<Type> > &taxIDs) const;
+	// Returns the taxID of the LCA of each of the given sets of taxIDs
+	std::vector<int> GetLCA_IDs(
+		const std::vector< std::vector<int> > &taxIDSets) const;
+
+	// Returns the depth of a taxID below its root (0 for the root itself)
+	// If it doesn't exist in the tree, returns -1
+	int GetDepth(const int taxID) const;
+	// Returns the ancestor of a taxID at the given depth (the taxID itself at
+	// its own depth), in logarithmic time once the tree is indexed
+	// If it doesn't exist in the tree or isn't that deep, returns -1
+	int GetLevelAncestor(const int taxID, const int depth) const;
+	// Returns the nearest ancestor of a taxID (or the taxID itself) of the
+	// given rank (e.g. "genus"). Ranks never nest in NCBI's main lineages, so
+	// once the tree is indexed this costs one binary search
+	// If it doesn't exist in the tree or has no such ancestor, returns -1
+	int RollUpToRank(const int taxID, const std::string &rank) const;
 private:
-	std::map<int, TaxonNode> treeHashTable;
+	// Bits of the flags column
+	enum NodeFlags {
+		INHERITED_DIV_FLAG			= 1 << 0,
+		INHERITED_GC_FLAG			= 1 << 1,
+		INHERITED_MGC_FLAG			= 1 << 2,
+		GENBANK_HIDDEN_FLAG			= 1 << 3,
+		HIDDEN_SUBTREE_ROOT_FLAG	= 1 << 4
+	};
+
+	// Stores the given characters once in the string arena and returns their
+	// offset, so that nodes share their (few distinct) text fields
+	unsigned int Intern(const char *text, size_t length);
+	// Interns a rank and returns its number in the rank table
+	// Throws std::runtime_error if there are too many distinct ranks
+	unsigned char InternRank(const char *text, size_t length);
+	// Returns the number of a rank in the rank table (-1 if no node has it)
+	int FindRank(const std::string &rank) const;
+	// Empties the tree
+	void Clear();
+	// Drops the LCA index
+	void ClearIndex();
+	// Returns the preorder position of the shallowest node within the
+	// positions [first, last]
+	size_t RangeMinimum(size_t first, size_t last) const;
+	// Writes a node into the columns, growing them to fit its taxID
+	void StoreNode(int taxonID, int parentID, unsigned char rankID,
+				   unsigned int emblCodeOffset, unsigned int commentsOffset,
+				   int divisionID, int geneticID,
+				   int mitochondrialGeneticCodeID, unsigned char flagBits);
+
+	// The tree is stored as a structure of arrays, all indexed by taxID (NCBI
+	// taxIDs are dense enough for this). Ancestor hops only touch the parent
+	// array; everything else is cold metadata kept out of its way. The columns
+	// borrow their elements from cacheMapping when loaded from a snapshot
+	Column<int> parents;							// -1 if taxID is absent
+	Column<unsigned char> rankIDs;					// Into rankNameOffsets
+	Column<unsigned int> emblCodeOffsets;			// Into stringArena
+	Column<unsigned int> commentsOffsets;			// Into stringArena
+	Column<unsigned char> divisionIDs;
+	Column<unsigned char> geneticIDs;
+	Column<unsigned char> mitochondrialGeneticIDs;
+	Column<unsigned char> flags;					// NodeFlags bits
+	Column<char> stringArena;						// Null terminated texts
+	Column<unsigned int> rankNameOffsets;			// Into stringArena
+	// LCA index: the LCA of two nodes is the parent of the shallowest node
+	// between them in preorder (exclusive of the first), so LCA queries are
+	// range minimum queries over preorder depths. These are answered from a
+	// sparse table over fixed size blocks of the preorder
+	Column<int> preorder;							// taxIDs in preorder
+	Column<int> preorderIndex;						// By taxID, -1 if absent
+	Column<int> preorderDepths;						// Depth of preorder[i]
+	Column<int> blockMinima;						// Sparse table levels
+	// Children of node t are children[childOffsets[t]..childOffsets[t + 1]),
+	// and the descendants of the node at preorder position p fill the
+	// positions up to (not including) subtreeEnds[p]
+	Column<int> childOffsets;						// By taxID, plus one
+	Column<int> children;
+	Column<int> subtreeEnds;						// By preorder position
+	// Level ancestor and rank index: the preorder positions of the nodes at
+	// each depth, and of the nodes of each rank, in ascending order. The
+	// ancestor of a node at some depth (or of some rank) is the last node of
+	// that depth (rank) at or before it in preorder whose subtree holds it
+	Column<int> depthOffsets;						// By depth, plus one
+	Column<int> depthPositions;
+	Column<int> rankPositionOffsets;				// By rank number, plus one
+	Column<int> rankPositions;
+	std::map<std::string, unsigned int> stringOffsets;
+	std::map<unsigned int, unsigned char> rankNumbers;	// By arena offset
+	std::string internKey;
+	size_t nodeCount;
+	boost::shared_ptr<MappedFile> cacheMapping;
 };
 
 // Defines template functions and classes
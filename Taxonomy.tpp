@@ -14,36 +14,16 @@
 // If somehow the tree hash table is actually disjoint (i.e. actually is
 // two trees and thus has multiple roots), then return -1
 template <template <typename, typename> class Container, typename Type>
-const int LCA_Finder::GetLCA_ID(Container<Type, std::allocator<Type> > &taxIDs){
+const int LCA_Finder::GetLCA_ID(
+	Container<Type, std::allocator<Type> > &taxIDs) const {
 	if (taxIDs.size() == 0) return -1;
 	if (taxIDs.size() == 1) return taxIDs.front();
 
-	// Choose first taxID and find ancestors for it
+	// Fold the pairwise LCA over the taxa, stopping early on disjoint trees
 	typename Container<Type, std::allocator<Type> >::iterator 
 		taxIter = taxIDs.begin();
-	std::list<int> ancestors = TraceToRoot(*taxIter);
-	std::list<int>::iterator ancestorIter;
-
-	// Iterate through taxa
-	taxIter++;
-	for (int taxID; taxIter != taxIDs.end(); taxIter++) {
-		taxID = *taxIter;
-		// See where the LCA for this taxID and the first taxID is
-		do {
-			for (ancestorIter = ancestors.begin();
-				 ancestorIter != ancestors.end();
-				 ancestorIter++) {
-				if (taxID == *ancestorIter) break;
-			}
-			if (taxID == *ancestorIter) break;
-			taxID = TraceParent(taxID);
-		} while (taxID != -1);
-		// Remove all ancestors from first taxon that are children of this LCA
-		if (taxID == *ancestorIter) {
-			ancestors.erase(ancestors.begin(), ancestorIter);
-		} else { // Disjoint trees
-			return -1;
-		}
-	}
-	return ancestors.front();
+	int LCA_ID = *taxIter;
+	for (taxIter++; taxIter != taxIDs.end() && LCA_ID != -1; taxIter++)
+		LCA_ID = GetLCA_ID(LCA_ID, *taxIter);
+	return LCA_ID;
 }
\ No newline at end of file
@@ -0,0 +1,456 @@
+// TaxonomyNames.cpp - An index of the names in NCBI's names.dmp (scientific
+// names, synonyms, common names...), so that taxa can be given by name instead
+// of by taxonomy ID. Names are looked up ignoring case and runs of whitespace,
+// by hash or by prefix, and the index maps straight from a binary snapshot.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "Compression.hpp"
+#include "HelperFunctions.hpp"
+#include "TaxonomyNames.hpp"
+
+namespace {
+	// Number of fields in each row of names.dmp
+	const int NAMES_DUMP_FIELDS = 4;
+
+	// Binary snapshot layout: a CacheHeader followed by each column's
+	// elements, every column starting on an eight byte boundary so it can be
+	// used straight from the mapping
+	const char NAME_CACHE_MAGIC[8] = {'C','B','D','B','N','A','M','\0'};
+	const uint32_t NAME_CACHE_VERSION = 1;
+
+	// Columns of the snapshot, in the order they are written
+	enum CacheSection {
+		NAME_ARENA_SECTION,
+		NAME_OFFSETS_SECTION,
+		NAME_TAXIDS_SECTION,
+		HASH_SLOTS_SECTION,
+		SCIENTIFIC_NAMES_SECTION,
+		CACHE_SECTIONS
+	};
+
+	struct CacheHeader {
+		SnapshotHeader snapshot;
+		SourceStamp source;					// Of names.dmp
+		uint64_t nameCount;
+		SnapshotSections<CACHE_SECTIONS> sections;
+	};
+
+	// A name of names.dmp while the index is built: its normalized form
+	// (kept in a buffer) and where it is written in the dump
+	struct NameEntry {
+		size_t keyOffset;
+		unsigned int length;		// Of the normalized form
+		const char *textFirst;
+		const char *textLast;
+		int taxID;
+		bool scientific;			// The scientific name of its taxon
+		bool unique;				// NCBI's unique name of its taxon
+	};
+
+	bool IsSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	char Lower(char c) {
+		return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+	}
+
+	// Appends the characters [first, last) to output with runs of whitespace
+	// made single spaces and trimmed from either end, lowercased if asked
+	void Normalize(const char *first, const char *last, bool lower,
+				   std::string &output) {
+		bool space = false, any = false;
+		for (; first != last; first++) {
+			if (IsSpace(*first)) {
+				space = any;
+				continue;
+			}
+			if (space) output += ' ';
+			output += lower ? Lower(*first) : *first;
+			space = false;
+			any = true;
+		}
+	}
+
+	// Compares a stored name to a normalized key, as though it were
+	// normalized too (stored names only differ from their keys by case)
+	// Returns <0, 0 or >0 as for strcmp, only comparing the first maxLength
+	// characters
+	int CompareName(const char *name, const std::string &key,
+					size_t maxLength) {
+		size_t length = std::min(key.size(), maxLength);
+		for (size_t i = 0; i < length; i++) {
+			unsigned char a = Lower(name[i]), b = key[i];
+			if (a != b) return (a < b) ? -1 : 1;
+			if (a == '\0') return 0;
+		}
+		if (length < maxLength && name[length] != '\0') return 1;
+		return 0;
+	}
+
+	// Splits a row of a taxonomy dump, whose fields are separated by "\t|\t"
+	// and which ends with "\t|", into at most maxFields fields
+	// Returns the number of fields found
+	int SplitRow(const char *first, const char *last, const char **fieldFirst,
+				 const char **fieldLast, int maxFields) {
+		if (last > first && last[-1] == '\r') last--;
+		if (last - first >= 2 && last[-1] == '|' && last[-2] == '\t')
+			last -= 2;
+		int fields = 0;
+		const char *fieldStart = first, *cursor = first;
+		while (fields < maxFields) {
+			const char *pipe = static_cast<const char *>(
+				memchr(cursor, '|', last - cursor));
+			if (pipe == NULL) {
+				fieldFirst[fields] = fieldStart;
+				fieldLast[fields] = last;
+				return fields + 1;
+			}
+			cursor = pipe + 1;
+			// A '|' within a field is not a delimiter
+			if (pipe == fieldStart || pipe[-1] != '\t' || cursor == last ||
+				*cursor != '\t') {
+				continue;
+			}
+			fieldFirst[fields] = fieldStart;
+			fieldLast[fields] = pipe - 1;
+			fields++;
+			fieldStart = ++cursor;
+		}
+		return fields;
+	}
+
+	// Returns whether the characters [first, last) spell out text
+	bool FieldIs(const char *first, const char *last, const char *text) {
+		size_t length = strlen(text);
+		return (size_t)(last - first) == length &&
+			   memcmp(first, text, length) == 0;
+	}
+}
+
+// ==== CLASSES ================================================================
+
+const int NameIndex::AMBIGUOUS_NAME;
+
+// Default constructor, needs later setup with names.dmp or a snapshot
+NameIndex::NameIndex() {}
+
+// Maps the binary snapshot cacheFile if it is up to date with names.dmp,
+// otherwise loads names.dmp and (re)writes the snapshot. A snapshot that
+// cannot be written is skipped. See LoadCache for verify
+// Throws std::runtime_error if names.dmp is needed but cannot be read or is
+// malformed
+NameIndex::NameIndex(const std::string &namesDumpFile,
+					 const std::string &cacheFile, bool verify) {
+	if (LoadCache(cacheFile, namesDumpFile, verify)) return;
+	LoadData(namesDumpFile);
+	try {
+		SaveCache(cacheFile, namesDumpFile);
+	} catch (const std::runtime_error &e) {
+		// The index is loaded regardless, the next run will simply try again
+	}
+}
+
+// Loads names.dmp: every name but the authorities (citations rather than
+// names) is gathered, the names are sorted by their normalized forms and each
+// distinct one is stored once, resolved to the taxon it names best
+// Throws std::runtime_error if it cannot be read or is malformed
+void NameIndex::LoadData(const std::string &namesDumpFile) {
+	Clear();
+	InputFile file(namesDumpFile, "names.dmp");
+	const char *cursor = file.Data(), *end = cursor + file.Size();
+	const char *fieldFirst[NAMES_DUMP_FIELDS], *fieldLast[NAMES_DUMP_FIELDS];
+	std::vector<NameEntry> entries;
+	std::string keys;
+	size_t line = 0;
+	while (cursor < end) {
+		const char *newline = static_cast<const char *>(
+			memchr(cursor, '\n', end - cursor));
+		const char *lineEnd = (newline == NULL) ? end : newline;
+		const char *lineStart = cursor;
+		cursor = lineEnd + 1;
+		line++;
+		if (lineEnd == lineStart || (lineEnd - lineStart == 1 &&
+									 *lineStart == '\r')) {
+			continue;
+		}
+		int fields = SplitRow(lineStart, lineEnd, fieldFirst, fieldLast,
+							  NAMES_DUMP_FIELDS);
+		int taxID = 0;
+		const char *digit = fieldFirst[0];
+		for (; digit != fieldLast[0] && *digit >= '0' && *digit <= '9';
+			 digit++) {
+			if (taxID > (std::numeric_limits<int>::max() - 9) / 10) break;
+			taxID = taxID * 10 + (*digit - '0');
+		}
+		if (fields < NAMES_DUMP_FIELDS || digit == fieldFirst[0] ||
+			digit != fieldLast[0]) {
+			throw std::runtime_error("Malformed names file: " + namesDumpFile +
+				" (line " + boost::lexical_cast<std::string>(line) + ")");
+		}
+		if (FieldIs(fieldFirst[3], fieldLast[3], "authority")) continue;
+		bool scientific = FieldIs(fieldFirst[3], fieldLast[3],
+								  "scientific name");
+
+		// The name, then its unique form if it has one
+		for (int field = 1; field <= 2; field++) {
+			NameEntry entry;
+			entry.keyOffset = keys.size();
+			entry.textFirst = fieldFirst[field];
+			entry.textLast = fieldLast[field];
+			Normalize(fieldFirst[field], fieldLast[field], true, keys);
+			entry.length = keys.size() - entry.keyOffset;
+			if (entry.length == 0) continue;
+			entry.taxID = taxID;
+			entry.scientific = scientific && field == 1;
+			entry.unique = field == 2;
+			entries.push_back(entry);
+		}
+	}
+
+	// Order by name, then the taxa they name best come first: those they are
+	// the (unique) scientific name of, then by taxonomy ID
+	struct ByName {
+		const char *keys;
+		bool operator()(const NameEntry &a, const NameEntry &b) const {
+			int order = memcmp(keys + a.keyOffset, keys + b.keyOffset,
+							   std::min(a.length, b.length));
+			if (order != 0) return order < 0;
+			if (a.length != b.length) return a.length < b.length;
+			bool aFirst = a.scientific || a.unique;
+			bool bFirst = b.scientific || b.unique;
+			if (aFirst != bFirst) return aFirst;
+			return a.taxID < b.taxID;
+		}
+	};
+	ByName byName;
+	byName.keys = keys.data();
+	std::sort(entries.begin(), entries.end(), byName);
+
+	// Store each distinct name once. A name is ambiguous if it equally well
+	// names another taxon
+	std::vector<char> &arena = nameArena.Mutable();
+	std::vector<unsigned int> &offsets = nameOffsets.Mutable();
+	std::vector<int> &taxIDs = nameTaxIDs.Mutable();
+	std::vector<int> &scientificNumbers = scientificNames.Mutable();
+	std::vector<uint64_t> hashes;
+	std::string text;
+	for (size_t first = 0, last; first < entries.size(); first = last) {
+		const NameEntry &best = entries[first];
+		bool bestFirst = best.scientific || best.unique;
+		int taxID = best.taxID;
+		for (last = first + 1; last < entries.size() &&
+			 entries[last].length == best.length &&
+			 memcmp(keys.data() + entries[last].keyOffset,
+					keys.data() + best.keyOffset, best.length) == 0;
+			 last++) {
+			bool lastFirst = entries[last].scientific || entries[last].unique;
+			if (lastFirst == bestFirst && entries[last].taxID != best.taxID)
+				taxID = AMBIGUOUS_NAME;
+		}
+		if (arena.size() + best.length + 1 >
+			std::numeric_limits<unsigned int>::max()) {
+			throw std::runtime_error("Too many names in: " + namesDumpFile);
+		}
+		unsigned int number = offsets.size();
+		offsets.push_back(arena.size());
+		text.clear();
+		Normalize(best.textFirst, best.textLast, false, text);
+		arena.insert(arena.end(), text.begin(), text.end());
+		arena.push_back('\0');
+		taxIDs.push_back(taxID);
+		hashes.push_back(HashBytes(keys.data() + best.keyOffset,
+								   best.length));
+		for (size_t i = first; i < last; i++) {
+			if (!entries[i].scientific) continue;
+			if ((size_t)entries[i].taxID >= scientificNumbers.size())
+				scientificNumbers.resize(entries[i].taxID + 1, -1);
+			scientificNumbers[entries[i].taxID] = number;
+		}
+	}
+	std::vector<NameEntry>().swap(entries);
+
+	// Hash table at most half full, so probe sequences stay short
+	size_t slotCount = 1;
+	while (slotCount < 2 * offsets.size()) slotCount <<= 1;
+	std::vector<unsigned int> &slots = hashSlots.Mutable();
+	slots.assign(slotCount, 0);
+	for (size_t number = 0; number < hashes.size(); number++) {
+		size_t slot = hashes[number] & (slotCount - 1);
+		while (slots[slot] != 0) slot = (slot + 1) & (slotCount - 1);
+		slots[slot] = number + 1;
+	}
+}
+
+// Maps a binary snapshot written by SaveCache in place of the current index
+// Returns false (leaving the index empty) if the snapshot is missing, corrupt,
+// from another version or stale relative to names.dmp. The checksum is only
+// verified if asked, as it reads every page of what is otherwise mapped lazily
+bool NameIndex::LoadCache(const std::string &cacheFile,
+						  const std::string &namesDumpFile, bool verify) {
+	Clear();
+	if (!FileExists(cacheFile) || !FileExists(namesDumpFile)) return false;
+
+	boost::shared_ptr<MappedFile> file(new MappedFile(cacheFile));
+	if (file->Size() < sizeof(CacheHeader)) return false;
+	CacheHeader header;
+	memcpy(&header, file->Data(), sizeof(header));
+	if (!SnapshotMatches(header.snapshot, NAME_CACHE_MAGIC, NAME_CACHE_VERSION))
+		return false;
+
+	// Stale if names.dmp changed since the snapshot was taken
+	if (!SourceUnchanged(namesDumpFile, header.source)) return false;
+
+	const SnapshotSections<CACHE_SECTIONS> &layout = header.sections;
+	bool valid =
+		BorrowSection(*file, layout, NAME_ARENA_SECTION, nameArena) &&
+		BorrowSection(*file, layout, NAME_OFFSETS_SECTION, nameOffsets) &&
+		BorrowSection(*file, layout, NAME_TAXIDS_SECTION, nameTaxIDs) &&
+		BorrowSection(*file, layout, HASH_SLOTS_SECTION, hashSlots) &&
+		BorrowSection(*file, layout, SCIENTIFIC_NAMES_SECTION,
+					  scientificNames);
+	if (valid) {
+		const size_t elementSizes[CACHE_SECTIONS] = {
+			1, sizeof(unsigned int), sizeof(int), sizeof(unsigned int),
+			sizeof(int)
+		};
+		size_t slotCount = hashSlots.Size();
+		valid = (!verify ||
+				 ChecksumSections(*file, layout, elementSizes) ==
+					layout.checksum) &&
+				nameOffsets.Size() == header.nameCount &&
+				nameTaxIDs.Size() == header.nameCount &&
+				slotCount >= 2 * header.nameCount &&
+				(slotCount & (slotCount - 1)) == 0 &&
+				(header.nameCount == 0 ||
+				 nameArena[nameArena.Size() - 1] == '\0');
+	}
+	if (!valid) {
+		Clear();
+		return false;
+	}
+	cacheMapping = file;
+	return true;
+}
+
+// Writes the index as a versioned, checksummed binary snapshot, stamped with
+// the names.dmp it was loaded from. The snapshot is written aside and renamed
+// into place so concurrent runs never map a half written file
+// Throws std::runtime_error if the snapshot cannot be written
+void NameIndex::SaveCache(const std::string &cacheFile,
+						  const std::string &namesDumpFile) const {
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	StampSnapshot(header.snapshot, NAME_CACHE_MAGIC, NAME_CACHE_VERSION);
+	header.source = StampSource(namesDumpFile);
+	header.nameCount = nameOffsets.Size();
+
+	AtomicFile cache(cacheFile);
+	std::ofstream ofs(cache.TempName().c_str(),
+					  std::ios::out | std::ios::binary | std::ios::trunc);
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + cache.TempName());
+	SnapshotSections<CACHE_SECTIONS> &layout = header.sections;
+	ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	WriteSection(ofs, layout, NAME_ARENA_SECTION, nameArena);
+	WriteSection(ofs, layout, NAME_OFFSETS_SECTION, nameOffsets);
+	WriteSection(ofs, layout, NAME_TAXIDS_SECTION, nameTaxIDs);
+	WriteSection(ofs, layout, HASH_SLOTS_SECTION, hashSlots);
+	WriteSection(ofs, layout, SCIENTIFIC_NAMES_SECTION, scientificNames);
+	ofs.seekp(0);
+	ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	ofs.close();
+	if (ofs.fail())
+		throw std::runtime_error("Cannot write: " + cacheFile);
+	cache.Commit();
+}
+
+// Returns the number of distinct names
+size_t NameIndex::Size() const {
+	return nameOffsets.Size();
+}
+
+// Returns the taxonomy ID a name resolves to: -1 if it isn't known,
+// AMBIGUOUS_NAME if shared
+int NameIndex::Find(const std::string &name) const {
+	std::string key;
+	Normalize(name.data(), name.data() + name.size(), true, key);
+	if (key.empty() || hashSlots.Size() == 0) return -1;
+	size_t mask = hashSlots.Size() - 1;
+	const char *arena = nameArena.Data();
+	for (size_t slot = HashBytes(key.data(), key.size()) & mask;
+		 hashSlots[slot] != 0;
+		 slot = (slot + 1) & mask) {
+		unsigned int number = hashSlots[slot] - 1;
+		if (CompareName(arena + nameOffsets[number], key,
+						key.size() + 1) == 0)
+			return nameTaxIDs[number];
+	}
+	return -1;
+}
+
+// Returns the names starting with a prefix with the taxonomy ID each resolves
+// to, in alphabetical order, at most limit of them (all if 0)
+std::vector< std::pair<std::string, int> > NameIndex::FindPrefix(
+	const std::string &prefix, size_t limit) const {
+	std::string key;
+	Normalize(prefix.data(), prefix.data() + prefix.size(), true, key);
+	std::vector< std::pair<std::string, int> > names;
+	const char *arena = nameArena.Data();
+	for (size_t number = LowerBound(key);
+		 number < nameOffsets.Size() && (limit == 0 || names.size() < limit);
+		 number++) {
+		const char *name = arena + nameOffsets[number];
+		if (CompareName(name, key, key.size()) != 0) break;
+		names.push_back(std::make_pair(std::string(name), nameTaxIDs[number]));
+	}
+	return names;
+}
+
+// Returns the scientific name of a taxonomy ID (empty if it has none)
+std::string NameIndex::GetName(const int taxID) const {
+	if (taxID < 0 || (size_t)taxID >= scientificNames.Size() ||
+		scientificNames[taxID] == -1) {
+		return "";
+	}
+	return nameArena.Data() + nameOffsets[scientificNames[taxID]];
+}
+
+// Empties the index
+void NameIndex::Clear() {
+	nameArena.Clear();
+	nameOffsets.Clear();
+	nameTaxIDs.Clear();
+	hashSlots.Clear();
+	scientificNames.Clear();
+	cacheMapping.reset();
+}
+
+// Returns the position of the first name not ordered before key
+size_t NameIndex::LowerBound(const std::string &key) const {
+	const char *arena = nameArena.Data();
+	size_t first = 0, count = nameOffsets.Size();
+	while (count > 0) {
+		size_t half = count / 2;
+		if (CompareName(arena + nameOffsets[first + half], key,
+						key.size() + 1) < 0) {
+			first += half + 1;
+			count -= half + 1;
+		} else {
+			count = half;
+		}
+	}
+	return first;
+}
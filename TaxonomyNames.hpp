@@ -0,0 +1,86 @@
+// TaxonomyNames.hpp - An index of the names in NCBI's names.dmp (scientific
+// names, synonyms, common names...), so that taxa can be given by name instead
+// of by taxonomy ID. Names are looked up ignoring case and runs of whitespace,
+// by hash or by prefix, and the index maps straight from a binary snapshot.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef TAXONOMYNAMES_HPP
+#define TAXONOMYNAMES_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "HelperFunctions.hpp"
+
+// Each distinct name is stored once and resolves to a single taxonomy ID: the
+// taxon it is the scientific name of, or else the taxon it is another name of.
+// Names shared by several taxa at the same standing (e.g. the genus
+// "Bacillus" of bacteria and of stick insects) are ambiguous; NCBI gives such
+// taxa unique names (e.g. "Bacillus <bacteria>"), which are indexed too
+class NameIndex {
+public:
+	// Returned by Find for a name shared by several taxa
+	static const int AMBIGUOUS_NAME = -2;
+
+	// Default constructor, needs later setup with names.dmp or a snapshot
+	NameIndex();
+	// Maps the binary snapshot cacheFile if it is up to date with names.dmp,
+	// otherwise loads names.dmp and (re)writes the snapshot. A snapshot that
+	// cannot be written is skipped. See LoadCache for verify
+	// Throws std::runtime_error if names.dmp is needed but cannot be read or
+	// is malformed
+	NameIndex(const std::string &namesDumpFile, const std::string &cacheFile,
+			  bool verify = false);
+	// Loads names.dmp
+	// Throws std::runtime_error if it cannot be read or is malformed
+	void LoadData(const std::string &namesDumpFile);
+
+	// Maps a binary snapshot written by SaveCache in place of the current
+	// index
+	// Returns false (leaving the index empty) if the snapshot is missing,
+	// corrupt, from another version or stale relative to names.dmp. Only the
+	// layout is checked unless verify is set, which also checksums every
+	// section (reading the whole snapshot rather than mapping it lazily)
+	bool LoadCache(const std::string &cacheFile,
+				   const std::string &namesDumpFile, bool verify = false);
+	// Writes the index as a versioned, checksummed binary snapshot, stamped
+	// with the names.dmp it was loaded from
+	// Throws std::runtime_error if the snapshot cannot be written
+	void SaveCache(const std::string &cacheFile,
+				   const std::string &namesDumpFile) const;
+
+	// Returns the number of distinct names
+	size_t Size() const;
+	// Returns the taxonomy ID a name resolves to, ignoring case and runs of
+	// whitespace: -1 if it isn't known, AMBIGUOUS_NAME if shared
+	int Find(const std::string &name) const;
+	// Returns the names (as written in names.dmp) starting with a prefix,
+	// again ignoring case and whitespace, with the taxonomy ID each resolves
+	// to. Names come in alphabetical order, at most limit of them (all if 0)
+	std::vector< std::pair<std::string, int> > FindPrefix(
+		const std::string &prefix, size_t limit = 0) const;
+	// Returns the scientific name of a taxonomy ID (empty if it has none)
+	std::string GetName(const int taxID) const;
+private:
+	// Empties the index
+	void Clear();
+	// Returns the position of the first name not ordered before key
+	size_t LowerBound(const std::string &key) const;
+
+	// Names in the order of their normalized forms, with the taxonomy ID
+	// each resolves to. Lookups go through an open addressed hash table of
+	// name numbers. The columns borrow their elements from cacheMapping when
+	// loaded from a snapshot
+	Column<char> nameArena;						// Null terminated names
+	Column<unsigned int> nameOffsets;			// Into nameArena
+	Column<int> nameTaxIDs;						// By name number
+	Column<unsigned int> hashSlots;				// Name number + 1, 0 if empty
+	Column<int> scientificNames;				// By taxID, name number or -1
+	boost::shared_ptr<MappedFile> cacheMapping;
+};
+
+#endif // TAXONOMYNAMES_HPP
@@ -0,0 +1,428 @@
+// TaxonomyServer.cpp - Keeps a loaded taxonomy resident and answers LCA,
+// parent, root path and descendant queries for other processes over a UNIX
+// domain socket, so that they need not load nodes.dmp themselves.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "TaxonomyServer.hpp"
+
+namespace {
+	// Connections waited on at once and the bytes read from one at a time
+	const int MAX_EVENTS = 64;
+	const size_t READ_SIZE = 64 << 10;
+
+	// Returns the address of a socket path
+	// Throws std::runtime_error if the path is too long for a socket
+	struct sockaddr_un SocketAddress(const std::string &socketPath) {
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path))
+			throw std::runtime_error("Socket path too long: " + socketPath);
+		memcpy(address.sun_path, socketPath.data(), socketPath.size());
+		return address;
+	}
+
+	// Returns a connected socket to socketPath, or -1 if none is listening
+	int ConnectTo(const std::string &socketPath) {
+		struct sockaddr_un address = SocketAddress(socketPath);
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1) return -1;
+		if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	// Writes all of size bytes, returning false on failure
+	bool WriteAll(int fd, const char *data, size_t size) {
+		while (size > 0) {
+			ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+			if (written == -1) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	// Reads exactly size bytes, returning false on failure or end of file
+	bool ReadAll(int fd, char *data, size_t size) {
+		while (size > 0) {
+			ssize_t bytesRead = read(fd, data, size);
+			if (bytesRead == -1 && errno == EINTR) continue;
+			if (bytesRead <= 0) return false;
+			data += bytesRead;
+			size -= bytesRead;
+		}
+		return true;
+	}
+
+	// Appends a reply to output
+	template <typename Iterator>
+	void AppendReply(uint32_t status, Iterator first, Iterator last,
+					 std::string &output) {
+		TaxonomyMessage header;
+		header.code = status;
+		header.size = 0;
+		size_t headerOffset = output.size();
+		output.append((const char *)&header, sizeof(header));
+		for (; first != last; first++) {
+			int32_t taxID = *first;
+			output.append((const char *)&taxID, sizeof(taxID));
+			header.size += sizeof(taxID);
+		}
+		memcpy(&output[headerOffset], &header, sizeof(header));
+	}
+
+	// Appends the taxIDs of a vector to a request payload
+	void AppendTaxIDs(const std::vector<int> &taxIDs, std::string &payload) {
+		for (std::vector<int>::const_iterator it = taxIDs.begin();
+			 it != taxIDs.end();
+			 it++) {
+			int32_t taxID = *it;
+			payload.append((const char *)&taxID, sizeof(taxID));
+		}
+	}
+
+	// Changes the events waited for on a connection
+	void WaitFor(int epollFd, int fd, uint32_t events) {
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = events;
+		event.data.fd = fd;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+	}
+}
+
+// ==== CLASSES ================================================================
+
+// TaxonomyServer - Answers taxonomy queries over a UNIX domain socket
+TaxonomyServer::TaxonomyServer(const LCA_Finder &taxonomy)
+	: taxonomy(taxonomy) {}
+
+// Listens on socketPath and answers clients until SIGINT or SIGTERM
+void TaxonomyServer::Serve(const std::string &socketPath) {
+	// Replace the socket of a server that is no longer running
+	int existing = ConnectTo(socketPath);
+	if (existing != -1) {
+		close(existing);
+		throw std::runtime_error("A server is already listening on: " +
+								 socketPath);
+	}
+	unlink(socketPath.c_str());
+
+	struct sockaddr_un address = SocketAddress(socketPath);
+	int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+						  0);
+	if (listenFd == -1 ||
+		bind(listenFd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+		listen(listenFd, SOMAXCONN) == -1) {
+		std::string reason = strerror(errno);
+		if (listenFd != -1) close(listenFd);
+		throw std::runtime_error("Cannot listen on: " + socketPath + " (" +
+								 reason + ")");
+	}
+
+	// Signals are taken as events like any other, so that the socket is
+	// always removed on the way out
+	sigset_t signals, oldSignals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &signals, &oldSignals);
+	int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = listenFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+	event.data.fd = signalFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+	std::map<int, Connection> connections;
+	std::vector<char> buffer(READ_SIZE);
+	struct epoll_event events[MAX_EVENTS];
+	bool serving = (signalFd != -1 && epollFd != -1);
+	while (serving) {
+		int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+		if (ready == -1 && errno != EINTR) break;
+		for (int i = 0; i < ready; i++) {
+			int fd = events[i].data.fd;
+			if (fd == signalFd) {
+				serving = false;
+				break;
+			}
+
+			// Accept every waiting client
+			if (fd == listenFd) {
+				int clientFd;
+				while ((clientFd = accept4(listenFd, NULL, NULL,
+						SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+					event.events = EPOLLIN;
+					event.data.fd = clientFd;
+					epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &event);
+					connections[clientFd].outputSent = 0;
+				}
+				continue;
+			}
+
+			// Read what a client sent and answer whole requests, but only
+			// once its earlier replies are sent, so that a client not
+			// reading its replies cannot make them pile up
+			Connection &connection = connections[fd];
+			bool open = true;
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				for (;;) {
+					ssize_t bytesRead = read(fd, &buffer[0], buffer.size());
+					if (bytesRead > 0) {
+						connection.input.append(&buffer[0], bytesRead);
+						continue;
+					}
+					if (bytesRead == 0 ||
+						(errno != EAGAIN && errno != EWOULDBLOCK &&
+						 errno != EINTR))
+						open = false;
+					if (bytesRead == 0 || errno != EINTR) break;
+				}
+				if (!AnswerRequests(connection)) open = false;
+			}
+			while (open && connection.outputSent < connection.output.size()) {
+				ssize_t written = send(fd,
+					connection.output.data() + connection.outputSent,
+					connection.output.size() - connection.outputSent,
+					MSG_NOSIGNAL);
+				if (written == -1) {
+					if (errno == EINTR) continue;
+					if (errno != EAGAIN && errno != EWOULDBLOCK) open = false;
+					break;
+				}
+				connection.outputSent += written;
+			}
+			if (!open) {
+				close(fd);
+				connections.erase(fd);
+				continue;
+			}
+			if (connection.outputSent == connection.output.size()) {
+				connection.output.clear();
+				connection.outputSent = 0;
+				if (!connection.input.empty() && !AnswerRequests(connection)) {
+					close(fd);
+					connections.erase(fd);
+					continue;
+				}
+			}
+			WaitFor(epollFd, fd, connection.output.empty() ?
+				EPOLLIN : EPOLLOUT);
+		}
+	}
+
+	for (std::map<int, Connection>::iterator it = connections.begin();
+		 it != connections.end();
+		 it++)
+		close(it->first);
+	if (epollFd != -1) close(epollFd);
+	if (signalFd != -1) close(signalFd);
+	close(listenFd);
+	unlink(socketPath.c_str());
+	sigprocmask(SIG_SETMASK, &oldSignals, NULL);
+}
+
+// Answers every whole request a connection has sent, unless replies are
+// still waiting to be sent
+bool TaxonomyServer::AnswerRequests(Connection &connection) const {
+	if (!connection.output.empty()) return true;
+	size_t offset = 0;
+	TaxonomyMessage header;
+	while (connection.input.size() - offset >= sizeof(header)) {
+		memcpy(&header, connection.input.data() + offset, sizeof(header));
+		if (header.size > MAX_TAXONOMY_REQUEST_SIZE) return false;
+		if (connection.input.size() - offset - sizeof(header) < header.size)
+			break;
+		Answer(header.code, connection.input.data() + offset + sizeof(header),
+			   header.size, connection.output);
+		offset += sizeof(header) + header.size;
+	}
+	connection.input.erase(0, offset);
+	return true;
+}
+
+// Appends the reply to a request to reply
+void TaxonomyServer::Answer(uint32_t code, const char *payload, uint32_t size,
+							std::string &reply) const {
+	std::vector<int> taxIDs(size / sizeof(int32_t));
+	if (!taxIDs.empty())
+		memcpy(&taxIDs[0], payload, taxIDs.size() * sizeof(int32_t));
+	std::vector<int> answer;
+	switch (code) {
+		case LCA_REQUEST:
+			if (size % sizeof(int32_t) != 0 || taxIDs.empty()) break;
+			answer.push_back(taxonomy.GetLCA_ID<std::vector, int>(taxIDs));
+			AppendReply(REPLY_OK, answer.begin(), answer.end(), reply);
+			return;
+		case LCA_PAIRS_REQUEST:
+			if (size % (2 * sizeof(int32_t)) != 0) break;
+			for (size_t i = 0; i < taxIDs.size(); i += 2)
+				answer.push_back(taxonomy.GetLCA_ID(taxIDs[i],
+													taxIDs[i + 1]));
+			AppendReply(REPLY_OK, answer.begin(), answer.end(), reply);
+			return;
+		case PARENT_REQUEST:
+			if (size % sizeof(int32_t) != 0) break;
+			for (size_t i = 0; i < taxIDs.size(); i++)
+				answer.push_back(taxonomy.TraceParent(taxIDs[i]));
+			AppendReply(REPLY_OK, answer.begin(), answer.end(), reply);
+			return;
+		case ROOT_PATH_REQUEST: {
+			if (size != sizeof(int32_t)) break;
+			std::list<int> path = taxonomy.TraceToRoot(taxIDs[0]);
+			AppendReply(REPLY_OK, path.begin(), path.end(), reply);
+			return;
+		}
+		case DESCENDANTS_REQUEST: {
+			if (size < 2 * sizeof(int32_t)) break;
+			std::string rank(payload + 2 * sizeof(int32_t),
+							 size - 2 * sizeof(int32_t));
+			answer = taxonomy.GetDescendants(taxIDs[0], rank, taxIDs[1] != 0);
+			AppendReply(REPLY_OK, answer.begin(), answer.end(), reply);
+			return;
+		}
+		case ROLL_UP_REQUEST: {
+			if (size < sizeof(int32_t)) break;
+			std::string rank(payload + sizeof(int32_t),
+							 size - sizeof(int32_t));
+			answer.push_back(taxonomy.RollUpToRank(taxIDs[0], rank));
+			AppendReply(REPLY_OK, answer.begin(), answer.end(), reply);
+			return;
+		}
+	}
+	AppendReply(REPLY_BAD_REQUEST, answer.end(), answer.end(), reply);
+}
+
+// TaxonomyClient - A connection to a TaxonomyServer
+TaxonomyClient::TaxonomyClient() : socketFd(-1) {}
+
+TaxonomyClient::~TaxonomyClient() {
+	if (socketFd != -1) close(socketFd);
+}
+
+// Connects to the server listening on socketPath
+bool TaxonomyClient::Connect(const std::string &socketPath) {
+	if (socketFd != -1) close(socketFd);
+	socketFd = ConnectTo(socketPath);
+	return socketFd != -1;
+}
+
+// Returns whether connected to a server
+bool TaxonomyClient::Connected() const {
+	return socketFd != -1;
+}
+
+// Returns the LCA of the taxIDs (-1 if there are none)
+int TaxonomyClient::GetLCA_ID(const std::vector<int> &taxIDs) {
+	if (taxIDs.empty()) return -1;
+	std::string payload;
+	AppendTaxIDs(taxIDs, payload);
+	return Request(LCA_REQUEST, payload).at(0);
+}
+
+// Returns the LCA of each pair of taxIDs
+std::vector<int> TaxonomyClient::GetLCA_IDs(
+	const std::vector< std::pair<int, int> > &taxIDPairs) {
+	std::vector<int> taxIDs;
+	taxIDs.reserve(2 * taxIDPairs.size());
+	for (std::vector< std::pair<int, int> >::const_iterator it =
+		 taxIDPairs.begin();
+		 it != taxIDPairs.end();
+		 it++) {
+		taxIDs.push_back(it->first);
+		taxIDs.push_back(it->second);
+	}
+	std::string payload;
+	AppendTaxIDs(taxIDs, payload);
+	return Request(LCA_PAIRS_REQUEST, payload);
+}
+
+// Returns the parent of each taxID (-1 for those not in the tree)
+std::vector<int> TaxonomyClient::TraceParents(const std::vector<int> &taxIDs) {
+	std::string payload;
+	AppendTaxIDs(taxIDs, payload);
+	return Request(PARENT_REQUEST, payload);
+}
+
+// Returns the taxIDs from a taxID to the root
+std::list<int> TaxonomyClient::TraceToRoot(const int taxID) {
+	std::string payload;
+	AppendTaxIDs(std::vector<int>(1, taxID), payload);
+	std::vector<int> path = Request(ROOT_PATH_REQUEST, payload);
+	return std::list<int>(path.begin(), path.end());
+}
+
+// Returns a taxID and its descendants, optionally only those of a rank and/or
+// those not hidden
+std::vector<int> TaxonomyClient::GetDescendants(const int taxID,
+												const std::string &rank,
+												const bool skipHidden) {
+	std::vector<int> arguments;
+	arguments.push_back(taxID);
+	arguments.push_back(skipHidden ? 1 : 0);
+	std::string payload;
+	AppendTaxIDs(arguments, payload);
+	payload += rank;
+	return Request(DESCENDANTS_REQUEST, payload);
+}
+
+// Returns the nearest ancestor of a taxID of a rank (-1 if it has none)
+int TaxonomyClient::RollUpToRank(const int taxID, const std::string &rank) {
+	std::string payload;
+	AppendTaxIDs(std::vector<int>(1, taxID), payload);
+	payload += rank;
+	return Request(ROLL_UP_REQUEST, payload).at(0);
+}
+
+// Sends a request and waits for its reply
+std::vector<int> TaxonomyClient::Request(uint32_t code,
+										 const std::string &payload) {
+	if (socketFd == -1)
+		throw std::runtime_error("Not connected to a taxonomy server");
+	if (payload.size() > MAX_TAXONOMY_REQUEST_SIZE)
+		throw std::runtime_error("Taxonomy server request too large");
+	TaxonomyMessage header;
+	header.code = code;
+	header.size = payload.size();
+	if (!WriteAll(socketFd, (const char *)&header, sizeof(header)) ||
+		!WriteAll(socketFd, payload.data(), payload.size()) ||
+		!ReadAll(socketFd, (char *)&header, sizeof(header)))
+		throw std::runtime_error("Lost connection to the taxonomy server");
+	if (header.size % sizeof(int32_t) != 0)
+		throw std::runtime_error("Malformed reply from the taxonomy server");
+	std::vector<int> answer(header.size / sizeof(int32_t));
+	if (!answer.empty() &&
+		!ReadAll(socketFd, (char *)&answer[0], header.size))
+		throw std::runtime_error("Lost connection to the taxonomy server");
+	if (header.code != REPLY_OK)
+		throw std::runtime_error("The taxonomy server rejected a request");
+	return answer;
+}
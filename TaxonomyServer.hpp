@@ -0,0 +1,114 @@
+// TaxonomyServer.hpp - Keeps a loaded taxonomy resident and answers LCA,
+// parent, root path and descendant queries for other processes over a UNIX
+// domain socket, so that they need not load nodes.dmp themselves.
+//
+// Author: Matt Preston (website: matthewpreston.github.io)
+// Created On: Oct 16, 2026
+// Revised On: Never
+
+#ifndef TAXONOMYSERVER_HPP
+#define TAXONOMYSERVER_HPP
+
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "Taxonomy.hpp"
+
+// Requests and replies are a header followed by size bytes of payload, all in
+// the host's byte order (the socket is local). Several requests may be sent
+// before reading their replies, which come back in order
+struct TaxonomyMessage {
+	uint32_t code;				// TaxonomyRequest or TaxonomyReply
+	uint32_t size;				// Bytes of payload that follow
+};
+
+// Requests, with their payloads (all taxIDs are int32) and replies
+enum TaxonomyRequest {
+	LCA_REQUEST = 1,			// taxIDs -> their LCA
+	LCA_PAIRS_REQUEST,			// Pairs of taxIDs -> the LCA of each pair
+	PARENT_REQUEST,				// taxIDs -> the parent of each
+	ROOT_PATH_REQUEST,			// One taxID -> its path to the root
+	DESCENDANTS_REQUEST,		// taxID, skipHidden, rank characters ->
+								// the taxID and its descendants
+	ROLL_UP_REQUEST				// taxID, rank characters -> its nearest
+								// ancestor of the rank
+};
+
+enum TaxonomyReply {
+	REPLY_OK = 0,				// Payload holds the answer's taxIDs
+	REPLY_BAD_REQUEST			// Unknown code or malformed payload
+};
+
+// Largest payload a request may have
+const uint32_t MAX_TAXONOMY_REQUEST_SIZE = 64 << 20;
+
+// ==== CLASSES ================================================================
+
+// Answers queries on a taxonomy for any number of clients, from one thread
+// waiting on all their connections at once (queries are far quicker than the
+// round trip of a request, so there is nothing for more threads to do)
+class TaxonomyServer {
+public:
+	// The taxonomy must outlive the server and not change while serving
+	TaxonomyServer(const LCA_Finder &taxonomy);
+	// Listens on socketPath and answers clients until SIGINT or SIGTERM,
+	// removing the socket afterwards. A socket left behind by a server that
+	// is no longer running is replaced
+	// Throws std::runtime_error if the socket cannot be set up or another
+	// server is already listening on it
+	void Serve(const std::string &socketPath);
+	// Appends the reply (header and payload) to a request to reply
+	void Answer(uint32_t code, const char *payload, uint32_t size,
+				std::string &reply) const;
+private:
+	// A client's unread requests and unsent replies
+	struct Connection {
+		std::string input;
+		std::string output;
+		size_t outputSent;
+	};
+
+	// Answers every whole request a connection has sent
+	// Returns false if the connection sent a request too large to answer
+	bool AnswerRequests(Connection &connection) const;
+
+	const LCA_Finder &taxonomy;
+};
+
+// A connection to a TaxonomyServer, with the queries of LCA_Finder
+class TaxonomyClient {
+public:
+	TaxonomyClient();
+	~TaxonomyClient();
+	// Connects to the server listening on socketPath
+	// Returns false if no server is listening there
+	bool Connect(const std::string &socketPath);
+	// Returns whether connected to a server
+	bool Connected() const;
+
+	// These ask the server, as LCA_Finder would answer them
+	// Throw std::runtime_error if not connected, the connection fails or the
+	// server rejects the request
+	int GetLCA_ID(const std::vector<int> &taxIDs);
+	std::vector<int> GetLCA_IDs(
+		const std::vector< std::pair<int, int> > &taxIDPairs);
+	std::vector<int> TraceParents(const std::vector<int> &taxIDs);
+	std::list<int> TraceToRoot(const int taxID);
+	std::vector<int> GetDescendants(const int taxID,
+									const std::string &rank = "",
+									const bool skipHidden = false);
+	int RollUpToRank(const int taxID, const std::string &rank);
+private:
+	// Non-copyable, as the connection is owned
+	TaxonomyClient(const TaxonomyClient &);
+	TaxonomyClient &operator=(const TaxonomyClient &);
+
+	// Sends a request and waits for its reply
+	std::vector<int> Request(uint32_t code, const std::string &payload);
+
+	int socketFd;
+};
+
+#endif // TAXONOMYSERVER_HPP